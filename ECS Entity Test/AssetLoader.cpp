@@ -0,0 +1,442 @@
+#include "AssetLoader.h"
+
+#include "TextureAtlas.h"
+
+#include <SDL3/SDL.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace
+{
+	constexpr size_t staging_alignment = 256;
+
+	// AudioSystem's mix format, so sounds go to the mixer without another conversion.
+	constexpr int mix_channels = 2;
+	constexpr int mix_frequency = 48000;
+
+	bool decode_sound(const std::string& path, SoundData& sound)
+	{
+		SDL_AudioSpec source_spec;
+		Uint8* source = nullptr;
+		Uint32 source_bytes = 0;
+		if (!SDL_LoadWAV(path.c_str(), &source_spec, &source, &source_bytes))
+		{
+			std::cerr << "Failed to load sound " << path << ": " << SDL_GetError() << "\n";
+			return false;
+		}
+
+		SDL_AudioSpec mix_spec = { SDL_AUDIO_F32, mix_channels, mix_frequency };
+		Uint8* converted = nullptr;
+		int converted_bytes = 0;
+		bool ok = SDL_ConvertAudioSamples(&source_spec, source, static_cast<int>(source_bytes), &mix_spec, &converted, &converted_bytes);
+		SDL_free(source);
+		if (!ok)
+		{
+			std::cerr << "Failed to convert sound " << path << ": " << SDL_GetError() << "\n";
+			return false;
+		}
+
+		sound.channels = mix_channels;
+		sound.frequency = mix_frequency;
+		sound.samples.resize(converted_bytes / sizeof(float));
+		std::memcpy(sound.samples.data(), converted, sound.samples.size() * sizeof(float));
+		SDL_free(converted);
+		return true;
+	}
+
+	bool parse_level(const std::string& path, LevelData& level)
+	{
+		std::ifstream file(path);
+		if (!file)
+		{
+			std::cerr << "Failed to open level " << path << "\n";
+			return false;
+		}
+
+		std::string line;
+		for (int number = 1; std::getline(file, line); ++number)
+		{
+			std::istringstream fields(line);
+			std::string kind;
+			if (!(fields >> kind) || kind[0] == '#')
+			{
+				continue;
+			}
+
+			if (kind == "tilemap")
+			{
+				LevelData::TileLayer layer;
+				if (!(fields >> layer.columns >> layer.rows >> layer.tile_size >> layer.x >> layer.y) || layer.columns <= 0 || layer.rows <= 0 || layer.tile_size <= 0.0f)
+				{
+					std::cerr << path << ":" << number << ": expected tilemap COLUMNS ROWS TILE_SIZE X Y\n";
+					return false;
+				}
+				level.tile_layers.push_back(std::move(layer));
+				continue;
+			}
+
+			if (kind == "tile")
+			{
+				std::string sprite;
+				LevelData::Tile tile = {};
+				if (level.tile_layers.empty() || !(fields >> sprite >> tile.column >> tile.row))
+				{
+					std::cerr << path << ":" << number << ": expected tile NAME COLUMN ROW after a tilemap line\n";
+					return false;
+				}
+
+				LevelData::TileLayer& layer = level.tile_layers.back();
+				auto found = std::find(layer.sprites.begin(), layer.sprites.end(), sprite);
+				tile.sprite = static_cast<uint32_t>(found - layer.sprites.begin());
+				if (found == layer.sprites.end())
+				{
+					layer.sprites.push_back(std::move(sprite));
+				}
+				layer.tiles.push_back(tile);
+				continue;
+			}
+
+			// The optional fields are read as words so a malformed one is reported rather than ignored.
+			LevelData::Placement placement;
+			std::string rotation;
+			std::string color;
+			char* rotation_end = nullptr;
+			char* color_end = nullptr;
+			bool ok = kind == "sprite" && fields >> placement.sprite >> placement.x >> placement.y >> placement.width >> placement.height;
+			if (ok && fields >> rotation)
+			{
+				placement.rotation = std::strtof(rotation.c_str(), &rotation_end);
+				ok = *rotation_end == '\0';
+			}
+			if (ok && fields >> color)
+			{
+				placement.color = static_cast<uint32_t>(std::strtoul(color.c_str(), &color_end, 16));
+				ok = *color_end == '\0';
+			}
+			if (!ok)
+			{
+				std::cerr << path << ":" << number << ": expected sprite NAME X Y WIDTH HEIGHT [ROTATION [AARRGGBB]]\n";
+				return false;
+			}
+			level.placements.push_back(std::move(placement));
+		}
+		return true;
+	}
+}
+
+AssetLoader::AssetLoader(JobSystem& jobs, TextureAtlas& atlas)
+	: jobs(jobs), atlas(atlas)
+{
+}
+
+AssetLoader::~AssetLoader()
+{
+	shutdown();
+}
+
+bool AssetLoader::init(size_t staging_bytes)
+{
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+	glGenBuffers(1, &staging);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging);
+	glBufferStorage(GL_PIXEL_UNPACK_BUFFER, static_cast<GLsizeiptr>(staging_bytes), nullptr, flags);
+	mapped = static_cast<unsigned char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, static_cast<GLsizeiptr>(staging_bytes), flags));
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	if (!mapped)
+	{
+		std::cerr << "Failed to map asset staging buffer\n";
+		glDeleteBuffers(1, &staging);
+		staging = 0;
+		return false;
+	}
+
+	staging_size = staging_bytes;
+	Memory::track_alloc(MemoryTag::RenderBuffers, staging_size);
+	return true;
+}
+
+void AssetLoader::shutdown()
+{
+	jobs.wait(decoding);
+
+	for (Upload& upload : uploads)
+	{
+		glDeleteSync(upload.fence);
+	}
+	uploads.clear();
+
+	if (staging)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		glDeleteBuffers(1, &staging);
+		Memory::track_free(MemoryTag::RenderBuffers, staging_size);
+		staging = 0;
+		mapped = nullptr;
+		staging_size = 0;
+	}
+}
+
+AssetHandle AssetLoader::load_image(const std::string& path)
+{
+	return enqueue(AssetType::Image, path);
+}
+
+AssetHandle AssetLoader::load_sound(const std::string& path)
+{
+	return enqueue(AssetType::Sound, path);
+}
+
+AssetHandle AssetLoader::load_level(const std::string& path)
+{
+	return enqueue(AssetType::Level, path);
+}
+
+AssetHandle AssetLoader::enqueue(AssetType type, const std::string& path)
+{
+	Asset* asset = nullptr;
+	AssetHandle handle = 0;
+	{
+		std::lock_guard<std::mutex> lock(assets_mutex);
+		handle = static_cast<AssetHandle>(assets.size());
+		asset = &assets.emplace_back();
+	}
+
+	asset->type = type;
+	asset->path = path;
+	outstanding.fetch_add(1, std::memory_order_relaxed);
+
+	jobs.run(decoding, [this, asset, handle]()
+	{
+		decode(*asset, handle);
+	});
+	return handle;
+}
+
+void AssetLoader::decode(Asset& asset, AssetHandle handle)
+{
+	bool ok = false;
+	switch (asset.type)
+	{
+	case AssetType::Image:
+		ok = load_image_rgba(asset.path, asset.pixels, asset.width, asset.height);
+		if (ok)
+		{
+			// GPU work stays on the render thread; hand the pixels over for staging.
+			asset.state.store(AssetState::Uploading, std::memory_order_release);
+			std::lock_guard<std::mutex> lock(decoded_mutex);
+			decoded.push_back(handle);
+			return;
+		}
+		break;
+
+	case AssetType::Sound:
+		ok = decode_sound(asset.path, asset.sound);
+		break;
+
+	case AssetType::Level:
+		ok = parse_level(asset.path, asset.level);
+		break;
+	}
+
+	asset.state.store(ok ? AssetState::Ready : AssetState::Failed, std::memory_order_release);
+	outstanding.fetch_sub(1, std::memory_order_release);
+}
+
+void AssetLoader::pump(size_t budget_bytes)
+{
+	retire_uploads();
+
+	size_t staged = 0;
+	while (staged < budget_bytes)
+	{
+		Asset* asset = nullptr;
+		{
+			std::lock_guard<std::mutex> lock(decoded_mutex);
+			if (decoded.empty())
+			{
+				break;
+			}
+
+			std::lock_guard<std::mutex> assets_lock(assets_mutex);
+			asset = &assets[decoded.front()];
+		}
+
+		size_t bytes = asset->pixels.size() * sizeof(uint32_t);
+		if (staged > 0 && staged + bytes > budget_bytes)
+		{
+			break;
+		}
+
+		if (!stage(*asset))
+		{
+			break;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(decoded_mutex);
+			decoded.pop_front();
+		}
+
+		staged += bytes;
+		total_uploaded += bytes;
+		outstanding.fetch_sub(1, std::memory_order_release);
+	}
+}
+
+bool AssetLoader::stage(Asset& asset)
+{
+	if (asset.region == ~0u)
+	{
+		asset.region = atlas.reserve(std::filesystem::path(asset.path).stem().string(), asset.width, asset.height);
+		if (asset.region == TextureAtlas::invalid_region)
+		{
+			std::cerr << "No atlas space for " << asset.path << "\n";
+			asset.pixels = {};
+			asset.state.store(AssetState::Failed, std::memory_order_release);
+			return true;
+		}
+	}
+
+	const AtlasRegion& r = atlas.region(asset.region);
+	if (r.width != asset.width || r.height != asset.height)
+	{
+		std::cerr << "Atlas already holds a different sprite named like " << asset.path << "\n";
+		asset.pixels = {};
+		asset.state.store(AssetState::Failed, std::memory_order_release);
+		return true;
+	}
+
+	size_t bytes = asset.pixels.size() * sizeof(uint32_t);
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, atlas.texture());
+
+	size_t offset = 0;
+	if (bytes > staging_size)
+	{
+		// Too big for the ring; fall back to a driver-side copy.
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, r.x, r.y, r.layer, r.width, r.height, 1, GL_RGBA, GL_UNSIGNED_BYTE, asset.pixels.data());
+	}
+	else if (reserve_staging(bytes, offset))
+	{
+		std::memcpy(mapped + offset, asset.pixels.data(), bytes);
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging);
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, r.x, r.y, r.layer, r.width, r.height, 1, GL_RGBA, GL_UNSIGNED_BYTE, reinterpret_cast<void*>(offset));
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+		uploads.push_back({ glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), offset + bytes });
+	}
+	else
+	{
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		return false;
+	}
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	asset.pixels = {};
+	asset.state.store(AssetState::Ready, std::memory_order_release);
+	return true;
+}
+
+bool AssetLoader::reserve_staging(size_t bytes, size_t& offset)
+{
+	if (uploads.empty())
+	{
+		head = 0;
+		tail = 0;
+	}
+
+	size_t aligned = (head + staging_alignment - 1) & ~(staging_alignment - 1);
+
+	if (uploads.empty() || head > tail)
+	{
+		// Free space is [head, size) followed by [0, tail).
+		if (aligned + bytes <= staging_size)
+		{
+			offset = aligned;
+		}
+		else if (bytes < tail)
+		{
+			offset = 0;
+		}
+		else
+		{
+			return false;
+		}
+	}
+	else
+	{
+		// Wrapped: free space is [head, tail).
+		if (aligned + bytes >= tail)
+		{
+			return false;
+		}
+		offset = aligned;
+	}
+
+	head = offset + bytes;
+	return true;
+}
+
+void AssetLoader::retire_uploads()
+{
+	while (!uploads.empty())
+	{
+		GLenum result = glClientWaitSync(uploads.front().fence, 0, 0);
+		if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED)
+		{
+			break;
+		}
+
+		glDeleteSync(uploads.front().fence);
+		tail = uploads.front().end;
+		uploads.pop_front();
+	}
+}
+
+AssetState AssetLoader::state(AssetHandle handle) const
+{
+	std::lock_guard<std::mutex> lock(assets_mutex);
+	return handle < assets.size() ? assets[handle].state.load(std::memory_order_acquire) : AssetState::Failed;
+}
+
+uint32_t AssetLoader::image_region(AssetHandle handle) const
+{
+	std::lock_guard<std::mutex> lock(assets_mutex);
+	if (handle >= assets.size() || assets[handle].state.load(std::memory_order_acquire) != AssetState::Ready)
+	{
+		return TextureAtlas::white_region;
+	}
+	return assets[handle].region;
+}
+
+const SoundData* AssetLoader::sound(AssetHandle handle) const
+{
+	std::lock_guard<std::mutex> lock(assets_mutex);
+	if (handle >= assets.size() || assets[handle].type != AssetType::Sound || assets[handle].state.load(std::memory_order_acquire) != AssetState::Ready)
+	{
+		return nullptr;
+	}
+	return &assets[handle].sound;
+}
+
+const LevelData* AssetLoader::level(AssetHandle handle) const
+{
+	std::lock_guard<std::mutex> lock(assets_mutex);
+	if (handle >= assets.size() || assets[handle].type != AssetType::Level || assets[handle].state.load(std::memory_order_acquire) != AssetState::Ready)
+	{
+		return nullptr;
+	}
+	return &assets[handle].level;
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include "JobSystem.h"
+#include "Memory.h"
+
+#include <glad/glad.h>
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class TextureAtlas;
+
+using AssetHandle = uint32_t;
+
+enum class AssetType : uint8_t
+{
+	Image,
+	Sound,
+	Level
+};
+
+enum class AssetState : uint8_t
+{
+	Decoding,
+	Uploading,
+	Ready,
+	Failed
+};
+
+// Interleaved float samples at the mixer's format.
+struct SoundData
+{
+	std::vector<float, TaggedAllocator<float, MemoryTag::Assets>> samples;
+	int channels = 0;
+	int frequency = 0;
+};
+
+// Sprites and tile maps placed in a level, parsed from its text file. Each line is one of
+//   sprite NAME X Y WIDTH HEIGHT [ROTATION [AARRGGBB]]
+//   tilemap COLUMNS ROWS TILE_SIZE X Y
+//   tile NAME COLUMN ROW
+// where NAME is an atlas region and tile lines fill the last tilemap above them; blank lines and lines
+// starting with # are skipped.
+struct LevelData
+{
+	struct Placement
+	{
+		std::string sprite;
+		float x = 0.0f;
+		float y = 0.0f;
+		float width = 0.0f;
+		float height = 0.0f;
+		float rotation = 0.0f;
+		uint32_t color = 0xffffffffu;
+	};
+
+	struct Tile
+	{
+		// Index into the layer's sprites, so each name is looked up once however many tiles use it.
+		uint32_t sprite;
+		int column;
+		int row;
+	};
+
+	struct TileLayer
+	{
+		int columns = 0;
+		int rows = 0;
+		float tile_size = 0.0f;
+		float x = 0.0f;
+		float y = 0.0f;
+		std::vector<std::string> sprites;
+		std::vector<Tile> tiles;
+	};
+
+	std::vector<Placement> placements;
+	std::vector<TileLayer> tile_layers;
+};
+
+// Decodes assets on job-system workers. Images are then copied by the render thread into a
+// persistently mapped pixel unpack buffer and uploaded into the atlas, a few per frame, so loading
+// never stalls the main loop.
+class AssetLoader
+{
+public:
+	static constexpr AssetHandle invalid_handle = ~0u;
+
+	AssetLoader(JobSystem& jobs, TextureAtlas& atlas);
+	~AssetLoader();
+
+	AssetLoader(const AssetLoader&) = delete;
+	AssetLoader& operator=(const AssetLoader&) = delete;
+
+	bool init(size_t staging_bytes);
+	void shutdown();
+
+	AssetHandle load_image(const std::string& path);
+	AssetHandle load_sound(const std::string& path);
+	AssetHandle load_level(const std::string& path);
+
+	// Render thread only. Uploads decoded images until budget_bytes have been staged this call.
+	void pump(size_t budget_bytes);
+
+	AssetState state(AssetHandle handle) const;
+	uint32_t image_region(AssetHandle handle) const;
+	const SoundData* sound(AssetHandle handle) const;
+	const LevelData* level(AssetHandle handle) const;
+
+	size_t pending() const { return outstanding.load(std::memory_order_acquire); }
+	size_t uploaded_bytes() const { return total_uploaded; }
+
+private:
+	struct Asset
+	{
+		AssetType type;
+		std::string path;
+		std::atomic<AssetState> state{ AssetState::Decoding };
+
+		std::vector<uint32_t> pixels;
+		int width = 0;
+		int height = 0;
+		uint32_t region = ~0u;
+
+		SoundData sound;
+		LevelData level;
+	};
+
+	struct Upload
+	{
+		GLsync fence;
+		size_t end;
+	};
+
+	AssetHandle enqueue(AssetType type, const std::string& path);
+	void decode(Asset& asset, AssetHandle handle);
+	bool stage(Asset& asset);
+	bool reserve_staging(size_t bytes, size_t& offset);
+	void retire_uploads();
+
+	JobSystem& jobs;
+	TextureAtlas& atlas;
+	JobCounter decoding;
+
+	std::deque<Asset> assets;
+	mutable std::mutex assets_mutex;
+
+	std::deque<AssetHandle> decoded;
+	std::mutex decoded_mutex;
+	std::atomic<size_t> outstanding{ 0 };
+
+	GLuint staging = 0;
+	unsigned char* mapped = nullptr;
+	size_t staging_size = 0;
+	size_t head = 0;
+	size_t tail = 0;
+	std::deque<Upload> uploads;
+	size_t total_uploaded = 0;
+};
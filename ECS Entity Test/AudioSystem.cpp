@@ -0,0 +1,1032 @@
+#include "AudioSystem.h"
+
+#include "Components.h"
+#include "ECS.h"
+#include "Memory.h"
+#include "Profiler.h"
+
+#include <SDL3/SDL.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define AUDIO_SSE 1
+#include <xmmintrin.h>
+#endif
+
+namespace
+{
+	constexpr uint64_t unit_increment = uint64_t(1) << 32;
+
+	// Sources closer than this sit in the middle instead of swinging hard from side to side.
+	constexpr float pan_distance = 64.0f;
+
+	// Doppler shifts under about two cents aren't worth resampling for.
+	constexpr float pitch_snap = 0.001f;
+
+	// About 1.4 s of decoded audio per stream, topped up once a quarter of it has played.
+	constexpr size_t stream_ring_frames = size_t(1) << 16;
+	constexpr size_t stream_refill_frames = stream_ring_frames / 4;
+	constexpr size_t decode_frames = 4096;
+	constexpr size_t raw_read_bytes = 16 * 1024;
+
+	struct WavFormat
+	{
+		uint16_t encoding;
+		uint16_t channels;
+		uint32_t rate;
+		uint32_t byte_rate;
+		uint16_t block_align;
+		uint16_t bits;
+	};
+
+	SDL_AudioFormat wav_sample_format(uint16_t encoding, uint16_t bits)
+	{
+		if (encoding == 1 && bits == 8)
+		{
+			return SDL_AUDIO_U8;
+		}
+		if (encoding == 1 && bits == 16)
+		{
+			return SDL_AUDIO_S16LE;
+		}
+		if (encoding == 1 && bits == 32)
+		{
+			return SDL_AUDIO_S32LE;
+		}
+		if (encoding == 3 && bits == 32)
+		{
+			return SDL_AUDIO_F32LE;
+		}
+		return SDL_AUDIO_UNKNOWN;
+	}
+
+	// Adds n stereo frames of src into out, with each side's gain moving by its step every frame so
+	// volume and pan changes ramp across the block instead of clicking.
+	void mix_span(float* out, const float* src, size_t n, float& left, float& right, float step_left, float step_right)
+	{
+		size_t i = 0;
+
+#if AUDIO_SSE
+		// Two frames per register: (left, right, left, right).
+		__m128 gains = _mm_setr_ps(left, right, left + step_left, right + step_right);
+		__m128 steps = _mm_setr_ps(step_left * 2.0f, step_right * 2.0f, step_left * 2.0f, step_right * 2.0f);
+		for (; i + 2 <= n; i += 2)
+		{
+			__m128 mixed = _mm_add_ps(_mm_loadu_ps(out + i * 2), _mm_mul_ps(_mm_loadu_ps(src + i * 2), gains));
+			_mm_storeu_ps(out + i * 2, mixed);
+			gains = _mm_add_ps(gains, steps);
+		}
+		left += step_left * i;
+		right += step_right * i;
+#endif
+
+		for (; i < n; ++i)
+		{
+			out[i * 2] += src[i * 2] * left;
+			out[i * 2 + 1] += src[i * 2 + 1] * right;
+			left += step_left;
+			right += step_right;
+		}
+	}
+
+	uint64_t pitch_increment(float pitch)
+	{
+		return pitch == 1.0f ? unit_increment : static_cast<uint64_t>(static_cast<double>(pitch) * unit_increment);
+	}
+
+	bool changed(float sent, float now)
+	{
+		return std::fabs(now - sent) > AudioSystem::audible_gain;
+	}
+}
+
+void AudioSystem::EmitterBatch::clear()
+{
+	for (std::vector<float>* lane : { &x, &y, &last_x, &last_y, &volume, &inverse_range })
+	{
+		lane->clear();
+	}
+	mixed.clear();
+	sounds.clear();
+	emitters.clear();
+}
+
+void AudioSystem::EmitterBatch::push(SoundEmitter& emitter, Sound& sound, float px, float py, float inverse)
+{
+	x.push_back(px);
+	y.push_back(py);
+	last_x.push_back(emitter.last_x);
+	last_y.push_back(emitter.last_y);
+	volume.push_back(emitter.volume);
+	inverse_range.push_back(inverse);
+	sounds.push_back(&sound);
+	emitters.push_back(&emitter);
+}
+
+void AudioSystem::EmitterBatch::pad()
+{
+	// Silent lanes: zero volume at the origin never reaches the mixer.
+	size_t lanes = (size() + 3) & ~size_t(3);
+	for (std::vector<float>* lane : { &x, &y, &last_x, &last_y, &volume, &inverse_range })
+	{
+		lane->resize(lanes, 0.0f);
+	}
+	left.resize(lanes);
+	right.resize(lanes);
+	pitch.resize(lanes);
+	mixed.assign(size(), 0);
+}
+
+AudioSystem::AudioSystem(JobSystem& jobs) : jobs(jobs)
+{
+}
+
+AudioSystem::~AudioSystem()
+{
+	shutdown();
+}
+
+bool AudioSystem::init()
+{
+	SDL_AudioSpec spec = { SDL_AUDIO_F32, 2, sample_rate };
+	stream = SDL_OpenAudioDeviceStream(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, &spec, stream_callback, this);
+	if (!stream)
+	{
+		std::cerr << "Failed to open audio device: " << SDL_GetError() << "\n";
+		return false;
+	}
+
+	SDL_ResumeAudioStreamDevice(stream);
+	return true;
+}
+
+void AudioSystem::shutdown()
+{
+	// Destroying the stream waits for a callback in progress, so nothing below races with the mixer.
+	if (stream)
+	{
+		SDL_DestroyAudioStream(stream);
+		stream = nullptr;
+	}
+
+	for (Voice& voice : voices)
+	{
+		voice = Voice{};
+	}
+	std::fill(std::begin(mixing), std::end(mixing), nullptr);
+	for (std::unique_ptr<Stream>& slot : streams)
+	{
+		if (slot)
+		{
+			jobs.wait(slot->decoding);
+			close_stream(*slot);
+			slot.reset();
+		}
+	}
+	for (const std::unique_ptr<Clip>& clip : clips)
+	{
+		Memory::deallocate(MemoryTag::Audio, clip->samples, clip->frames * 2 * sizeof(float));
+	}
+	clips.clear();
+	sounds.clear();
+	playbacks.clear();
+	clock.store(0, std::memory_order_relaxed);
+}
+
+AudioClipId AudioSystem::add_clip(const float* stereo, size_t frames)
+{
+	if (frames == 0)
+	{
+		std::cerr << "Ignoring empty sound clip\n";
+		return invalid_clip;
+	}
+
+	size_t bytes = frames * 2 * sizeof(float);
+	float* samples = static_cast<float*>(Memory::allocate(MemoryTag::Audio, bytes));
+	std::memcpy(samples, stereo, bytes);
+	clips.push_back(std::make_unique<Clip>(Clip{ samples, frames }));
+	return static_cast<AudioClipId>(clips.size() - 1);
+}
+
+AudioStreamId AudioSystem::play_stream(const std::string& path, float volume, bool loop)
+{
+	int index = 0;
+	while (index < max_streams && streams[index] && streams[index]->open)
+	{
+		++index;
+	}
+	if (index == max_streams)
+	{
+		std::cerr << "No free audio stream for " << path << "\n";
+		return invalid_stream;
+	}
+
+	if (!streams[index])
+	{
+		streams[index] = std::make_unique<Stream>();
+		streams[index]->storage.resize(stream_ring_frames * 2);
+		streams[index]->decoded.resize(decode_frames * 2);
+		streams[index]->raw.resize(raw_read_bytes);
+	}
+
+	Stream& slot = *streams[index];
+	if (!open_wav(slot, path))
+	{
+		close_stream(slot);
+		return invalid_stream;
+	}
+
+	slot.loop = loop;
+	slot.flushed = false;
+	slot.ring.reset(slot.storage.data(), slot.storage.size());
+	slot.exhausted.store(false, std::memory_order_relaxed);
+	slot.released.store(false, std::memory_order_release);
+	if (!commands.push({ Command::StartStream, 0, loop, static_cast<uint32_t>(index), nullptr, 0, volume, volume, 1.0f }))
+	{
+		std::cerr << "Audio command queue full, not starting " << path << "\n";
+		slot.released.store(true, std::memory_order_relaxed);
+		close_stream(slot);
+		return invalid_stream;
+	}
+
+	// The mixer starts on whatever the first decode has produced; it plays silence until then.
+	slot.open = true;
+	++slot.generation;
+	jobs.run(slot.decoding, [&slot]() { decode(slot); });
+	return slot.generation * max_streams + static_cast<uint32_t>(index);
+}
+
+void AudioSystem::stop_stream(AudioStreamId id)
+{
+	if (find_stream(id))
+	{
+		commands.push({ Command::StopStream, 0, false, id % max_streams, nullptr, 0, 0.0f, 0.0f, 1.0f });
+	}
+}
+
+void AudioSystem::set_stream_volume(AudioStreamId id, float volume)
+{
+	if (find_stream(id))
+	{
+		commands.push({ Command::SetStreamVolume, 0, false, id % max_streams, nullptr, 0, volume, volume, 1.0f });
+	}
+}
+
+bool AudioSystem::stream_playing(AudioStreamId id) const
+{
+	return find_stream(id) != nullptr;
+}
+
+AudioSystem::Stream* AudioSystem::find_stream(AudioStreamId id) const
+{
+	if (id == invalid_stream)
+	{
+		return nullptr;
+	}
+	Stream* slot = streams[id % max_streams].get();
+	return slot && slot->open && slot->generation == id / max_streams ? slot : nullptr;
+}
+
+bool AudioSystem::open_wav(Stream& stream, const std::string& path)
+{
+	stream.file.clear();
+	stream.file.open(path, std::ios::binary);
+	if (!stream.file)
+	{
+		std::cerr << "Failed to open sound stream " << path << "\n";
+		return false;
+	}
+
+	char riff[12];
+	stream.file.read(riff, sizeof(riff));
+	if (!stream.file || std::memcmp(riff, "RIFF", 4) != 0 || std::memcmp(riff + 8, "WAVE", 4) != 0)
+	{
+		std::cerr << "Sound stream " << path << " is not a WAV file\n";
+		return false;
+	}
+
+	// Only the header is read here; the samples stay on disk until the decoder gets to them.
+	WavFormat format = {};
+	bool have_format = false;
+	char id[4];
+	uint32_t size = 0;
+	while (stream.file.read(id, 4) && stream.file.read(reinterpret_cast<char*>(&size), 4))
+	{
+		if (std::memcmp(id, "fmt ", 4) == 0 && size >= sizeof(WavFormat))
+		{
+			char chunk[40] = {};
+			stream.file.read(chunk, std::min<uint32_t>(size, sizeof(chunk)));
+			stream.file.ignore(size > sizeof(chunk) ? size - sizeof(chunk) + (size & 1) : size & 1);
+			std::memcpy(&format, chunk, sizeof(format));
+
+			// WAVE_FORMAT_EXTENSIBLE keeps the real encoding at the start of its sub-format GUID.
+			if (format.encoding == 0xfffe && size >= 26)
+			{
+				std::memcpy(&format.encoding, chunk + 24, sizeof(format.encoding));
+			}
+			have_format = true;
+		}
+		else if (std::memcmp(id, "data", 4) == 0)
+		{
+			stream.data_start = static_cast<uint64_t>(stream.file.tellg());
+			stream.data_size = size;
+			break;
+		}
+		else
+		{
+			stream.file.ignore(size + (size & 1));
+		}
+	}
+
+	SDL_AudioFormat sample_format = have_format ? wav_sample_format(format.encoding, format.bits) : SDL_AUDIO_UNKNOWN;
+	if (sample_format == SDL_AUDIO_UNKNOWN || format.channels == 0 || !stream.file)
+	{
+		std::cerr << "Sound stream " << path << " has no data in a supported format\n";
+		return false;
+	}
+
+	SDL_AudioSpec source = { sample_format, format.channels, static_cast<int>(format.rate) };
+	SDL_AudioSpec target = { SDL_AUDIO_F32, 2, sample_rate };
+	stream.converter = SDL_CreateAudioStream(&source, &target);
+	if (!stream.converter)
+	{
+		std::cerr << "Failed to convert sound stream " << path << ": " << SDL_GetError() << "\n";
+		return false;
+	}
+
+	stream.frame_bytes = format.channels * (format.bits / 8);
+	stream.remaining = stream.data_size;
+	return true;
+}
+
+void AudioSystem::close_stream(Stream& stream)
+{
+	if (stream.converter)
+	{
+		SDL_DestroyAudioStream(stream.converter);
+		stream.converter = nullptr;
+	}
+	stream.file.close();
+	stream.open = false;
+}
+
+void AudioSystem::pump_stream(Stream& stream)
+{
+	if (!stream.open || stream.decoding.value.load(std::memory_order_acquire) != 0)
+	{
+		return;
+	}
+
+	if (stream.released.load(std::memory_order_acquire))
+	{
+		close_stream(stream);
+		return;
+	}
+
+	// Between decodes the game thread is the ring's producer, so it can look at the free space.
+	if (!stream.exhausted.load(std::memory_order_relaxed) && stream.ring.space() >= stream_refill_frames * 2)
+	{
+		jobs.run(stream.decoding, [&stream]() { decode(stream); });
+	}
+}
+
+void AudioSystem::decode(Stream& stream)
+{
+	CpuZone zone("Audio decode");
+	size_t decoded_bytes = stream.decoded.size() * sizeof(float);
+	while (stream.ring.space() >= stream.decoded.size())
+	{
+		int bytes = SDL_GetAudioStreamData(stream.converter, stream.decoded.data(), static_cast<int>(decoded_bytes));
+		if (bytes > 0)
+		{
+			stream.ring.push(stream.decoded.data(), bytes / sizeof(float));
+			continue;
+		}
+		if (stream.flushed)
+		{
+			stream.exhausted.store(true, std::memory_order_release);
+			return;
+		}
+
+		if (stream.remaining == 0 && stream.loop)
+		{
+			stream.file.clear();
+			stream.file.seekg(static_cast<std::streamoff>(stream.data_start));
+			stream.remaining = stream.data_size;
+		}
+
+		// Whole frames only, so the converter never sees half a sample.
+		size_t want = static_cast<size_t>(std::min<uint64_t>(stream.remaining, stream.raw.size()));
+		want -= want % stream.frame_bytes;
+		stream.file.read(stream.raw.data(), static_cast<std::streamsize>(want));
+		size_t got = static_cast<size_t>(stream.file.gcount());
+		got -= got % stream.frame_bytes;
+		stream.remaining = got < want ? 0 : stream.remaining - got;
+
+		// A short or failed read ends the stream, even a looping one, rather than spinning on it.
+		if (got == 0 || !SDL_PutAudioStreamData(stream.converter, stream.raw.data(), static_cast<int>(got)))
+		{
+			SDL_FlushAudioStream(stream.converter);
+			stream.flushed = true;
+		}
+	}
+}
+
+void AudioSystem::set_listener(float x, float y)
+{
+	listener_x = x;
+	listener_y = y;
+	if (!has_listener)
+	{
+		listener_last_x = x;
+		listener_last_y = y;
+		has_listener = true;
+	}
+}
+
+void AudioSystem::update(World& world, float dt)
+{
+	uint32_t ended;
+	while (finished.pop(ended))
+	{
+		// A one-shot whose voice played out or was taken is over; a loop goes virtual and may come back.
+		// A voice stopped for going quiet was already detached and just goes.
+		auto playback = playbacks.find(ended);
+		if (playback == playbacks.end())
+		{
+			continue;
+		}
+		auto sound = sounds.find(playback->second);
+		if (sound != sounds.end() && sound->second.playback == ended)
+		{
+			if (sound->second.loop)
+			{
+				sound->second.playback = 0;
+			}
+			else
+			{
+				sounds.erase(sound);
+			}
+		}
+		playbacks.erase(playback);
+	}
+
+	++update_count;
+	batch_dt = dt;
+
+	for (std::unique_ptr<Stream>& slot : streams)
+	{
+		if (slot)
+		{
+			pump_stream(*slot);
+		}
+	}
+
+	listener_vx = dt > 0.0f ? (listener_x - listener_last_x) / dt : 0.0f;
+	listener_vy = dt > 0.0f ? (listener_y - listener_last_y) / dt : 0.0f;
+	listener_last_x = listener_x;
+	listener_last_y = listener_y;
+
+	uint64_t now = clock.load(std::memory_order_acquire);
+	batch.clear();
+	world.query<SoundEmitter>().each_chunk([&](const Chunk& chunk, SoundEmitter* emitters)
+	{
+		const Transform* transforms = chunk.column<const Transform>();
+		for (uint32_t row = 0; row < chunk.count; ++row)
+		{
+			SoundEmitter& emitter = emitters[row];
+			if (emitter.state == SoundState::Finished)
+			{
+				continue;
+			}
+
+			// Emitters without a position are heard from wherever the listener is.
+			bool positional = transforms && emitter.range > 0.0f;
+			float x = positional ? transforms[row].x : listener_x;
+			float y = positional ? transforms[row].y : listener_y;
+
+			if (emitter.state == SoundState::Pending)
+			{
+				if (emitter.clip >= clips.size())
+				{
+					emitter.state = SoundState::Finished;
+					continue;
+				}
+				emitter.voice = take_voice_id();
+				emitter.state = SoundState::Playing;
+				emitter.last_x = x;
+				emitter.last_y = y;
+				sounds[emitter.voice] = Sound{ clips[emitter.clip].get(), now, 0, 0, emitter.loop, 0.0f, 0.0f, 1.0f };
+			}
+
+			auto found = sounds.find(emitter.voice);
+			if (found == sounds.end())
+			{
+				emitter.state = SoundState::Finished;
+				continue;
+			}
+
+			found->second.seen = update_count;
+			batch.push(emitter, found->second, x, y, positional ? 1.0f / emitter.range : 0.0f);
+			emitter.last_x = x;
+			emitter.last_y = y;
+		}
+	});
+
+	batch.pad();
+	spatialize();
+
+	// The loudest audible emitters get voices, most important first; everything else goes virtual.
+	chosen.clear();
+	for (uint32_t i = 0; i < batch.size(); ++i)
+	{
+		if (std::max(batch.left[i], batch.right[i]) >= audible_gain)
+		{
+			chosen.push_back(i);
+		}
+	}
+	if (chosen.size() > max_voices)
+	{
+		std::nth_element(chosen.begin(), chosen.begin() + max_voices, chosen.end(), [&](uint32_t a, uint32_t b)
+		{
+			uint8_t pa = batch.emitters[a]->priority;
+			uint8_t pb = batch.emitters[b]->priority;
+			if (pa != pb)
+			{
+				return pa > pb;
+			}
+			return batch.left[a] + batch.right[a] > batch.left[b] + batch.right[b];
+		});
+		chosen.resize(max_voices);
+	}
+	for (uint32_t i : chosen)
+	{
+		batch.mixed[i] = 1;
+	}
+
+	// Voices are given up before new ones start, so a handover never finds the mixer full.
+	virtual_count = 0;
+	for (size_t i = 0; i < batch.size(); ++i)
+	{
+		if (batch.mixed[i])
+		{
+			continue;
+		}
+
+		SoundEmitter& emitter = *batch.emitters[i];
+		Sound& sound = *batch.sounds[i];
+		if (sound.playback != 0 && commands.push({ Command::Stop, 0, false, sound.playback, nullptr, 0, 0.0f, 0.0f, 1.0f }))
+		{
+			sound.playback = 0;
+		}
+		if (sound.playback != 0)
+		{
+			continue;
+		}
+		if (!emitter.loop && now - sound.start >= sound.clip->frames)
+		{
+			sounds.erase(emitter.voice);
+			emitter.state = SoundState::Finished;
+			continue;
+		}
+		++virtual_count;
+	}
+
+	// Whatever had no emitter this frame belongs to a destroyed entity.
+	for (auto it = sounds.begin(); it != sounds.end();)
+	{
+		Sound& sound = it->second;
+		if (sound.seen != update_count && (sound.playback == 0 || commands.push({ Command::Stop, 0, false, sound.playback, nullptr, 0, 0.0f, 0.0f, 1.0f })))
+		{
+			it = sounds.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+
+	// A full queue just leaves the rest for the next frame; those emitters stay virtual until they fit.
+	for (uint32_t i : chosen)
+	{
+		SoundEmitter& emitter = *batch.emitters[i];
+		Sound& sound = *batch.sounds[i];
+		float left = batch.left[i];
+		float right = batch.right[i];
+		float pitch = std::fabs(batch.pitch[i] - 1.0f) < pitch_snap ? 1.0f : batch.pitch[i];
+
+		if (sound.playback == 0)
+		{
+			uint64_t elapsed = now - sound.start;
+			if (!emitter.loop && elapsed >= sound.clip->frames)
+			{
+				sounds.erase(emitter.voice);
+				emitter.state = SoundState::Finished;
+				continue;
+			}
+
+			// Coming back from virtual starts where the sound would have got to by now.
+			uint32_t voice = take_voice_id();
+			uint32_t offset = static_cast<uint32_t>(elapsed % sound.clip->frames);
+			if (!commands.push({ Command::Play, emitter.priority, emitter.loop, voice, sound.clip, offset, left, right, pitch }))
+			{
+				++virtual_count;
+				continue;
+			}
+			playbacks[voice] = emitter.voice;
+			sound.playback = voice;
+		}
+		else if (!changed(sound.left, left) && !changed(sound.right, right) && std::fabs(sound.pitch - pitch) < pitch_snap)
+		{
+			continue;
+		}
+		else if (!commands.push({ Command::SetParams, 0, false, sound.playback, nullptr, 0, left, right, pitch }))
+		{
+			continue;
+		}
+
+		sound.left = left;
+		sound.right = right;
+		sound.pitch = pitch;
+	}
+}
+
+void AudioSystem::spatialize()
+{
+	// Per emitter: a quadratic fade to silence at its range, an equal-power pan from the side it is on,
+	// and a doppler ratio from how fast it and the listener are closing on each other.
+	float inverse_dt = batch_dt > 0.0f ? 1.0f / batch_dt : 0.0f;
+	size_t lanes = batch.x.size();
+	size_t i = 0;
+
+#if AUDIO_SSE
+	const __m128 listener_x4 = _mm_set1_ps(listener_x);
+	const __m128 listener_y4 = _mm_set1_ps(listener_y);
+	const __m128 listener_vx4 = _mm_set1_ps(listener_vx);
+	const __m128 listener_vy4 = _mm_set1_ps(listener_vy);
+	const __m128 rate = _mm_set1_ps(inverse_dt);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 centred = _mm_set1_ps(pan_distance);
+	const __m128 tiny = _mm_set1_ps(1e-3f);
+	const __m128 still = _mm_set1_ps(speed_of_sound);
+	const __m128 slowest = _mm_set1_ps(speed_of_sound * 0.5f);
+	const __m128 fastest = _mm_set1_ps(speed_of_sound * 2.0f);
+	for (; i + 4 <= lanes; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(&batch.x[i]);
+		__m128 y = _mm_loadu_ps(&batch.y[i]);
+		__m128 dx = _mm_sub_ps(x, listener_x4);
+		__m128 dy = _mm_sub_ps(y, listener_y4);
+		__m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+
+		__m128 fade = _mm_max_ps(zero, _mm_sub_ps(one, _mm_mul_ps(distance, _mm_loadu_ps(&batch.inverse_range[i]))));
+		__m128 gain = _mm_mul_ps(_mm_loadu_ps(&batch.volume[i]), _mm_mul_ps(fade, fade));
+		__m128 pan = _mm_div_ps(dx, _mm_max_ps(distance, centred));
+		_mm_storeu_ps(&batch.left[i], _mm_mul_ps(gain, _mm_sqrt_ps(_mm_mul_ps(half, _mm_sub_ps(one, pan)))));
+		_mm_storeu_ps(&batch.right[i], _mm_mul_ps(gain, _mm_sqrt_ps(_mm_mul_ps(half, _mm_add_ps(one, pan)))));
+
+		__m128 vx = _mm_sub_ps(_mm_mul_ps(_mm_sub_ps(x, _mm_loadu_ps(&batch.last_x[i])), rate), listener_vx4);
+		__m128 vy = _mm_sub_ps(_mm_mul_ps(_mm_sub_ps(y, _mm_loadu_ps(&batch.last_y[i])), rate), listener_vy4);
+		__m128 receding = _mm_div_ps(_mm_add_ps(_mm_mul_ps(vx, dx), _mm_mul_ps(vy, dy)), _mm_max_ps(distance, tiny));
+		__m128 speed = _mm_min_ps(fastest, _mm_max_ps(slowest, _mm_add_ps(still, receding)));
+		_mm_storeu_ps(&batch.pitch[i], _mm_div_ps(still, speed));
+	}
+#endif
+
+	for (; i < lanes; ++i)
+	{
+		float dx = batch.x[i] - listener_x;
+		float dy = batch.y[i] - listener_y;
+		float distance = std::sqrt(dx * dx + dy * dy);
+
+		float fade = std::max(0.0f, 1.0f - distance * batch.inverse_range[i]);
+		float gain = batch.volume[i] * fade * fade;
+		float pan = dx / std::max(distance, pan_distance);
+		batch.left[i] = gain * std::sqrt(0.5f * (1.0f - pan));
+		batch.right[i] = gain * std::sqrt(0.5f * (1.0f + pan));
+
+		float vx = (batch.x[i] - batch.last_x[i]) * inverse_dt - listener_vx;
+		float vy = (batch.y[i] - batch.last_y[i]) * inverse_dt - listener_vy;
+		float receding = (vx * dx + vy * dy) / std::max(distance, 1e-3f);
+		float speed = std::clamp(speed_of_sound + receding, speed_of_sound * 0.5f, speed_of_sound * 2.0f);
+		batch.pitch[i] = speed_of_sound / speed;
+	}
+}
+
+uint32_t AudioSystem::take_voice_id()
+{
+	uint32_t id = next_voice;
+	next_voice = next_voice == ~0u ? 1 : next_voice + 1;
+	return id;
+}
+
+void AudioSystem::render(float* out, size_t frames)
+{
+	Command command;
+	while (commands.pop(command))
+	{
+		apply(command);
+	}
+
+	std::fill(out, out + frames * 2, 0.0f);
+
+	size_t active = 0;
+	for (Voice& voice : voices)
+	{
+		// A voice whose end couldn't be reported last time keeps its slot until it can be.
+		if (voice.ended)
+		{
+			release(voice);
+			continue;
+		}
+		if (voice.clip)
+		{
+			mix(voice, out, frames);
+			active += voice.clip != nullptr && !voice.ended;
+		}
+	}
+	for (Stream*& slot : mixing)
+	{
+		if (slot)
+		{
+			mix_stream(*slot, out, frames);
+			slot = slot->active ? slot : nullptr;
+		}
+	}
+	playing.store(active, std::memory_order_relaxed);
+	clock.fetch_add(frames, std::memory_order_release);
+}
+
+void AudioSystem::stream_callback(void* self, SDL_AudioStream* stream, int additional, int)
+{
+	AudioSystem& audio = *static_cast<AudioSystem*>(self);
+	size_t frames = (static_cast<size_t>(additional) + 2 * sizeof(float) - 1) / (2 * sizeof(float));
+	while (frames > 0)
+	{
+		size_t count = std::min(frames, block_frames);
+		audio.render(audio.block, count);
+		SDL_PutAudioStreamData(stream, audio.block, static_cast<int>(count * 2 * sizeof(float)));
+		frames -= count;
+	}
+}
+
+void AudioSystem::apply(const Command& command)
+{
+	if (command.type == Command::StartStream || command.type == Command::StopStream || command.type == Command::SetStreamVolume)
+	{
+		if (command.type == Command::StartStream)
+		{
+			mixing[command.voice] = streams[command.voice].get();
+		}
+		if (!mixing[command.voice])
+		{
+			return;
+		}
+
+		Stream& slot = *mixing[command.voice];
+		if (command.type == Command::StartStream)
+		{
+			slot.active = true;
+			slot.stopping = false;
+			slot.primed = false;
+			slot.gain = command.left;
+			slot.target = command.left;
+		}
+		else if (command.type == Command::StopStream && slot.active)
+		{
+			slot.stopping = true;
+			slot.target = 0.0f;
+		}
+		else if (slot.active && !slot.stopping)
+		{
+			slot.target = command.left;
+		}
+		return;
+	}
+
+	if (command.type == Command::Play)
+	{
+		Voice* slot = nullptr;
+		Voice* victim = nullptr;
+		for (Voice& voice : voices)
+		{
+			if (!voice.clip)
+			{
+				slot = &voice;
+				break;
+			}
+			if (voice.ended)
+			{
+				continue;
+			}
+			if (!victim || (voice.stopping && !victim->stopping))
+			{
+				victim = &voice;
+			}
+			else if (voice.stopping == victim->stopping && (voice.priority < victim->priority || (voice.priority == victim->priority && voice.target_left + voice.target_right < victim->target_left + victim->target_right)))
+			{
+				victim = &voice;
+			}
+		}
+
+		// Out of voices: one already fading out gives way first, then the least important, then quietest,
+		// voice gives way to a more important sound.
+		if (!slot && victim && (victim->stopping || command.priority > victim->priority))
+		{
+			release(*victim);
+			slot = victim->clip ? nullptr : victim;
+		}
+
+		if (!slot)
+		{
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			finished.push(command.voice);
+			return;
+		}
+
+		*slot = Voice{};
+		slot->clip = command.clip;
+		slot->id = command.voice;
+		slot->position = static_cast<uint64_t>(command.offset) << 32;
+		slot->increment = pitch_increment(command.pitch);
+		slot->left = command.left;
+		slot->right = command.right;
+		slot->target_left = command.left;
+		slot->target_right = command.right;
+		slot->priority = command.priority;
+		slot->loop = command.loop;
+		return;
+	}
+
+	for (Voice& voice : voices)
+	{
+		if (voice.clip && voice.id == command.voice && !voice.ended)
+		{
+			if (command.type == Command::Stop)
+			{
+				voice.stopping = true;
+				voice.target_left = 0.0f;
+				voice.target_right = 0.0f;
+			}
+			else if (!voice.stopping)
+			{
+				voice.target_left = command.left;
+				voice.target_right = command.right;
+				voice.increment = pitch_increment(command.pitch);
+			}
+			return;
+		}
+	}
+}
+
+void AudioSystem::mix(Voice& voice, float* out, size_t frames)
+{
+	const Clip& clip = *voice.clip;
+	float step_left = (voice.target_left - voice.left) / static_cast<float>(frames);
+	float step_right = (voice.target_right - voice.right) / static_cast<float>(frames);
+
+	if (voice.increment != unit_increment)
+	{
+		if (!mix_resampled(voice, out, frames, step_left, step_right))
+		{
+			release(voice);
+			return;
+		}
+	}
+	else
+	{
+		size_t position = static_cast<size_t>(voice.position >> 32);
+		size_t done = 0;
+		while (done < frames)
+		{
+			if (position >= clip.frames)
+			{
+				if (!voice.loop)
+				{
+					release(voice);
+					return;
+				}
+				position = 0;
+			}
+
+			size_t count = std::min(frames - done, clip.frames - position);
+			mix_span(out + done * 2, clip.samples + position * 2, count, voice.left, voice.right, step_left, step_right);
+			done += count;
+			position += count;
+
+			if (position == clip.frames)
+			{
+				if (!voice.loop)
+				{
+					release(voice);
+					return;
+				}
+				position = 0;
+			}
+		}
+		voice.position = static_cast<uint64_t>(position) << 32;
+	}
+
+	// Stops ramp to silence over one block and end there.
+	voice.left = voice.target_left;
+	voice.right = voice.target_right;
+	if (voice.stopping)
+	{
+		release(voice);
+	}
+}
+
+bool AudioSystem::mix_resampled(Voice& voice, float* out, size_t frames, float step_left, float step_right)
+{
+	// Doppler-shifted voices step through the clip at their pitch, blending neighbouring frames.
+	const Clip& clip = *voice.clip;
+	const uint64_t end = static_cast<uint64_t>(clip.frames) << 32;
+	for (size_t i = 0; i < frames; ++i)
+	{
+		if (voice.position >= end)
+		{
+			if (!voice.loop)
+			{
+				return false;
+			}
+			voice.position %= end;
+		}
+
+		size_t index = static_cast<size_t>(voice.position >> 32);
+		size_t next = index + 1 < clip.frames ? index + 1 : (voice.loop ? 0 : index);
+		float t = static_cast<float>(voice.position & 0xffffffffu) * (1.0f / 4294967296.0f);
+		const float* a = clip.samples + index * 2;
+		const float* b = clip.samples + next * 2;
+		out[i * 2] += (a[0] + (b[0] - a[0]) * t) * voice.left;
+		out[i * 2 + 1] += (a[1] + (b[1] - a[1]) * t) * voice.right;
+		voice.left += step_left;
+		voice.right += step_right;
+		voice.position += voice.increment;
+	}
+
+	// Leave the position inside the clip, so a pitch change back to 1 never starts past the end.
+	if (voice.position >= end)
+	{
+		if (!voice.loop)
+		{
+			return false;
+		}
+		voice.position %= end;
+	}
+	return true;
+}
+
+void AudioSystem::mix_stream(Stream& stream, float* out, size_t frames)
+{
+	float step = (stream.target - stream.gain) / static_cast<float>(frames);
+	size_t done = 0;
+	while (done < frames)
+	{
+		size_t count = std::min(frames - done, block_frames);
+		size_t got = stream.ring.pop(stream_block, count * 2) / 2;
+		float right = stream.gain;
+		mix_span(out + done * 2, stream_block, got, stream.gain, right, step, step);
+		stream.primed = stream.primed || got > 0;
+
+		if (got < count)
+		{
+			// Played to the end, or the decoder is behind; before the first data arrives it is just starting.
+			if (stream.exhausted.load(std::memory_order_acquire) && stream.ring.available() == 0)
+			{
+				stream.stopping = true;
+				break;
+			}
+			if (stream.primed)
+			{
+				underruns.fetch_add(count - got, std::memory_order_relaxed);
+			}
+			stream.gain += step * static_cast<float>(count - got);
+		}
+		done += count;
+	}
+
+	stream.gain = stream.target;
+	if (stream.stopping)
+	{
+		stream.active = false;
+		stream.released.store(true, std::memory_order_release);
+	}
+}
+
+void AudioSystem::release(Voice& voice)
+{
+	if (finished.push(voice.id))
+	{
+		voice = Voice{};
+	}
+	else
+	{
+		voice.ended = true;
+	}
+}
@@ -0,0 +1,248 @@
+#pragma once
+
+#include "JobSystem.h"
+#include "Memory.h"
+#include "SpscQueue.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct SDL_AudioStream;
+struct SoundEmitter;
+class World;
+
+using AudioClipId = uint32_t;
+using AudioStreamId = uint32_t;
+
+// Mixes SoundEmitter components on SDL's audio thread. The game thread only talks to the callback
+// through lock-free queues, and the callback mixes into buffers made up front, so a long frame never
+// shows up as a gap in the sound.
+//
+// Attenuation, panning and doppler for every emitter are worked out on the game thread in one batch.
+// Only the loudest max_voices audible emitters get a mixer voice; the rest stay virtual, keeping time
+// so they pick up where they would be if they become audible again.
+class AudioSystem
+{
+public:
+	static constexpr int sample_rate = 48000;
+	static constexpr int max_voices = 32;
+	static constexpr int max_streams = 4;
+	static constexpr AudioClipId invalid_clip = ~0u;
+	static constexpr AudioStreamId invalid_stream = ~0u;
+
+	// Emitters quieter than this (-60 dB) aren't mixed.
+	static constexpr float audible_gain = 0.001f;
+
+	// World units per second.
+	static constexpr float speed_of_sound = 3000.0f;
+
+	explicit AudioSystem(JobSystem& jobs);
+	~AudioSystem();
+
+	// Opens the default playback device. Without one the game runs silent; update() still works.
+	bool init();
+	void shutdown();
+
+	// Interleaved stereo float at sample_rate, as AssetLoader::load_sound decodes it. The samples are
+	// copied and live until shutdown().
+	AudioClipId add_clip(const float* stereo, size_t frames);
+	size_t clip_count() const { return clips.size(); }
+
+	// Music and long ambiences. The file is decoded a little at a time on a job worker into a ring the
+	// mixer reads from, so only about a second of it is in memory at once. Streams play unpositioned,
+	// beside the emitter voices. WAV only; any sample format SDL converts.
+	AudioStreamId play_stream(const std::string& path, float volume, bool loop);
+	void stop_stream(AudioStreamId id);
+	void set_stream_volume(AudioStreamId id, float volume);
+	bool stream_playing(AudioStreamId id) const;
+
+	// Where positional emitters are heard from; call before update() with the camera centre.
+	void set_listener(float x, float y);
+
+	// Main thread, while nothing else changes the world. Starts Pending emitters, spatialises them,
+	// hands the audible ones to the mixer, stops the voices of emitters that are gone and marks finished
+	// one-shots. dt is the time since the last update, for velocities. Also keeps streams decoding.
+	void update(World& world, float dt);
+
+	// Mixes frames of interleaved stereo into out. The device callback calls this; it can also be
+	// called directly to render offline when no device is open.
+	void render(float* out, size_t frames);
+
+	size_t active_voices() const { return playing.load(std::memory_order_relaxed); }
+	size_t virtual_voices() const { return virtual_count; }
+
+	// Frames a stream came up short because its decoder fell behind.
+	uint64_t stream_underruns() const { return underruns.load(std::memory_order_relaxed); }
+	uint64_t dropped_sounds() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+	struct Clip
+	{
+		float* samples;
+		size_t frames;
+	};
+
+	struct Command
+	{
+		enum Type : uint8_t
+		{
+			Play,
+			Stop,
+			SetParams,
+			StartStream,
+			StopStream,
+			SetStreamVolume
+		};
+
+		Type type;
+		uint8_t priority;
+		bool loop;
+		uint32_t voice;
+		const Clip* clip;
+		uint32_t offset;
+		float left;
+		float right;
+		float pitch;
+	};
+
+	// Owned by the audio thread. position is in frames, 32.32 fixed point.
+	struct Voice
+	{
+		const Clip* clip = nullptr;
+		uint32_t id = 0;
+		uint64_t position = 0;
+		uint64_t increment = 0;
+		float left = 0.0f;
+		float right = 0.0f;
+		float target_left = 0.0f;
+		float target_right = 0.0f;
+		uint8_t priority = 0;
+		bool loop = false;
+		bool stopping = false;
+		bool ended = false;
+	};
+
+	// Game thread: one per emitter that has started. playback is the mixer voice it has now, 0 while virtual.
+	struct Sound
+	{
+		const Clip* clip;
+		uint64_t start;
+		uint32_t playback;
+		uint32_t seen;
+		bool loop;
+		float left;
+		float right;
+		float pitch;
+	};
+
+	// Game thread scratch for the batch, one lane per emitter, padded to whole SIMD registers.
+	struct EmitterBatch
+	{
+		std::vector<float> x, y, last_x, last_y, volume, inverse_range;
+		std::vector<float> left, right, pitch;
+		std::vector<uint8_t> mixed;
+		std::vector<Sound*> sounds;
+		std::vector<SoundEmitter*> emitters;
+
+		void clear();
+		void push(SoundEmitter& emitter, Sound& sound, float px, float py, float inverse);
+		void pad();
+		size_t size() const { return sounds.size(); }
+	};
+
+	using AudioBytes = std::vector<char, TaggedAllocator<char, MemoryTag::Audio>>;
+	using AudioSamples = std::vector<float, TaggedAllocator<float, MemoryTag::Audio>>;
+
+	struct Stream
+	{
+		// The game thread between decodes, the decode job during one.
+		std::ifstream file;
+		SDL_AudioStream* converter = nullptr;
+		uint64_t data_start = 0;
+		uint64_t data_size = 0;
+		uint64_t remaining = 0;
+		uint32_t frame_bytes = 0;
+		bool loop = false;
+		bool flushed = false;
+		AudioBytes raw;
+		AudioSamples decoded;
+
+		// Game thread.
+		JobCounter decoding;
+		uint32_t generation = 0;
+		bool open = false;
+
+		// Decoded stereo frames, from the decode job to the mixer. exhausted is set once the last is in.
+		AudioSamples storage;
+		SpscRing<float> ring;
+		std::atomic<bool> exhausted{ false };
+
+		// Set by the audio thread once it has stopped reading the ring.
+		std::atomic<bool> released{ true };
+
+		// Audio thread.
+		float gain = 0.0f;
+		float target = 0.0f;
+		bool active = false;
+		bool stopping = false;
+		bool primed = false;
+	};
+
+	static constexpr size_t block_frames = 512;
+
+	static void stream_callback(void* self, SDL_AudioStream* stream, int additional, int total);
+	void spatialize();
+	bool open_wav(Stream& stream, const std::string& path);
+	void close_stream(Stream& stream);
+	void pump_stream(Stream& stream);
+	static void decode(Stream& stream);
+	void mix_stream(Stream& stream, float* out, size_t frames);
+	Stream* find_stream(AudioStreamId id) const;
+	void apply(const Command& command);
+	void mix(Voice& voice, float* out, size_t frames);
+	bool mix_resampled(Voice& voice, float* out, size_t frames, float step_left, float step_right);
+	void release(Voice& voice);
+	uint32_t take_voice_id();
+
+	JobSystem& jobs;
+	SDL_AudioStream* stream = nullptr;
+	std::vector<std::unique_ptr<Clip>> clips;
+	std::unique_ptr<Stream> streams[max_streams];
+
+	SpscQueue<Command, 1024> commands;
+	SpscQueue<uint32_t, 1024> finished;
+
+	Voice voices[max_voices];
+	Stream* mixing[max_streams] = {};
+	float block[block_frames * 2];
+	float stream_block[block_frames * 2];
+	std::atomic<size_t> playing{ 0 };
+	std::atomic<uint64_t> dropped{ 0 };
+	std::atomic<uint64_t> underruns{ 0 };
+
+	// Frames rendered so far; the game thread's clock for virtual voices.
+	std::atomic<uint64_t> clock{ 0 };
+
+	// Game thread. Sounds are keyed by SoundEmitter::voice; playbacks maps mixer voices back to them.
+	std::unordered_map<uint32_t, Sound> sounds;
+	std::unordered_map<uint32_t, uint32_t> playbacks;
+	EmitterBatch batch;
+	std::vector<uint32_t> chosen;
+	float listener_x = 0.0f;
+	float listener_y = 0.0f;
+	float listener_last_x = 0.0f;
+	float listener_last_y = 0.0f;
+	float listener_vx = 0.0f;
+	float listener_vy = 0.0f;
+	bool has_listener = false;
+	float batch_dt = 0.0f;
+	uint32_t next_voice = 1;
+	uint32_t update_count = 0;
+	size_t virtual_count = 0;
+};
@@ -0,0 +1,788 @@
+#include "Benchmark.h"
+
+#include "Camera.h"
+#include "ChunkAllocator.h"
+#include "Components.h"
+#include "ECS.h"
+#include "JobSystem.h"
+#include "Memory.h"
+#include "RenderSystem.h"
+#include "SpatialGrid.h"
+#include "SpriteRenderer.h"
+#include "StressScene.h"
+#include "TextureAtlas.h"
+#include "Visibility.h"
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+namespace
+{
+	// Everything a scene touches. Built fresh for every run so no run inherits another's chunk layout.
+	struct SceneState
+	{
+		SceneState(BenchmarkTargets& targets, const StressConfig& config)
+			: targets(targets), world(targets.chunks, targets.jobs), arena(16ull * 1024 * 1024), scene(world, targets.jobs, config), entities(config.entities)
+		{
+			// About a sixteenth of the world, the share a zoomed-out view of a large level would see.
+			camera.x = config.extent * 0.5f;
+			camera.y = config.extent * 0.5f;
+			camera.zoom = camera.viewport_width * 4.0f / config.extent;
+		}
+
+		BenchmarkTargets& targets;
+		World world;
+		LinearArena arena;
+		StressScene scene;
+		size_t entities;
+		SpatialGrid grid;
+		Camera2D camera;
+	};
+
+	void populate(SceneState& state)
+	{
+		state.scene.populate();
+		update_bounds(state.world, state.targets.jobs);
+	}
+
+	void create_destroy_frame(SceneState& state)
+	{
+		std::vector<Entity> entities;
+		entities.reserve(state.entities);
+		for (size_t i = 0; i < state.entities; ++i)
+		{
+			float x = static_cast<float>(i);
+			entities.push_back(state.world.create(Transform{ x, x, 0.0f }, Sprite{ 16.0f, 16.0f, TextureAtlas::white_region, 0xffffffff }));
+		}
+		for (Entity entity : entities)
+		{
+			state.world.destroy(entity);
+		}
+	}
+
+	void iterate_frame(SceneState& state)
+	{
+		state.world.query<Transform>().par_each(state.targets.jobs, [](Entity, Transform& t)
+		{
+			t.x += 0.5f;
+			t.rotation += 0.001f;
+		});
+	}
+
+	void bounds_frame(SceneState& state)
+	{
+		update_bounds(state.world, state.targets.jobs);
+	}
+
+	void cull_frame(SceneState& state)
+	{
+		state.arena.reset();
+		VisibleSet visible = cull_visible(state.world, state.camera.bounds(), state.arena);
+		(void)visible;
+	}
+
+	void grid_frame(SceneState& state)
+	{
+		state.arena.reset();
+		state.grid.build(state.world);
+		VisibleSet visible = cull_visible(state.world, state.camera.bounds(), state.arena, &state.grid);
+		(void)visible;
+	}
+
+	void stress_frame(SceneState& state)
+	{
+		state.scene.update(1.0f / 60.0f);
+		update_bounds(state.world, state.targets.jobs);
+		state.scene.collide();
+	}
+
+	// Waits for the GPU so the sample covers the draw, not just the submission.
+	void render_frame(SceneState& state)
+	{
+		state.arena.reset();
+		VisibleSet visible = cull_visible(state.world, state.camera.bounds(), state.arena);
+		state.targets.renderer->begin(state.camera, *state.targets.atlas);
+		submit_sprites(visible, *state.targets.renderer, *state.targets.atlas);
+		state.targets.renderer->end();
+		glFinish();
+	}
+
+	struct Scene
+	{
+		const char* name;
+		bool populated;
+		bool renders;
+		void (*frame)(SceneState&);
+	};
+
+	const Scene scenes[] =
+	{
+		{ "ecs_create_destroy", false, false, create_destroy_frame },
+		{ "ecs_iterate", true, false, iterate_frame },
+		{ "bounds_update", true, false, bounds_frame },
+		{ "cull_linear", true, false, cull_frame },
+		{ "cull_grid", true, false, grid_frame },
+		{ "stress_update", true, false, stress_frame },
+		{ "render_sprites", true, true, render_frame },
+	};
+
+	struct SceneResult
+	{
+		std::string name;
+		std::vector<double> samples;
+	};
+
+	struct RunRecord
+	{
+		std::string label;
+		std::string config;
+		int64_t time = 0;
+		bool baseline = false;
+		std::vector<SceneResult> scenes;
+	};
+
+	const SceneResult* find_scene(const RunRecord& run, const std::string& name)
+	{
+		for (const SceneResult& scene : run.scenes)
+		{
+			if (scene.name == name)
+			{
+				return &scene;
+			}
+		}
+		return nullptr;
+	}
+
+	double median(std::vector<double> values)
+	{
+		if (values.empty())
+		{
+			return 0.0;
+		}
+
+		size_t middle = values.size() / 2;
+		std::nth_element(values.begin(), values.begin() + middle, values.end());
+		double upper = values[middle];
+		if (values.size() % 2 != 0)
+		{
+			return upper;
+		}
+		double lower = *std::max_element(values.begin(), values.begin() + middle);
+		return (lower + upper) * 0.5;
+	}
+
+	// Median absolute deviation, scaled so it estimates the standard deviation for normal noise.
+	double mad(const std::vector<double>& values)
+	{
+		double center = median(values);
+		std::vector<double> deviations;
+		deviations.reserve(values.size());
+		for (double value : values)
+		{
+			deviations.push_back(std::fabs(value - center));
+		}
+		return median(std::move(deviations)) * 1.4826;
+	}
+
+	// One-sided Mann-Whitney U: the probability of seeing current this much slower than baseline if both
+	// came from the same distribution. Normal approximation with tie correction, fine from about 8 samples each.
+	double mann_whitney_slower(const std::vector<double>& current, const std::vector<double>& baseline)
+	{
+		size_t n1 = current.size();
+		size_t n2 = baseline.size();
+		if (n1 == 0 || n2 == 0)
+		{
+			return 1.0;
+		}
+
+		std::vector<std::pair<double, bool>> all;
+		all.reserve(n1 + n2);
+		for (double value : current)
+		{
+			all.push_back({ value, true });
+		}
+		for (double value : baseline)
+		{
+			all.push_back({ value, false });
+		}
+		std::sort(all.begin(), all.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+		double current_rank_sum = 0.0;
+		double tie_term = 0.0;
+		for (size_t i = 0; i < all.size();)
+		{
+			size_t j = i;
+			while (j < all.size() && all[j].first == all[i].first)
+			{
+				++j;
+			}
+
+			double rank = (i + 1 + j) * 0.5;
+			for (size_t k = i; k < j; ++k)
+			{
+				if (all[k].second)
+				{
+					current_rank_sum += rank;
+				}
+			}
+			double ties = static_cast<double>(j - i);
+			tie_term += ties * ties * ties - ties;
+			i = j;
+		}
+
+		double n = static_cast<double>(n1 + n2);
+		double u = current_rank_sum - n1 * (n1 + 1) * 0.5;
+		double mean = n1 * n2 * 0.5;
+		double variance = n1 * n2 / 12.0 * ((n + 1.0) - tie_term / (n * (n - 1.0)));
+		if (variance <= 0.0)
+		{
+			return 1.0;
+		}
+
+		double z = (u - mean - 0.5) / std::sqrt(variance);
+		return 0.5 * std::erfc(z / std::sqrt(2.0));
+	}
+
+	// Just enough JSON to read back the history this file writes.
+	struct JsonValue
+	{
+		enum Type { Null, Bool, Number, String, Array, Object } type = Null;
+		bool flag = false;
+		double number = 0.0;
+		std::string text;
+		std::vector<JsonValue> items;
+		std::vector<std::pair<std::string, JsonValue>> members;
+
+		const JsonValue* find(const char* key) const
+		{
+			for (const auto& member : members)
+			{
+				if (member.first == key)
+				{
+					return &member.second;
+				}
+			}
+			return nullptr;
+		}
+	};
+
+	class JsonReader
+	{
+	public:
+		explicit JsonReader(const std::string& source) : source(source) {}
+
+		bool parse(JsonValue& value)
+		{
+			return parse_value(value) && (skip_space(), position == source.size());
+		}
+
+	private:
+		const std::string& source;
+		size_t position = 0;
+
+		void skip_space()
+		{
+			while (position < source.size() && std::strchr(" \t\r\n", source[position]))
+			{
+				++position;
+			}
+		}
+
+		bool consume(char c)
+		{
+			skip_space();
+			if (position < source.size() && source[position] == c)
+			{
+				++position;
+				return true;
+			}
+			return false;
+		}
+
+		bool parse_string(std::string& out)
+		{
+			if (!consume('"'))
+			{
+				return false;
+			}
+			while (position < source.size() && source[position] != '"')
+			{
+				char c = source[position++];
+				if (c == '\\' && position < source.size())
+				{
+					c = source[position++];
+					c = c == 'n' ? '\n' : c == 't' ? '\t' : c;
+				}
+				out.push_back(c);
+			}
+			return position++ < source.size();
+		}
+
+		bool parse_value(JsonValue& value)
+		{
+			skip_space();
+			if (position >= source.size())
+			{
+				return false;
+			}
+
+			char c = source[position];
+			if (c == '{')
+			{
+				++position;
+				value.type = JsonValue::Object;
+				if (consume('}'))
+				{
+					return true;
+				}
+				do
+				{
+					std::pair<std::string, JsonValue> member;
+					if (!parse_string(member.first) || !consume(':') || !parse_value(member.second))
+					{
+						return false;
+					}
+					value.members.push_back(std::move(member));
+				} while (consume(','));
+				return consume('}');
+			}
+
+			if (c == '[')
+			{
+				++position;
+				value.type = JsonValue::Array;
+				if (consume(']'))
+				{
+					return true;
+				}
+				do
+				{
+					value.items.emplace_back();
+					if (!parse_value(value.items.back()))
+					{
+						return false;
+					}
+				} while (consume(','));
+				return consume(']');
+			}
+
+			if (c == '"')
+			{
+				value.type = JsonValue::String;
+				return parse_string(value.text);
+			}
+
+			for (const char* word : { "true", "false", "null" })
+			{
+				size_t length = std::strlen(word);
+				if (source.compare(position, length, word) == 0)
+				{
+					position += length;
+					value.type = word[0] == 'n' ? JsonValue::Null : JsonValue::Bool;
+					value.flag = word[0] == 't';
+					return true;
+				}
+			}
+
+			const char* start = source.c_str() + position;
+			char* end = nullptr;
+			value.type = JsonValue::Number;
+			value.number = std::strtod(start, &end);
+			position += end - start;
+			return end != start;
+		}
+	};
+
+	bool load_history(const std::string& path, std::vector<RunRecord>& runs)
+	{
+		std::ifstream file(path, std::ios::binary);
+		if (!file)
+		{
+			return true;
+		}
+
+		std::stringstream contents;
+		contents << file.rdbuf();
+		std::string source = contents.str();
+
+		JsonValue root;
+		const JsonValue* list = nullptr;
+		if (!JsonReader(source).parse(root) || !(list = root.find("runs")) || list->type != JsonValue::Array)
+		{
+			std::cerr << "Benchmark history " << path << " is not valid\n";
+			return false;
+		}
+
+		for (const JsonValue& item : list->items)
+		{
+			RunRecord run;
+			if (const JsonValue* label = item.find("label"))
+			{
+				run.label = label->text;
+			}
+			if (const JsonValue* config = item.find("config"))
+			{
+				run.config = config->text;
+			}
+			if (const JsonValue* time = item.find("time"))
+			{
+				run.time = static_cast<int64_t>(time->number);
+			}
+			if (const JsonValue* baseline = item.find("baseline"))
+			{
+				run.baseline = baseline->flag;
+			}
+			if (const JsonValue* scene_map = item.find("scenes"))
+			{
+				for (const auto& member : scene_map->members)
+				{
+					SceneResult result{ member.first, {} };
+					if (const JsonValue* samples = member.second.find("samples"))
+					{
+						for (const JsonValue& sample : samples->items)
+						{
+							result.samples.push_back(sample.number);
+						}
+					}
+					run.scenes.push_back(std::move(result));
+				}
+			}
+			runs.push_back(std::move(run));
+		}
+		return true;
+	}
+
+	void write_string(std::ostream& out, const std::string& text)
+	{
+		out << '"';
+		for (char c : text)
+		{
+			if (c == '"' || c == '\\')
+			{
+				out << '\\';
+			}
+			out << c;
+		}
+		out << '"';
+	}
+
+	bool save_history(const std::string& path, const std::vector<RunRecord>& runs)
+	{
+		std::filesystem::path parent = std::filesystem::path(path).parent_path();
+		if (!parent.empty())
+		{
+			std::error_code error;
+			std::filesystem::create_directories(parent, error);
+		}
+
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		if (!file)
+		{
+			std::cerr << "Failed to write benchmark history " << path << "\n";
+			return false;
+		}
+
+		file.precision(9);
+		file << "{\n\t\"runs\": [";
+		for (size_t r = 0; r < runs.size(); ++r)
+		{
+			const RunRecord& run = runs[r];
+			file << (r ? ",\n" : "\n") << "\t\t{\n\t\t\t\"label\": ";
+			write_string(file, run.label);
+			file << ",\n\t\t\t\"config\": ";
+			write_string(file, run.config);
+			file << ",\n\t\t\t\"time\": " << run.time << ",\n\t\t\t\"baseline\": " << (run.baseline ? "true" : "false") << ",\n\t\t\t\"scenes\": {";
+			for (size_t s = 0; s < run.scenes.size(); ++s)
+			{
+				const SceneResult& scene = run.scenes[s];
+				file << (s ? ",\n" : "\n") << "\t\t\t\t";
+				write_string(file, scene.name);
+				file << ": { \"median\": " << median(scene.samples) << ", \"mad\": " << mad(scene.samples) << ", \"samples\": [";
+				for (size_t i = 0; i < scene.samples.size(); ++i)
+				{
+					file << (i ? ", " : "") << scene.samples[i];
+				}
+				file << "] }";
+			}
+			file << "\n\t\t\t}\n\t\t}";
+		}
+		file << "\n\t]\n}\n";
+		return static_cast<bool>(file);
+	}
+
+	std::string describe(const StressConfig& config)
+	{
+		char text[192];
+		std::snprintf(text, sizeof(text), "seed=%u entities=%zu archetypes=%u churn=%g depth=%u colliders=%g sprites=%g extent=%g",
+			config.seed, config.entities, config.archetypes, config.churn, config.hierarchy_depth, config.collider_density, config.sprite_density, config.extent);
+		return text;
+	}
+
+	double run_scene(const Scene& scene, const StressConfig& config, BenchmarkTargets& targets, int frames)
+	{
+		SceneState state(targets, config);
+		if (scene.populated)
+		{
+			populate(state);
+		}
+
+		// One untimed frame so lazily built state (grid cells, arena pages, GL buffers) is already in place.
+		scene.frame(state);
+
+		auto start = std::chrono::steady_clock::now();
+		for (int frame = 0; frame < frames; ++frame)
+		{
+			scene.frame(state);
+		}
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		return elapsed.count() / frames;
+	}
+}
+
+bool parse_benchmark_argument(int argc, char* argv[], int& i, BenchmarkOptions& options)
+{
+	const char* arg = argv[i];
+	if (std::strcmp(arg, "--benchmark") == 0)
+	{
+		options.enabled = true;
+		return true;
+	}
+	if (std::strcmp(arg, "--baseline") == 0)
+	{
+		options.set_baseline = true;
+		return true;
+	}
+	if (std::strcmp(arg, "--scaling") == 0)
+	{
+		options.scaling = true;
+		return true;
+	}
+	if (i + 1 >= argc)
+	{
+		return false;
+	}
+
+	const char* value = argv[i + 1];
+	if (std::strcmp(arg, "--runs") == 0)
+	{
+		options.runs = std::max(std::atoi(value), 1);
+	}
+	else if (std::strcmp(arg, "--run-frames") == 0)
+	{
+		options.frames_per_run = std::max(std::atoi(value), 1);
+	}
+	else if (std::strcmp(arg, "--threshold") == 0)
+	{
+		options.threshold = static_cast<float>(std::atof(value) / 100.0);
+	}
+	else if (std::strcmp(arg, "--history") == 0)
+	{
+		options.history_path = value;
+	}
+	else if (std::strcmp(arg, "--label") == 0)
+	{
+		options.label = value;
+	}
+	else if (std::strcmp(arg, "--filter") == 0)
+	{
+		options.filter = value;
+	}
+	else if (std::strcmp(arg, "--max-workers") == 0)
+	{
+		options.max_workers = std::max(std::atoi(value), 1);
+	}
+	else
+	{
+		return false;
+	}
+	++i;
+	return true;
+}
+
+int run_benchmarks(const BenchmarkOptions& options, const StressConfig& scene_config, BenchmarkTargets& targets)
+{
+	std::vector<RunRecord> history;
+	if (!load_history(options.history_path, history))
+	{
+		return -1;
+	}
+
+	RunRecord current;
+	current.time = static_cast<int64_t>(std::time(nullptr));
+	current.label = options.label.empty() ? std::to_string(current.time) : options.label;
+	current.config = describe(scene_config);
+
+	for (const Scene& scene : scenes)
+	{
+		if (!options.filter.empty() && std::strstr(scene.name, options.filter.c_str()) == nullptr)
+		{
+			continue;
+		}
+
+		// Warmup runs settle clocks, caches and the allocator's free lists and are thrown away.
+		SceneResult result{ scene.name, {} };
+		for (int run = 0; run < options.warmup_runs + options.runs; ++run)
+		{
+			double milliseconds = run_scene(scene, scene_config, targets, options.frames_per_run);
+			if (run >= options.warmup_runs)
+			{
+				result.samples.push_back(milliseconds);
+			}
+		}
+		current.scenes.push_back(std::move(result));
+	}
+
+	// Timings from different scene configs aren't comparable, so each config keeps its own baselines. A
+	// filtered run only holds some scenes, so baselines are found per scene: the latest run marked with
+	// --baseline that ran it, or else the first run that did.
+	std::vector<const RunRecord*> baselines;
+	for (const SceneResult& result : current.scenes)
+	{
+		const RunRecord* baseline = nullptr;
+		for (const RunRecord& run : history)
+		{
+			if (run.config == current.config && (run.baseline || !baseline) && find_scene(run, result.name))
+			{
+				baseline = &run;
+			}
+		}
+		baselines.push_back(baseline);
+	}
+	bool compared = std::any_of(baselines.begin(), baselines.end(), [](const RunRecord* run) { return run != nullptr; });
+	current.baseline = options.set_baseline && !current.scenes.empty();
+
+	int regressions = 0;
+	char line[160];
+	std::snprintf(line, sizeof(line), "%-20s %9s %8s %9s %8s %8s", "scene", "median ms", "mad", "baseline", "change", "p");
+	std::cout << line << "\n";
+	std::string labels;
+	for (size_t i = 0; i < current.scenes.size(); ++i)
+	{
+		const SceneResult& result = current.scenes[i];
+		double current_median = median(result.samples);
+		const SceneResult* previous = baselines[i] ? find_scene(*baselines[i], result.name) : nullptr;
+		if (baselines[i] && std::find(baselines.begin(), baselines.begin() + i, baselines[i]) == baselines.begin() + i)
+		{
+			labels += (labels.empty() ? "" : ", ") + baselines[i]->label;
+		}
+
+		if (!previous || previous->samples.empty())
+		{
+			std::snprintf(line, sizeof(line), "%-20s %9.3f %8.3f %9s", result.name.c_str(), current_median, mad(result.samples), "-");
+			std::cout << line << "\n";
+			continue;
+		}
+
+		double baseline_median = median(previous->samples);
+		double change = baseline_median > 0.0 ? current_median / baseline_median - 1.0 : 0.0;
+		double slower = mann_whitney_slower(result.samples, previous->samples);
+		double faster = mann_whitney_slower(previous->samples, result.samples);
+		const char* verdict = "";
+		if (change > options.threshold && slower < options.significance)
+		{
+			verdict = "  REGRESSION";
+			++regressions;
+		}
+		else if (change < -options.threshold && faster < options.significance)
+		{
+			verdict = "  improved";
+		}
+
+		std::snprintf(line, sizeof(line), "%-20s %9.3f %8.3f %9.3f %+7.1f%% %8.4f%s", result.name.c_str(), current_median, mad(result.samples), baseline_median, change * 100.0, std::min(slower, faster), verdict);
+		std::cout << line << "\n";
+	}
+
+	if (compared)
+	{
+		std::cout << "Compared with baseline " << labels << (current.baseline ? "; this run is the new baseline for its scenes" : "") << "\n";
+	}
+	else if (!current.scenes.empty())
+	{
+		std::cout << "No earlier run of these scenes with " << current.config << " in " << options.history_path << "; this run is their baseline\n";
+	}
+
+	history.push_back(std::move(current));
+	if (!save_history(options.history_path, history))
+	{
+		return -1;
+	}
+	return regressions;
+}
+
+int run_scaling_benchmarks(const BenchmarkOptions& options, const StressConfig& scene_config)
+{
+	std::vector<int> worker_counts;
+	for (int workers = 1; workers < options.max_workers; workers *= 2)
+	{
+		worker_counts.push_back(workers);
+	}
+	worker_counts.push_back(options.max_workers);
+
+	std::vector<const Scene*> selected;
+	for (const Scene& scene : scenes)
+	{
+		if (!scene.renders && (options.filter.empty() || std::strstr(scene.name, options.filter.c_str())))
+		{
+			selected.push_back(&scene);
+		}
+	}
+
+	// medians[scene][worker count]. Each worker count gets a job system and chunk allocator of its own,
+	// and every scene runs on it before the next is built, so threads are only started once per count.
+	std::vector<std::vector<double>> medians(selected.size());
+	std::vector<std::vector<double>> deviations(selected.size());
+	unsigned cores = 0;
+	for (int workers : worker_counts)
+	{
+		JobSystem jobs(static_cast<unsigned>(workers));
+		ChunkAllocator chunks(jobs.topology().node_ids);
+		BenchmarkTargets targets{ jobs, chunks, nullptr, nullptr };
+		cores = static_cast<unsigned>(jobs.topology().cores.size());
+
+		for (size_t s = 0; s < selected.size(); ++s)
+		{
+			std::vector<double> samples;
+			for (int run = 0; run < options.warmup_runs + options.runs; ++run)
+			{
+				double milliseconds = run_scene(*selected[s], scene_config, targets, options.frames_per_run);
+				if (run >= options.warmup_runs)
+				{
+					samples.push_back(milliseconds);
+				}
+			}
+			medians[s].push_back(median(samples));
+			deviations[s].push_back(mad(samples));
+		}
+	}
+
+	// Speedup is against one worker; the calling thread joins in par_each as well, so one worker is two
+	// threads at most. Counts above the core count share cores and show the cost of oversubscription.
+	std::cout << describe(scene_config) << ", " << cores << " logical cores\n";
+	char line[160];
+	std::snprintf(line, sizeof(line), "%-20s %7s %9s %8s %8s %10s", "scene", "workers", "median ms", "mad", "speedup", "efficiency");
+	std::cout << line << "\n";
+	for (size_t s = 0; s < selected.size(); ++s)
+	{
+		for (size_t w = 0; w < worker_counts.size(); ++w)
+		{
+			double speedup = medians[s][w] > 0.0 ? medians[s][0] / medians[s][w] : 0.0;
+			std::snprintf(line, sizeof(line), "%-20s %7d %9.3f %8.3f %7.2fx %9.0f%%", w == 0 ? selected[s]->name : "", worker_counts[w],
+				medians[s][w], deviations[s][w], speedup, speedup / worker_counts[w] * 100.0);
+			std::cout << line << "\n";
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <string>
+
+class ChunkAllocator;
+class JobSystem;
+class SpriteRenderer;
+class TextureAtlas;
+struct StressConfig;
+
+struct BenchmarkOptions
+{
+	bool enabled = false;
+	int runs = 10;
+	int warmup_runs = 2;
+	int frames_per_run = 10;
+
+	// A scene regresses when its median is more than threshold slower than the baseline's and the
+	// Mann-Whitney test says the shift is unlikely to be noise.
+	float threshold = 0.03f;
+	float significance = 0.01f;
+
+	std::string history_path = "benchmarks/history.json";
+	std::string label;
+	std::string filter;
+	bool set_baseline = false;
+
+	// Runs the scenes that don't draw on job systems of 1, 2, 4... workers up to max_workers instead.
+	bool scaling = false;
+	int max_workers = 64;
+};
+
+struct BenchmarkTargets
+{
+	JobSystem& jobs;
+	ChunkAllocator& chunks;
+	// Null for scaling runs, which never create a window.
+	TextureAtlas* atlas;
+	SpriteRenderer* renderer;
+};
+
+// Consumes argv[i] (and its value) when it is a benchmark flag: --benchmark, --runs N, --run-frames N,
+// --threshold PERCENT, --history PATH, --label TEXT, --filter TEXT, --baseline, --scaling, --max-workers N.
+bool parse_benchmark_argument(int argc, char* argv[], int& i, BenchmarkOptions& options);
+
+// Runs every scene whose name contains the filter on a StressScene built from scene, compares each with its
+// baseline for the same scene config and appends this run. A scene's baseline is the last --baseline run that
+// included it, or the first run that did when there is none, so a filtered run only ever sets baselines for
+// the scenes it ran. Returns the number of regressions, or -1 when the history can't be read or written.
+int run_benchmarks(const BenchmarkOptions& options, const StressConfig& scene, BenchmarkTargets& targets);
+
+// Prints how each scene's median frame time scales with the worker count. Scaling curves depend on the
+// machine more than on the code, so nothing is compared or written to the history. Returns 0.
+int run_scaling_benchmarks(const BenchmarkOptions& options, const StressConfig& scene);
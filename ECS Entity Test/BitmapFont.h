@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstdint>
+
+constexpr int bitmap_font_width = 5;
+constexpr int bitmap_font_height = 8;
+
+// Columns of a 5x8 glyph for printable ASCII, least significant bit at the top. Anything else maps to '?'.
+const uint8_t* bitmap_font_glyph(unsigned char c);
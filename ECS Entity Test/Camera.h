@@ -0,0 +1,35 @@
+#pragma once
+
+struct Rect
+{
+	float min_x;
+	float min_y;
+	float max_x;
+	float max_y;
+};
+
+// World units are pixels at zoom 1. Y points up.
+struct Camera2D
+{
+	float x = 0.0f;
+	float y = 0.0f;
+	float zoom = 1.0f;
+	int viewport_width = 1280;
+	int viewport_height = 720;
+
+	Rect bounds() const
+	{
+		float half_width = viewport_width * 0.5f / zoom;
+		float half_height = viewport_height * 0.5f / zoom;
+		return { x - half_width, y - half_height, x + half_width, y + half_height };
+	}
+
+	// clip = world * (scale_x, scale_y) + (offset_x, offset_y)
+	void projection(float out[4]) const
+	{
+		out[0] = 2.0f * zoom / viewport_width;
+		out[1] = 2.0f * zoom / viewport_height;
+		out[2] = -x * out[0];
+		out[3] = -y * out[1];
+	}
+};
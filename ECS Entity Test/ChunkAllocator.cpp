@@ -0,0 +1,127 @@
+#include "ChunkAllocator.h"
+
+#include "Memory.h"
+
+#include <iostream>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	void* allocate_on_node(size_t size, unsigned node)
+	{
+#if defined(_WIN32)
+		return VirtualAllocExNuma(GetCurrentProcess(), nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, node);
+#elif defined(__linux__)
+		void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (memory == MAP_FAILED)
+		{
+			return nullptr;
+		}
+
+		// MPOL_PREFERRED: place pages on the node when possible without failing if it is full.
+		// The kernel reads one bit fewer than maxnode, hence the + 1.
+		constexpr int mpol_preferred = 1;
+		constexpr size_t bits = sizeof(unsigned long) * 8;
+		std::vector<unsigned long> mask(node / bits + 1, 0);
+		mask[node / bits] = 1ul << (node % bits);
+		syscall(SYS_mbind, memory, size, mpol_preferred, mask.data(), mask.size() * bits + 1, 0);
+		return memory;
+#else
+		(void)node;
+		return ::operator new(size);
+#endif
+	}
+
+	void free_on_node(void* memory, size_t size)
+	{
+#if defined(_WIN32)
+		(void)size;
+		VirtualFree(memory, 0, MEM_RELEASE);
+#elif defined(__linux__)
+		munmap(memory, size);
+#else
+		(void)size;
+		::operator delete(memory);
+#endif
+	}
+}
+
+ChunkAllocator::ChunkAllocator(const std::vector<unsigned>& node_ids)
+{
+	for (unsigned os_node : node_ids)
+	{
+		nodes.push_back({ os_node, {} });
+	}
+	if (nodes.empty())
+	{
+		nodes.push_back({ 0, {} });
+	}
+}
+
+ChunkAllocator::~ChunkAllocator()
+{
+	for (const Slab& slab : slabs)
+	{
+		free_on_node(slab.memory, slab_size);
+		Memory::track_free(MemoryTag::ECSChunks, slab_size);
+	}
+}
+
+void* ChunkAllocator::allocate(unsigned node)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	node %= static_cast<unsigned>(nodes.size());
+	std::vector<void*>& free_chunks = nodes[node].free_chunks;
+
+	if (free_chunks.empty())
+	{
+		void* memory = allocate_on_node(slab_size, nodes[node].os_node);
+		if (!memory)
+		{
+			std::cerr << "Failed to allocate chunk slab on NUMA node " << nodes[node].os_node << "\n";
+			return nullptr;
+		}
+
+		Memory::track_alloc(MemoryTag::ECSChunks, slab_size);
+		slabs.push_back({ memory, node });
+
+		// Push in reverse so chunks come back out in address order.
+		unsigned char* base = static_cast<unsigned char*>(memory);
+		for (size_t offset = slab_size; offset >= chunk_size; offset -= chunk_size)
+		{
+			free_chunks.push_back(base + offset - chunk_size);
+		}
+	}
+
+	void* chunk = free_chunks.back();
+	free_chunks.pop_back();
+	++in_use;
+	return chunk;
+}
+
+void ChunkAllocator::free(void* chunk, unsigned node)
+{
+	if (!chunk)
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	nodes[node % nodes.size()].free_chunks.push_back(chunk);
+	--in_use;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+// Hands out fixed-size ECS chunks carved from large slabs placed on a specific NUMA node.
+class ChunkAllocator
+{
+public:
+	static constexpr size_t chunk_size = 16 * 1024;
+	static constexpr size_t slab_size = 1024 * 1024;
+
+	// One entry per compact node index (CpuTopology::node_ids), giving the OS node to place its slabs on.
+	explicit ChunkAllocator(const std::vector<unsigned>& node_ids = { 0 });
+	~ChunkAllocator();
+
+	ChunkAllocator(const ChunkAllocator&) = delete;
+	ChunkAllocator& operator=(const ChunkAllocator&) = delete;
+
+	void* allocate(unsigned node);
+	void free(void* chunk, unsigned node);
+
+	size_t chunks_in_use() const { return in_use; }
+	size_t slab_count() const { return slabs.size(); }
+
+private:
+	struct Slab
+	{
+		void* memory;
+		unsigned node;
+	};
+
+	struct Node
+	{
+		unsigned os_node;
+		std::vector<void*> free_chunks;
+	};
+
+	std::vector<Node> nodes;
+	std::vector<Slab> slabs;
+	size_t in_use = 0;
+	std::mutex mutex;
+};
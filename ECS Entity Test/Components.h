@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+
+struct Transform
+{
+	float x;
+	float y;
+	float rotation;
+};
+
+struct Sprite
+{
+	float width;
+	float height;
+	uint32_t region;
+	uint32_t color;
+};
+
+// World-space AABB. Rebuilt from Transform + Sprite each frame by update_bounds(); culling only sees
+// entities that have one.
+struct alignas(16) Bounds
+{
+	float min_x;
+	float min_y;
+	float max_x;
+	float max_y;
+};
+
+// Draws the TilemapRenderer map with this id, bottom-left corner at the entity's Transform.
+struct Tilemap
+{
+	uint32_t map;
+};
+
+enum class SoundState : uint8_t
+{
+	Pending,
+	Playing,
+	Finished
+};
+
+// Plays an AudioSystem clip. A Pending emitter starts in the next AudioSystem::update(); a one-shot turns
+// Finished once it has played out or lost its voice to a more important sound. Higher priority wins.
+// With a Transform and a range, the sound fades out towards range world units from the listener and is
+// panned and pitch-shifted by its motion; otherwise it plays centred at full volume.
+struct SoundEmitter
+{
+	uint32_t clip;
+	float volume;
+	uint8_t priority;
+	bool loop;
+	SoundState state;
+	uint32_t voice;
+	float range = 0.0f;
+
+	// Where the emitter was at the last update, for its velocity.
+	float last_x = 0.0f;
+	float last_y = 0.0f;
+};
@@ -0,0 +1,196 @@
+#include "Coroutine.h"
+
+#include "Memory.h"
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+	constexpr size_t smallest_frame = 64;
+	constexpr int size_classes = 8;
+
+	// Freed frames are kept for reuse rather than returned, so the tag's live bytes track the peak.
+	struct FreeFrame
+	{
+		FreeFrame* next;
+	};
+
+	struct SizeClass
+	{
+		std::mutex mutex;
+		FreeFrame* head = nullptr;
+	};
+
+	SizeClass classes[size_classes];
+
+	int class_of(size_t size)
+	{
+		int index = 0;
+		for (size_t capacity = smallest_frame; capacity < size && index < size_classes; capacity <<= 1)
+		{
+			++index;
+		}
+		return index;
+	}
+
+	struct AssetWaiter
+	{
+		std::coroutine_handle<> coroutine;
+		Coroutines::AssetLoad* load;
+	};
+
+	struct GroupWaiter
+	{
+		std::coroutine_handle<> coroutine;
+		const JobGroup* group;
+	};
+
+	std::vector<std::coroutine_handle<>> roots;
+	std::vector<std::coroutine_handle<>> frame_waiters;
+	std::vector<AssetWaiter> asset_waiters;
+	std::vector<GroupWaiter> group_waiters;
+	std::vector<std::coroutine_handle<>> resuming;
+}
+
+namespace CoroutineDetail
+{
+	void* allocate_frame(size_t size)
+	{
+		int index = class_of(size);
+		if (index == size_classes)
+		{
+			return Memory::allocate(MemoryTag::Coroutines, size);
+		}
+
+		SizeClass& size_class = classes[index];
+		{
+			std::lock_guard<std::mutex> lock(size_class.mutex);
+			if (FreeFrame* frame = size_class.head)
+			{
+				size_class.head = frame->next;
+				return frame;
+			}
+		}
+		return Memory::allocate(MemoryTag::Coroutines, smallest_frame << index);
+	}
+
+	void free_frame(void* frame, size_t size)
+	{
+		int index = class_of(size);
+		if (index == size_classes)
+		{
+			Memory::deallocate(MemoryTag::Coroutines, frame, size);
+			return;
+		}
+
+		SizeClass& size_class = classes[index];
+		std::lock_guard<std::mutex> lock(size_class.mutex);
+		size_class.head = new (frame) FreeFrame{ size_class.head };
+	}
+
+	void finish_root(std::coroutine_handle<> root)
+	{
+		auto found = std::find(roots.begin(), roots.end(), root);
+		if (found != roots.end())
+		{
+			*found = roots.back();
+			roots.pop_back();
+		}
+		root.destroy();
+	}
+}
+
+void JobGroup::Awaiter::await_suspend(std::coroutine_handle<> coroutine)
+{
+	group_waiters.push_back({ coroutine, &group });
+}
+
+namespace Coroutines
+{
+	void NextFrame::await_suspend(std::coroutine_handle<> coroutine)
+	{
+		frame_waiters.push_back(coroutine);
+	}
+
+	void AssetLoad::await_suspend(std::coroutine_handle<> coroutine)
+	{
+		asset_waiters.push_back({ coroutine, this });
+	}
+
+	void spawn(Task<void> task)
+	{
+		std::coroutine_handle<Task<void>::promise_type> coroutine = task.release();
+		if (!coroutine)
+		{
+			return;
+		}
+
+		coroutine.promise().root = true;
+		roots.push_back(coroutine);
+		coroutine.resume();
+	}
+
+	void update(const AssetLoader& assets)
+	{
+		// Everything due is collected first, so a coroutine that waits again is only resumed next frame.
+		resuming.swap(frame_waiters);
+
+		for (size_t i = 0; i < asset_waiters.size();)
+		{
+			AssetState state = assets.state(asset_waiters[i].load->handle);
+			if (state == AssetState::Ready || state == AssetState::Failed)
+			{
+				asset_waiters[i].load->result = state;
+				resuming.push_back(asset_waiters[i].coroutine);
+				asset_waiters[i] = asset_waiters.back();
+				asset_waiters.pop_back();
+			}
+			else
+			{
+				++i;
+			}
+		}
+
+		for (size_t i = 0; i < group_waiters.size();)
+		{
+			if (group_waiters[i].group->done())
+			{
+				resuming.push_back(group_waiters[i].coroutine);
+				group_waiters[i] = group_waiters.back();
+				group_waiters.pop_back();
+			}
+			else
+			{
+				++i;
+			}
+		}
+
+		for (std::coroutine_handle<> coroutine : resuming)
+		{
+			coroutine.resume();
+		}
+		resuming.clear();
+	}
+
+	void shutdown()
+	{
+		frame_waiters.clear();
+		asset_waiters.clear();
+		group_waiters.clear();
+
+		// Destroying a root destroys the tasks it is awaiting along with its locals.
+		std::vector<std::coroutine_handle<>> pending;
+		pending.swap(roots);
+		for (std::coroutine_handle<> root : pending)
+		{
+			root.destroy();
+		}
+	}
+
+	size_t running_count()
+	{
+		return roots.size();
+	}
+}
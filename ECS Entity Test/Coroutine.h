@@ -0,0 +1,210 @@
+#pragma once
+
+#include "AssetLoader.h"
+#include "JobSystem.h"
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+namespace CoroutineDetail
+{
+	// Frames come from size-class free lists, so a coroutine started every frame doesn't hit the heap.
+	void* allocate_frame(size_t size);
+	void free_frame(void* frame, size_t size);
+
+	void finish_root(std::coroutine_handle<> root);
+
+	struct PromiseBase
+	{
+		std::coroutine_handle<> continuation;
+		bool root = false;
+
+		static void* operator new(size_t size) { return allocate_frame(size); }
+		static void operator delete(void* frame, size_t size) { free_frame(frame, size); }
+
+		std::suspend_always initial_suspend() noexcept { return {}; }
+
+		struct FinalAwaiter
+		{
+			bool await_ready() noexcept { return false; }
+			void await_resume() noexcept {}
+
+			// Hands control straight to whoever awaited this task. A spawned task has nobody, so it frees itself.
+			template <typename Promise>
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> self) noexcept
+			{
+				PromiseBase& promise = self.promise();
+				if (promise.root)
+				{
+					finish_root(self);
+					return std::noop_coroutine();
+				}
+				return promise.continuation ? promise.continuation : std::noop_coroutine();
+			}
+		};
+
+		FinalAwaiter final_suspend() noexcept { return {}; }
+
+		// The engine builds without relying on exceptions; an escaping one is a bug.
+		void unhandled_exception() noexcept { std::terminate(); }
+	};
+
+	template <typename T>
+	struct TaskPromise : PromiseBase
+	{
+		std::optional<T> value;
+
+		void return_value(T result) { value.emplace(std::move(result)); }
+	};
+
+	template <>
+	struct TaskPromise<void> : PromiseBase
+	{
+		void return_void() {}
+	};
+}
+
+// Lazy coroutine: nothing runs until it is awaited or handed to Coroutines::spawn. Awaiting a task runs it
+// and resumes the awaiter as soon as it finishes, without going back through the scheduler.
+template <typename T = void>
+class [[nodiscard]] Task
+{
+public:
+	struct promise_type : CoroutineDetail::TaskPromise<T>
+	{
+		Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+	};
+
+	Task() = default;
+	Task(Task&& other) noexcept : coroutine(std::exchange(other.coroutine, nullptr)) {}
+	Task& operator=(Task&& other) noexcept
+	{
+		if (this != &other)
+		{
+			if (coroutine)
+			{
+				coroutine.destroy();
+			}
+			coroutine = std::exchange(other.coroutine, nullptr);
+		}
+		return *this;
+	}
+
+	~Task()
+	{
+		if (coroutine)
+		{
+			coroutine.destroy();
+		}
+	}
+
+	Task(const Task&) = delete;
+	Task& operator=(const Task&) = delete;
+
+	bool done() const { return !coroutine || coroutine.done(); }
+
+	std::coroutine_handle<promise_type> release() { return std::exchange(coroutine, nullptr); }
+
+	auto operator co_await() && noexcept
+	{
+		struct Awaiter
+		{
+			std::coroutine_handle<promise_type> coroutine;
+
+			bool await_ready() noexcept { return !coroutine || coroutine.done(); }
+
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+			{
+				coroutine.promise().continuation = awaiting;
+				return coroutine;
+			}
+
+			T await_resume()
+			{
+				if constexpr (!std::is_void_v<T>)
+				{
+					return std::move(*coroutine.promise().value);
+				}
+			}
+		};
+		return Awaiter{ coroutine };
+	}
+
+private:
+	explicit Task(std::coroutine_handle<promise_type> handle) : coroutine(handle) {}
+
+	std::coroutine_handle<promise_type> coroutine;
+};
+
+// Jobs started from a coroutine. co_await resumes the coroutine on the main thread, in the first
+// Coroutines::update() after every job has finished. Destroying the group waits for its jobs, so a
+// coroutine destroyed mid-wait never leaves a job writing to its frame.
+class JobGroup
+{
+public:
+	explicit JobGroup(JobSystem& jobs) : jobs(jobs) {}
+	~JobGroup() { jobs.wait(counter); }
+
+	JobGroup(const JobGroup&) = delete;
+	JobGroup& operator=(const JobGroup&) = delete;
+
+	void run(Job job) { jobs.run(counter, std::move(job)); }
+	bool done() const { return counter.value.load(std::memory_order_acquire) == 0; }
+
+	struct Awaiter
+	{
+		JobGroup& group;
+
+		bool await_ready() const noexcept { return group.done(); }
+		void await_suspend(std::coroutine_handle<> coroutine);
+		void await_resume() noexcept {}
+	};
+
+	Awaiter operator co_await() { return { *this }; }
+
+private:
+	JobSystem& jobs;
+	JobCounter counter;
+};
+
+// Runs coroutines on the main thread. Everything they wait on is checked once per frame in update(),
+// so gameplay code awaits frames, loads and jobs without keeping its own state between frames.
+namespace Coroutines
+{
+	// Starts task now; it runs until its first suspension. The scheduler owns it from then on.
+	void spawn(Task<void> task);
+
+	// Main thread, once per frame after the asset loader has been pumped.
+	void update(const AssetLoader& assets);
+
+	// Destroys every coroutine that hasn't finished.
+	void shutdown();
+
+	size_t running_count();
+
+	// Resumes in the next update().
+	struct NextFrame
+	{
+		bool await_ready() const noexcept { return false; }
+		void await_suspend(std::coroutine_handle<> coroutine);
+		void await_resume() noexcept {}
+	};
+
+	// Resumes in the next update(). Returns Ready or Failed.
+	struct AssetLoad
+	{
+		AssetHandle handle;
+		AssetState result = AssetState::Failed;
+
+		bool await_ready() const noexcept { return handle == AssetLoader::invalid_handle; }
+		void await_suspend(std::coroutine_handle<> coroutine);
+		AssetState await_resume() const noexcept { return result; }
+	};
+
+	inline NextFrame next_frame() { return {}; }
+	inline AssetLoad load(AssetHandle handle) { return { handle }; }
+}
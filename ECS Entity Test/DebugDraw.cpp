@@ -0,0 +1,359 @@
+#include "DebugDraw.h"
+
+#include "BitmapFont.h"
+#include "Memory.h"
+#include "Shader.h"
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+	struct Segment
+	{
+		float x0;
+		float y0;
+		float x1;
+		float y1;
+		float width;
+		uint32_t color;
+	};
+
+	struct alignas(64) Arena
+	{
+		std::vector<Segment, TaggedAllocator<Segment, MemoryTag::Transient>> segments;
+	};
+
+	constexpr int frames_in_flight = 3;
+
+	const char* vertex_source = R"(#version 450 core
+layout(location = 0) in vec4 in_points;
+layout(location = 1) in float in_width;
+layout(location = 2) in vec4 in_color;
+
+uniform vec4 u_projection;
+
+out vec4 v_color;
+
+void main()
+{
+	vec2 a = in_points.xy;
+	vec2 b = in_points.zw;
+	float len = length(b - a);
+	vec2 along = len > 0.0 ? (b - a) / len : vec2(1.0, 0.0);
+	vec2 across = vec2(-along.y, along.x);
+	float half_width = in_width * 0.5;
+
+	// Square caps, so a zero-length segment is a dot and runs of font pixels tile exactly.
+	vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+	vec2 world = mix(a - along * half_width, b + along * half_width, corner.x) + across * half_width * (corner.y * 2.0 - 1.0);
+
+	gl_Position = vec4(world * u_projection.xy + u_projection.zw, 0.0, 1.0);
+	v_color = in_color;
+}
+)";
+
+	const char* fragment_source = R"(#version 450 core
+in vec4 v_color;
+
+out vec4 out_color;
+
+void main()
+{
+	out_color = v_color;
+}
+)";
+
+	// Bumped by init() and shutdown() so threads re-register their arena with the new state.
+	std::atomic<uint64_t> generation{ 0 };
+	uint64_t next_generation = 0;
+	std::mutex arenas_mutex;
+	std::vector<std::unique_ptr<Arena>> arenas;
+
+	float pixel = 1.0f;
+	Rect view = {};
+	float projection[4] = {};
+
+	GLuint program = 0;
+	GLuint vao = 0;
+	GLuint buffer = 0;
+	GLint projection_location = -1;
+	Segment* mapped = nullptr;
+	GLsync fences[frames_in_flight] = {};
+	int frame = 0;
+	size_t max_segments = 0;
+	size_t last_count = 0;
+	size_t dropped = 0;
+
+	Arena* local_arena()
+	{
+		thread_local Arena* arena = nullptr;
+		thread_local uint64_t arena_generation = 0;
+
+		uint64_t current = generation.load(std::memory_order_acquire);
+		if (current == 0)
+		{
+			return nullptr;
+		}
+
+		if (arena_generation != current)
+		{
+			std::lock_guard<std::mutex> lock(arenas_mutex);
+			arenas.push_back(std::make_unique<Arena>());
+			arena = arenas.back().get();
+			arena_generation = current;
+		}
+		return arena;
+	}
+}
+
+namespace DebugDraw
+{
+	bool init(size_t max_segments_per_frame)
+	{
+		program = create_program(vertex_source, fragment_source);
+		if (!program)
+		{
+			return false;
+		}
+		projection_location = glGetUniformLocation(program, "u_projection");
+
+		max_segments = max_segments_per_frame;
+		GLsizeiptr bytes = static_cast<GLsizeiptr>(max_segments * sizeof(Segment) * frames_in_flight);
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+		glGenVertexArrays(1, &vao);
+		glGenBuffers(1, &buffer);
+		glBindVertexArray(vao);
+		glBindBuffer(GL_ARRAY_BUFFER, buffer);
+		glBufferStorage(GL_ARRAY_BUFFER, bytes, nullptr, flags);
+		mapped = static_cast<Segment*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, flags));
+		if (!mapped)
+		{
+			std::cerr << "Failed to map debug draw buffer\n";
+			glBindVertexArray(0);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+			shutdown();
+			return false;
+		}
+		Memory::track_alloc(MemoryTag::RenderBuffers, static_cast<size_t>(bytes));
+
+		GLsizei stride = sizeof(Segment);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, stride, reinterpret_cast<void*>(offsetof(Segment, x0)));
+		glVertexAttribDivisor(0, 1);
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, stride, reinterpret_cast<void*>(offsetof(Segment, width)));
+		glVertexAttribDivisor(1, 1);
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, reinterpret_cast<void*>(offsetof(Segment, color)));
+		glVertexAttribDivisor(2, 1);
+
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		generation.store(++next_generation, std::memory_order_release);
+		return true;
+	}
+
+	void shutdown()
+	{
+		generation.store(0, std::memory_order_release);
+		{
+			std::lock_guard<std::mutex> lock(arenas_mutex);
+			arenas.clear();
+		}
+
+		for (GLsync& fence : fences)
+		{
+			if (fence)
+			{
+				glDeleteSync(fence);
+				fence = nullptr;
+			}
+		}
+
+		if (buffer)
+		{
+			if (mapped)
+			{
+				glBindBuffer(GL_ARRAY_BUFFER, buffer);
+				glUnmapBuffer(GL_ARRAY_BUFFER);
+				glBindBuffer(GL_ARRAY_BUFFER, 0);
+				Memory::track_free(MemoryTag::RenderBuffers, max_segments * sizeof(Segment) * frames_in_flight);
+				mapped = nullptr;
+			}
+			glDeleteBuffers(1, &buffer);
+			buffer = 0;
+		}
+
+		if (vao)
+		{
+			glDeleteVertexArrays(1, &vao);
+			vao = 0;
+		}
+
+		if (program)
+		{
+			glDeleteProgram(program);
+			program = 0;
+		}
+	}
+
+	void begin_frame(const Camera2D& camera)
+	{
+		pixel = 1.0f / camera.zoom;
+		view = camera.bounds();
+		camera.projection(projection);
+	}
+
+	void flush()
+	{
+		if (!mapped)
+		{
+			return;
+		}
+
+		if (fences[frame])
+		{
+			glClientWaitSync(fences[frame], GL_SYNC_FLUSH_COMMANDS_BIT, UINT64_MAX);
+			glDeleteSync(fences[frame]);
+			fences[frame] = nullptr;
+		}
+
+		Segment* section = mapped + frame * max_segments;
+		size_t count = 0;
+		{
+			std::lock_guard<std::mutex> lock(arenas_mutex);
+			for (const std::unique_ptr<Arena>& arena : arenas)
+			{
+				size_t amount = std::min(arena->segments.size(), max_segments - count);
+				std::memcpy(section + count, arena->segments.data(), amount * sizeof(Segment));
+				dropped += arena->segments.size() - amount;
+				count += amount;
+				arena->segments.clear();
+			}
+		}
+		last_count = count;
+
+		if (count > 0)
+		{
+			glUseProgram(program);
+			glUniform4fv(projection_location, 1, projection);
+			glEnable(GL_BLEND);
+			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+			glBindVertexArray(vao);
+			glDrawArraysInstancedBaseInstance(GL_TRIANGLE_STRIP, 0, 4, static_cast<GLsizei>(count), static_cast<GLuint>(frame * max_segments));
+			glBindVertexArray(0);
+		}
+
+		fences[frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		frame = (frame + 1) % frames_in_flight;
+	}
+
+	void line(float x0, float y0, float x1, float y1, uint32_t color, float width)
+	{
+		float world_width = width * pixel;
+		float pad = world_width * 0.5f;
+		if (std::max(x0, x1) + pad < view.min_x || std::min(x0, x1) - pad > view.max_x ||
+			std::max(y0, y1) + pad < view.min_y || std::min(y0, y1) - pad > view.max_y)
+		{
+			return;
+		}
+
+		Arena* arena = local_arena();
+		if (arena)
+		{
+			arena->segments.push_back({ x0, y0, x1, y1, world_width, color });
+		}
+	}
+
+	void box(const Rect& rect, uint32_t color, float width)
+	{
+		line(rect.min_x, rect.min_y, rect.max_x, rect.min_y, color, width);
+		line(rect.max_x, rect.min_y, rect.max_x, rect.max_y, color, width);
+		line(rect.max_x, rect.max_y, rect.min_x, rect.max_y, color, width);
+		line(rect.min_x, rect.max_y, rect.min_x, rect.min_y, color, width);
+	}
+
+	void circle(float x, float y, float radius, uint32_t color, float width)
+	{
+		if (x + radius < view.min_x || x - radius > view.max_x || y + radius < view.min_y || y - radius > view.max_y)
+		{
+			return;
+		}
+
+		// Roughly one segment per 4 screen pixels of circumference.
+		int steps = std::clamp(static_cast<int>(radius / pixel * 1.5f), 8, 64);
+		float step = 6.2831853f / steps;
+		float px = x + radius;
+		float py = y;
+		for (int i = 1; i <= steps; ++i)
+		{
+			float nx = x + radius * std::cos(step * i);
+			float ny = y + radius * std::sin(step * i);
+			line(px, py, nx, ny, color, width);
+			px = nx;
+			py = ny;
+		}
+	}
+
+	void text(float x, float y, std::string_view text, uint32_t color, float scale)
+	{
+		// Each vertical run of set font pixels becomes one segment as wide as a font pixel.
+		float size = scale * pixel;
+		float pen_x = x;
+		float pen_y = y;
+		for (char ch : text)
+		{
+			if (ch == '\n')
+			{
+				pen_x = x;
+				pen_y -= (bitmap_font_height + 2) * size;
+				continue;
+			}
+
+			const uint8_t* columns = bitmap_font_glyph(static_cast<unsigned char>(ch));
+			for (int column = 0; column < bitmap_font_width; ++column)
+			{
+				uint32_t bits = columns[column];
+				float cx = pen_x + (column + 0.5f) * size;
+				while (bits)
+				{
+					int first = std::countr_zero(bits);
+					int last = first + std::countr_one(bits >> first) - 1;
+					bits &= ~((2u << last) - (1u << first));
+
+					line(cx, pen_y - (first + 0.5f) * size, cx, pen_y - (last + 0.5f) * size, color, scale);
+				}
+			}
+			pen_x += (bitmap_font_width + 1) * size;
+		}
+	}
+
+	size_t segment_count()
+	{
+		return last_count;
+	}
+
+	size_t dropped_count()
+	{
+		return dropped;
+	}
+
+	size_t queued_count()
+	{
+		Arena* arena = local_arena();
+		return arena ? arena->segments.size() : 0;
+	}
+}
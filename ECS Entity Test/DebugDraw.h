@@ -0,0 +1,36 @@
+#pragma once
+
+#include "Camera.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Immediate-mode debug shapes, callable from any thread between begin_frame() and flush(). Each thread
+// appends to its own arena; flush() merges them into a persistently mapped buffer and draws everything
+// as instanced segments with one call. Widths are in screen pixels.
+namespace DebugDraw
+{
+	bool init(size_t max_segments_per_frame);
+	void shutdown();
+
+	// Main thread. Fixes the world size of a pixel for this frame's shapes.
+	void begin_frame(const Camera2D& camera);
+
+	// Main thread, once every thread has stopped drawing for the frame.
+	void flush();
+
+	void line(float x0, float y0, float x1, float y1, uint32_t color, float width = 1.0f);
+	void box(const Rect& rect, uint32_t color, float width = 1.0f);
+	void circle(float x, float y, float radius, uint32_t color, float width = 1.0f);
+
+	// Top-left at x, y, using the built-in bitmap font; scale is screen pixels per font pixel.
+	void text(float x, float y, std::string_view text, uint32_t color, float scale = 1.0f);
+
+	// Segments drawn by the last flush.
+	size_t segment_count();
+	size_t dropped_count();
+
+	// Segments the calling thread has queued since the last flush, so a caller can measure its share.
+	size_t queued_count();
+}
@@ -0,0 +1,379 @@
+#include "ECS.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+
+namespace
+{
+	ComponentInfo component_infos[max_components];
+	ComponentId component_count = 0;
+	std::mutex registry_mutex;
+
+	size_t align_up(size_t value, size_t alignment)
+	{
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+
+	// Columns start on cache lines so chunk data can be streamed with aligned SIMD loads.
+	constexpr size_t column_alignment = 64;
+
+	// Waking a worker and handing it a job costs a few microseconds, and claiming a grain one atomic add.
+	// A thread is only brought in for a share worth several wakeups, and a grain is sized to dwarf its add.
+	constexpr double min_share_ns = 50000.0;
+	constexpr double target_grain_ns = 20000.0;
+
+	// Grains stay small enough that each thread claims several, so a slow archetype doesn't leave one
+	// thread finishing alone.
+	constexpr size_t grains_per_thread = 4;
+
+	bool written_since(const Chunk& chunk, uint32_t tick)
+	{
+		return std::any_of(chunk.changed.begin(), chunk.changed.end(), [tick](uint32_t changed) { return changed > tick; });
+	}
+
+	size_t layout(const std::vector<ComponentId>& components, uint32_t capacity, std::vector<uint32_t>* offsets)
+	{
+		size_t offset = capacity * sizeof(Entity);
+		for (ComponentId id : components)
+		{
+			const ComponentInfo& info = component_infos[id];
+			offset = align_up(offset, info.align > column_alignment ? info.align : column_alignment);
+			if (offsets)
+			{
+				offsets->push_back(static_cast<uint32_t>(offset));
+			}
+			offset += capacity * info.size;
+		}
+		return offset;
+	}
+
+	// Chunk slabs come straight from the OS, so a failure here means the process is out of address
+	// space or memory; there is no smaller request to fall back to.
+	unsigned char* allocate_chunk(ChunkAllocator& allocator, unsigned node)
+	{
+		void* memory = allocator.allocate(node);
+		if (!memory)
+		{
+			std::cerr << "Out of memory allocating an ECS chunk (" << ChunkAllocator::chunk_size << " bytes, node " << node << ")\n";
+			std::abort();
+		}
+		return static_cast<unsigned char*>(memory);
+	}
+}
+
+ComponentId ECSDetail::register_component(size_t size, size_t align, const char* name)
+{
+	std::lock_guard<std::mutex> lock(registry_mutex);
+
+	if (component_count == max_components)
+	{
+		std::cerr << "Too many component types, " << name << " could not be registered\n";
+		std::abort();
+	}
+
+	component_infos[component_count] = { size, align, name };
+	return component_count++;
+}
+
+const ComponentInfo& component_info(ComponentId id)
+{
+	return component_infos[id];
+}
+
+World::World(ChunkAllocator& allocator, const JobSystem& jobs)
+	: allocator(allocator), jobs(jobs)
+{
+}
+
+World::~World()
+{
+	for (std::unique_ptr<Archetype>& archetype : archetype_list)
+	{
+		for (Chunk& chunk : archetype->chunks)
+		{
+			allocator.free(chunk.memory, chunk.node);
+		}
+	}
+}
+
+void World::destroy(Entity entity)
+{
+	if (!alive(entity))
+	{
+		return;
+	}
+
+	Record& record = records[entity.index];
+	remove_row(record.archetype, record.chunk, record.row);
+
+	record.archetype = nullptr;
+	++record.generation;
+	free_indices.push_back(entity.index);
+	--live_entities;
+}
+
+bool World::alive(Entity entity) const
+{
+	return entity.index < records.size()
+		&& records[entity.index].generation == entity.generation
+		&& records[entity.index].archetype != nullptr;
+}
+
+size_t World::chunk_count() const
+{
+	size_t total = 0;
+	for (const std::unique_ptr<Archetype>& archetype : archetype_list)
+	{
+		total += archetype->chunks.size();
+	}
+	return total;
+}
+
+void World::save(WorldSnapshot& snapshot)
+{
+	size_t total = chunk_count();
+	snapshot.chunks.resize(total);
+	if (snapshot.memory.size() < total * ChunkAllocator::chunk_size)
+	{
+		snapshot.memory.resize(total * ChunkAllocator::chunk_size);
+	}
+
+	snapshot.archetypes.resize(archetype_list.size());
+	snapshot.copied = 0;
+	uint32_t index = 0;
+	for (size_t a = 0; a < archetype_list.size(); ++a)
+	{
+		Archetype& archetype = *archetype_list[a];
+		snapshot.archetypes[a] = { index, static_cast<uint32_t>(archetype.chunks.size()), archetype.next_home };
+		for (const Chunk& chunk : archetype.chunks)
+		{
+			// A freed and reallocated chunk is stamped throughout, so a matching address alone is never trusted.
+			WorldSnapshot::SavedChunk& saved = snapshot.chunks[index];
+			if (saved.source != chunk.memory || saved.count != chunk.count || written_since(chunk, snapshot.tick))
+			{
+				std::memcpy(snapshot.memory.data() + size_t(index) * ChunkAllocator::chunk_size, chunk.memory, ChunkAllocator::chunk_size);
+				++snapshot.copied;
+			}
+			saved = { chunk.memory, chunk.count, chunk.home_worker, chunk.node };
+			++index;
+		}
+	}
+
+	snapshot.records.assign(records.begin(), records.end());
+	snapshot.free_indices.assign(free_indices.begin(), free_indices.end());
+	snapshot.live_entities = live_entities;
+	snapshot.tick = current_tick++;
+}
+
+void World::restore(const WorldSnapshot& snapshot)
+{
+	for (size_t a = 0; a < archetype_list.size(); ++a)
+	{
+		// Archetypes made since the save stay registered, just empty.
+		Archetype& archetype = *archetype_list[a];
+		WorldSnapshot::SavedArchetype saved = a < snapshot.archetypes.size() ? snapshot.archetypes[a] : WorldSnapshot::SavedArchetype{ 0, 0, archetype.next_home };
+		archetype.next_home = saved.next_home;
+
+		while (archetype.chunks.size() > saved.chunk_count)
+		{
+			allocator.free(archetype.chunks.back().memory, archetype.chunks.back().node);
+			archetype.chunks.pop_back();
+		}
+
+		for (uint32_t i = 0; i < saved.chunk_count; ++i)
+		{
+			const WorldSnapshot::SavedChunk& source = snapshot.chunks[saved.first_chunk + i];
+			if (i == archetype.chunks.size())
+			{
+				Chunk chunk;
+				chunk.archetype = &archetype;
+				chunk.home_worker = source.home_worker;
+				chunk.node = source.node;
+				chunk.memory = allocate_chunk(allocator, chunk.node);
+				chunk.changed.resize(archetype.components.size());
+				archetype.chunks.push_back(std::move(chunk));
+			}
+			else if (archetype.chunks[i].memory == source.source && archetype.chunks[i].count == source.count && !written_since(archetype.chunks[i], snapshot.tick))
+			{
+				continue;
+			}
+
+			Chunk& chunk = archetype.chunks[i];
+			std::memcpy(chunk.memory, snapshot.memory.data() + size_t(saved.first_chunk + i) * ChunkAllocator::chunk_size, ChunkAllocator::chunk_size);
+			chunk.count = source.count;
+			std::fill(chunk.changed.begin(), chunk.changed.end(), current_tick);
+		}
+	}
+
+	records.assign(snapshot.records.begin(), snapshot.records.end());
+	free_indices.assign(snapshot.free_indices.begin(), snapshot.free_indices.end());
+	live_entities = snapshot.live_entities;
+}
+
+Archetype* World::find_or_create(ComponentMask mask)
+{
+	auto found = archetype_map.find(mask);
+	if (found != archetype_map.end())
+	{
+		return found->second;
+	}
+
+	auto archetype = std::make_unique<Archetype>();
+	archetype->mask = mask;
+	std::fill(std::begin(archetype->slot_of), std::end(archetype->slot_of), int8_t(-1));
+
+	size_t bytes_per_entity = sizeof(Entity);
+	for (ComponentId id = 0; id < max_components; ++id)
+	{
+		if ((mask >> id) & 1)
+		{
+			archetype->slot_of[id] = static_cast<int8_t>(archetype->components.size());
+			archetype->components.push_back(id);
+			bytes_per_entity += component_infos[id].size;
+		}
+	}
+
+	uint32_t capacity = static_cast<uint32_t>(ChunkAllocator::chunk_size / bytes_per_entity);
+	while (capacity > 1 && layout(archetype->components, capacity, nullptr) > ChunkAllocator::chunk_size)
+	{
+		--capacity;
+	}
+
+	archetype->capacity = capacity;
+	layout(archetype->components, capacity, &archetype->offsets);
+
+	Archetype* result = archetype.get();
+	archetype_list.push_back(std::move(archetype));
+	archetype_map.emplace(mask, result);
+	return result;
+}
+
+Entity World::allocate_entity()
+{
+	Entity entity;
+	if (!free_indices.empty())
+	{
+		entity.index = free_indices.back();
+		free_indices.pop_back();
+	}
+	else
+	{
+		entity.index = static_cast<uint32_t>(records.size());
+		records.push_back({ nullptr, 0, 0, 0 });
+	}
+
+	entity.generation = records[entity.index].generation;
+	++live_entities;
+	return entity;
+}
+
+void World::insert(Entity entity, Archetype* archetype)
+{
+	if (archetype->chunks.empty() || archetype->chunks.back().count == archetype->capacity)
+	{
+		// New chunks are dealt to workers round-robin and placed on that worker's node. The owner never
+		// changes for the chunk's lifetime, which keeps its memory local to the thread that iterates it.
+		Chunk chunk;
+		chunk.archetype = archetype;
+		chunk.count = 0;
+		chunk.home_worker = archetype->next_home++ % jobs.worker_count();
+		chunk.node = jobs.worker_node(chunk.home_worker);
+		chunk.memory = allocate_chunk(allocator, chunk.node);
+		chunk.changed.resize(archetype->components.size());
+		archetype->chunks.push_back(std::move(chunk));
+	}
+
+	Chunk& chunk = archetype->chunks.back();
+	std::fill(chunk.changed.begin(), chunk.changed.end(), current_tick);
+	uint32_t row = chunk.count++;
+	chunk.entities()[row] = entity;
+
+	Record& record = records[entity.index];
+	record.archetype = archetype;
+	record.chunk = static_cast<uint32_t>(archetype->chunks.size() - 1);
+	record.row = row;
+}
+
+void World::remove_row(Archetype* archetype, uint32_t chunk_index, uint32_t row)
+{
+	Chunk& chunk = archetype->chunks[chunk_index];
+	Chunk& last = archetype->chunks.back();
+	uint32_t last_row = last.count - 1;
+	std::fill(chunk.changed.begin(), chunk.changed.end(), current_tick);
+	std::fill(last.changed.begin(), last.changed.end(), current_tick);
+
+	// Keep chunks packed by filling the hole with the archetype's final entity.
+	if (&chunk != &last || row != last_row)
+	{
+		Entity moved = last.entities()[last_row];
+		chunk.entities()[row] = moved;
+
+		for (size_t slot = 0; slot < archetype->components.size(); ++slot)
+		{
+			size_t size = component_infos[archetype->components[slot]].size;
+			std::memcpy(chunk.memory + archetype->offsets[slot] + row * size, last.memory + archetype->offsets[slot] + last_row * size, size);
+		}
+
+		records[moved.index].chunk = chunk_index;
+		records[moved.index].row = row;
+	}
+
+	if (--last.count == 0)
+	{
+		allocator.free(last.memory, last.node);
+		archetype->chunks.pop_back();
+	}
+}
+
+void World::move(Entity entity, Archetype* to)
+{
+	Record old = records[entity.index];
+	insert(entity, to);
+	const Record& record = records[entity.index];
+
+	const Chunk& from_chunk = old.archetype->chunks[old.chunk];
+	for (ComponentId id : to->components)
+	{
+		void* source = old.archetype->column(from_chunk, id);
+		if (source)
+		{
+			size_t size = component_infos[id].size;
+			std::memcpy(component(record, id), static_cast<unsigned char*>(source) + old.row * size, size);
+		}
+	}
+
+	remove_row(old.archetype, old.chunk, old.row);
+}
+
+void* World::component(const Record& record, ComponentId id) const
+{
+	const Chunk& chunk = record.archetype->chunks[record.chunk];
+	void* column = record.archetype->column(chunk, id);
+	return column ? static_cast<unsigned char*>(column) + record.row * component_infos[id].size : nullptr;
+}
+
+ParallelPlan ParallelTuning::plan(size_t chunk_count, unsigned threads) const
+{
+	size_t most = std::min<size_t>(threads, chunk_count);
+	double cost = chunk_ns.load(std::memory_order_relaxed);
+
+	// Nothing measured yet: spread as widely and finely as possible, and learn from that.
+	if (cost <= 0.0)
+	{
+		return { static_cast<unsigned>(most), 1 };
+	}
+
+	size_t participants = std::clamp<size_t>(static_cast<size_t>(cost * chunk_count / min_share_ns), 1, most);
+	size_t grain = std::clamp<size_t>(static_cast<size_t>(target_grain_ns / cost), 1, std::max<size_t>(chunk_count / (participants * grains_per_thread), 1));
+	return { static_cast<unsigned>(participants), grain };
+}
+
+void ParallelTuning::record(size_t chunk_count, double busy_ns)
+{
+	// Smoothed, so one frame that lost its core to another process doesn't swing the next split.
+	double sample = busy_ns / chunk_count;
+	double cost = chunk_ns.load(std::memory_order_relaxed);
+	chunk_ns.store(cost <= 0.0 ? sample : cost + (sample - cost) * 0.25, std::memory_order_relaxed);
+}
@@ -0,0 +1,539 @@
+#pragma once
+
+#include "ChunkAllocator.h"
+#include "JobSystem.h"
+#include "Memory.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+
+struct Entity
+{
+	uint32_t index = ~0u;
+	uint32_t generation = 0;
+
+	bool operator==(const Entity&) const = default;
+};
+
+using ComponentId = uint32_t;
+using ComponentMask = uint64_t;
+
+constexpr ComponentId max_components = 64;
+
+struct ComponentInfo
+{
+	size_t size;
+	size_t align;
+	const char* name;
+};
+
+namespace ECSDetail
+{
+	ComponentId register_component(size_t size, size_t align, const char* name);
+}
+
+const ComponentInfo& component_info(ComponentId id);
+
+// Components are moved between chunks with memcpy, so they must be plain data. A const type names the
+// same component; queries use it to mark a column they only read.
+template <typename T>
+ComponentId component_id()
+{
+	if constexpr (std::is_const_v<T>)
+	{
+		return component_id<std::remove_const_t<T>>();
+	}
+	else
+	{
+		static_assert(std::is_trivially_copyable_v<T> && std::is_trivially_destructible_v<T>, "Components must be trivially copyable");
+		static const ComponentId id = ECSDetail::register_component(sizeof(T), alignof(T), typeid(T).name());
+		return id;
+	}
+}
+
+template <typename... Ts>
+ComponentMask component_mask()
+{
+	return ((ComponentMask(1) << component_id<Ts>()) | ... | ComponentMask(0));
+}
+
+struct Archetype;
+
+struct Chunk
+{
+	Archetype* archetype;
+	unsigned char* memory;
+	uint32_t count;
+	uint32_t home_worker;
+	unsigned node;
+
+	// World tick each column was last written at, by slot. Adding or removing a row stamps them all.
+	std::vector<uint32_t> changed;
+
+	Entity* entities() const { return reinterpret_cast<Entity*>(memory); }
+
+	template <typename T>
+	T* column() const;
+};
+
+struct Archetype
+{
+	ComponentMask mask = 0;
+	std::vector<ComponentId> components;
+	std::vector<uint32_t> offsets;
+	int8_t slot_of[max_components];
+	uint32_t capacity = 0;
+	uint32_t next_home = 0;
+	std::vector<Chunk> chunks;
+
+	bool has(ComponentId id) const { return (mask >> id) & 1; }
+
+	void* column(const Chunk& chunk, ComponentId id) const
+	{
+		int8_t slot = slot_of[id];
+		return slot < 0 ? nullptr : chunk.memory + offsets[slot];
+	}
+
+	size_t entity_count() const
+	{
+		return chunks.empty() ? 0 : (chunks.size() - 1) * capacity + chunks.back().count;
+	}
+};
+
+template <typename T>
+T* Chunk::column() const
+{
+	return static_cast<T*>(archetype->column(*this, component_id<T>()));
+}
+
+class World;
+class WorldSnapshot;
+
+// How par_each splits a query: how many threads join in and how many chunks each takes per grab.
+struct ParallelPlan
+{
+	unsigned participants;
+	size_t grain;
+};
+
+// Measured cost of one chunk for one system. Small queries run on fewer threads than would cost more to
+// wake than the work is worth; grabs are sized so claiming one is cheap next to running it.
+struct ParallelTuning
+{
+	std::atomic<double> chunk_ns{ 0.0 };
+
+	ParallelPlan plan(size_t chunk_count, unsigned threads) const;
+	void record(size_t chunk_count, double busy_ns);
+};
+
+template <typename... Ts>
+class Query
+{
+public:
+	explicit Query(World& world);
+
+	// fn(Entity, Ts&...). Columns of non-const Ts are stamped as changed in every chunk visited, so
+	// query const T for components that are only read.
+	template <typename Fn>
+	void each(Fn&& fn);
+
+	// fn(const Chunk&, Ts*...)
+	template <typename Fn>
+	void each_chunk(Fn&& fn);
+
+	// Spreads chunks over the workers and the calling thread. Each thread starts on the chunks its worker
+	// owns, so most are processed from the same NUMA node every frame, then takes from the others once its
+	// own run out. fn(Entity, Ts&...) is called concurrently and must not change the world's structure.
+	// The split is tuned from the time this call site took before.
+	template <typename Fn>
+	void par_each(JobSystem& jobs, Fn&& fn);
+
+	// Same, with tuning kept by the caller.
+	template <typename Fn>
+	void par_each(JobSystem& jobs, ParallelTuning& tuning, Fn&& fn);
+
+	size_t count() const;
+
+private:
+	template <typename Fn>
+	static void run_chunk(const Chunk& chunk, Fn& fn);
+
+	void mark_written(Chunk& chunk) const;
+
+	std::vector<Archetype*> matches;
+	uint32_t tick;
+};
+
+class World
+{
+public:
+	World(ChunkAllocator& allocator, const JobSystem& jobs);
+	~World();
+
+	World(const World&) = delete;
+	World& operator=(const World&) = delete;
+
+	template <typename... Ts>
+	Entity create(const Ts&... values);
+
+	void destroy(Entity entity);
+	bool alive(Entity entity) const;
+
+	template <typename T>
+	T* get(Entity entity);
+
+	template <typename T>
+	bool has(Entity entity) const;
+
+	template <typename T>
+	void add(Entity entity, const T& value);
+
+	template <typename T>
+	void remove(Entity entity);
+
+	template <typename... Ts>
+	Query<Ts...> query() { return Query<Ts...>(*this); }
+
+	// Writes are stamped with the current tick. Advancing it starts a new interval, so a reader that
+	// remembers the tick it looked at can tell which columns were written since.
+	uint32_t tick() const { return current_tick; }
+	void advance_tick() { ++current_tick; }
+
+	size_t entity_count() const { return live_entities; }
+	size_t archetype_count() const { return archetype_list.size(); }
+	size_t chunk_count() const;
+
+	const std::vector<std::unique_ptr<Archetype>>& archetypes() const { return archetype_list; }
+
+	// Copies every chunk and entity record into snapshot, then advances the tick. Chunks the snapshot
+	// already holds and that haven't been written since it took them aren't copied again.
+	void save(WorldSnapshot& snapshot);
+
+	// Puts the world back as it was saved. Only chunks written since the save are copied back; they are
+	// stamped with the current tick, since to anyone watching the world they have just changed. Entity
+	// handles from before the save are valid again, ones created after it are not.
+	void restore(const WorldSnapshot& snapshot);
+
+private:
+	friend class WorldSnapshot;
+
+	struct Record
+	{
+		Archetype* archetype;
+		uint32_t chunk;
+		uint32_t row;
+		uint32_t generation;
+	};
+
+	Archetype* find_or_create(ComponentMask mask);
+	Entity allocate_entity();
+	void insert(Entity entity, Archetype* archetype);
+	void remove_row(Archetype* archetype, uint32_t chunk, uint32_t row);
+	void move(Entity entity, Archetype* to);
+	void* component(const Record& record, ComponentId id) const;
+
+	ChunkAllocator& allocator;
+	const JobSystem& jobs;
+
+	std::vector<Record, TaggedAllocator<Record, MemoryTag::ECSChunks>> records;
+	std::vector<uint32_t, TaggedAllocator<uint32_t, MemoryTag::ECSChunks>> free_indices;
+	std::vector<std::unique_ptr<Archetype>> archetype_list;
+	std::unordered_map<ComponentMask, Archetype*> archetype_map;
+	size_t live_entities = 0;
+	uint32_t current_tick = 1;
+};
+
+// Preallocated copy of a world. Keep one per frame that may be rolled back to and reuse it: once its
+// buffers have grown to fit the world, saving into it doesn't allocate.
+class WorldSnapshot
+{
+public:
+	size_t chunk_count() const { return chunks.size(); }
+	size_t memory_bytes() const { return memory.size(); }
+
+	// Chunks the last save actually copied.
+	size_t copied_chunks() const { return copied; }
+
+private:
+	friend class World;
+
+	struct SavedArchetype
+	{
+		uint32_t first_chunk;
+		uint32_t chunk_count;
+		uint32_t next_home;
+	};
+
+	struct SavedChunk
+	{
+		const unsigned char* source;
+		uint32_t count;
+		uint32_t home_worker;
+		unsigned node;
+	};
+
+	std::vector<SavedArchetype> archetypes;
+	std::vector<SavedChunk> chunks;
+
+	// Chunk i is copied whole to i * ChunkAllocator::chunk_size.
+	std::vector<unsigned char, TaggedAllocator<unsigned char, MemoryTag::Rollback>> memory;
+
+	std::vector<World::Record, TaggedAllocator<World::Record, MemoryTag::Rollback>> records;
+	std::vector<uint32_t, TaggedAllocator<uint32_t, MemoryTag::Rollback>> free_indices;
+	size_t live_entities = 0;
+	uint32_t tick = 0;
+	size_t copied = 0;
+};
+
+template <typename... Ts>
+Entity World::create(const Ts&... values)
+{
+	Entity entity = allocate_entity();
+	insert(entity, find_or_create(component_mask<Ts...>()));
+
+	const Record& record = records[entity.index];
+	((std::memcpy(component(record, component_id<Ts>()), &values, sizeof(Ts))), ...);
+	return entity;
+}
+
+template <typename T>
+T* World::get(Entity entity)
+{
+	if (!alive(entity))
+	{
+		return nullptr;
+	}
+
+	const Record& record = records[entity.index];
+	ComponentId id = component_id<T>();
+	int8_t slot = record.archetype->slot_of[id];
+	if constexpr (!std::is_const_v<T>)
+	{
+		if (slot >= 0)
+		{
+			record.archetype->chunks[record.chunk].changed[slot] = current_tick;
+		}
+	}
+	return static_cast<T*>(component(record, id));
+}
+
+template <typename T>
+bool World::has(Entity entity) const
+{
+	return alive(entity) && records[entity.index].archetype->has(component_id<T>());
+}
+
+template <typename T>
+void World::add(Entity entity, const T& value)
+{
+	if (!alive(entity))
+	{
+		return;
+	}
+
+	Record& record = records[entity.index];
+	ComponentId id = component_id<T>();
+	if (!record.archetype->has(id))
+	{
+		move(entity, find_or_create(record.archetype->mask | (ComponentMask(1) << id)));
+	}
+	std::memcpy(component(records[entity.index], id), &value, sizeof(T));
+}
+
+template <typename T>
+void World::remove(Entity entity)
+{
+	if (!alive(entity))
+	{
+		return;
+	}
+
+	ComponentId id = component_id<T>();
+	Archetype* from = records[entity.index].archetype;
+	if (from->has(id))
+	{
+		move(entity, find_or_create(from->mask & ~(ComponentMask(1) << id)));
+	}
+}
+
+template <typename... Ts>
+Query<Ts...>::Query(World& world)
+	: tick(world.tick())
+{
+	ComponentMask mask = component_mask<Ts...>();
+	for (const std::unique_ptr<Archetype>& archetype : world.archetypes())
+	{
+		if ((archetype->mask & mask) == mask)
+		{
+			matches.push_back(archetype.get());
+		}
+	}
+}
+
+template <typename... Ts>
+template <typename Fn>
+void Query<Ts...>::each(Fn&& fn)
+{
+	for (Archetype* archetype : matches)
+	{
+		for (Chunk& chunk : archetype->chunks)
+		{
+			mark_written(chunk);
+			run_chunk(chunk, fn);
+		}
+	}
+}
+
+template <typename... Ts>
+template <typename Fn>
+void Query<Ts...>::each_chunk(Fn&& fn)
+{
+	for (Archetype* archetype : matches)
+	{
+		for (Chunk& chunk : archetype->chunks)
+		{
+			mark_written(chunk);
+			fn(chunk, chunk.template column<Ts>()...);
+		}
+	}
+}
+
+template <typename... Ts>
+template <typename Fn>
+void Query<Ts...>::par_each(JobSystem& jobs, Fn&& fn)
+{
+	// A lambda has its own type, so every call site, and so every system, gets its own tuning.
+	static ParallelTuning tuning;
+	par_each(jobs, tuning, std::forward<Fn>(fn));
+}
+
+template <typename... Ts>
+template <typename Fn>
+void Query<Ts...>::par_each(JobSystem& jobs, ParallelTuning& tuning, Fn&& fn)
+{
+	using Clock = std::chrono::steady_clock;
+
+	struct alignas(64) HomeRange
+	{
+		size_t begin = 0;
+		size_t end = 0;
+		std::atomic<size_t> next{ 0 };
+	};
+
+	// Chunks grouped by home worker, each group claimed front to back a grain at a time.
+	unsigned worker_count = std::max(jobs.worker_count(), 1u);
+	std::vector<HomeRange> ranges(worker_count);
+	size_t chunk_count = 0;
+	for (Archetype* archetype : matches)
+	{
+		for (const Chunk& chunk : archetype->chunks)
+		{
+			++ranges[chunk.home_worker % worker_count].end;
+			++chunk_count;
+		}
+	}
+	if (chunk_count == 0)
+	{
+		return;
+	}
+
+	std::vector<Chunk*> chunks(chunk_count);
+	size_t offset = 0;
+	for (HomeRange& range : ranges)
+	{
+		range.begin = offset;
+		range.next.store(offset, std::memory_order_relaxed);
+		offset += range.end;
+		range.end = range.begin;
+	}
+	for (Archetype* archetype : matches)
+	{
+		for (Chunk& chunk : archetype->chunks)
+		{
+			chunks[ranges[chunk.home_worker % worker_count].end++] = &chunk;
+		}
+	}
+
+	ParallelPlan plan = tuning.plan(chunk_count, worker_count + 1);
+	std::atomic<int64_t> busy_ns{ 0 };
+	auto drain = [&](unsigned first)
+	{
+		// The main thread owns no chunks; it starts at the far end from the first worker.
+		first = first == JobSystem::not_a_worker ? worker_count - 1 : first;
+		Clock::time_point start = Clock::now();
+		for (unsigned i = 0; i < worker_count; ++i)
+		{
+			HomeRange& range = ranges[(first + i) % worker_count];
+			for (size_t begin; (begin = range.next.fetch_add(plan.grain, std::memory_order_relaxed)) < range.end;)
+			{
+				size_t end = std::min(begin + plan.grain, range.end);
+				for (size_t chunk = begin; chunk < end; ++chunk)
+				{
+					mark_written(*chunks[chunk]);
+					run_chunk(*chunks[chunk], fn);
+				}
+			}
+		}
+		busy_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count(), std::memory_order_relaxed);
+	};
+
+	// Helpers go to whichever workers are free rather than to fixed ones, so a worker still busy with
+	// something else doesn't hold the query up; the chunks it owns are taken by the others. Their counters
+	// go to the zone the query runs in.
+	const CpuZone* zone = CpuZone::active();
+	JobCounter counter;
+	for (unsigned helper = 1; helper < plan.participants; ++helper)
+	{
+		jobs.run(counter, [&drain, zone]()
+		{
+			ZoneCounters counters(zone);
+			drain(JobSystem::current_worker());
+		});
+	}
+
+	drain(JobSystem::current_worker());
+	jobs.wait(counter);
+
+	tuning.record(chunk_count, static_cast<double>(busy_ns.load(std::memory_order_relaxed)));
+}
+
+template <typename... Ts>
+void Query<Ts...>::mark_written(Chunk& chunk) const
+{
+	const Archetype& archetype = *chunk.archetype;
+	((std::is_const_v<Ts> ? void() : void(chunk.changed[archetype.slot_of[component_id<Ts>()]] = tick)), ...);
+}
+
+template <typename... Ts>
+size_t Query<Ts...>::count() const
+{
+	size_t total = 0;
+	for (Archetype* archetype : matches)
+	{
+		total += archetype->entity_count();
+	}
+	return total;
+}
+
+template <typename... Ts>
+template <typename Fn>
+void Query<Ts...>::run_chunk(const Chunk& chunk, Fn& fn)
+{
+	Entity* entities = chunk.entities();
+	auto columns = std::make_tuple(chunk.template column<Ts>()...);
+
+	for (uint32_t row = 0; row < chunk.count; ++row)
+	{
+		std::apply([&](Ts*... column) { fn(entities[row], column[row]...); }, columns);
+	}
+}
@@ -0,0 +1,390 @@
+#include "GpuParticleSystem.h"
+
+#include "Memory.h"
+#include "Shader.h"
+#include "TextureAtlas.h"
+
+#include <algorithm>
+#include <iostream>
+
+namespace
+{
+	// Control buffer, in uints: [0..2] dispatch arguments for the simulate pass, [3] live particles in
+	// the source buffer, [4..7] the indirect draw command, [8..9] one append counter per particle buffer.
+	constexpr GLsizeiptr control_bytes = 10 * sizeof(GLuint);
+	constexpr GLintptr draw_offset = 4 * sizeof(GLuint);
+	constexpr GLintptr counter_offset = 8 * sizeof(GLuint);
+	constexpr GLsizeiptr particle_bytes = 6 * sizeof(float);
+	constexpr GLuint group_size = 256;
+
+	const char* control_source = R"(#version 450 core
+layout(local_size_x = 1) in;
+
+layout(std430, binding = 2) buffer Control
+{
+	uint dispatch[3];
+	uint live;
+	uint draw[4];
+	uint counters[2];
+};
+
+// x: 0 prepares a simulate pass from buffer y, 1 publishes buffer y to the draw. z: capacity.
+uniform uvec3 u_control;
+
+void main()
+{
+	uint side = u_control.y;
+	uint count = min(counters[side], u_control.z);
+	if (u_control.x == 0u)
+	{
+		live = count;
+		dispatch[0] = (count + 255u) / 256u;
+		dispatch[1] = 1u;
+		dispatch[2] = 1u;
+		counters[1u - side] = 0u;
+	}
+	else
+	{
+		counters[side] = count;
+		draw[0] = 4u;
+		draw[1] = count;
+		draw[2] = 0u;
+		draw[3] = 0u;
+	}
+}
+)";
+
+	const char* simulate_source = R"(#version 450 core
+layout(local_size_x = 256) in;
+
+struct Particle
+{
+	vec2 position;
+	vec2 velocity;
+	float age;
+	float lifetime;
+};
+
+layout(std430, binding = 0) readonly buffer Source { Particle source[]; };
+layout(std430, binding = 1) writeonly buffer Destination { Particle destination[]; };
+layout(std430, binding = 2) readonly buffer Control { uint dispatch[3]; uint live; };
+layout(binding = 0, offset = 0) uniform atomic_uint u_alive;
+
+uniform float u_dt;
+uniform float u_gravity;
+
+void main()
+{
+	uint id = gl_GlobalInvocationID.x;
+	if (id >= live)
+	{
+		return;
+	}
+
+	Particle p = source[id];
+	p.age += u_dt;
+	if (p.age >= p.lifetime)
+	{
+		return;
+	}
+
+	p.velocity.y += u_gravity * u_dt;
+	p.position += p.velocity * u_dt;
+	destination[atomicCounterIncrement(u_alive)] = p;
+}
+)";
+
+	const char* emit_source = R"(#version 450 core
+layout(local_size_x = 256) in;
+
+struct Particle
+{
+	vec2 position;
+	vec2 velocity;
+	float age;
+	float lifetime;
+};
+
+layout(std430, binding = 1) writeonly buffer Destination { Particle destination[]; };
+layout(binding = 0, offset = 0) uniform atomic_uint u_alive;
+
+uniform uint u_count;
+uniform uint u_seed;
+uniform vec2 u_origin;
+uniform vec4 u_velocity;
+uniform float u_lifetime;
+
+uint hash(uint x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+float unit(inout uint state)
+{
+	state = hash(state);
+	return float(state >> 8) * (1.0 / 16777216.0);
+}
+
+void main()
+{
+	uint id = gl_GlobalInvocationID.x;
+	if (id >= u_count)
+	{
+		return;
+	}
+
+	// The counter may run past the end when the pool is full; the control pass clamps it afterwards.
+	uint slot = atomicCounterIncrement(u_alive);
+	if (slot >= uint(destination.length()))
+	{
+		return;
+	}
+
+	uint state = u_seed ^ (id * 0x9e3779b9u);
+	float angle = u_velocity.x + (unit(state) - 0.5) * u_velocity.y;
+	float speed = mix(u_velocity.z, u_velocity.w, unit(state));
+
+	Particle p;
+	p.position = u_origin;
+	p.velocity = vec2(cos(angle), sin(angle)) * speed;
+	p.age = 0.0;
+	p.lifetime = u_lifetime * (0.75 + 0.5 * unit(state));
+	destination[slot] = p;
+}
+)";
+
+	const char* vertex_source = R"(#version 450 core
+struct Particle
+{
+	vec2 position;
+	vec2 velocity;
+	float age;
+	float lifetime;
+};
+
+layout(std430, binding = 0) readonly buffer Particles { Particle particles[]; };
+
+uniform vec4 u_projection;
+uniform vec4 u_uv;
+uniform vec4 u_style;
+
+out vec3 v_uv;
+out float v_fade;
+
+void main()
+{
+	Particle p = particles[gl_InstanceID];
+	vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+	vec2 world = p.position + (corner - 0.5) * u_style.x;
+
+	gl_Position = vec4(world * u_projection.xy + u_projection.zw, 0.0, 1.0);
+	v_uv = vec3(mix(u_uv.x, u_uv.z, corner.x), mix(u_uv.w, u_uv.y, corner.y), u_style.y);
+	v_fade = 1.0 - min(p.age / p.lifetime, 1.0);
+}
+)";
+
+	const char* fragment_source = R"(#version 450 core
+in vec3 v_uv;
+in float v_fade;
+
+uniform sampler2DArray u_atlas;
+uniform vec4 u_color;
+
+out vec4 out_color;
+
+void main()
+{
+	out_color = texture(u_atlas, v_uv) * vec4(u_color.rgb, u_color.a * v_fade);
+}
+)";
+
+	GLuint create_compute(const char* source)
+	{
+		GLenum type = GL_COMPUTE_SHADER;
+		return create_program(&type, &source, 1);
+	}
+}
+
+GpuParticleSystem::~GpuParticleSystem()
+{
+	shutdown();
+}
+
+bool GpuParticleSystem::init(size_t capacity)
+{
+	control_program = create_compute(control_source);
+	simulate_program = create_compute(simulate_source);
+	emit_program = create_compute(emit_source);
+	draw_program = create_program(vertex_source, fragment_source);
+	if (!control_program || !simulate_program || !emit_program || !draw_program)
+	{
+		std::cerr << "Failed to build GPU particle programs\n";
+		shutdown();
+		return false;
+	}
+
+	control_mode_location = glGetUniformLocation(control_program, "u_control");
+	simulate_dt_location = glGetUniformLocation(simulate_program, "u_dt");
+	simulate_gravity_location = glGetUniformLocation(simulate_program, "u_gravity");
+	emit_count_location = glGetUniformLocation(emit_program, "u_count");
+	emit_seed_location = glGetUniformLocation(emit_program, "u_seed");
+	emit_origin_location = glGetUniformLocation(emit_program, "u_origin");
+	emit_velocity_location = glGetUniformLocation(emit_program, "u_velocity");
+	emit_lifetime_location = glGetUniformLocation(emit_program, "u_lifetime");
+	draw_projection_location = glGetUniformLocation(draw_program, "u_projection");
+	draw_uv_location = glGetUniformLocation(draw_program, "u_uv");
+	draw_style_location = glGetUniformLocation(draw_program, "u_style");
+	draw_color_location = glGetUniformLocation(draw_program, "u_color");
+	glUseProgram(draw_program);
+	glUniform1i(glGetUniformLocation(draw_program, "u_atlas"), 0);
+	glUseProgram(0);
+
+	max_particles = capacity;
+	glCreateBuffers(2, particles);
+	for (GLuint buffer : particles)
+	{
+		glNamedBufferStorage(buffer, static_cast<GLsizeiptr>(capacity) * particle_bytes, nullptr, 0);
+	}
+
+	GLuint initial[10] = { 0, 1, 1, 0, 4, 0, 0, 0, 0, 0 };
+	glCreateBuffers(1, &control);
+	glNamedBufferStorage(control, control_bytes, initial, 0);
+	Memory::track_alloc(MemoryTag::RenderBuffers, 2 * capacity * particle_bytes + control_bytes);
+
+	// Quads are generated from gl_VertexID, but core profile still wants a VAO bound to draw.
+	glCreateVertexArrays(1, &vao);
+	return true;
+}
+
+void GpuParticleSystem::shutdown()
+{
+	if (control)
+	{
+		glDeleteBuffers(2, particles);
+		glDeleteBuffers(1, &control);
+		Memory::track_free(MemoryTag::RenderBuffers, 2 * max_particles * particle_bytes + control_bytes);
+		particles[0] = particles[1] = 0;
+		control = 0;
+	}
+
+	if (vao)
+	{
+		glDeleteVertexArrays(1, &vao);
+		vao = 0;
+	}
+
+	for (GLuint* program : { &control_program, &simulate_program, &emit_program, &draw_program })
+	{
+		if (*program)
+		{
+			glDeleteProgram(*program);
+			*program = 0;
+		}
+	}
+}
+
+void GpuParticleSystem::burst(uint32_t count)
+{
+	pending += static_cast<float>(count);
+}
+
+void GpuParticleSystem::update(float dt)
+{
+	if (!control)
+	{
+		return;
+	}
+
+	int destination = 1 - source;
+	GLuint capacity = static_cast<GLuint>(max_particles);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, particles[source]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, particles[destination]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, control);
+	glBindBufferRange(GL_ATOMIC_COUNTER_BUFFER, 0, control, counter_offset + destination * sizeof(GLuint), sizeof(GLuint));
+
+	glUseProgram(control_program);
+	glUniform3ui(control_mode_location, 0, static_cast<GLuint>(source), capacity);
+	glDispatchCompute(1, 1, 1);
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT | GL_ATOMIC_COUNTER_BARRIER_BIT);
+
+	glUseProgram(simulate_program);
+	glUniform1f(simulate_dt_location, dt);
+	glUniform1f(simulate_gravity_location, emitter.gravity);
+	glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, control);
+	glDispatchComputeIndirect(0);
+	glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+
+	pending += emitter.rate * dt;
+	GLuint count = static_cast<GLuint>(std::min(pending, static_cast<float>(capacity)));
+	pending -= static_cast<float>(count);
+	if (count > 0)
+	{
+		glMemoryBarrier(GL_ATOMIC_COUNTER_BARRIER_BIT);
+		glUseProgram(emit_program);
+		glUniform1ui(emit_count_location, count);
+		glUniform1ui(emit_seed_location, ++seed * 0x85ebca6bu);
+		glUniform2f(emit_origin_location, emitter.x, emitter.y);
+		glUniform4f(emit_velocity_location, emitter.direction, emitter.spread, emitter.speed_min, emitter.speed_max);
+		glUniform1f(emit_lifetime_location, emitter.lifetime);
+		glDispatchCompute((count + group_size - 1) / group_size, 1, 1);
+	}
+
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_ATOMIC_COUNTER_BARRIER_BIT);
+	glUseProgram(control_program);
+	glUniform3ui(control_mode_location, 1, static_cast<GLuint>(destination), capacity);
+	glDispatchCompute(1, 1, 1);
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+	glUseProgram(0);
+	source = destination;
+}
+
+void GpuParticleSystem::render(const Camera2D& camera, const TextureAtlas& atlas)
+{
+	if (!control || emitter.region >= atlas.region_count())
+	{
+		return;
+	}
+
+	float projection[4];
+	camera.projection(projection);
+	const AtlasRegion& region = atlas.region(emitter.region);
+	uint32_t c = emitter.color;
+
+	glUseProgram(draw_program);
+	glUniform4fv(draw_projection_location, 1, projection);
+	glUniform4f(draw_uv_location, region.u0, region.v0, region.u1, region.v1);
+	glUniform4f(draw_style_location, emitter.size, static_cast<float>(region.layer), 0.0f, 0.0f);
+	glUniform4f(draw_color_location, (c & 0xff) / 255.0f, ((c >> 8) & 0xff) / 255.0f, ((c >> 16) & 0xff) / 255.0f, (c >> 24) / 255.0f);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, atlas.texture());
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+	// update() left the newest particles in the source buffer.
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, particles[source]);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, control);
+	glBindVertexArray(vao);
+	glDrawArraysIndirect(GL_TRIANGLE_STRIP, reinterpret_cast<const void*>(draw_offset));
+	glBindVertexArray(0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	glUseProgram(0);
+}
+
+uint32_t GpuParticleSystem::particle_count() const
+{
+	if (!control)
+	{
+		return 0;
+	}
+
+	GLuint count = 0;
+	glGetNamedBufferSubData(control, counter_offset + source * sizeof(GLuint), sizeof(GLuint), &count);
+	return count;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "Camera.h"
+#include "ParticleSystem.h"
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstdint>
+
+class TextureAtlas;
+
+// One emitter simulated entirely on the GPU. Particles ping-pong between two SSBOs: a compute pass
+// integrates the source buffer and appends survivors to the destination through an atomic counter,
+// new particles are appended after them, and the counter becomes the instance count of an indirect draw.
+// The CPU never learns how many particles are alive unless particle_count() is called.
+class GpuParticleSystem
+{
+public:
+	~GpuParticleSystem();
+
+	bool init(size_t capacity);
+	void shutdown();
+
+	// Changes take effect on the next update.
+	EmitterDesc& desc() { return emitter; }
+
+	void burst(uint32_t count);
+
+	void update(float dt);
+	void render(const Camera2D& camera, const TextureAtlas& atlas);
+
+	// Reads the live count back from the GPU, which waits for all queued work. For tools and benchmarks.
+	uint32_t particle_count() const;
+	size_t capacity() const { return max_particles; }
+
+private:
+	GLuint control_program = 0;
+	GLuint simulate_program = 0;
+	GLuint emit_program = 0;
+	GLuint draw_program = 0;
+
+	GLuint particles[2] = {};
+	GLuint control = 0;
+	GLuint vao = 0;
+
+	GLint control_mode_location = -1;
+	GLint simulate_dt_location = -1;
+	GLint simulate_gravity_location = -1;
+	GLint emit_count_location = -1;
+	GLint emit_seed_location = -1;
+	GLint emit_origin_location = -1;
+	GLint emit_velocity_location = -1;
+	GLint emit_lifetime_location = -1;
+	GLint draw_projection_location = -1;
+	GLint draw_uv_location = -1;
+	GLint draw_style_location = -1;
+	GLint draw_color_location = -1;
+
+	EmitterDesc emitter;
+	size_t max_particles = 0;
+	float pending = 0.0f;
+	uint32_t seed = 0;
+	int source = 0;
+};
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// FNV-1a. Used for cache keys, not for anything security related.
+constexpr uint64_t fnv1a_seed = 14695981039346656037ull;
+
+inline uint64_t fnv1a_bytes(const void* data, size_t size, uint64_t hash = fnv1a_seed)
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+inline uint64_t fnv1a(std::string_view text, uint64_t hash = fnv1a_seed)
+{
+	return fnv1a_bytes(text.data(), text.size(), hash);
+}
@@ -0,0 +1,126 @@
+#include "InputRecording.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace
+{
+	constexpr uint32_t recording_version = 1;
+
+	struct RecordingHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint32_t config_size;
+		uint32_t input_count;
+		uint64_t end_step;
+		uint64_t checksum;
+	};
+}
+
+void InputRecording::start(const StressConfig& config)
+{
+	scene = config;
+	inputs.clear();
+	last_step = 0;
+	final_checksum = 0;
+	cursor = 0;
+}
+
+void InputRecording::add(uint64_t step, uint64_t timestamp, uint32_t key)
+{
+	inputs.push_back({ step, timestamp, key, 0 });
+}
+
+void InputRecording::finish(uint64_t end_step, uint64_t checksum)
+{
+	last_step = end_step;
+	final_checksum = checksum;
+}
+
+bool InputRecording::save(const std::string& path) const
+{
+	std::error_code error;
+	std::filesystem::path parent = std::filesystem::path(path).parent_path();
+	if (!parent.empty())
+	{
+		std::filesystem::create_directories(parent, error);
+	}
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		std::cerr << "Failed to write input recording " << path << "\n";
+		return false;
+	}
+
+	RecordingHeader header = {};
+	std::memcpy(header.magic, "INPT", 4);
+	header.version = recording_version;
+	header.config_size = sizeof(StressConfig);
+	header.input_count = static_cast<uint32_t>(inputs.size());
+	header.end_step = last_step;
+	header.checksum = final_checksum;
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(&scene), sizeof(scene));
+	file.write(reinterpret_cast<const char*>(inputs.data()), inputs.size() * sizeof(RecordedInput));
+	return static_cast<bool>(file);
+}
+
+bool InputRecording::load(const std::string& path)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+	{
+		std::cerr << "Failed to open input recording " << path << "\n";
+		return false;
+	}
+
+	// The config is stored as raw bytes, so a recording only loads into the build layout that wrote it.
+	RecordingHeader header = {};
+	file.read(reinterpret_cast<char*>(&header), sizeof(header));
+	if (!file || std::memcmp(header.magic, "INPT", 4) != 0 || header.version != recording_version || header.config_size != sizeof(StressConfig))
+	{
+		std::cerr << "Input recording " << path << " is not valid for this build\n";
+		return false;
+	}
+
+	StressConfig config;
+	std::vector<RecordedInput> recorded(header.input_count);
+	file.read(reinterpret_cast<char*>(&config), sizeof(config));
+	file.read(reinterpret_cast<char*>(recorded.data()), recorded.size() * sizeof(RecordedInput));
+	if (!file)
+	{
+		std::cerr << "Input recording " << path << " is truncated\n";
+		return false;
+	}
+
+	scene = config;
+	inputs = std::move(recorded);
+	last_step = header.end_step;
+	final_checksum = header.checksum;
+	cursor = 0;
+	return true;
+}
+
+bool parse_replay_argument(int argc, char* argv[], int& i, ReplayOptions& options)
+{
+	if (i + 1 >= argc)
+	{
+		return false;
+	}
+
+	if (std::strcmp(argv[i], "--record") == 0)
+	{
+		options.record_path = argv[++i];
+		return true;
+	}
+	if (std::strcmp(argv[i], "--replay") == 0)
+	{
+		options.replay_path = argv[++i];
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "StressScene.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct RecordedInput
+{
+	uint64_t step;
+	uint64_t timestamp;
+	uint32_t key;
+	uint32_t reserved;
+};
+
+// Key presses tagged with the fixed step they were applied before, plus the scene config (and so the
+// seed) the run started from. Applying the same keys before the same steps reproduces the run exactly.
+class InputRecording
+{
+public:
+	void start(const StressConfig& config);
+	void add(uint64_t step, uint64_t timestamp, uint32_t key);
+	void finish(uint64_t end_step, uint64_t checksum);
+
+	bool save(const std::string& path) const;
+	bool load(const std::string& path);
+
+	const StressConfig& config() const { return scene; }
+	uint64_t end_step() const { return last_step; }
+	uint64_t checksum() const { return final_checksum; }
+	size_t input_count() const { return inputs.size(); }
+
+	// Calls fn(key) for every input recorded before step that hasn't been replayed yet.
+	template <typename Fn>
+	void replay(uint64_t step, Fn&& fn);
+
+	// Starts replay() from the first input again.
+	void rewind() { cursor = 0; }
+
+private:
+	StressConfig scene;
+	std::vector<RecordedInput> inputs;
+	uint64_t last_step = 0;
+	uint64_t final_checksum = 0;
+	size_t cursor = 0;
+};
+
+template <typename Fn>
+void InputRecording::replay(uint64_t step, Fn&& fn)
+{
+	while (cursor < inputs.size() && inputs[cursor].step <= step)
+	{
+		fn(inputs[cursor++].key);
+	}
+}
+
+struct ReplayOptions
+{
+	std::string record_path;
+	std::string replay_path;
+};
+
+// Consumes argv[i] and its value when it is --record PATH or --replay PATH.
+bool parse_replay_argument(int argc, char* argv[], int& i, ReplayOptions& options);
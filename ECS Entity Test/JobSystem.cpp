@@ -0,0 +1,629 @@
+#include "JobSystem.h"
+
+#include "Profiler.h"
+
+#include <iostream>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <fstream>
+#include <pthread.h>
+#include <sched.h>
+#include <sstream>
+#include <string>
+#endif
+
+#if !defined(_WIN32)
+#include <ucontext.h>
+#endif
+
+namespace
+{
+	// Windows has native fibers. Elsewhere ucontext does the switching; swapcontext also saves the signal
+	// mask, which costs a syscall per switch, but switches only happen when a job actually has to wait.
+	struct FiberContext
+	{
+#if defined(_WIN32)
+		void* handle = nullptr;
+		bool owns_handle = false;
+#else
+		ucontext_t context;
+		std::unique_ptr<char[]> stack;
+#endif
+		void (*entry)(void*) = nullptr;
+		void* argument = nullptr;
+
+		FiberContext() = default;
+		FiberContext(const FiberContext&) = delete;
+		FiberContext& operator=(const FiberContext&) = delete;
+
+		~FiberContext()
+		{
+#if defined(_WIN32)
+			if (owns_handle)
+			{
+				DeleteFiber(handle);
+			}
+#endif
+		}
+	};
+
+#if defined(_WIN32)
+	VOID CALLBACK fiber_start(LPVOID parameter)
+	{
+		FiberContext* context = static_cast<FiberContext*>(parameter);
+		context->entry(context->argument);
+	}
+#else
+	thread_local FiberContext* starting_context = nullptr;
+
+	void fiber_start()
+	{
+		FiberContext* context = starting_context;
+		context->entry(context->argument);
+	}
+#endif
+
+	// Lets the calling thread switch to fibers and back; context then stands for the thread's own stack.
+	void adopt_thread(FiberContext& context)
+	{
+#if defined(_WIN32)
+		context.handle = ConvertThreadToFiber(nullptr);
+#else
+		(void)context;
+#endif
+	}
+
+	void release_thread()
+	{
+#if defined(_WIN32)
+		ConvertFiberToThread();
+#endif
+	}
+
+	bool create_fiber(FiberContext& context, size_t stack_size, void (*entry)(void*), void* argument)
+	{
+		context.entry = entry;
+		context.argument = argument;
+#if defined(_WIN32)
+		context.handle = CreateFiber(stack_size, fiber_start, &context);
+		context.owns_handle = context.handle != nullptr;
+		return context.handle != nullptr;
+#else
+		if (getcontext(&context.context) != 0)
+		{
+			return false;
+		}
+		context.stack = std::make_unique<char[]>(stack_size);
+		context.context.uc_stack.ss_sp = context.stack.get();
+		context.context.uc_stack.ss_size = stack_size;
+		context.context.uc_link = nullptr;
+		makecontext(&context.context, fiber_start, 0);
+		return true;
+#endif
+	}
+
+	void switch_fiber(FiberContext& from, FiberContext& to)
+	{
+#if defined(_WIN32)
+		(void)from;
+		SwitchToFiber(to.handle);
+#else
+		starting_context = &to;
+		swapcontext(&from.context, &to.context);
+#endif
+	}
+}
+
+struct JobSystem::Fiber
+{
+	FiberContext context;
+	JobSystem* owner = nullptr;
+	Job job;
+
+	// The worker that handed this fiber its job. A pooled fiber moves between workers from job to job,
+	// so it is passed here rather than read back from thread-local storage after a switch.
+	unsigned worker = JobSystem::not_a_worker;
+	bool finished = false;
+};
+
+thread_local JobSystem::Fiber* JobSystem::running_fiber = nullptr;
+
+namespace
+{
+	thread_local unsigned current_worker_index = JobSystem::not_a_worker;
+
+	constexpr size_t fiber_stack_size = 256 * 1024;
+
+	// Past this many fibers a worker runs jobs on its own stack again, and waits there fall back to helping.
+	constexpr size_t max_fibers = 256;
+
+#if defined(__linux__)
+	// Parses a sysfs range list such as "0-3,8,10-11".
+	void parse_id_list(const std::string& list, std::vector<unsigned>& ids)
+	{
+		std::stringstream ranges(list);
+		std::string range;
+		while (std::getline(ranges, range, ','))
+		{
+			if (range.empty())
+			{
+				continue;
+			}
+
+			size_t dash = range.find('-');
+			unsigned first = static_cast<unsigned>(std::stoul(range.substr(0, dash)));
+			unsigned last = dash == std::string::npos ? first : static_cast<unsigned>(std::stoul(range.substr(dash + 1)));
+			for (unsigned id = first; id <= last; ++id)
+			{
+				ids.push_back(id);
+			}
+		}
+	}
+
+	bool read_id_list(const std::string& path, std::vector<unsigned>& ids)
+	{
+		std::ifstream file(path);
+		if (!file)
+		{
+			return false;
+		}
+
+		std::string list;
+		std::getline(file, list);
+		parse_id_list(list, ids);
+		return true;
+	}
+#endif
+}
+
+CpuTopology CpuTopology::query()
+{
+	CpuTopology result;
+	result.node_count = 0;
+
+#if defined(_WIN32)
+	ULONG highest_node = 0;
+	if (GetNumaHighestNodeNumber(&highest_node))
+	{
+		result.node_ids.clear();
+		for (ULONG node = 0; node <= highest_node; ++node)
+		{
+			GROUP_AFFINITY affinity = {};
+			if (!GetNumaNodeProcessorMaskEx(static_cast<USHORT>(node), &affinity) || affinity.Mask == 0)
+			{
+				continue;
+			}
+
+			for (unsigned bit = 0; bit < sizeof(KAFFINITY) * 8; ++bit)
+			{
+				if (affinity.Mask & (KAFFINITY(1) << bit))
+				{
+					result.cores.push_back({ bit, result.node_count, affinity.Group });
+				}
+			}
+			result.node_ids.push_back(node);
+			++result.node_count;
+		}
+	}
+#elif defined(__linux__)
+	// Node ids can be sparse (offlined or CPU-less memory nodes), so walk the online list rather than
+	// counting up from node0, and keep only cpus this process may actually run on.
+	std::vector<unsigned> nodes;
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	bool have_affinity = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+	if (read_id_list("/sys/devices/system/node/online", nodes))
+	{
+		result.node_ids.clear();
+		for (unsigned node : nodes)
+		{
+			std::vector<unsigned> cpus;
+			if (!read_id_list("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist", cpus))
+			{
+				continue;
+			}
+
+			bool any = false;
+			for (unsigned cpu : cpus)
+			{
+				if (have_affinity && (cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed)))
+				{
+					continue;
+				}
+				result.cores.push_back({ cpu, result.node_count, 0 });
+				any = true;
+			}
+
+			if (any)
+			{
+				result.node_ids.push_back(node);
+				++result.node_count;
+			}
+		}
+	}
+#endif
+
+	if (result.cores.empty())
+	{
+		unsigned count = std::thread::hardware_concurrency();
+		for (unsigned i = 0; i < (count ? count : 1); ++i)
+		{
+			result.cores.push_back({ i, 0, 0 });
+		}
+		result.node_count = 1;
+		result.node_ids.assign(1, 0);
+	}
+
+	return result;
+}
+
+JobSystem::JobSystem(unsigned worker_count)
+	: cpu(CpuTopology::query())
+{
+	unsigned core_count = static_cast<unsigned>(cpu.cores.size());
+	if (worker_count == 0)
+	{
+		worker_count = core_count > 1 ? core_count - 1 : 1;
+	}
+
+	// Deal cores out node by node so a partial worker set still spreads across every socket.
+	std::vector<std::vector<unsigned>> node_cores(cpu.node_count);
+	for (unsigned i = 0; i < core_count; ++i)
+	{
+		node_cores[cpu.cores[i].node].push_back(i);
+	}
+
+	std::vector<unsigned> order;
+	for (size_t depth = 0; order.size() < core_count; ++depth)
+	{
+		for (const std::vector<unsigned>& cores : node_cores)
+		{
+			if (depth < cores.size())
+			{
+				order.push_back(cores[depth]);
+			}
+		}
+	}
+
+	for (unsigned i = 0; i < worker_count; ++i)
+	{
+		auto worker = std::make_unique<Worker>();
+		worker->scheduler = std::make_unique<Fiber>();
+		worker->core = order[i % core_count];
+		worker->node = cpu.cores[worker->core].node;
+		workers.push_back(std::move(worker));
+	}
+
+	for (unsigned i = 0; i < worker_count; ++i)
+	{
+		workers[i]->thread = std::thread(&JobSystem::worker_main, this, i);
+		pin(*workers[i]);
+	}
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+
+	for (std::unique_ptr<Worker>& worker : workers)
+	{
+		worker->thread.join();
+	}
+}
+
+void JobSystem::run(JobCounter& counter, Job job)
+{
+	counter.value.fetch_add(1, std::memory_order_relaxed);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		shared.push_back([this, job = std::move(job), &counter]()
+		{
+			job();
+			finish(counter);
+		});
+	}
+	wake.notify_one();
+}
+
+void JobSystem::run_on(unsigned worker, JobCounter& counter, Job job)
+{
+	counter.value.fetch_add(1, std::memory_order_relaxed);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		workers[worker % workers.size()]->queue.push_back([this, job = std::move(job), &counter]()
+		{
+			job();
+			finish(counter);
+		});
+	}
+	wake.notify_all();
+}
+
+void JobSystem::wait(JobCounter& counter)
+{
+	if (counter.value.load(std::memory_order_acquire) == 0)
+	{
+		return;
+	}
+
+	unsigned self = current_worker_index;
+	Fiber* fiber = running_fiber;
+
+	// Whatever this thread runs until the counter clears belongs to other jobs, not to the waiter's zones.
+	CpuZone* zones = Profiler::suspend_zones();
+
+	if (fiber && self != not_a_worker)
+	{
+		while (counter.value.load(std::memory_order_acquire) > 0)
+		{
+			// Checked again under the lock: finish() takes it before resuming waiters, so the wakeup can't be missed.
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (counter.value.load(std::memory_order_acquire) == 0)
+				{
+					break;
+				}
+				parked.push_back({ &counter, fiber, self });
+			}
+			switch_fiber(fiber->context, workers[self]->scheduler->context);
+		}
+	}
+	else
+	{
+		// A worker gets here running a job on its own stack. Fibers it parked earlier only ever resume on
+		// it, and the counter may be waiting on one of them, so they are run from here as they wake.
+		while (counter.value.load(std::memory_order_acquire) > 0)
+		{
+			Job job;
+			if (Fiber* ready = self != not_a_worker ? pop_ready(self) : nullptr)
+			{
+				resume(*workers[self], ready);
+			}
+			else if (pop(self, job))
+			{
+				job();
+			}
+			else
+			{
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	Profiler::resume_zones(zones);
+}
+
+unsigned JobSystem::current_worker()
+{
+	return current_worker_index;
+}
+
+size_t JobSystem::fiber_count()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return fibers.size();
+}
+
+void JobSystem::finish(JobCounter& counter)
+{
+	if (counter.value.fetch_sub(1, std::memory_order_acq_rel) != 1)
+	{
+		return;
+	}
+
+	// Only the address is compared; the counter may already be gone if its waiter wasn't parked.
+	bool resumed = false;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (size_t i = 0; i < parked.size();)
+		{
+			if (parked[i].counter == &counter)
+			{
+				workers[parked[i].worker]->ready.push_back(parked[i].fiber);
+				parked[i] = parked.back();
+				parked.pop_back();
+				resumed = true;
+			}
+			else
+			{
+				++i;
+			}
+		}
+	}
+
+	if (resumed)
+	{
+		wake.notify_all();
+	}
+}
+
+// Called with the lock held.
+JobSystem::Fiber* JobSystem::acquire_fiber()
+{
+	if (!idle_fibers.empty())
+	{
+		Fiber* fiber = idle_fibers.back();
+		idle_fibers.pop_back();
+		return fiber;
+	}
+
+	if (fibers.size() >= max_fibers)
+	{
+		return nullptr;
+	}
+
+	auto fiber = std::make_unique<Fiber>();
+	fiber->owner = this;
+	if (!create_fiber(fiber->context, fiber_stack_size, &JobSystem::run_fiber, fiber.get()))
+	{
+		return nullptr;
+	}
+	fibers.push_back(std::move(fiber));
+	return fibers.back().get();
+}
+
+void JobSystem::run_fiber(void* fiber)
+{
+	Fiber* self = static_cast<Fiber*>(fiber);
+	self->owner->fiber_main(*self);
+}
+
+// A fiber runs one job per switch from the scheduler, then hands control back. It never returns.
+void JobSystem::fiber_main(Fiber& fiber)
+{
+	while (true)
+	{
+		fiber.job();
+		fiber.job = nullptr;
+		fiber.finished = true;
+		switch_fiber(fiber.context, workers[fiber.worker]->scheduler->context);
+	}
+}
+
+JobSystem::Fiber* JobSystem::pop_ready(unsigned worker)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	std::deque<Fiber*>& ready = workers[worker]->ready;
+	if (ready.empty())
+	{
+		return nullptr;
+	}
+
+	Fiber* fiber = ready.front();
+	ready.pop_front();
+	return fiber;
+}
+
+bool JobSystem::pop(unsigned worker, Job& job)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (worker != not_a_worker && !workers[worker]->queue.empty())
+	{
+		job = std::move(workers[worker]->queue.front());
+		workers[worker]->queue.pop_front();
+		return true;
+	}
+
+	if (!shared.empty())
+	{
+		job = std::move(shared.front());
+		shared.pop_front();
+		return true;
+	}
+
+	return false;
+}
+
+void JobSystem::worker_main(unsigned index)
+{
+	current_worker_index = index;
+	Worker& self = *workers[index];
+	adopt_thread(self.scheduler->context);
+
+	while (true)
+	{
+		Job job;
+		Fiber* fiber = nullptr;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [&]() { return stopping || !self.ready.empty() || !self.queue.empty() || !shared.empty(); });
+
+			// Resumed waits go first; they usually sit on the critical path of whoever is waiting on them.
+			if (!self.ready.empty())
+			{
+				fiber = self.ready.front();
+				self.ready.pop_front();
+			}
+			else if (!self.queue.empty())
+			{
+				job = std::move(self.queue.front());
+				self.queue.pop_front();
+			}
+			else if (!shared.empty())
+			{
+				job = std::move(shared.front());
+				shared.pop_front();
+			}
+			else if (stopping)
+			{
+				break;
+			}
+
+			if (!fiber)
+			{
+				fiber = acquire_fiber();
+			}
+		}
+
+		if (!fiber)
+		{
+			job();
+			continue;
+		}
+
+		if (job)
+		{
+			fiber->job = std::move(job);
+			fiber->worker = index;
+			fiber->finished = false;
+		}
+
+		resume(self, fiber);
+	}
+
+	release_thread();
+}
+
+// Runs fiber from the worker's own stack until it finishes its job or parks again.
+void JobSystem::resume(Worker& worker, Fiber* fiber)
+{
+	running_fiber = fiber;
+	switch_fiber(worker.scheduler->context, fiber->context);
+	running_fiber = nullptr;
+
+	// A fiber that isn't finished has parked itself and is owned by the parked list now.
+	if (fiber->finished)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		idle_fibers.push_back(fiber);
+	}
+}
+
+void JobSystem::pin(Worker& worker)
+{
+	const CpuTopology::Core& core = cpu.cores[worker.core];
+
+#if defined(_WIN32)
+	GROUP_AFFINITY affinity = {};
+	affinity.Group = core.group;
+	affinity.Mask = KAFFINITY(1) << core.id;
+	if (!SetThreadGroupAffinity(worker.thread.native_handle(), &affinity, nullptr))
+	{
+		std::cerr << "Failed to pin worker to core " << core.id << "\n";
+	}
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(core.id, &set);
+	if (pthread_setaffinity_np(worker.thread.native_handle(), sizeof(set), &set) != 0)
+	{
+		std::cerr << "Failed to pin worker to core " << core.id << "\n";
+	}
+#else
+	(void)core;
+#endif
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct CpuTopology
+{
+	struct Core
+	{
+		unsigned id;
+		unsigned node;
+		uint16_t group;
+	};
+
+	std::vector<Core> cores;
+	unsigned node_count = 1;
+	// OS node number for each compact node index. Nodes without usable cores are skipped, so these
+	// can be sparse; anything handed to the OS (mbind, VirtualAllocExNuma) must go through here.
+	std::vector<unsigned> node_ids{ 0 };
+
+	static CpuTopology query();
+};
+
+struct JobCounter
+{
+	std::atomic<int> value{ 0 };
+};
+
+using Job = std::function<void()>;
+
+class JobSystem
+{
+public:
+	static constexpr unsigned not_a_worker = ~0u;
+
+	// worker_count of 0 uses one worker per logical core, leaving one for the main thread.
+	explicit JobSystem(unsigned worker_count = 0);
+	~JobSystem();
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	unsigned worker_count() const { return static_cast<unsigned>(workers.size()); }
+	unsigned worker_node(unsigned worker) const { return workers[worker]->node; }
+	const CpuTopology& topology() const { return cpu; }
+
+	// Runs on whichever worker is free first.
+	void run(JobCounter& counter, Job job);
+
+	// Runs only on the given worker so the data it touches stays on that worker's node.
+	void run_on(unsigned worker, JobCounter& counter, Job job);
+
+	// Waits until every job added to the counter has finished. A job on a worker parks its fiber and the
+	// worker picks up other jobs until the counter reaches zero; it then resumes on the same worker. The main
+	// thread, or a worker whose fiber pool is used up, runs shared jobs itself meanwhile; the worker also
+	// resumes its own parked fibers as they become ready, since no other thread can.
+	void wait(JobCounter& counter);
+
+	static unsigned current_worker();
+
+	// Fibers created so far. They are pooled and only grow while jobs are parked.
+	size_t fiber_count();
+
+private:
+	struct Fiber;
+
+	struct Worker
+	{
+		std::thread thread;
+		std::deque<Job> queue;
+		std::deque<Fiber*> ready;
+		std::unique_ptr<Fiber> scheduler;
+		unsigned core = 0;
+		unsigned node = 0;
+	};
+
+	struct ParkedFiber
+	{
+		const JobCounter* counter;
+		Fiber* fiber;
+		unsigned worker;
+	};
+
+	void worker_main(unsigned index);
+	void fiber_main(Fiber& fiber);
+	static void run_fiber(void* fiber);
+	Fiber* acquire_fiber();
+	void resume(Worker& worker, Fiber* fiber);
+	void finish(JobCounter& counter);
+	bool pop(unsigned worker, Job& job);
+	Fiber* pop_ready(unsigned worker);
+	void pin(Worker& worker);
+
+	static thread_local Fiber* running_fiber;
+
+	CpuTopology cpu;
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::deque<Job> shared;
+	std::vector<std::unique_ptr<Fiber>> fibers;
+	std::vector<Fiber*> idle_fibers;
+	std::vector<ParkedFiber> parked;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping = false;
+};
@@ -0,0 +1,198 @@
+#include "Memory.h"
+
+#include <atomic>
+#include <iomanip>
+#include <iostream>
+#include <new>
+
+namespace
+{
+	struct TagCounters
+	{
+		std::atomic<size_t> live{ 0 };
+		std::atomic<size_t> peak{ 0 };
+		std::atomic<size_t> budget{ 0 };
+		std::atomic<uint64_t> allocations{ 0 };
+		std::atomic<uint64_t> frees{ 0 };
+		std::atomic<bool> over_budget{ false };
+	};
+
+	TagCounters counters[static_cast<size_t>(MemoryTag::Count)];
+
+	const char* tag_names[static_cast<size_t>(MemoryTag::Count)] =
+	{
+		"ECS Chunks",
+		"Render Buffers",
+		"Physics",
+		"Particles",
+		"Assets",
+		"Coroutines",
+		"Audio",
+		"Rollback",
+		"Transient"
+	};
+
+	void on_alloc(MemoryTag tag, size_t size)
+	{
+		TagCounters& c = counters[static_cast<size_t>(tag)];
+		size_t live = c.live.fetch_add(size, std::memory_order_relaxed) + size;
+		c.allocations.fetch_add(1, std::memory_order_relaxed);
+
+		size_t peak = c.peak.load(std::memory_order_relaxed);
+		while (live > peak && !c.peak.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+		{
+		}
+
+		size_t budget = c.budget.load(std::memory_order_relaxed);
+		if (budget != 0 && live > budget && !c.over_budget.exchange(true, std::memory_order_relaxed))
+		{
+			std::cerr << "Memory budget exceeded for " << tag_names[static_cast<size_t>(tag)]
+				<< ": " << live << " / " << budget << " bytes\n";
+		}
+	}
+
+	void on_free(MemoryTag tag, size_t size)
+	{
+		TagCounters& c = counters[static_cast<size_t>(tag)];
+		size_t live = c.live.fetch_sub(size, std::memory_order_relaxed) - size;
+		c.frees.fetch_add(1, std::memory_order_relaxed);
+
+		// Re-arm the alarm once usage drops back under budget.
+		size_t budget = c.budget.load(std::memory_order_relaxed);
+		if (budget == 0 || live <= budget)
+		{
+			c.over_budget.store(false, std::memory_order_relaxed);
+		}
+	}
+}
+
+void* Memory::allocate(MemoryTag tag, size_t size, size_t alignment)
+{
+	void* ptr = ::operator new(size, std::align_val_t(alignment));
+	on_alloc(tag, size);
+	return ptr;
+}
+
+void Memory::deallocate(MemoryTag tag, void* ptr, size_t size, size_t alignment)
+{
+	if (!ptr)
+	{
+		return;
+	}
+
+	::operator delete(ptr, std::align_val_t(alignment));
+	on_free(tag, size);
+}
+
+void Memory::track_alloc(MemoryTag tag, size_t size)
+{
+	on_alloc(tag, size);
+}
+
+void Memory::track_free(MemoryTag tag, size_t size)
+{
+	on_free(tag, size);
+}
+
+void Memory::set_budget(MemoryTag tag, size_t bytes)
+{
+	counters[static_cast<size_t>(tag)].budget.store(bytes, std::memory_order_relaxed);
+}
+
+MemoryStats Memory::stats(MemoryTag tag)
+{
+	const TagCounters& c = counters[static_cast<size_t>(tag)];
+
+	MemoryStats result;
+	result.live_bytes = c.live.load(std::memory_order_relaxed);
+	result.peak_bytes = c.peak.load(std::memory_order_relaxed);
+	result.budget_bytes = c.budget.load(std::memory_order_relaxed);
+	result.allocations = c.allocations.load(std::memory_order_relaxed);
+	result.frees = c.frees.load(std::memory_order_relaxed);
+	return result;
+}
+
+const char* Memory::tag_name(MemoryTag tag)
+{
+	return tag_names[static_cast<size_t>(tag)];
+}
+
+void Memory::dump(std::ostream& out)
+{
+	constexpr double kib = 1024.0;
+
+	out << "---- Memory ----\n";
+	out << std::left << std::setw(16) << "Tag"
+		<< std::right << std::setw(12) << "Live KiB"
+		<< std::setw(12) << "Peak KiB"
+		<< std::setw(12) << "Budget KiB"
+		<< std::setw(10) << "Allocs"
+		<< std::setw(10) << "Frees" << "\n";
+
+	size_t total_live = 0;
+	size_t total_peak = 0;
+
+	for (size_t i = 0; i < static_cast<size_t>(MemoryTag::Count); ++i)
+	{
+		MemoryStats s = stats(static_cast<MemoryTag>(i));
+		total_live += s.live_bytes;
+		total_peak += s.peak_bytes;
+
+		out << std::left << std::setw(16) << tag_names[i]
+			<< std::right << std::fixed << std::setprecision(1)
+			<< std::setw(12) << s.live_bytes / kib
+			<< std::setw(12) << s.peak_bytes / kib;
+
+		if (s.budget_bytes != 0)
+		{
+			out << std::setw(12) << s.budget_bytes / kib;
+		}
+		else
+		{
+			out << std::setw(12) << "-";
+		}
+
+		out << std::setw(10) << s.allocations
+			<< std::setw(10) << s.frees
+			<< (s.budget_bytes != 0 && s.live_bytes > s.budget_bytes ? "  OVER BUDGET" : "") << "\n";
+	}
+
+	out << std::left << std::setw(16) << "Total"
+		<< std::right << std::setw(12) << total_live / kib
+		<< std::setw(12) << total_peak / kib << "\n";
+	out.unsetf(std::ios::floatfield);
+}
+
+LinearArena::LinearArena(size_t capacity, MemoryTag tag)
+	: tag(tag), size(capacity)
+{
+	base = static_cast<unsigned char*>(Memory::allocate(tag, capacity, 64));
+}
+
+LinearArena::~LinearArena()
+{
+	Memory::deallocate(tag, base, size, 64);
+}
+
+void* LinearArena::allocate(size_t bytes, size_t alignment)
+{
+	size_t aligned = (offset + alignment - 1) & ~(alignment - 1);
+	if (aligned + bytes > size)
+	{
+		std::cerr << "LinearArena (" << Memory::tag_name(tag) << ") out of space: requested "
+			<< bytes << " bytes with " << size - offset << " remaining\n";
+		return nullptr;
+	}
+
+	offset = aligned + bytes;
+	if (offset > peak)
+	{
+		peak = offset;
+	}
+	return base + aligned;
+}
+
+void LinearArena::reset()
+{
+	offset = 0;
+}
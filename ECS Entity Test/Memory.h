@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+
+enum class MemoryTag : uint8_t
+{
+	ECSChunks,
+	RenderBuffers,
+	Physics,
+	Particles,
+	Assets,
+	Coroutines,
+	Audio,
+	Rollback,
+	Transient,
+	Count
+};
+
+struct MemoryStats
+{
+	size_t live_bytes;
+	size_t peak_bytes;
+	size_t budget_bytes;
+	uint64_t allocations;
+	uint64_t frees;
+};
+
+namespace Memory
+{
+	void* allocate(MemoryTag tag, size_t size, size_t alignment = alignof(std::max_align_t));
+	void deallocate(MemoryTag tag, void* ptr, size_t size, size_t alignment = alignof(std::max_align_t));
+
+	// For memory that lives outside our heap (GL buffers, textures) but still counts against a tag.
+	void track_alloc(MemoryTag tag, size_t size);
+	void track_free(MemoryTag tag, size_t size);
+
+	// A budget of 0 disables the alarm for that tag.
+	void set_budget(MemoryTag tag, size_t bytes);
+
+	MemoryStats stats(MemoryTag tag);
+	const char* tag_name(MemoryTag tag);
+	void dump(std::ostream& out);
+}
+
+template <typename T, MemoryTag Tag>
+struct TaggedAllocator
+{
+	using value_type = T;
+
+	TaggedAllocator() = default;
+
+	template <typename U>
+	TaggedAllocator(const TaggedAllocator<U, Tag>&) {}
+
+	T* allocate(size_t count)
+	{
+		return static_cast<T*>(Memory::allocate(Tag, count * sizeof(T), alignof(T)));
+	}
+
+	void deallocate(T* ptr, size_t count)
+	{
+		Memory::deallocate(Tag, ptr, count * sizeof(T), alignof(T));
+	}
+
+	template <typename U>
+	struct rebind
+	{
+		using other = TaggedAllocator<U, Tag>;
+	};
+
+	bool operator==(const TaggedAllocator&) const { return true; }
+	bool operator!=(const TaggedAllocator&) const { return false; }
+};
+
+// Bump allocator for per-frame scratch data. reset() releases everything at once.
+class LinearArena
+{
+public:
+	explicit LinearArena(size_t capacity, MemoryTag tag = MemoryTag::Transient);
+	~LinearArena();
+
+	LinearArena(const LinearArena&) = delete;
+	LinearArena& operator=(const LinearArena&) = delete;
+
+	void* allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+	template <typename T>
+	T* allocate_array(size_t count)
+	{
+		return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+	}
+
+	void reset();
+
+	size_t used() const { return offset; }
+	size_t capacity() const { return size; }
+	size_t high_water() const { return peak; }
+
+private:
+	MemoryTag tag;
+	unsigned char* base = nullptr;
+	size_t size = 0;
+	size_t offset = 0;
+	size_t peak = 0;
+};
@@ -0,0 +1,285 @@
+#include "Net.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+#if defined(_WIN32)
+	using SocketHandle = SOCKET;
+	using SocketLength = int;
+
+	bool start_sockets()
+	{
+		static bool started = []()
+		{
+			WSADATA data;
+			return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+		}();
+		return started;
+	}
+
+	void close_socket(SocketHandle socket) { closesocket(socket); }
+	bool peer_gone() { return WSAGetLastError() == WSAECONNRESET; }
+#else
+	using SocketHandle = int;
+	using SocketLength = socklen_t;
+
+	bool start_sockets() { return true; }
+	void close_socket(SocketHandle socket) { ::close(socket); }
+	bool peer_gone() { return errno == ECONNREFUSED; }
+#endif
+
+	// Enough for a burst of snapshot parts to queue up between two reads.
+	constexpr int socket_buffer_bytes = 4 * 1024 * 1024;
+
+	sockaddr_in to_sockaddr(const NetAddress& address)
+	{
+		sockaddr_in result = {};
+		result.sin_family = AF_INET;
+		result.sin_addr.s_addr = htonl(address.host);
+		result.sin_port = htons(address.port);
+		return result;
+	}
+
+	SocketHandle native(uintptr_t handle)
+	{
+		return static_cast<SocketHandle>(handle);
+	}
+}
+
+bool parse_address(const std::string& text, NetAddress& address)
+{
+	size_t colon = text.rfind(':');
+	if (colon == std::string::npos)
+	{
+		return false;
+	}
+
+	std::string host = text.substr(0, colon);
+	int port = std::atoi(text.c_str() + colon + 1);
+	if (port <= 0 || port > 65535)
+	{
+		return false;
+	}
+
+	if (host == "localhost")
+	{
+		host = "127.0.0.1";
+	}
+	in_addr parsed = {};
+	if (inet_pton(AF_INET, host.c_str(), &parsed) != 1)
+	{
+		return false;
+	}
+
+	address.host = ntohl(parsed.s_addr);
+	address.port = static_cast<uint16_t>(port);
+	return true;
+}
+
+UdpSocket::~UdpSocket()
+{
+	close();
+}
+
+bool UdpSocket::open(uint16_t port)
+{
+	close();
+	if (!start_sockets())
+	{
+		std::cerr << "Failed to start networking\n";
+		return false;
+	}
+
+	SocketHandle socket_handle = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+#if defined(_WIN32)
+	if (socket_handle == INVALID_SOCKET)
+#else
+	if (socket_handle < 0)
+#endif
+	{
+		std::cerr << "Failed to create UDP socket\n";
+		return false;
+	}
+
+	sockaddr_in local = to_sockaddr({ INADDR_ANY, port });
+	if (bind(socket_handle, reinterpret_cast<const sockaddr*>(&local), sizeof(local)) != 0)
+	{
+		std::cerr << "Failed to bind UDP port " << port << "\n";
+		close_socket(socket_handle);
+		return false;
+	}
+
+	int buffer = socket_buffer_bytes;
+	setsockopt(socket_handle, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<const char*>(&buffer), sizeof(buffer));
+	setsockopt(socket_handle, SOL_SOCKET, SO_SNDBUF, reinterpret_cast<const char*>(&buffer), sizeof(buffer));
+
+#if defined(_WIN32)
+	u_long non_blocking = 1;
+	ioctlsocket(socket_handle, FIONBIO, &non_blocking);
+#else
+	fcntl(socket_handle, F_SETFL, fcntl(socket_handle, F_GETFL, 0) | O_NONBLOCK);
+#endif
+
+	handle = static_cast<uintptr_t>(socket_handle);
+	sent = 0;
+	received = 0;
+	return true;
+}
+
+void UdpSocket::close()
+{
+	if (is_open())
+	{
+		close_socket(native(handle));
+		handle = invalid_handle;
+	}
+}
+
+uint16_t UdpSocket::local_port() const
+{
+	sockaddr_in local = {};
+	SocketLength length = sizeof(local);
+	if (!is_open() || getsockname(native(handle), reinterpret_cast<sockaddr*>(&local), &length) != 0)
+	{
+		return 0;
+	}
+	return ntohs(local.sin_port);
+}
+
+bool UdpSocket::send(const NetAddress& to, const void* data, size_t size)
+{
+	sockaddr_in target = to_sockaddr(to);
+	int result = sendto(native(handle), static_cast<const char*>(data), static_cast<int>(size), 0, reinterpret_cast<const sockaddr*>(&target), sizeof(target));
+	if (result < 0)
+	{
+		return false;
+	}
+	sent += size;
+	return true;
+}
+
+size_t UdpSocket::receive(NetAddress& from, void* data, size_t capacity)
+{
+	// A peer's port closing is reported on a later read; it says nothing about the datagrams behind it.
+	for (;;)
+	{
+		sockaddr_in source = {};
+		SocketLength length = sizeof(source);
+		int result = recvfrom(native(handle), static_cast<char*>(data), static_cast<int>(capacity), 0, reinterpret_cast<sockaddr*>(&source), &length);
+		if (result < 0 && peer_gone())
+		{
+			continue;
+		}
+		if (result <= 0)
+		{
+			return 0;
+		}
+
+		from.host = ntohl(source.sin_addr.s_addr);
+		from.port = ntohs(source.sin_port);
+		received += static_cast<uint64_t>(result);
+		return static_cast<size_t>(result);
+	}
+}
+
+void NetWriter::u16(uint16_t value)
+{
+	out.push_back(static_cast<uint8_t>(value));
+	out.push_back(static_cast<uint8_t>(value >> 8));
+}
+
+void NetWriter::u32(uint32_t value)
+{
+	for (int shift = 0; shift < 32; shift += 8)
+	{
+		out.push_back(static_cast<uint8_t>(value >> shift));
+	}
+}
+
+void NetWriter::f32(float value)
+{
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	u32(bits);
+}
+
+void NetWriter::varint(uint64_t value)
+{
+	while (value >= 0x80)
+	{
+		out.push_back(static_cast<uint8_t>(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back(static_cast<uint8_t>(value));
+}
+
+uint8_t NetReader::u8()
+{
+	if (position >= size)
+	{
+		failed = true;
+		return 0;
+	}
+	return data[position++];
+}
+
+uint16_t NetReader::u16()
+{
+	uint16_t low = u8();
+	return static_cast<uint16_t>(low | (u8() << 8));
+}
+
+uint32_t NetReader::u32()
+{
+	uint32_t value = 0;
+	for (int shift = 0; shift < 32; shift += 8)
+	{
+		value |= static_cast<uint32_t>(u8()) << shift;
+	}
+	return value;
+}
+
+float NetReader::f32()
+{
+	uint32_t bits = u32();
+	float value;
+	std::memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+uint64_t NetReader::varint()
+{
+	uint64_t value = 0;
+	for (int shift = 0; shift < 64; shift += 7)
+	{
+		uint8_t byte = u8();
+		value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+		{
+			return value;
+		}
+	}
+	failed = true;
+	return 0;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct NetAddress
+{
+	// IPv4, host byte order.
+	uint32_t host = 0;
+	uint16_t port = 0;
+
+	bool operator==(const NetAddress&) const = default;
+};
+
+// Parses "a.b.c.d:port" or "localhost:port".
+bool parse_address(const std::string& text, NetAddress& address);
+
+// Non-blocking IPv4 UDP socket.
+class UdpSocket
+{
+public:
+	UdpSocket() = default;
+	~UdpSocket();
+
+	UdpSocket(const UdpSocket&) = delete;
+	UdpSocket& operator=(const UdpSocket&) = delete;
+
+	// Port 0 takes any free port.
+	bool open(uint16_t port);
+	void close();
+	bool is_open() const { return handle != invalid_handle; }
+	uint16_t local_port() const;
+
+	bool send(const NetAddress& to, const void* data, size_t size);
+
+	// Returns the datagram's size, or 0 when nothing is waiting.
+	size_t receive(NetAddress& from, void* data, size_t capacity);
+
+	uint64_t bytes_sent() const { return sent; }
+	uint64_t bytes_received() const { return received; }
+
+private:
+	static constexpr uintptr_t invalid_handle = ~uintptr_t(0);
+
+	uintptr_t handle = invalid_handle;
+	uint64_t sent = 0;
+	uint64_t received = 0;
+};
+
+// Packet fields: fixed-width little-endian integers and LEB128 varints, zigzagged when signed.
+class NetWriter
+{
+public:
+	explicit NetWriter(std::vector<uint8_t>& out) : out(out) {}
+
+	void u8(uint8_t value) { out.push_back(value); }
+	void u16(uint16_t value);
+	void u32(uint32_t value);
+	void f32(float value);
+	void varint(uint64_t value);
+	void zigzag(int64_t value) { varint((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63)); }
+
+	size_t size() const { return out.size(); }
+
+private:
+	std::vector<uint8_t>& out;
+};
+
+// Reading past the end yields zeros and clears ok(), so a packet is checked once after decoding it.
+class NetReader
+{
+public:
+	NetReader(const uint8_t* data, size_t size) : data(data), size(size) {}
+
+	uint8_t u8();
+	uint16_t u16();
+	uint32_t u32();
+	float f32();
+	uint64_t varint();
+	int64_t zigzag()
+	{
+		uint64_t value = varint();
+		return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+	}
+
+	bool ok() const { return !failed; }
+	bool done() const { return position == size; }
+	const uint8_t* rest() const { return data + position; }
+	size_t remaining() const { return size - position; }
+
+private:
+	const uint8_t* data;
+	size_t size;
+	size_t position = 0;
+	bool failed = false;
+};
@@ -0,0 +1,411 @@
+#include "ParticleSystem.h"
+
+#include "JobSystem.h"
+#include "Memory.h"
+#include "Profiler.h"
+#include "SpriteRenderer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define PARTICLES_SSE 1
+#include <xmmintrin.h>
+#endif
+
+namespace
+{
+	constexpr size_t stream_count = 6;
+	constexpr size_t block_bytes = ParticleSystem::block_capacity * sizeof(float) * stream_count;
+
+	float next_unit(uint32_t& state)
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return static_cast<float>(state >> 8) * (1.0f / 16777216.0f);
+	}
+}
+
+ParticleSystem::ParticleSystem(JobSystem& jobs)
+	: jobs(jobs)
+{
+}
+
+ParticleSystem::~ParticleSystem()
+{
+	for (Emitter& emitter : emitters)
+	{
+		free_blocks(emitter);
+	}
+}
+
+uint32_t ParticleSystem::create_emitter(const EmitterDesc& desc, size_t max_particles)
+{
+	uint32_t index = 0;
+	while (index < emitters.size() && emitters[index].alive)
+	{
+		++index;
+	}
+	if (index == emitters.size())
+	{
+		emitters.emplace_back();
+	}
+
+	Emitter& emitter = emitters[index];
+	emitter.desc = desc;
+	emitter.max_particles = max_particles;
+	emitter.live = 0;
+	emitter.pending = 0.0f;
+	emitter.rng = 0x9e3779b9u * (index + 1);
+	emitter.alive = true;
+	return index;
+}
+
+void ParticleSystem::destroy_emitter(uint32_t index)
+{
+	if (index >= emitters.size() || !emitters[index].alive)
+	{
+		return;
+	}
+
+	free_blocks(emitters[index]);
+	emitters[index].alive = false;
+}
+
+void ParticleSystem::free_blocks(Emitter& emitter)
+{
+	for (Block& block : emitter.blocks)
+	{
+		Memory::deallocate(MemoryTag::Particles, block.x, block_bytes, 64);
+	}
+	emitter.blocks.clear();
+	emitter.live = 0;
+}
+
+void ParticleSystem::burst(uint32_t index, uint32_t count)
+{
+	if (index < emitters.size() && emitters[index].alive)
+	{
+		emitters[index].pending += static_cast<float>(count);
+	}
+}
+
+void ParticleSystem::spawn(Emitter& emitter, size_t count)
+{
+	const EmitterDesc& d = emitter.desc;
+	count = std::min(count, emitter.max_particles - emitter.live);
+
+	// Earlier blocks are topped up first, so a new block is only needed when every block is full.
+	size_t block_index = 0;
+	while (count > 0)
+	{
+		while (block_index < emitter.blocks.size() && emitter.blocks[block_index].count == block_capacity)
+		{
+			++block_index;
+		}
+
+		if (block_index == emitter.blocks.size())
+		{
+			allocate_block(emitter);
+		}
+
+		Block& block = emitter.blocks[block_index];
+		uint32_t amount = static_cast<uint32_t>(std::min<size_t>(count, block_capacity - block.count));
+		for (uint32_t i = block.count; i < block.count + amount; ++i)
+		{
+			float angle = d.direction + (next_unit(emitter.rng) - 0.5f) * d.spread;
+			float speed = d.speed_min + (d.speed_max - d.speed_min) * next_unit(emitter.rng);
+			block.x[i] = d.x;
+			block.y[i] = d.y;
+			block.vx[i] = std::cos(angle) * speed;
+			block.vy[i] = std::sin(angle) * speed;
+			block.age[i] = 0.0f;
+			block.lifetime[i] = d.lifetime * (0.75f + 0.5f * next_unit(emitter.rng));
+		}
+
+		block.count += amount;
+		emitter.live += amount;
+		count -= amount;
+	}
+}
+
+void ParticleSystem::allocate_block(Emitter& emitter)
+{
+	float* memory = static_cast<float*>(Memory::allocate(MemoryTag::Particles, block_bytes, 64));
+
+	Block block;
+	block.x = memory;
+	block.y = block.x + block_capacity;
+	block.vx = block.y + block_capacity;
+	block.vy = block.vx + block_capacity;
+	block.age = block.vy + block_capacity;
+	block.lifetime = block.age + block_capacity;
+	block.count = 0;
+	emitter.blocks.push_back(block);
+}
+
+void ParticleSystem::update(float dt)
+{
+	// Block jobs count towards the zone that updates the particles.
+	const CpuZone* zone = CpuZone::active();
+	JobCounter counter;
+
+	for (Emitter& emitter : emitters)
+	{
+		if (!emitter.alive)
+		{
+			continue;
+		}
+
+		emitter.pending += emitter.desc.rate * dt;
+		size_t spawned = static_cast<size_t>(emitter.pending);
+		emitter.pending -= static_cast<float>(spawned);
+		spawn(emitter, spawned);
+
+		float gravity = emitter.desc.gravity;
+		for (Block& block : emitter.blocks)
+		{
+			if (block.count == 0)
+			{
+				continue;
+			}
+
+			Block* b = &block;
+			jobs.run(counter, [b, dt, gravity, zone]()
+			{
+				ZoneCounters counters(zone);
+				uint32_t count = b->count;
+				uint32_t i = 0;
+				bool any_dead = false;
+
+#if PARTICLES_SSE
+				__m128 step = _mm_set1_ps(dt);
+				__m128 fall = _mm_set1_ps(gravity * dt);
+				__m128 dead = _mm_setzero_ps();
+				for (; i + 4 <= count; i += 4)
+				{
+					__m128 vx = _mm_load_ps(b->vx + i);
+					__m128 vy = _mm_add_ps(_mm_load_ps(b->vy + i), fall);
+					__m128 age = _mm_add_ps(_mm_load_ps(b->age + i), step);
+					_mm_store_ps(b->x + i, _mm_add_ps(_mm_load_ps(b->x + i), _mm_mul_ps(vx, step)));
+					_mm_store_ps(b->y + i, _mm_add_ps(_mm_load_ps(b->y + i), _mm_mul_ps(vy, step)));
+					_mm_store_ps(b->vy + i, vy);
+					_mm_store_ps(b->age + i, age);
+					dead = _mm_or_ps(dead, _mm_cmpge_ps(age, _mm_load_ps(b->lifetime + i)));
+				}
+				any_dead = _mm_movemask_ps(dead) != 0;
+#endif
+
+				for (; i < count; ++i)
+				{
+					b->vy[i] += gravity * dt;
+					b->x[i] += b->vx[i] * dt;
+					b->y[i] += b->vy[i] * dt;
+					b->age[i] += dt;
+					any_dead |= b->age[i] >= b->lifetime[i];
+				}
+
+				if (!any_dead)
+				{
+					return;
+				}
+
+				i = 0;
+				while (i < count)
+				{
+					if (b->age[i] < b->lifetime[i])
+					{
+						++i;
+						continue;
+					}
+
+					--count;
+					b->x[i] = b->x[count];
+					b->y[i] = b->y[count];
+					b->vx[i] = b->vx[count];
+					b->vy[i] = b->vy[count];
+					b->age[i] = b->age[count];
+					b->lifetime[i] = b->lifetime[count];
+				}
+				b->count = count;
+			});
+		}
+	}
+
+	jobs.wait(counter);
+
+	for (Emitter& emitter : emitters)
+	{
+		emitter.live = 0;
+		for (const Block& block : emitter.blocks)
+		{
+			emitter.live += block.count;
+		}
+
+		// Spawning tops up earlier blocks first, so once a burst dies down the emptied blocks are at the
+		// end and can go back to the heap.
+		while (!emitter.blocks.empty() && emitter.blocks.back().count == 0)
+		{
+			Memory::deallocate(MemoryTag::Particles, emitter.blocks.back().x, block_bytes, 64);
+			emitter.blocks.pop_back();
+		}
+	}
+}
+
+void ParticleSystem::submit(SpriteRenderer& renderer, const TextureAtlas& atlas)
+{
+	size_t total = 0;
+	for (const Emitter& emitter : emitters)
+	{
+		total += (emitter.alive && emitter.desc.region < atlas.region_count()) ? emitter.live : 0;
+	}
+
+	total = std::min(total, renderer.capacity() - renderer.sprite_count());
+	SpriteInstance* out = total ? renderer.allocate(total) : nullptr;
+	if (!out)
+	{
+		return;
+	}
+
+	// Each block gets its own slice of the frame's section, so workers write without coordinating.
+	const CpuZone* zone = CpuZone::active();
+	JobCounter counter;
+	size_t offset = 0;
+	for (const Emitter& emitter : emitters)
+	{
+		if (!emitter.alive || emitter.desc.region >= atlas.region_count())
+		{
+			continue;
+		}
+
+		const AtlasRegion& region = atlas.region(emitter.desc.region);
+		const EmitterDesc* d = &emitter.desc;
+		for (const Block& block : emitter.blocks)
+		{
+			uint32_t count = static_cast<uint32_t>(std::min<size_t>(block.count, total - offset));
+			if (count == 0)
+			{
+				continue;
+			}
+
+			const Block* b = &block;
+			SpriteInstance* slice = out + offset;
+			offset += count;
+			jobs.run(counter, [b, d, &region, slice, count, zone]()
+			{
+				ZoneCounters counters(zone);
+				float layer = static_cast<float>(region.layer);
+				uint32_t rgb = d->color & 0x00ffffffu;
+				float alpha = static_cast<float>(d->color >> 24);
+				for (uint32_t i = 0; i < count; ++i)
+				{
+					float fade = 1.0f - std::min(b->age[i] / b->lifetime[i], 1.0f);
+					uint32_t a = static_cast<uint32_t>(alpha * fade);
+					slice[i] = { b->x[i], b->y[i], d->size, d->size, region.u0, region.v0, region.u1, region.v1, layer, 0.0f, rgb | (a << 24), 0 };
+				}
+			});
+		}
+	}
+
+	jobs.wait(counter);
+}
+
+void ParticleSystem::save(ParticleSnapshot& snapshot) const
+{
+	snapshot.emitters.clear();
+	snapshot.counts.clear();
+	size_t total = 0;
+	for (const Emitter& emitter : emitters)
+	{
+		snapshot.emitters.push_back({ emitter.desc, emitter.max_particles, emitter.pending, emitter.rng, static_cast<uint32_t>(emitter.blocks.size()), emitter.alive });
+		for (const Block& block : emitter.blocks)
+		{
+			snapshot.counts.push_back(block.count);
+			total += block.count;
+		}
+	}
+
+	// The six streams of a block sit block_capacity apart; each goes in as its live prefix.
+	snapshot.particles.resize(total * stream_count);
+	float* out = snapshot.particles.data();
+	for (const Emitter& emitter : emitters)
+	{
+		for (const Block& block : emitter.blocks)
+		{
+			for (size_t stream = 0; stream < stream_count; ++stream)
+			{
+				std::memcpy(out, block.x + stream * block_capacity, block.count * sizeof(float));
+				out += block.count;
+			}
+		}
+	}
+}
+
+void ParticleSystem::restore(const ParticleSnapshot& snapshot)
+{
+	for (size_t i = snapshot.emitters.size(); i < emitters.size(); ++i)
+	{
+		free_blocks(emitters[i]);
+		emitters[i].alive = false;
+	}
+	if (emitters.size() < snapshot.emitters.size())
+	{
+		emitters.resize(snapshot.emitters.size());
+	}
+
+	const uint32_t* count = snapshot.counts.data();
+	const float* in = snapshot.particles.data();
+	for (size_t i = 0; i < snapshot.emitters.size(); ++i)
+	{
+		const ParticleSnapshot::SavedEmitter& saved = snapshot.emitters[i];
+		Emitter& emitter = emitters[i];
+		while (emitter.blocks.size() > saved.block_count)
+		{
+			Memory::deallocate(MemoryTag::Particles, emitter.blocks.back().x, block_bytes, 64);
+			emitter.blocks.pop_back();
+		}
+		while (emitter.blocks.size() < saved.block_count)
+		{
+			allocate_block(emitter);
+		}
+
+		emitter.desc = saved.desc;
+		emitter.max_particles = saved.max_particles;
+		emitter.pending = saved.pending;
+		emitter.rng = saved.rng;
+		emitter.alive = saved.alive;
+		emitter.live = 0;
+		for (Block& block : emitter.blocks)
+		{
+			block.count = *count++;
+			for (size_t stream = 0; stream < stream_count; ++stream)
+			{
+				std::memcpy(block.x + stream * block_capacity, in, block.count * sizeof(float));
+				in += block.count;
+			}
+			emitter.live += block.count;
+		}
+	}
+}
+
+size_t ParticleSystem::particle_count() const
+{
+	size_t count = 0;
+	for (const Emitter& emitter : emitters)
+	{
+		count += emitter.alive ? emitter.live : 0;
+	}
+	return count;
+}
+
+size_t ParticleSystem::block_count() const
+{
+	size_t count = 0;
+	for (const Emitter& emitter : emitters)
+	{
+		count += emitter.blocks.size();
+	}
+	return count;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "Memory.h"
+#include "TextureAtlas.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class JobSystem;
+class ParticleSnapshot;
+class SpriteRenderer;
+
+struct EmitterDesc
+{
+	float x = 0.0f;
+	float y = 0.0f;
+	float rate = 1000.0f;
+	float lifetime = 1.0f;
+	float direction = 1.5707963f;
+	float spread = 6.2831853f;
+	float speed_min = 50.0f;
+	float speed_max = 150.0f;
+	float gravity = -98.0f;
+	float size = 4.0f;
+	uint32_t color = 0xffffffff;
+	uint32_t region = TextureAtlas::white_region;
+};
+
+// Particles live outside the ECS. Each emitter owns fixed-size SoA blocks that are integrated with SSE,
+// kept packed by swap-removing dead particles, and written straight into the sprite renderer's mapped buffer.
+class ParticleSystem
+{
+public:
+	static constexpr uint32_t block_capacity = 4096;
+
+	explicit ParticleSystem(JobSystem& jobs);
+	~ParticleSystem();
+
+	ParticleSystem(const ParticleSystem&) = delete;
+	ParticleSystem& operator=(const ParticleSystem&) = delete;
+
+	uint32_t create_emitter(const EmitterDesc& desc, size_t max_particles);
+	void destroy_emitter(uint32_t emitter);
+
+	// Changes take effect on the next update.
+	EmitterDesc& desc(uint32_t emitter) { return emitters[emitter].desc; }
+
+	// Spawns count particles on the next update on top of the emitter's rate.
+	void burst(uint32_t emitter, uint32_t count);
+
+	void update(float dt);
+	void submit(SpriteRenderer& renderer, const TextureAtlas& atlas);
+
+	size_t particle_count() const;
+	size_t block_count() const;
+
+	// Copies every emitter and its live particles. Blocks are saved packed, so the cost follows the
+	// particle count rather than the capacity.
+	void save(ParticleSnapshot& snapshot) const;
+	void restore(const ParticleSnapshot& snapshot);
+
+private:
+	struct Block
+	{
+		float* x;
+		float* y;
+		float* vx;
+		float* vy;
+		float* age;
+		float* lifetime;
+		uint32_t count;
+	};
+
+	struct Emitter
+	{
+		EmitterDesc desc;
+		std::vector<Block> blocks;
+		size_t max_particles = 0;
+		size_t live = 0;
+		float pending = 0.0f;
+		uint32_t rng = 0;
+		bool alive = false;
+	};
+
+	void spawn(Emitter& emitter, size_t count);
+	void allocate_block(Emitter& emitter);
+	void free_blocks(Emitter& emitter);
+
+	JobSystem& jobs;
+	std::vector<Emitter> emitters;
+};
+
+// Reused across saves, so once it has grown to fit it doesn't allocate.
+class ParticleSnapshot
+{
+private:
+	friend class ParticleSystem;
+
+	struct SavedEmitter
+	{
+		EmitterDesc desc;
+		size_t max_particles;
+		float pending;
+		uint32_t rng;
+		uint32_t block_count;
+		bool alive;
+	};
+
+	std::vector<SavedEmitter> emitters;
+	std::vector<uint32_t> counts;
+	std::vector<float, TaggedAllocator<float, MemoryTag::Rollback>> particles;
+};
@@ -0,0 +1,197 @@
+#include "PerfCounters.h"
+
+#include "JobSystem.h"
+
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	enum Counter
+	{
+		Cycles,
+		Instructions,
+		L1dMisses,
+		LlcMisses,
+		BranchMisses,
+		CounterCount
+	};
+
+	struct Group
+	{
+		int leader = -1;
+		int fds[CounterCount];
+		int slot_of[CounterCount];
+		int opened = 0;
+	};
+
+	std::mutex groups_mutex;
+	std::vector<Group> groups;
+
+	// Each thread keeps its own group so read() takes no lock. detach() bumps the generation, which
+	// marks every thread's copy as closed.
+	std::atomic<uint32_t> generation{ 1 };
+	thread_local Group thread_group;
+	thread_local uint32_t thread_generation = 0;
+
+#if defined(__linux__)
+	int open_counter(uint32_t type, uint64_t config, int group_fd)
+	{
+		perf_event_attr attr = {};
+		attr.size = sizeof(attr);
+		attr.type = type;
+		attr.config = config;
+		attr.disabled = group_fd == -1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP;
+		return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0));
+	}
+
+	// Counters the CPU can't provide are left out of the group rather than failing the whole thing.
+	bool open_group(Group& group)
+	{
+		constexpr uint64_t l1d_read_miss = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		struct { uint32_t type; uint64_t config; } events[CounterCount] =
+		{
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+			{ PERF_TYPE_HW_CACHE, l1d_read_miss },
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+		};
+
+		for (int i = 0; i < CounterCount; ++i)
+		{
+			group.fds[i] = -1;
+			group.slot_of[i] = -1;
+
+			int fd = open_counter(events[i].type, events[i].config, group.leader);
+			if (fd < 0)
+			{
+				if (i == Cycles)
+				{
+					return false;
+				}
+				continue;
+			}
+
+			if (group.leader == -1)
+			{
+				group.leader = fd;
+			}
+			group.fds[i] = fd;
+			group.slot_of[i] = group.opened++;
+		}
+
+		ioctl(group.leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(group.leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+		return true;
+	}
+
+	void close_group(Group& group)
+	{
+		for (int fd : group.fds)
+		{
+			if (fd >= 0)
+			{
+				close(fd);
+			}
+		}
+	}
+
+	bool attach_current_thread()
+	{
+		Group group;
+		if (!open_group(group))
+		{
+			return false;
+		}
+
+		std::lock_guard<std::mutex> lock(groups_mutex);
+		groups.push_back(group);
+		thread_group = group;
+		thread_generation = generation.load(std::memory_order_relaxed);
+		return true;
+	}
+#endif
+}
+
+namespace PerfCounters
+{
+	bool attach(JobSystem& jobs)
+	{
+		detach();
+
+#if defined(__linux__)
+		if (!attach_current_thread())
+		{
+			std::cerr << "perf_event_open failed; hardware counters are unavailable (check perf_event_paranoid)\n";
+			return false;
+		}
+
+		// Each worker has to open its own group, since a group only counts the thread it was opened on.
+		JobCounter counter;
+		for (unsigned worker = 0; worker < jobs.worker_count(); ++worker)
+		{
+			jobs.run_on(worker, counter, []() { attach_current_thread(); });
+		}
+		jobs.wait(counter);
+		return true;
+#else
+		(void)jobs;
+		return false;
+#endif
+	}
+
+	void detach()
+	{
+		std::lock_guard<std::mutex> lock(groups_mutex);
+		generation.fetch_add(1, std::memory_order_acq_rel);
+#if defined(__linux__)
+		for (Group& group : groups)
+		{
+			close_group(group);
+		}
+#endif
+		groups.clear();
+	}
+
+	bool available()
+	{
+		std::lock_guard<std::mutex> lock(groups_mutex);
+		return !groups.empty();
+	}
+
+	CounterValues read()
+	{
+		uint64_t totals[CounterCount] = {};
+
+#if defined(__linux__)
+		// PERF_FORMAT_GROUP: the number of counters, then one value per counter in the order they were opened.
+		uint64_t values[1 + CounterCount] = {};
+		if (thread_generation == generation.load(std::memory_order_acquire)
+			&& ::read(thread_group.leader, values, sizeof(uint64_t) * (1 + thread_group.opened)) > 0)
+		{
+			for (int i = 0; i < CounterCount; ++i)
+			{
+				if (thread_group.slot_of[i] >= 0)
+				{
+					totals[i] = values[1 + thread_group.slot_of[i]];
+				}
+			}
+		}
+#endif
+
+		return { totals[Cycles], totals[Instructions], totals[L1dMisses], totals[LlcMisses], totals[BranchMisses] };
+	}
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+
+class JobSystem;
+
+struct CounterValues
+{
+	uint64_t cycles;
+	uint64_t instructions;
+	uint64_t l1d_misses;
+	uint64_t llc_misses;
+	uint64_t branch_misses;
+};
+
+// Hardware counters through perf_event_open, one counter group per attached thread. read() only reads the
+// calling thread's group, so reading before and after a piece of work counts that thread alone, whatever
+// other threads ran alongside it. Only implemented on Linux; elsewhere, on a thread that isn't attached, or
+// when the kernel refuses, reads are zero and available() is false.
+namespace PerfCounters
+{
+	// Opens a group on the calling thread and on every worker.
+	bool attach(JobSystem& jobs);
+	void detach();
+
+	bool available();
+
+	// The calling thread's counters.
+	CounterValues read();
+}
@@ -0,0 +1,151 @@
+#include "PerfOverlay.h"
+
+#include "DebugDraw.h"
+#include "ECS.h"
+#include "Memory.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace
+{
+	constexpr float panel_width = 330.0f;
+	constexpr float margin = 8.0f;
+	constexpr float line_step = 10.0f;
+	constexpr float graph_height = 60.0f;
+	constexpr float graph_range = 33.3f;
+	constexpr float overlay_budget = 0.1f;
+
+	constexpr uint32_t panel_color = 0xb0000000;
+	constexpr uint32_t text_color = 0xffffffff;
+	constexpr uint32_t warn_color = 0xff4040ff;
+	constexpr uint32_t graph_color = 0xff40ff40;
+	constexpr uint32_t guide_color = 0x80ffffff;
+
+	// The overlay's segments go out in the shared debug draw batch, which has one GPU zone. Its share of
+	// that zone is estimated from its share of the segments, both from the last frame flushed.
+	size_t overlay_segments = 0;
+
+	// Positions in screen pixels from the top-left of the panel.
+	struct Panel
+	{
+		float left;
+		float top;
+		float pixel;
+		float cursor = 0.0f;
+
+		float x(float px) const { return left + px * pixel; }
+		float y(float py) const { return top - py * pixel; }
+
+		void print(const char* text, uint32_t color = text_color)
+		{
+			DebugDraw::text(x(margin), y(cursor), text, color);
+			cursor += line_step;
+		}
+	};
+}
+
+void draw_perf_overlay(const Camera2D& camera, const World& world, const OverlayCounters& counters)
+{
+	CpuZone zone("Overlay");
+	size_t queued_before = DebugDraw::queued_count();
+
+	Rect view = camera.bounds();
+	float pixel = 1.0f / camera.zoom;
+	Panel panel{ view.max_x - (panel_width + margin) * pixel, view.max_y - margin * pixel, pixel };
+	char line[96];
+
+	// A wide line is a filled rectangle. Drawn first so it sits behind everything else from this thread.
+	bool counting = Profiler::counters_enabled();
+	int rows = 3 + 1 + Profiler::zone_count() + 1 + 1 + static_cast<int>(MemoryTag::Count);
+	float height = margin + graph_height + 6.0f + rows * line_step + 8.0f + margin;
+	if (counting)
+	{
+		height += (1 + Profiler::zone_count()) * line_step + 4.0f;
+	}
+	float middle = panel.y(height * 0.5f);
+	DebugDraw::line(panel.x(0.0f), middle, panel.x(panel_width), middle, panel_color, height);
+
+	// Frame graph, newest sample on the right, with a 60 Hz guide.
+	panel.cursor = margin;
+	float graph_top = panel.cursor;
+	float graph_bottom = graph_top + graph_height;
+	const float* history = Profiler::frame_history();
+	int start = Profiler::history_start();
+	float step = (panel_width - 2.0f * margin) / (Profiler::history_length - 1);
+	float previous = 0.0f;
+	for (int i = 0; i < Profiler::history_length; ++i)
+	{
+		float ms = history[(start + i) % Profiler::history_length];
+		float bar_height = std::min(ms / graph_range, 1.0f) * graph_height;
+		float current = graph_bottom - bar_height;
+		if (i > 0)
+		{
+			DebugDraw::line(panel.x(margin + step * (i - 1)), panel.y(previous), panel.x(margin + step * i), panel.y(current), graph_color);
+		}
+		previous = current;
+	}
+	float guide = graph_bottom - 16.7f / graph_range * graph_height;
+	DebugDraw::line(panel.x(margin), panel.y(guide), panel.x(panel_width - margin), panel.y(guide), guide_color);
+	panel.cursor = graph_bottom + 6.0f;
+
+	float frame = Profiler::frame_milliseconds();
+	std::snprintf(line, sizeof(line), "frame %6.2f ms  %5.0f fps", frame, frame > 0.0f ? 1000.0f / frame : 0.0f);
+	panel.print(line);
+	std::snprintf(line, sizeof(line), "entities %zu  archetypes %zu  chunks %zu", world.entity_count(), world.archetype_count(), world.chunk_count());
+	panel.print(line);
+	std::snprintf(line, sizeof(line), "draws %zu  sprites %zu  particles %zu", counters.draw_calls, counters.sprites, counters.particles);
+	panel.print(line);
+
+	panel.cursor += 4.0f;
+	panel.print("zone              cpu ms    gpu ms");
+	for (int i = 0; i < Profiler::zone_count(); ++i)
+	{
+		float cpu = Profiler::cpu_milliseconds(i);
+		float gpu = Profiler::gpu_milliseconds(i);
+		std::snprintf(line, sizeof(line), "%-16s %7.3f   %7.3f", Profiler::zone_name(i), cpu, gpu);
+		bool over = i == Profiler::zone_index("Overlay") && cpu > overlay_budget;
+		panel.print(line, over ? warn_color : text_color);
+	}
+
+	size_t flushed = DebugDraw::segment_count();
+	int debug_zone = Profiler::zone_index("Debug draw");
+	float debug_gpu = debug_zone >= 0 ? Profiler::gpu_milliseconds(debug_zone) : 0.0f;
+	float overlay_gpu = flushed ? debug_gpu * static_cast<float>(std::min(overlay_segments, flushed)) / static_cast<float>(flushed) : 0.0f;
+	std::snprintf(line, sizeof(line), "%-16s %7s   %7.3f %6zu seg", " overlay share", "-", overlay_gpu, overlay_segments);
+	panel.print(line);
+
+	// Misses are per thousand instructions, so zones of different sizes compare directly.
+	if (counting)
+	{
+		panel.cursor += 4.0f;
+		panel.print("zone              IPC  L1D/k  LLC/k   br/k");
+		for (int i = 0; i < Profiler::zone_count(); ++i)
+		{
+			CounterValues c = Profiler::zone_counters(i);
+			double kilo = c.instructions / 1000.0;
+			if (c.cycles == 0 || kilo == 0.0)
+			{
+				std::snprintf(line, sizeof(line), "%-16s     -", Profiler::zone_name(i));
+			}
+			else
+			{
+				std::snprintf(line, sizeof(line), "%-16s %5.2f %6.2f %6.2f %6.2f", Profiler::zone_name(i), static_cast<double>(c.instructions) / c.cycles, c.l1d_misses / kilo, c.llc_misses / kilo, c.branch_misses / kilo);
+			}
+			panel.print(line);
+		}
+	}
+
+	panel.cursor += 4.0f;
+	panel.print("memory             live MiB  budget");
+	for (size_t i = 0; i < static_cast<size_t>(MemoryTag::Count); ++i)
+	{
+		MemoryTag tag = static_cast<MemoryTag>(i);
+		MemoryStats s = Memory::stats(tag);
+		std::snprintf(line, sizeof(line), "%-16s %9.1f %7.0f", Memory::tag_name(tag), s.live_bytes / 1048576.0, s.budget_bytes / 1048576.0);
+		panel.print(line, s.budget_bytes != 0 && s.live_bytes > s.budget_bytes ? warn_color : text_color);
+	}
+
+	overlay_segments = DebugDraw::queued_count() - queued_before;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "Camera.h"
+
+#include <cstddef>
+
+class World;
+
+struct OverlayCounters
+{
+	size_t draw_calls;
+	size_t sprites;
+	size_t particles;
+};
+
+// Frame time graph, profiler zones, world and memory stats in the top-right of the view. Everything goes
+// through DebugDraw, so the overlay adds no draw calls; its own CPU cost is the "Overlay" zone, and its
+// share of the "Debug draw" GPU zone is shown under the zones, apportioned by segment count.
+void draw_perf_overlay(const Camera2D& camera, const World& world, const OverlayCounters& counters);
@@ -0,0 +1,337 @@
+#include "Profiler.h"
+
+#include <glad/glad.h>
+
+#include <atomic>
+#include <cstring>
+#include <mutex>
+
+namespace
+{
+	// GPU results are read back this many frames after they were issued.
+	constexpr int query_frames = 4;
+	constexpr size_t name_length = 32;
+	constexpr float smoothing = 1.0f / 16.0f;
+
+	std::mutex zones_mutex;
+	std::atomic<int> zone_total{ 0 };
+	char names[Profiler::max_zones][name_length];
+	std::atomic<uint64_t> cpu_nanoseconds[Profiler::max_zones];
+	float cpu_smoothed[Profiler::max_zones];
+	float gpu_smoothed[Profiler::max_zones];
+
+	// Zones on any thread add the counts of the thread they ran on.
+	constexpr int counter_fields = sizeof(CounterValues) / sizeof(uint64_t);
+	std::atomic<bool> counting{ false };
+	std::atomic<uint64_t> counter_totals[Profiler::max_zones][counter_fields];
+	float counter_smoothed[Profiler::max_zones][counter_fields];
+
+	// Zones counting on this thread's current job, innermost first. A job's chain is taken down before
+	// it waits, so another job running meanwhile never sees it.
+	thread_local CpuZone* active_zones = nullptr;
+
+	GLuint queries[query_frames][Profiler::max_zones][2];
+	bool issued[query_frames][Profiler::max_zones];
+	bool gpu_ready = false;
+	int slot = 0;
+
+	float history[Profiler::history_length];
+	int history_head = 0;
+	float last_frame = 0.0f;
+	std::chrono::steady_clock::time_point frame_start;
+	bool started = false;
+
+	void add_counters(int zone, const CounterValues& before, const CounterValues& after)
+	{
+		const uint64_t* from = &before.cycles;
+		const uint64_t* to = &after.cycles;
+		for (int field = 0; field < counter_fields; ++field)
+		{
+			counter_totals[zone][field].fetch_add(to[field] - from[field], std::memory_order_relaxed);
+		}
+	}
+
+	int find_zone(const char* name, int count)
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			if (std::strncmp(names[i], name, name_length - 1) == 0)
+			{
+				return i;
+			}
+		}
+		return -1;
+	}
+}
+
+namespace Profiler
+{
+	bool init()
+	{
+		glGenQueries(query_frames * max_zones * 2, &queries[0][0][0]);
+		std::memset(issued, 0, sizeof(issued));
+		gpu_ready = true;
+		return true;
+	}
+
+	void shutdown()
+	{
+		if (gpu_ready)
+		{
+			glDeleteQueries(query_frames * max_zones * 2, &queries[0][0][0]);
+			gpu_ready = false;
+		}
+	}
+
+	void begin_frame()
+	{
+		auto now = std::chrono::steady_clock::now();
+		if (started)
+		{
+			last_frame = std::chrono::duration<float, std::milli>(now - frame_start).count();
+			history[history_head] = last_frame;
+			history_head = (history_head + 1) % history_length;
+		}
+		frame_start = now;
+		started = true;
+
+		if (!gpu_ready)
+		{
+			return;
+		}
+
+		// This slot was last written query_frames ago. Results that still aren't ready are skipped, not waited on.
+		slot = (slot + 1) % query_frames;
+		int count = zone_total.load(std::memory_order_acquire);
+		for (int zone = 0; zone < count; ++zone)
+		{
+			if (!issued[slot][zone])
+			{
+				continue;
+			}
+			issued[slot][zone] = false;
+
+			GLint available = 0;
+			glGetQueryObjectiv(queries[slot][zone][1], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+			{
+				continue;
+			}
+
+			GLuint64 begin = 0;
+			GLuint64 end = 0;
+			glGetQueryObjectui64v(queries[slot][zone][0], GL_QUERY_RESULT, &begin);
+			glGetQueryObjectui64v(queries[slot][zone][1], GL_QUERY_RESULT, &end);
+			float milliseconds = static_cast<float>(end - begin) * 1e-6f;
+			gpu_smoothed[zone] += (milliseconds - gpu_smoothed[zone]) * smoothing;
+		}
+	}
+
+	void end_frame()
+	{
+		int count = zone_total.load(std::memory_order_acquire);
+		for (int zone = 0; zone < count; ++zone)
+		{
+			float milliseconds = static_cast<float>(cpu_nanoseconds[zone].exchange(0, std::memory_order_relaxed)) * 1e-6f;
+			cpu_smoothed[zone] += (milliseconds - cpu_smoothed[zone]) * smoothing;
+
+			for (int field = 0; field < counter_fields; ++field)
+			{
+				float value = static_cast<float>(counter_totals[zone][field].exchange(0, std::memory_order_relaxed));
+				counter_smoothed[zone][field] += (value - counter_smoothed[zone][field]) * smoothing;
+			}
+		}
+	}
+
+	int zone_index(const char* name)
+	{
+		int zone = find_zone(name, zone_total.load(std::memory_order_acquire));
+		if (zone >= 0)
+		{
+			return zone;
+		}
+
+		std::lock_guard<std::mutex> lock(zones_mutex);
+		int count = zone_total.load(std::memory_order_relaxed);
+		zone = find_zone(name, count);
+		if (zone >= 0 || count == max_zones)
+		{
+			return zone;
+		}
+
+		std::strncpy(names[count], name, name_length - 1);
+		zone_total.store(count + 1, std::memory_order_release);
+		return count;
+	}
+
+	void add_cpu_time(int zone, uint64_t nanoseconds)
+	{
+		if (zone >= 0)
+		{
+			cpu_nanoseconds[zone].fetch_add(nanoseconds, std::memory_order_relaxed);
+		}
+	}
+
+	void gpu_begin(int zone)
+	{
+		if (gpu_ready && zone >= 0)
+		{
+			glQueryCounter(queries[slot][zone][0], GL_TIMESTAMP);
+		}
+	}
+
+	void gpu_end(int zone)
+	{
+		if (gpu_ready && zone >= 0)
+		{
+			glQueryCounter(queries[slot][zone][1], GL_TIMESTAMP);
+			issued[slot][zone] = true;
+		}
+	}
+
+	void enable_counters(bool enabled)
+	{
+		counting.store(enabled && PerfCounters::available(), std::memory_order_relaxed);
+	}
+
+	bool counters_enabled()
+	{
+		return counting.load(std::memory_order_relaxed);
+	}
+
+	CpuZone* suspend_zones()
+	{
+		CpuZone* zones = active_zones;
+		if (!zones)
+		{
+			return nullptr;
+		}
+
+		CounterValues now = PerfCounters::read();
+		for (CpuZone* open = zones; open; open = open->outer)
+		{
+			add_counters(open->zone, open->counters, now);
+		}
+		active_zones = nullptr;
+		return zones;
+	}
+
+	void resume_zones(CpuZone* zones)
+	{
+		if (!zones)
+		{
+			return;
+		}
+
+		CounterValues now = PerfCounters::read();
+		for (CpuZone* open = zones; open; open = open->outer)
+		{
+			open->counters = now;
+		}
+		active_zones = zones;
+	}
+
+	CounterValues zone_counters(int zone)
+	{
+		const float* f = counter_smoothed[zone];
+		return { static_cast<uint64_t>(f[0]), static_cast<uint64_t>(f[1]), static_cast<uint64_t>(f[2]), static_cast<uint64_t>(f[3]), static_cast<uint64_t>(f[4]) };
+	}
+
+	int zone_count()
+	{
+		return zone_total.load(std::memory_order_acquire);
+	}
+
+	const char* zone_name(int zone)
+	{
+		return names[zone];
+	}
+
+	float cpu_milliseconds(int zone)
+	{
+		return cpu_smoothed[zone];
+	}
+
+	float gpu_milliseconds(int zone)
+	{
+		return gpu_smoothed[zone];
+	}
+
+	const float* frame_history()
+	{
+		return history;
+	}
+
+	int history_start()
+	{
+		return history_head;
+	}
+
+	float frame_milliseconds()
+	{
+		return last_frame;
+	}
+}
+
+CpuZone::CpuZone(const char* name)
+	: zone(Profiler::zone_index(name)), counting(::counting.load(std::memory_order_relaxed) && zone >= 0), counters{}
+{
+	if (counting)
+	{
+		counters = PerfCounters::read();
+		outer = active_zones;
+		active_zones = this;
+	}
+	start = std::chrono::steady_clock::now();
+}
+
+CpuZone::~CpuZone()
+{
+	auto elapsed = std::chrono::steady_clock::now() - start;
+	Profiler::add_cpu_time(zone, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+
+	if (counting)
+	{
+		add_counters(zone, counters, PerfCounters::read());
+		active_zones = outer;
+	}
+}
+
+const CpuZone* CpuZone::active()
+{
+	return active_zones;
+}
+
+ZoneCounters::ZoneCounters(const CpuZone* zone)
+	: zone(zone), counters{}
+{
+	if (zone)
+	{
+		counters = PerfCounters::read();
+	}
+}
+
+ZoneCounters::~ZoneCounters()
+{
+	if (!zone)
+	{
+		return;
+	}
+
+	CounterValues end = PerfCounters::read();
+	for (const CpuZone* open = zone; open; open = open->outer)
+	{
+		add_counters(open->zone, counters, end);
+	}
+}
+
+GpuZone::GpuZone(const char* name)
+	: zone(Profiler::zone_index(name))
+{
+	Profiler::gpu_begin(zone);
+}
+
+GpuZone::~GpuZone()
+{
+	Profiler::gpu_end(zone);
+}
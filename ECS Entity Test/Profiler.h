@@ -0,0 +1,102 @@
+#pragma once
+
+#include "PerfCounters.h"
+
+#include <chrono>
+#include <cstdint>
+
+class CpuZone;
+
+// Named CPU and GPU timings per frame. CPU zones can be recorded from any thread and accumulate into
+// their zone; GPU zones are timestamp queries on the main thread, read back a few frames later so
+// the CPU never waits on them. Displayed values are smoothed over roughly the last 16 frames.
+namespace Profiler
+{
+	constexpr int max_zones = 32;
+	constexpr int history_length = 240;
+
+	// Needs the GL context for the timestamp queries.
+	bool init();
+	void shutdown();
+
+	void begin_frame();
+	void end_frame();
+
+	// Registers name on first use. Names are compared by content, so string literals are fine.
+	int zone_index(const char* name);
+	void add_cpu_time(int zone, uint64_t nanoseconds);
+	void gpu_begin(int zone);
+	void gpu_end(int zone);
+
+	int zone_count();
+	const char* zone_name(int zone);
+	float cpu_milliseconds(int zone);
+	float gpu_milliseconds(int zone);
+
+	// Samples PerfCounters around every zone, on the thread the zone runs on, and around the chunks other
+	// workers run for it in par_each. Whatever a thread runs while a zone's job waits in JobSystem::wait
+	// is left out of that zone.
+	void enable_counters(bool enabled);
+	bool counters_enabled();
+	CounterValues zone_counters(int zone);
+
+	// JobSystem::wait calls these around running other work. suspend_zones() stops the calling job's
+	// open zones counting and returns them for resume_zones() to carry on.
+	CpuZone* suspend_zones();
+	void resume_zones(CpuZone* zones);
+
+	// Frame times in milliseconds, oldest first starting at history_start().
+	const float* frame_history();
+	int history_start();
+	float frame_milliseconds();
+}
+
+class CpuZone
+{
+public:
+	explicit CpuZone(const char* name);
+	~CpuZone();
+
+	CpuZone(const CpuZone&) = delete;
+	CpuZone& operator=(const CpuZone&) = delete;
+
+	// The innermost zone counting on the calling job, or null.
+	static const CpuZone* active();
+
+private:
+	friend class ZoneCounters;
+	friend CpuZone* Profiler::suspend_zones();
+	friend void Profiler::resume_zones(CpuZone* zones);
+
+	int zone;
+	bool counting;
+	CounterValues counters;
+	CpuZone* outer = nullptr;
+	std::chrono::steady_clock::time_point start;
+};
+
+// Adds the counters of work done on another thread for zone and the zones around it, such as the
+// chunks a par_each helper takes. Time isn't added: the zone's own time already covers it.
+class ZoneCounters
+{
+public:
+	explicit ZoneCounters(const CpuZone* zone);
+	~ZoneCounters();
+
+	ZoneCounters(const ZoneCounters&) = delete;
+	ZoneCounters& operator=(const ZoneCounters&) = delete;
+
+private:
+	const CpuZone* zone;
+	CounterValues counters;
+};
+
+class GpuZone
+{
+public:
+	explicit GpuZone(const char* name);
+	~GpuZone();
+
+private:
+	int zone;
+};
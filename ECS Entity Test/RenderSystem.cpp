@@ -0,0 +1,38 @@
+#include "RenderSystem.h"
+
+#include "Components.h"
+#include "SpriteRenderer.h"
+#include "TextureAtlas.h"
+#include "Visibility.h"
+
+void submit_sprites(const VisibleSet& visible, SpriteRenderer& renderer, const TextureAtlas& atlas)
+{
+	const AtlasRegion* regions = atlas.region_data();
+	uint32_t region_count = static_cast<uint32_t>(atlas.region_count());
+
+	for (uint32_t c = 0; c < visible.chunk_count; ++c)
+	{
+		const VisibleChunk& entry = visible.chunks[c];
+		const Transform* transforms = entry.transforms;
+		const Sprite* sprites = entry.sprites;
+		if (!transforms || !sprites)
+		{
+			continue;
+		}
+
+		SpriteInstance* out = renderer.allocate(entry.count);
+		if (!out)
+		{
+			return;
+		}
+
+		for (uint32_t i = 0; i < entry.count; ++i)
+		{
+			uint16_t row = entry.rows[i];
+			const Transform& t = transforms[row];
+			const Sprite& s = sprites[row];
+			const AtlasRegion& r = regions[s.region < region_count ? s.region : TextureAtlas::white_region];
+			out[i] = { t.x, t.y, s.width, s.height, r.u0, r.v0, r.u1, r.v1, static_cast<float>(r.layer), t.rotation, s.color, 0 };
+		}
+	}
+}
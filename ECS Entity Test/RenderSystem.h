@@ -0,0 +1,8 @@
+#pragma once
+
+class SpriteRenderer;
+class TextureAtlas;
+struct VisibleSet;
+
+// Writes the visible Transform + Sprite rows into the renderer's instance buffer, chunk by chunk.
+void submit_sprites(const VisibleSet& visible, SpriteRenderer& renderer, const TextureAtlas& atlas);
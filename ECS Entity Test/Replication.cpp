@@ -0,0 +1,1038 @@
+#include "Replication.h"
+
+#include "ChunkAllocator.h"
+#include "Components.h"
+#include "JobSystem.h"
+#include "Simulation.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+namespace
+{
+	constexpr uint32_t protocol_id = 0x314e4345;
+
+	enum PacketType : uint8_t
+	{
+		HelloPacket = 1,
+		AckPacket,
+		ByePacket,
+		SnapshotPacket
+	};
+
+	// Field bits in front of each entity record. A new record carries every field; a removal none.
+	enum RecordFlags : uint8_t
+	{
+		RecordX = 1 << 0,
+		RecordY = 1 << 1,
+		RecordRotation = 1 << 2,
+		RecordSprite = 1 << 3,
+		RecordNew = 1 << 6,
+		RecordRemoved = 1 << 7
+	};
+
+	// Keeps every datagram under a typical path MTU, so none is ever fragmented.
+	constexpr size_t max_packet_bytes = 1200;
+	constexpr size_t max_record_bytes = 40;
+
+	// protocol, type, sequence, baseline, tick, part, first index, end index, part count.
+	constexpr size_t snapshot_header_bytes = 4 + 1 + 4 + 4 + 4 + 2 + 4 + 4 + 2;
+
+	// A part's range ending here reaches past every entity.
+	constexpr uint32_t end_of_indices = 0xffffffffu;
+
+	static_assert(ReplicationServer::max_snapshot_parts <= 32, "the parts of a snapshot are acknowledged as a 32-bit mask");
+
+	// Positions to 1/16 of a world unit, sprite sizes to 1/8, rotation to 1/65536 of a turn.
+	constexpr float position_scale = 16.0f;
+	constexpr float size_scale = 8.0f;
+	constexpr float two_pi = 6.2831853f;
+
+	// Relevance reaches this fraction of the view beyond each edge, so entities are there before they show.
+	constexpr float interest_margin = 0.25f;
+
+	constexpr uint64_t client_timeout_steps = 5 * 60;
+	constexpr uint32_t hello_interval = 30;
+
+	NetEntity quantize(Entity entity, const Transform& transform, const Sprite& sprite)
+	{
+		float turns = transform.rotation / two_pi;
+		turns -= std::floor(turns);
+
+		NetEntity result;
+		result.index = entity.index;
+		result.generation = entity.generation;
+		result.x = static_cast<int32_t>(std::lround(transform.x * position_scale));
+		result.y = static_cast<int32_t>(std::lround(transform.y * position_scale));
+		result.rotation = static_cast<uint16_t>(std::lround(turns * 65536.0f) & 0xffff);
+		result.width = static_cast<uint16_t>(std::clamp(std::lround(sprite.width * size_scale), 0l, 65535l));
+		result.height = static_cast<uint16_t>(std::clamp(std::lround(sprite.height * size_scale), 0l, 65535l));
+		result.region = sprite.region;
+		result.color = sprite.color;
+		return result;
+	}
+
+	Transform to_transform(const NetEntity& entity)
+	{
+		return { entity.x / position_scale, entity.y / position_scale, entity.rotation * (two_pi / 65536.0f) };
+	}
+
+	Sprite to_sprite(const NetEntity& entity)
+	{
+		return { entity.width / size_scale, entity.height / size_scale, entity.region, entity.color };
+	}
+
+	bool same_transform(const NetEntity& a, const NetEntity& b)
+	{
+		return a.x == b.x && a.y == b.y && a.rotation == b.rotation;
+	}
+
+	bool same_sprite(const NetEntity& a, const NetEntity& b)
+	{
+		return a.width == b.width && a.height == b.height && a.region == b.region && a.color == b.color;
+	}
+
+	void write_sprite(NetWriter& writer, const NetEntity& entity)
+	{
+		writer.u16(entity.width);
+		writer.u16(entity.height);
+		writer.varint(entity.region);
+		writer.u32(entity.color);
+	}
+
+	void read_sprite(NetReader& reader, NetEntity& entity)
+	{
+		entity.width = reader.u16();
+		entity.height = reader.u16();
+		entity.region = static_cast<uint32_t>(reader.varint());
+		entity.color = reader.u32();
+	}
+
+	// Appends the entities of from whose index is in [first, end). Both lists are sorted by index.
+	void append_range(std::vector<NetEntity>& out, const std::vector<NetEntity>& from, uint32_t first, uint32_t end)
+	{
+		auto before = [](const NetEntity& entity, uint32_t index) { return entity.index < index; };
+		auto begin = std::lower_bound(from.begin(), from.end(), first, before);
+		out.insert(out.end(), begin, std::lower_bound(begin, from.end(), end, before));
+	}
+
+	void patch_u32(std::vector<uint8_t>& packet, size_t offset, uint32_t value)
+	{
+		for (size_t i = 0; i < 4; ++i)
+		{
+			packet[offset + i] = static_cast<uint8_t>(value >> (8 * i));
+		}
+	}
+
+	void write_view(NetWriter& writer, const Rect& view)
+	{
+		writer.f32(view.min_x);
+		writer.f32(view.min_y);
+		writer.f32(view.max_x);
+		writer.f32(view.max_y);
+	}
+
+	Rect read_view(NetReader& reader)
+	{
+		Rect view;
+		view.min_x = reader.f32();
+		view.min_y = reader.f32();
+		view.max_x = reader.f32();
+		view.max_y = reader.f32();
+		return view;
+	}
+
+	// The view a headless run looks through: a quarter of the scene across, as run_stress_headless uses.
+	Camera2D headless_camera(const StressConfig& config)
+	{
+		Camera2D camera;
+		camera.x = config.extent * 0.5f;
+		camera.y = config.extent * 0.5f;
+		camera.zoom = camera.viewport_width * 4.0f / config.extent;
+		return camera;
+	}
+}
+
+bool parse_net_argument(int argc, char* argv[], int& i, NetOptions& options)
+{
+	const char* arg = argv[i];
+	if (std::strcmp(arg, "--loopback") == 0)
+	{
+		options.loopback = true;
+		return true;
+	}
+	if (i + 1 >= argc)
+	{
+		return false;
+	}
+
+	const char* value = argv[i + 1];
+	if (std::strcmp(arg, "--serve") == 0)
+	{
+		int port = std::atoi(value);
+		if (port <= 0 || port > 65535)
+		{
+			return false;
+		}
+		options.serve_port = static_cast<uint16_t>(port);
+	}
+	else if (std::strcmp(arg, "--connect") == 0)
+	{
+		options.connect = value;
+	}
+	else if (std::strcmp(arg, "--net-loss") == 0)
+	{
+		options.loss = std::clamp(static_cast<float>(std::atof(value)), 0.0f, 1.0f);
+	}
+	else
+	{
+		return false;
+	}
+	++i;
+	return true;
+}
+
+bool ReplicationServer::open(uint16_t port)
+{
+	clients.clear();
+	steps = 0;
+	return socket.open(port);
+}
+
+void ReplicationServer::close()
+{
+	socket.close();
+	clients.clear();
+}
+
+bool ReplicationServer::held_by(size_t client, uint32_t sequence, uint32_t parts, NetSnapshot& out) const
+{
+	return client < clients.size() && compose(clients[client], sequence, parts, out);
+}
+
+bool ReplicationServer::compose(const Client& client, uint32_t sequence, uint32_t parts, NetSnapshot& out) const
+{
+	const Sent& sent = client.history[sequence % history_size];
+	if (sequence == 0 || sequence >= client.next_sequence || sent.snapshot.sequence != sequence)
+	{
+		return false;
+	}
+
+	// A snapshot built on a baseline since replaced can't be rebuilt; the client acks a newer one soon.
+	static const NetSnapshot nothing;
+	const NetSnapshot* base = &nothing;
+	if (sent.baseline != 0)
+	{
+		if (client.acked.sequence != sent.baseline)
+		{
+			return false;
+		}
+		base = &client.acked;
+	}
+
+	out.sequence = sequence;
+	out.entities.clear();
+	append_range(out.entities, base->entities, 0, sent.bounds.front());
+	bool whole = sent.bounds.front() == 0 && sent.bounds.back() == end_of_indices;
+	for (size_t part = 0; part + 1 < sent.bounds.size(); ++part)
+	{
+		bool arrived = (parts >> part) & 1;
+		whole = whole && arrived;
+		append_range(out.entities, arrived ? sent.snapshot.entities : base->entities, sent.bounds[part], sent.bounds[part + 1]);
+	}
+	append_range(out.entities, base->entities, sent.bounds.back(), end_of_indices);
+
+	// Entities kept from the baseline are only as recent as its tick, and build() trusts the tick.
+	out.tick = whole || base == &nothing ? sent.snapshot.tick : base->tick;
+	return true;
+}
+
+void ReplicationServer::update(World& world, const SpatialGrid& grid)
+{
+	++steps;
+	receive();
+
+	// Everything written from here on is stamped after this snapshot.
+	uint32_t tick = world.tick();
+	world.advance_tick();
+
+	// A client that has gone quiet is dropped; saying hello again starts it over.
+	auto silent = std::remove_if(clients.begin(), clients.end(), [&](const Client& client)
+	{
+		return steps - client.last_heard > client_timeout_steps;
+	});
+	if (silent != clients.end())
+	{
+		std::cout << "Dropped " << (clients.end() - silent) << " silent client(s)\n";
+		clients.erase(silent, clients.end());
+	}
+
+	relevant_total = 0;
+	for (Client& client : clients)
+	{
+		// The client keeps its last history_size snapshots, and the baseline has to be among them.
+		const NetSnapshot* baseline = nullptr;
+		if (client.acked.sequence != 0 && client.next_sequence - client.acked.sequence < history_size)
+		{
+			baseline = &client.acked;
+		}
+
+		build(client, grid, baseline, tick);
+		Sent& sent = client.history[building.sequence % history_size];
+		encode(baseline, building, client.resume, sent.bounds);
+		client.resume = sent.bounds.back() == end_of_indices ? 0 : sent.bounds.back();
+		send(client);
+		relevant_total += building.entities.size();
+
+		// The slot's old contents come back as the next build's storage.
+		sent.baseline = baseline ? baseline->sequence : 0;
+		std::swap(sent.snapshot, building);
+	}
+}
+
+void ReplicationServer::receive()
+{
+	incoming.resize(max_packet_bytes);
+	NetAddress from;
+	while (size_t size = socket.receive(from, incoming.data(), incoming.size()))
+	{
+		NetReader reader(incoming.data(), size);
+		if (reader.u32() != protocol_id)
+		{
+			continue;
+		}
+
+		uint8_t type = reader.u8();
+		auto client = std::find_if(clients.begin(), clients.end(), [&](const Client& known) { return known.address == from; });
+		if (type == HelloPacket && client == clients.end())
+		{
+			Rect view = read_view(reader);
+			if (!reader.ok())
+			{
+				continue;
+			}
+			if (clients.size() == max_clients)
+			{
+				std::cerr << "Server full, ignoring a client on port " << from.port << "\n";
+				continue;
+			}
+			clients.emplace_back();
+			clients.back().address = from;
+			clients.back().view = view;
+			clients.back().last_heard = steps;
+			std::cout << "Client connected from port " << from.port << "\n";
+			continue;
+		}
+		if (client == clients.end())
+		{
+			continue;
+		}
+
+		client->last_heard = steps;
+		if (type == AckPacket)
+		{
+			uint32_t ack = reader.u32();
+			uint32_t parts = reader.u32();
+			Rect view = read_view(reader);
+			if (!reader.ok())
+			{
+				continue;
+			}
+
+			// Acknowledgements can overtake each other; only a newer one moves the baseline on.
+			if (ack > client->acked.sequence && compose(*client, ack, parts, composing))
+			{
+				std::swap(client->acked, composing);
+			}
+			client->view = view;
+		}
+		else if (type == ByePacket)
+		{
+			std::cout << "Client on port " << from.port << " disconnected\n";
+			clients.erase(client);
+		}
+	}
+}
+
+void ReplicationServer::build(Client& client, const SpatialGrid& grid, const NetSnapshot* baseline, uint32_t tick)
+{
+	building.sequence = client.next_sequence++;
+	building.tick = tick;
+	building.entities.clear();
+
+	float margin_x = (client.view.max_x - client.view.min_x) * interest_margin;
+	float margin_y = (client.view.max_y - client.view.min_y) * interest_margin;
+	Rect area = { client.view.min_x - margin_x, client.view.min_y - margin_y, client.view.max_x + margin_x, client.view.max_y + margin_y };
+
+	relevant.clear();
+	grid.query(area, [&](const SpatialGrid::Entry& entry, const Bounds&) { relevant.push_back(entry); });
+	std::sort(relevant.begin(), relevant.end(), [](const SpatialGrid::Entry& a, const SpatialGrid::Entry& b) { return a.entity.index < b.entity.index; });
+
+	static const std::vector<NetEntity> nothing;
+	const std::vector<NetEntity>& base = baseline ? baseline->entities : nothing;
+	const ComponentId transform_id = component_id<Transform>();
+	const ComponentId sprite_id = component_id<Sprite>();
+
+	size_t b = 0;
+	for (const SpatialGrid::Entry& entry : relevant)
+	{
+		int8_t transform_slot = entry.chunk->archetype->slot_of[transform_id];
+		int8_t sprite_slot = entry.chunk->archetype->slot_of[sprite_id];
+		if (transform_slot < 0 || sprite_slot < 0)
+		{
+			continue;
+		}
+
+		while (b < base.size() && base[b].index < entry.entity.index)
+		{
+			++b;
+		}
+
+		// Neither column written since the baseline, so the entity still quantizes to what the client has.
+		bool in_baseline = b < base.size() && base[b].index == entry.entity.index && base[b].generation == entry.entity.generation;
+		if (in_baseline && entry.chunk->changed[transform_slot] <= baseline->tick && entry.chunk->changed[sprite_slot] <= baseline->tick)
+		{
+			building.entities.push_back(base[b]);
+			continue;
+		}
+
+		const Transform& transform = entry.chunk->column<const Transform>()[entry.row];
+		const Sprite& sprite = entry.chunk->column<const Sprite>()[entry.row];
+		building.entities.push_back(quantize(entry.entity, transform, sprite));
+	}
+}
+
+void ReplicationServer::encode(const NetSnapshot* baseline, const NetSnapshot& next, uint32_t first, std::vector<uint32_t>& bounds)
+{
+	// Records are in index order from first, each index written as the step from the previous one in its
+	// packet. A packet covers the indices from its first record to the next packet's, so it decodes
+	// against the baseline on its own.
+	size_t packet_count = 0;
+	uint32_t previous = 0;
+	bounds.clear();
+	auto begin_packet = [&](uint32_t first)
+	{
+		if (packet_count == packets.size())
+		{
+			packets.emplace_back();
+		}
+		std::vector<uint8_t>& packet = packets[packet_count++];
+		packet.clear();
+		NetWriter writer(packet);
+		writer.u32(protocol_id);
+		writer.u8(SnapshotPacket);
+		writer.u32(next.sequence);
+		writer.u32(baseline ? baseline->sequence : 0);
+		writer.u32(next.tick);
+		writer.u16(static_cast<uint16_t>(packet_count - 1));
+		writer.u32(first);
+		writer.u32(0);
+		writer.u16(0);
+		bounds.push_back(first);
+		previous = first;
+	};
+
+	begin_packet(first);
+
+	static const std::vector<NetEntity> nothing;
+	const std::vector<NetEntity>& base = baseline ? baseline->entities : nothing;
+	auto before = [](const NetEntity& entity, uint32_t index) { return entity.index < index; };
+	uint32_t end = end_of_indices;
+	size_t b = std::lower_bound(base.begin(), base.end(), first, before) - base.begin();
+	size_t n = std::lower_bound(next.entities.begin(), next.entities.end(), first, before) - next.entities.begin();
+	while (n < next.entities.size() || b < base.size())
+	{
+		// Walk both lists together. A baseline entity with no match was removed; a changed generation
+		// is a new entity in a reused slot.
+		const NetEntity* entity = nullptr;
+		const NetEntity* known = nullptr;
+		uint32_t index;
+		if (n == next.entities.size() || (b < base.size() && base[b].index < next.entities[n].index))
+		{
+			index = base[b++].index;
+		}
+		else
+		{
+			entity = &next.entities[n++];
+			index = entity->index;
+			if (b < base.size() && base[b].index == index)
+			{
+				known = base[b].generation == entity->generation ? &base[b] : nullptr;
+				++b;
+			}
+		}
+
+		uint8_t flags = RecordRemoved;
+		if (entity && known)
+		{
+			flags = (entity->x != known->x ? RecordX : 0) | (entity->y != known->y ? RecordY : 0)
+				| (entity->rotation != known->rotation ? RecordRotation : 0) | (same_sprite(*entity, *known) ? 0 : RecordSprite);
+			if (flags == 0)
+			{
+				continue;
+			}
+		}
+		else if (entity)
+		{
+			flags = RecordNew;
+		}
+
+		if (packets[packet_count - 1].size() + max_record_bytes > max_packet_bytes)
+		{
+			if (packet_count == max_snapshot_parts)
+			{
+				end = index;
+				break;
+			}
+			begin_packet(index);
+		}
+
+		NetWriter writer(packets[packet_count - 1]);
+		writer.varint(index - previous);
+		writer.u8(flags);
+		previous = index;
+		if (flags & RecordNew)
+		{
+			writer.varint(entity->generation);
+			writer.zigzag(entity->x);
+			writer.zigzag(entity->y);
+			writer.u16(entity->rotation);
+			write_sprite(writer, *entity);
+			continue;
+		}
+
+		// Positions go as the move since the baseline, which is a byte or two for anything moving smoothly.
+		if (flags & RecordX)
+		{
+			writer.zigzag(static_cast<int64_t>(entity->x) - known->x);
+		}
+		if (flags & RecordY)
+		{
+			writer.zigzag(static_cast<int64_t>(entity->y) - known->y);
+		}
+		if (flags & RecordRotation)
+		{
+			writer.u16(entity->rotation);
+		}
+		if (flags & RecordSprite)
+		{
+			write_sprite(writer, *entity);
+		}
+	}
+	bounds.push_back(end);
+
+	for (size_t i = 0; i < packet_count; ++i)
+	{
+		patch_u32(packets[i], snapshot_header_bytes - 6, bounds[i + 1]);
+		packets[i][snapshot_header_bytes - 2] = static_cast<uint8_t>(packet_count);
+		packets[i][snapshot_header_bytes - 1] = static_cast<uint8_t>(packet_count >> 8);
+	}
+	packets.resize(packet_count);
+}
+
+void ReplicationServer::send(Client& client)
+{
+	for (const std::vector<uint8_t>& packet : packets)
+	{
+		if (loss > 0.0f)
+		{
+			loss_state ^= loss_state << 13;
+			loss_state ^= loss_state >> 17;
+			loss_state ^= loss_state << 5;
+			if ((loss_state >> 8) * (1.0f / 16777216.0f) < loss)
+			{
+				continue;
+			}
+		}
+		socket.send(client.address, packet.data(), packet.size());
+	}
+}
+
+bool ReplicationClient::connect(const NetAddress& address)
+{
+	if (!socket.open(0))
+	{
+		return false;
+	}
+
+	server = address;
+	assembly = Assembly{};
+	applied_sequence = 0;
+	applied_parts = 0;
+	updates = 0;
+	dropped = 0;
+	lost = 0;
+	for (NetSnapshot& snapshot : history)
+	{
+		snapshot.sequence = 0;
+	}
+	return true;
+}
+
+void ReplicationClient::disconnect(World& world)
+{
+	if (socket.is_open())
+	{
+		std::vector<uint8_t> packet;
+		NetWriter writer(packet);
+		writer.u32(protocol_id);
+		writer.u8(ByePacket);
+		socket.send(server, packet.data(), packet.size());
+		socket.close();
+	}
+
+	for (Entity local : locals)
+	{
+		world.destroy(local);
+	}
+	locals.clear();
+	shown = NetSnapshot{};
+	applied_sequence = 0;
+}
+
+void ReplicationClient::update(World& world, const Rect& view)
+{
+	if (!socket.is_open())
+	{
+		return;
+	}
+
+	receive();
+	finish(world);
+
+	// Until the first snapshot lands the server may not know about us, so keep saying hello.
+	std::vector<uint8_t>& packet = incoming;
+	packet.clear();
+	NetWriter writer(packet);
+	writer.u32(protocol_id);
+	if (!connected())
+	{
+		if (updates++ % hello_interval != 0)
+		{
+			return;
+		}
+		writer.u8(HelloPacket);
+	}
+	else
+	{
+		writer.u8(AckPacket);
+		writer.u32(applied_sequence);
+		writer.u32(applied_parts);
+	}
+	write_view(writer, view);
+	socket.send(server, packet.data(), packet.size());
+}
+
+void ReplicationClient::receive()
+{
+	incoming.resize(max_packet_bytes);
+	NetAddress from;
+	while (size_t size = socket.receive(from, incoming.data(), incoming.size()))
+	{
+		NetReader reader(incoming.data(), size);
+		if (!(from == server) || reader.u32() != protocol_id || reader.u8() != SnapshotPacket)
+		{
+			continue;
+		}
+
+		uint32_t sequence = reader.u32();
+		uint32_t baseline = reader.u32();
+		uint32_t tick = reader.u32();
+		uint16_t part = reader.u16();
+		uint32_t first = reader.u32();
+		uint32_t end = reader.u32();
+		uint16_t part_count = reader.u16();
+		if (!reader.ok() || part >= part_count || part_count > ReplicationServer::max_snapshot_parts || first > end
+			|| sequence <= applied_sequence || sequence < assembly.sequence)
+		{
+			continue;
+		}
+
+		// A newer snapshot replaces one still being put together; the server will build on what we ack.
+		if (sequence != assembly.sequence)
+		{
+			if (assembly.sequence > applied_sequence)
+			{
+				++dropped;
+			}
+			assembly.sequence = sequence;
+			assembly.baseline = baseline;
+			assembly.tick = tick;
+			assembly.part_count = part_count;
+			assembly.received = 0;
+		}
+
+		if (part_count != assembly.part_count || baseline != assembly.baseline || ((assembly.received >> part) & 1))
+		{
+			continue;
+		}
+		Part& stored = assembly.parts[part];
+		stored.first = first;
+		stored.end = end;
+		stored.records.assign(reader.rest(), reader.rest() + reader.remaining());
+		assembly.received |= 1u << part;
+	}
+}
+
+void ReplicationClient::finish(World& world)
+{
+	// Whatever has arrived of the newest snapshot is all of it we take. Parts still on their way are
+	// dropped with the rest when the next ack names this one.
+	if (assembly.sequence <= applied_sequence)
+	{
+		return;
+	}
+
+	NetSnapshot& next = history[assembly.sequence % history_size];
+	if (!reconstruct(next))
+	{
+		next.sequence = 0;
+		assembly.sequence = applied_sequence;
+		++dropped;
+		return;
+	}
+	for (uint16_t part = 0; part < assembly.part_count; ++part)
+	{
+		lost += ((assembly.received >> part) & 1) ? 0 : 1;
+	}
+
+	// Lost ranges keep showing what they showed, which is at least as recent as the baseline's.
+	showing.sequence = next.sequence;
+	showing.tick = next.tick;
+	showing.entities.clear();
+	uint32_t covered = 0;
+	for (uint16_t part = 0; part < assembly.part_count; ++part)
+	{
+		if ((assembly.received >> part) & 1)
+		{
+			const Part& arrived = assembly.parts[part];
+			append_range(showing.entities, shown.entities, covered, arrived.first);
+			append_range(showing.entities, next.entities, arrived.first, arrived.end);
+			covered = arrived.end;
+		}
+	}
+	append_range(showing.entities, shown.entities, covered, end_of_indices);
+
+	apply(world, showing);
+	applied_sequence = assembly.sequence;
+	applied_parts = assembly.received;
+}
+
+bool ReplicationClient::reconstruct(NetSnapshot& next) const
+{
+	static const std::vector<NetEntity> nothing;
+	const std::vector<NetEntity>* base = &nothing;
+	if (assembly.baseline != 0)
+	{
+		const NetSnapshot& stored = history[assembly.baseline % history_size];
+		if (stored.sequence != assembly.baseline)
+		{
+			return false;
+		}
+		base = &stored.entities;
+	}
+
+	// The baseline's slot is never the one being written: the server only uses baselines that fit.
+	if (&next.entities == base)
+	{
+		return false;
+	}
+
+	next.sequence = assembly.sequence;
+	next.tick = assembly.tick;
+	next.entities.clear();
+
+	// Ranges whose part didn't arrive stay as the baseline has them, as the server assumes once we ack.
+	uint32_t covered = 0;
+	for (uint16_t p = 0; p < assembly.part_count; ++p)
+	{
+		if (!((assembly.received >> p) & 1))
+		{
+			continue;
+		}
+		const Part& part = assembly.parts[p];
+		if (part.first < covered)
+		{
+			return false;
+		}
+		append_range(next.entities, *base, covered, part.first);
+
+		auto before = [](const NetEntity& entity, uint32_t index) { return entity.index < index; };
+		size_t b = std::lower_bound(base->begin(), base->end(), part.first, before) - base->begin();
+		NetReader reader(part.records.data(), part.records.size());
+		uint32_t index = part.first;
+		while (reader.ok() && !reader.done())
+		{
+			index += static_cast<uint32_t>(reader.varint());
+			uint8_t flags = reader.u8();
+			if (index < part.first || index >= part.end)
+			{
+				return false;
+			}
+			for (; b < base->size() && (*base)[b].index < index; ++b)
+			{
+				next.entities.push_back((*base)[b]);
+			}
+			const NetEntity* known = b < base->size() && (*base)[b].index == index ? &(*base)[b++] : nullptr;
+
+			if (flags & RecordRemoved)
+			{
+				continue;
+			}
+
+			NetEntity entity;
+			if (flags & RecordNew)
+			{
+				entity.index = index;
+				entity.generation = static_cast<uint32_t>(reader.varint());
+				entity.x = static_cast<int32_t>(reader.zigzag());
+				entity.y = static_cast<int32_t>(reader.zigzag());
+				entity.rotation = reader.u16();
+				read_sprite(reader, entity);
+			}
+			else if (known)
+			{
+				entity = *known;
+				entity.x += (flags & RecordX) ? static_cast<int32_t>(reader.zigzag()) : 0;
+				entity.y += (flags & RecordY) ? static_cast<int32_t>(reader.zigzag()) : 0;
+				entity.rotation = (flags & RecordRotation) ? reader.u16() : entity.rotation;
+				if (flags & RecordSprite)
+				{
+					read_sprite(reader, entity);
+				}
+			}
+			else
+			{
+				return false;
+			}
+			next.entities.push_back(entity);
+		}
+		if (!reader.ok())
+		{
+			return false;
+		}
+		for (; b < base->size() && (*base)[b].index < part.end; ++b)
+		{
+			next.entities.push_back((*base)[b]);
+		}
+		covered = part.end;
+	}
+	append_range(next.entities, *base, covered, end_of_indices);
+	return true;
+}
+
+void ReplicationClient::apply(World& world, const NetSnapshot& next)
+{
+	// Both lists are sorted by server index, so one pass pairs every local entity with its update.
+	next_locals.clear();
+	size_t s = 0;
+	for (const NetEntity& entity : next.entities)
+	{
+		for (; s < shown.entities.size() && shown.entities[s].index < entity.index; ++s)
+		{
+			world.destroy(locals[s]);
+		}
+
+		if (s < shown.entities.size() && shown.entities[s].index == entity.index)
+		{
+			const NetEntity& old = shown.entities[s];
+			Entity local = locals[s++];
+			if (old.generation == entity.generation)
+			{
+				if (!same_transform(old, entity))
+				{
+					*world.get<Transform>(local) = to_transform(entity);
+				}
+				if (!same_sprite(old, entity))
+				{
+					*world.get<Sprite>(local) = to_sprite(entity);
+				}
+				next_locals.push_back(local);
+				continue;
+			}
+			world.destroy(local);
+		}
+
+		next_locals.push_back(world.create(to_transform(entity), to_sprite(entity), Bounds{}));
+	}
+	for (; s < shown.entities.size(); ++s)
+	{
+		world.destroy(locals[s]);
+	}
+
+	shown.sequence = next.sequence;
+	shown.tick = next.tick;
+	shown.entities = next.entities;
+	locals.swap(next_locals);
+}
+
+int run_server_headless(const NetOptions& options, const StressConfig& config)
+{
+	using Clock = std::chrono::steady_clock;
+
+	StressConfig scene = config;
+	scene.enabled = true;
+
+	JobSystem jobs;
+	ChunkAllocator chunk_allocator(jobs.topology().node_ids);
+	World world(chunk_allocator, jobs);
+	Simulation simulation(world, jobs, scene);
+	simulation.populate();
+	SpatialGrid grid;
+
+	ReplicationServer server;
+	if (!server.open(options.serve_port))
+	{
+		return -1;
+	}
+	server.set_loss(options.loss);
+	std::cout << "Serving " << world.entity_count() << " entities on UDP port " << server.port() << "\n";
+
+	// Real-time fixed steps. A server that falls behind skips ahead rather than trying to catch up.
+	const auto step = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(Simulation::step_seconds));
+	auto next = Clock::now();
+	uint64_t reported_bytes = 0;
+	for (;;)
+	{
+		simulation.step();
+		grid.build(world);
+		server.update(world, grid);
+
+		if (simulation.step_index() % 300 == 0)
+		{
+			double kilobytes = (server.bytes_sent() - reported_bytes) / 1024.0 / 5.0;
+			reported_bytes = server.bytes_sent();
+			char line[128];
+			std::snprintf(line, sizeof(line), "step %llu: %zu client(s), %zu relevant entities, %.1f KB/s",
+				static_cast<unsigned long long>(simulation.step_index()), server.client_count(), server.last_relevant(), kilobytes);
+			std::cout << line << "\n";
+		}
+
+		next += step;
+		auto now = Clock::now();
+		if (now > next + step * 15)
+		{
+			next = now;
+		}
+		std::this_thread::sleep_until(next);
+	}
+}
+
+int run_client_headless(const NetOptions& options, const StressConfig& config)
+{
+	using Clock = std::chrono::steady_clock;
+
+	NetAddress address;
+	if (!parse_address(options.connect, address))
+	{
+		std::cerr << "Bad server address " << options.connect << "\n";
+		return -1;
+	}
+
+	JobSystem jobs;
+	ChunkAllocator chunk_allocator(jobs.topology().node_ids);
+	World world(chunk_allocator, jobs);
+	ReplicationClient client;
+	if (!client.connect(address))
+	{
+		return -1;
+	}
+
+	Camera2D camera = headless_camera(config);
+	const auto step = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(Simulation::step_seconds));
+	auto next = Clock::now();
+	for (int frame = 0; frame < config.frames; ++frame)
+	{
+		client.update(world, camera.bounds());
+		next += step;
+		std::this_thread::sleep_until(next);
+	}
+
+	char line[192];
+	std::snprintf(line, sizeof(line), "Received snapshot %u: %zu entities mirrored, %.1f KB over %d frames, %llu snapshots dropped, %llu parts lost",
+		client.sequence(), world.entity_count(), client.bytes_received() / 1024.0, config.frames, static_cast<unsigned long long>(client.snapshots_dropped()),
+		static_cast<unsigned long long>(client.parts_lost()));
+	std::cout << line << "\n";
+	bool connected = client.connected();
+	client.disconnect(world);
+	return connected ? 0 : 1;
+}
+
+int run_loopback_test(const NetOptions& options, const StressConfig& config)
+{
+	StressConfig scene = config;
+	scene.enabled = true;
+
+	JobSystem jobs;
+	ChunkAllocator chunk_allocator(jobs.topology().node_ids);
+	World world(chunk_allocator, jobs);
+	Simulation simulation(world, jobs, scene);
+	simulation.populate();
+	SpatialGrid grid;
+
+	ReplicationServer server;
+	if (!server.open(0))
+	{
+		return -1;
+	}
+	server.set_loss(options.loss);
+
+	World mirror(chunk_allocator, jobs);
+	ReplicationClient client;
+	if (!client.connect({ 0x7f000001, server.port() }))
+	{
+		return -1;
+	}
+
+	// The view sweeps across the scene, so entities keep entering and leaving it.
+	Camera2D camera = headless_camera(config);
+	NetSnapshot expected;
+	uint32_t checked = 0;
+	size_t snapshots = 0;
+	size_t mismatches = 0;
+	size_t relevant = 0;
+	for (int frame = 0; frame < config.frames; ++frame)
+	{
+		camera.x = config.extent * (0.25f + 0.5f * frame / config.frames);
+
+		simulation.step();
+		grid.build(world);
+		server.update(world, grid);
+		client.update(mirror, camera.bounds());
+		relevant += server.last_relevant();
+
+		// The client has to hold exactly what the server will build on once the ack arrives.
+		if (client.sequence() != checked)
+		{
+			checked = client.sequence();
+			++snapshots;
+			if (!server.held_by(0, checked, client.parts(), expected) || expected.entities != client.held().entities
+				|| mirror.entity_count() != client.applied().entities.size())
+			{
+				++mismatches;
+			}
+		}
+	}
+
+	// Against sending each relevant entity's Transform and Sprite whole, every step.
+	double steps = std::max(config.frames, 1);
+	double bytes = static_cast<double>(server.bytes_sent()) / steps;
+	double raw = relevant / steps * (sizeof(Transform) + sizeof(Sprite) + sizeof(uint32_t));
+	char line[224];
+	std::snprintf(line, sizeof(line), "Loopback: %d steps, %.0f relevant entities per step, %zu snapshots applied, %llu dropped, %llu parts lost, %zu mismatched",
+		config.frames, relevant / steps, snapshots, static_cast<unsigned long long>(client.snapshots_dropped()),
+		static_cast<unsigned long long>(client.parts_lost()), mismatches);
+	std::cout << line << "\n";
+	std::snprintf(line, sizeof(line), "%.1f KB per step (%.1f KB/s at 60 Hz), %.1f%% of sending full state", bytes / 1024.0, bytes * 60.0 / 1024.0, raw > 0.0 ? bytes * 100.0 / raw : 0.0);
+	std::cout << line << "\n";
+
+	client.disconnect(mirror);
+	server.close();
+	return mismatches == 0 && snapshots > 0 ? 0 : 1;
+}
@@ -0,0 +1,198 @@
+#pragma once
+
+#include "Camera.h"
+#include "ECS.h"
+#include "Net.h"
+#include "SpatialGrid.h"
+#include "StressScene.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// One entity as it goes on the wire: Transform and Sprite quantized, keyed by the server's entity.
+struct NetEntity
+{
+	uint32_t index;
+	uint32_t generation;
+	int32_t x;
+	int32_t y;
+	uint16_t rotation;
+	uint16_t width;
+	uint16_t height;
+	uint32_t region;
+	uint32_t color;
+
+	bool operator==(const NetEntity&) const = default;
+};
+
+// Everything one client can see at one server step, sorted by entity index.
+struct NetSnapshot
+{
+	uint32_t sequence = 0;
+	uint32_t tick = 0;
+	std::vector<NetEntity> entities;
+};
+
+struct NetOptions
+{
+	uint16_t serve_port = 0;
+	std::string connect;
+	bool loopback = false;
+
+	// Fraction of snapshot packets the server throws away, to exercise recovery.
+	float loss = 0.0f;
+};
+
+// Consumes argv[i] and its value when it is one of --serve PORT, --connect HOST:PORT, --loopback or
+// --net-loss FRACTION.
+bool parse_net_argument(int argc, char* argv[], int& i, NetOptions& options);
+
+// Sends each client the entities near its view, as a delta against what that client last acknowledged
+// holding. Every packet of a snapshot covers its own range of entity indices and decodes against the
+// baseline by itself, and the client acknowledges which packets it got. Both ends then hold the same
+// snapshot: the new entities in the ranges that arrived, the baseline's everywhere else. Entities whose
+// chunk hasn't been written since the baseline are taken from it without being quantized again.
+class ReplicationServer
+{
+public:
+	static constexpr size_t max_clients = 16;
+	static constexpr uint32_t history_size = 32;
+
+	// A snapshot stops at this many packets and leaves the indices past them as the baseline had them.
+	// The next one starts where it stopped, so a client that has fallen far behind catches up over a few
+	// steps without any step costing more.
+	static constexpr uint32_t max_snapshot_parts = 32;
+
+	bool open(uint16_t port);
+	void close();
+
+	// After each step, with the grid built over the stepped world. Reads acknowledgements and views,
+	// sends every client its snapshot and advances the world tick.
+	void update(World& world, const SpatialGrid& grid);
+
+	uint16_t port() const { return socket.local_port(); }
+	size_t client_count() const { return clients.size(); }
+	uint64_t bytes_sent() const { return socket.bytes_sent(); }
+	size_t last_relevant() const { return relevant_total; }
+	void set_loss(float fraction) { loss = fraction; }
+
+	// What a client holds after receiving the parts of a snapshot set in the parts mask, while the
+	// snapshot and its baseline are still known.
+	bool held_by(size_t client, uint32_t sequence, uint32_t parts, NetSnapshot& out) const;
+
+private:
+	struct Sent
+	{
+		NetSnapshot snapshot;
+		uint32_t baseline = 0;
+
+		// Where each part's range of indices begins, then where the last one ends.
+		std::vector<uint32_t> bounds;
+	};
+
+	struct Client
+	{
+		NetAddress address;
+		Rect view;
+		NetSnapshot acked;
+		uint32_t next_sequence = 1;
+		uint32_t resume = 0;
+		uint64_t last_heard = 0;
+		Sent history[history_size];
+	};
+
+	void receive();
+	void build(Client& client, const SpatialGrid& grid, const NetSnapshot* baseline, uint32_t tick);
+	void encode(const NetSnapshot* baseline, const NetSnapshot& next, uint32_t first, std::vector<uint32_t>& bounds);
+	void send(Client& client);
+	bool compose(const Client& client, uint32_t sequence, uint32_t parts, NetSnapshot& out) const;
+
+	UdpSocket socket;
+	std::vector<Client> clients;
+	NetSnapshot building;
+	NetSnapshot composing;
+	std::vector<SpatialGrid::Entry> relevant;
+	std::vector<std::vector<uint8_t>> packets;
+	std::vector<uint8_t> incoming;
+	uint64_t steps = 0;
+	size_t relevant_total = 0;
+	float loss = 0.0f;
+	uint32_t loss_state = 1;
+};
+
+// Mirrors what a ReplicationServer sends into a local world: one entity with a Transform, Sprite and
+// Bounds per replicated entity, created, updated and destroyed as snapshots arrive.
+class ReplicationClient
+{
+public:
+	static constexpr uint32_t history_size = ReplicationServer::history_size;
+
+	bool connect(const NetAddress& server);
+	void disconnect(World& world);
+
+	// Main thread, while nothing else changes the world. Applies whatever parts of the newest snapshot
+	// have arrived, then acknowledges them and tells the server what view to fill. Ranges whose part
+	// was lost keep showing what they showed before.
+	void update(World& world, const Rect& view);
+
+	bool connected() const { return applied_sequence != 0; }
+	uint32_t sequence() const { return applied_sequence; }
+	uint32_t parts() const { return applied_parts; }
+	const NetSnapshot& applied() const { return shown; }
+
+	// The snapshot acknowledged to the server, which it builds the next deltas on.
+	const NetSnapshot& held() const { return history[applied_sequence % history_size]; }
+
+	uint64_t bytes_received() const { return socket.bytes_received(); }
+	uint64_t snapshots_dropped() const { return dropped; }
+	uint64_t parts_lost() const { return lost; }
+
+private:
+	struct Part
+	{
+		uint32_t first = 0;
+		uint32_t end = 0;
+		std::vector<uint8_t> records;
+	};
+
+	struct Assembly
+	{
+		uint32_t sequence = 0;
+		uint32_t baseline = 0;
+		uint32_t tick = 0;
+		uint16_t part_count = 0;
+		uint32_t received = 0;
+		Part parts[ReplicationServer::max_snapshot_parts];
+	};
+
+	void receive();
+	void finish(World& world);
+	bool reconstruct(NetSnapshot& next) const;
+	void apply(World& world, const NetSnapshot& next);
+
+	UdpSocket socket;
+	NetAddress server;
+	Assembly assembly;
+	NetSnapshot history[history_size];
+	NetSnapshot shown;
+	NetSnapshot showing;
+	std::vector<Entity> locals;
+	std::vector<Entity> next_locals;
+	std::vector<uint8_t> incoming;
+	uint32_t applied_sequence = 0;
+	uint32_t applied_parts = 0;
+	uint32_t updates = 0;
+	uint64_t dropped = 0;
+	uint64_t lost = 0;
+};
+
+// A headless server running the stress scene until it is stopped.
+int run_server_headless(const NetOptions& options, const StressConfig& config);
+
+// A headless client that follows a server for config.frames frames and reports what it received.
+int run_client_headless(const NetOptions& options, const StressConfig& config);
+
+// A server and a client in one process over loopback. Checks every snapshot the client rebuilds
+// against what the server sent, and reports bandwidth. Returns 0 when they all match.
+int run_loopback_test(const NetOptions& options, const StressConfig& config);
@@ -0,0 +1,533 @@
+#include "Rollback.h"
+
+#include "ChunkAllocator.h"
+#include "ECS.h"
+#include "JobSystem.h"
+
+#include <SDL3/SDL.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+namespace
+{
+	constexpr uint32_t protocol_id = 0x314b4252;
+
+	enum PacketType : uint8_t
+	{
+		InputPacket = 1,
+		DonePacket
+	};
+
+	constexpr size_t max_packet_bytes = 1200;
+	constexpr uint64_t no_rollback = ~0ull;
+	constexpr int max_latency_ms = 1000;
+
+	// After both checksums are known, keep answering for this long so the peer hears ours too.
+	constexpr int linger_frames = 120;
+	constexpr int finish_timeout_frames = 10 * 60;
+
+	using MergedKeys = std::array<uint32_t, StepInput::max_keys * 2>;
+
+	// Every peer sees the same keys in the same order: both inputs merged and sorted. There are at most
+	// eight, so an insertion sort does it.
+	uint32_t merge(const StepInput& a, const StepInput& b, MergedKeys& keys)
+	{
+		auto end = std::copy_n(a.keys, std::min(a.count, StepInput::max_keys), keys.begin());
+		end = std::copy_n(b.keys, std::min(b.count, StepInput::max_keys), end);
+		for (auto it = keys.begin(); it != end; ++it)
+		{
+			std::rotate(std::upper_bound(keys.begin(), it, *it), it, it + 1);
+		}
+		return static_cast<uint32_t>(end - keys.begin());
+	}
+
+	double elapsed_ms(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	int run_rollback_bench(const RollbackOptions& options, const StressConfig& config)
+	{
+		// Two copies of the scene. The predicted one runs ahead guessing that no key is pressed, as a
+		// session does while waiting on its peer; the reference runs straight with the real keys.
+		JobSystem jobs;
+		ChunkAllocator chunk_allocator(jobs.topology().node_ids);
+		World predicted_world(chunk_allocator, jobs);
+		World reference_world(chunk_allocator, jobs);
+		Simulation predicted(predicted_world, jobs, config);
+		Simulation reference(reference_world, jobs, config);
+		predicted.populate();
+		reference.populate();
+		for (int i = 0; i < 60; ++i)
+		{
+			predicted.step();
+			reference.step();
+		}
+
+		std::vector<SimulationSnapshot> snapshots(options.window);
+		constexpr int rounds = 30;
+		double save_ms = 0.0;
+		double restore_ms = 0.0;
+		double resimulate_ms = 0.0;
+		double worst_ms = 0.0;
+		int mismatches = 0;
+		int unchanged = 0;
+		for (int round = 0; round < rounds; ++round)
+		{
+			for (SimulationSnapshot& snapshot : snapshots)
+			{
+				auto start = std::chrono::steady_clock::now();
+				predicted.save(snapshot);
+				save_ms += elapsed_ms(start);
+				predicted.step();
+			}
+
+			// The peer's input for the first two steps of the window arrives late: the fountain key, pressed
+			// and pressed again, so one step's worth of particles is spawned that the guess didn't have and
+			// every predicted step has to be redone.
+			for (uint32_t i = 0; i < options.window; ++i)
+			{
+				if (i < 2)
+				{
+					reference.handle_key(SDLK_F3);
+				}
+				reference.step();
+			}
+			unchanged += predicted.checksum() == reference.checksum();
+
+			auto start = std::chrono::steady_clock::now();
+			predicted.restore(snapshots.front());
+			double restore = elapsed_ms(start);
+			start = std::chrono::steady_clock::now();
+			for (uint32_t i = 0; i < options.window; ++i)
+			{
+				if (i < 2)
+				{
+					predicted.handle_key(SDLK_F3);
+				}
+				predicted.step();
+			}
+			double resimulate = elapsed_ms(start);
+
+			restore_ms += restore;
+			resimulate_ms += resimulate;
+			worst_ms = std::max(worst_ms, restore + resimulate);
+			mismatches += predicted.checksum() != reference.checksum();
+		}
+
+		char line[224];
+		std::snprintf(line, sizeof(line), "Rollback of %u steps over %zu entities, %zu chunks, %zu particles: restore %.3f ms + re-simulate %.3f ms = %.3f ms mean, %.3f ms max",
+			options.window, predicted_world.entity_count(), predicted_world.chunk_count(), predicted.particles().particle_count(), restore_ms / rounds, resimulate_ms / rounds, (restore_ms + resimulate_ms) / rounds, worst_ms);
+		std::cout << line << "\n";
+		std::snprintf(line, sizeof(line), "save %.3f ms per step, %.1f MB per snapshot; %d of %d corrections diverged from the straight run, %d guesses were already right",
+			save_ms / (rounds * options.window), snapshots.front().world.memory_bytes() / (1024.0 * 1024.0), mismatches, rounds, unchanged);
+		std::cout << line << "\n";
+		return mismatches == 0 && unchanged == 0 ? 0 : 1;
+	}
+}
+
+bool parse_rollback_argument(int argc, char* argv[], int& i, RollbackOptions& options)
+{
+	const char* arg = argv[i];
+	if (std::strcmp(arg, "--rollback-bench") == 0)
+	{
+		options.bench = true;
+		return true;
+	}
+	if (i + 1 >= argc)
+	{
+		return false;
+	}
+
+	const char* value = argv[i + 1];
+	if (std::strcmp(arg, "--rollback") == 0)
+	{
+		int port = std::atoi(value);
+		if (port <= 0 || port > 65535)
+		{
+			return false;
+		}
+		options.port = static_cast<uint16_t>(port);
+	}
+	else if (std::strcmp(arg, "--peer") == 0)
+	{
+		options.peer = value;
+	}
+	else if (std::strcmp(arg, "--latency") == 0)
+	{
+		options.latency_ms = std::clamp(std::atoi(value), 0, max_latency_ms);
+	}
+	else if (std::strcmp(arg, "--rollback-window") == 0)
+	{
+		options.window = static_cast<uint32_t>(std::clamp(std::atoi(value), 1, static_cast<int>(RollbackSession::max_window)));
+	}
+	else
+	{
+		return false;
+	}
+	++i;
+	return true;
+}
+
+bool StepInput::operator==(const StepInput& other) const
+{
+	return count == other.count && std::equal(keys, keys + count, other.keys);
+}
+
+RollbackSession::RollbackSession(Simulation& simulation, uint32_t window)
+	: simulation(simulation), window(std::clamp(window, 1u, max_window)), rollback_from(no_rollback)
+{
+	// Rolling back never reaches further than the window, so one snapshot per step in it is enough.
+	snapshots.resize(this->window + 1);
+	snapshot_steps.assign(this->window + 1, no_rollback);
+}
+
+bool RollbackSession::connect(uint16_t port, const NetAddress& address, int latency_ms)
+{
+	if (!socket.open(port))
+	{
+		return false;
+	}
+
+	peer = address;
+	latency = std::chrono::duration_cast<Clock::duration>(std::chrono::milliseconds(latency_ms));
+	latency_steps = static_cast<uint64_t>(latency_ms * 60 / 1000);
+	return true;
+}
+
+void RollbackSession::press(uint32_t key)
+{
+	if (pending.count < StepInput::max_keys)
+	{
+		pending.keys[pending.count++] = key;
+	}
+}
+
+bool RollbackSession::update(bool advance)
+{
+	receive();
+	if (rollback_from < simulation.step_index())
+	{
+		roll_back();
+	}
+	rollback_from = no_rollback;
+
+	// The peer's latest step is latency_steps old by the time it gets here; being further ahead than
+	// that means this side started first, and waiting a frame evens it out.
+	bool stepped = false;
+	uint64_t step = simulation.step_index();
+	if (advance && step >= remote_count + window)
+	{
+		++counters.stalls;
+	}
+	else if (advance && step > remote_step + latency_steps + 1)
+	{
+		++counters.waits;
+	}
+	else if (advance)
+	{
+		local[step % input_history] = pending;
+		pending = {};
+		if (step >= remote_count)
+		{
+			save(step);
+		}
+		run(step);
+		stepped = true;
+	}
+
+	send_inputs();
+	if (done)
+	{
+		std::vector<uint8_t> packet;
+		NetWriter writer(packet);
+		writer.u32(protocol_id);
+		writer.u8(DonePacket);
+		writer.u32(static_cast<uint32_t>(checksum));
+		writer.u32(static_cast<uint32_t>(checksum >> 32));
+		send(packet);
+	}
+	flush();
+	return stepped;
+}
+
+void RollbackSession::finish(uint64_t sum)
+{
+	done = true;
+	checksum = sum;
+}
+
+void RollbackSession::receive()
+{
+	incoming.resize(max_packet_bytes);
+	NetAddress from;
+	while (size_t size = socket.receive(from, incoming.data(), incoming.size()))
+	{
+		NetReader reader(incoming.data(), size);
+		if (!(from == peer) || reader.u32() != protocol_id)
+		{
+			continue;
+		}
+
+		uint8_t type = reader.u8();
+		if (type == DonePacket)
+		{
+			uint64_t low = reader.u32();
+			uint64_t high = reader.u32();
+			if (reader.ok())
+			{
+				peer_done = true;
+				peer_sum = low | high << 32;
+			}
+			continue;
+		}
+		if (type != InputPacket)
+		{
+			continue;
+		}
+
+		uint64_t sender_step = reader.varint();
+		uint64_t acked = reader.varint();
+		uint64_t first = reader.varint();
+		uint32_t count = reader.u8();
+		if (!reader.ok())
+		{
+			continue;
+		}
+		remote_step = std::max(remote_step, sender_step);
+		peer_acked = std::min(std::max(acked, peer_acked), simulation.step_index());
+
+		// Packets overlap; only the steps right after the ones already held are new.
+		for (uint64_t step = first; step < first + count; ++step)
+		{
+			StepInput input;
+			input.count = reader.u8();
+			if (input.count > StepInput::max_keys)
+			{
+				break;
+			}
+			for (uint32_t k = 0; k < input.count; ++k)
+			{
+				input.keys[k] = static_cast<uint32_t>(reader.varint());
+			}
+			if (!reader.ok() || step > remote_count)
+			{
+				break;
+			}
+			if (step < remote_count)
+			{
+				continue;
+			}
+
+			remote[step % input_history] = input;
+			++remote_count;
+			if (step < simulation.step_index() && !(input == StepInput{}))
+			{
+				rollback_from = std::min(rollback_from, step);
+			}
+		}
+	}
+}
+
+void RollbackSession::roll_back()
+{
+	uint64_t target = simulation.step_index();
+	uint64_t slot = rollback_from % snapshots.size();
+	if (snapshot_steps[slot] != rollback_from)
+	{
+		std::cerr << "No snapshot to roll back to step " << rollback_from << "\n";
+		return;
+	}
+
+	auto start = Clock::now();
+	simulation.restore(snapshots[slot]);
+	counters.restore_ms += elapsed_ms(start);
+
+	// The snapshot being run from still holds its step; later ones were taken on a wrong guess.
+	start = Clock::now();
+	for (uint64_t step = rollback_from; step < target; ++step)
+	{
+		if (step > rollback_from && step >= remote_count)
+		{
+			save(step);
+		}
+		run(step);
+	}
+	counters.resimulate_ms += elapsed_ms(start);
+
+	++counters.rollbacks;
+	counters.resimulated += target - rollback_from;
+	counters.deepest = std::max(counters.deepest, target - rollback_from);
+}
+
+void RollbackSession::save(uint64_t step)
+{
+	auto start = Clock::now();
+	uint64_t slot = step % snapshots.size();
+	simulation.save(snapshots[slot]);
+	snapshot_steps[slot] = step;
+	counters.save_ms += elapsed_ms(start);
+	++counters.saves;
+}
+
+void RollbackSession::run(uint64_t step)
+{
+	StepInput guess;
+	MergedKeys keys;
+	uint32_t count = merge(local[step % input_history], step < remote_count ? remote[step % input_history] : guess, keys);
+	for (uint32_t k = 0; k < count; ++k)
+	{
+		simulation.handle_key(keys[k]);
+	}
+	simulation.step();
+}
+
+void RollbackSession::send_inputs()
+{
+	// Everything the peer hasn't acknowledged goes in every packet, so a lost one costs nothing.
+	uint64_t step = simulation.step_index();
+	uint64_t first = std::max(peer_acked, step > input_history ? step - input_history : 0);
+	uint64_t count = std::min<uint64_t>(step - first, 255);
+
+	std::vector<uint8_t> packet;
+	NetWriter writer(packet);
+	writer.u32(protocol_id);
+	writer.u8(InputPacket);
+	writer.varint(step);
+	writer.varint(remote_count);
+	writer.varint(first);
+	writer.u8(0);
+
+	// Most steps have no keys and take a byte; the count is patched once it is known what fit.
+	size_t count_at = packet.size() - 1;
+	uint64_t written = 0;
+	for (; written < count && writer.size() + 1 + StepInput::max_keys * 5 <= max_packet_bytes; ++written)
+	{
+		const StepInput& input = local[(first + written) % input_history];
+		writer.u8(static_cast<uint8_t>(input.count));
+		for (uint32_t k = 0; k < input.count; ++k)
+		{
+			writer.varint(input.keys[k]);
+		}
+	}
+	packet[count_at] = static_cast<uint8_t>(written);
+	send(packet);
+}
+
+void RollbackSession::send(std::vector<uint8_t>& packet)
+{
+	if (latency == Clock::duration::zero())
+	{
+		socket.send(peer, packet.data(), packet.size());
+		return;
+	}
+	outgoing.push_back({ Clock::now() + latency, std::move(packet) });
+}
+
+void RollbackSession::flush()
+{
+	Clock::time_point now = Clock::now();
+	while (!outgoing.empty() && outgoing.front().due <= now)
+	{
+		socket.send(peer, outgoing.front().packet.data(), outgoing.front().packet.size());
+		outgoing.pop_front();
+	}
+}
+
+int run_rollback_headless(const RollbackOptions& options, const StressConfig& config)
+{
+	using Clock = std::chrono::steady_clock;
+
+	StressConfig scene = config;
+	scene.enabled = true;
+	if (options.bench)
+	{
+		return run_rollback_bench(options, scene);
+	}
+
+	NetAddress peer;
+	if (!parse_address(options.peer, peer))
+	{
+		std::cerr << "Bad peer address " << options.peer << "\n";
+		return -1;
+	}
+
+	JobSystem jobs;
+	ChunkAllocator chunk_allocator(jobs.topology().node_ids);
+	World world(chunk_allocator, jobs);
+	Simulation simulation(world, jobs, scene);
+	simulation.populate();
+
+	RollbackSession session(simulation, options.window);
+	if (!session.connect(options.port, peer, options.latency_ms))
+	{
+		return -1;
+	}
+	std::cout << "Rollback peer on port " << options.port << ", " << options.latency_ms << " ms added latency\n";
+
+	// Each peer presses differently; the fountain keys are the inputs the simulation takes.
+	uint32_t random = 0x9e3779b9u * (options.port + 1u);
+	uint64_t target = static_cast<uint64_t>(scene.frames);
+	const auto step = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(Simulation::step_seconds));
+	auto next = Clock::now();
+	bool finished = false;
+	int frames_after = 0;
+	int linger = -1;
+	while (linger != 0)
+	{
+		bool advance = simulation.step_index() < target;
+		if (advance)
+		{
+			random ^= random << 13;
+			random ^= random >> 17;
+			random ^= random << 5;
+			if (random % 120 == 0)
+			{
+				session.press(random & 0x100 ? SDLK_F4 : SDLK_F3);
+			}
+		}
+		session.update(advance);
+
+		if (!finished && !advance && session.confirmed())
+		{
+			session.finish(simulation.checksum());
+			finished = true;
+		}
+		if (finished && session.peer_finished() && linger < 0)
+		{
+			linger = linger_frames;
+		}
+		linger -= linger > 0;
+
+		if (!advance && ++frames_after > finish_timeout_frames)
+		{
+			std::cerr << "Peer never finished\n";
+			return 1;
+		}
+
+		next += step;
+		std::this_thread::sleep_until(next);
+	}
+
+	const RollbackStats& stats = session.stats();
+	uint64_t checksum = simulation.checksum();
+	double rollbacks = static_cast<double>(std::max<uint64_t>(stats.rollbacks, 1));
+	char line[224];
+	std::snprintf(line, sizeof(line), "%llu steps: %llu rollbacks, %.1f steps deep on average, %llu deepest; %llu stalls, %llu waits",
+		static_cast<unsigned long long>(target), static_cast<unsigned long long>(stats.rollbacks), stats.resimulated / rollbacks,
+		static_cast<unsigned long long>(stats.deepest), static_cast<unsigned long long>(stats.stalls), static_cast<unsigned long long>(stats.waits));
+	std::cout << line << "\n";
+	std::snprintf(line, sizeof(line), "save %.3f ms per snapshot; per rollback restore %.3f ms, re-simulate %.3f ms; %.1f KB sent",
+		stats.save_ms / std::max<uint64_t>(stats.saves, 1), stats.restore_ms / rollbacks, stats.resimulate_ms / rollbacks, session.bytes_sent() / 1024.0);
+	std::cout << line << "\n";
+	std::snprintf(line, sizeof(line), "checksum %016llx, peer %016llx: %s",
+		static_cast<unsigned long long>(checksum), static_cast<unsigned long long>(session.peer_checksum()), checksum == session.peer_checksum() ? "match" : "MISMATCH");
+	std::cout << line << "\n";
+	return checksum == session.peer_checksum() ? 0 : 1;
+}
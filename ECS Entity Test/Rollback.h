@@ -0,0 +1,141 @@
+#pragma once
+
+#include "Net.h"
+#include "Simulation.h"
+#include "StressScene.h"
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+struct RollbackOptions
+{
+	uint16_t port = 0;
+	std::string peer;
+
+	// Added to every packet this peer sends, to play over a slow link on loopback.
+	int latency_ms = 0;
+
+	// How many steps a peer may run ahead of the last one it has the other's input for.
+	uint32_t window = 10;
+
+	bool bench = false;
+};
+
+// Consumes argv[i] and its value when it is --rollback PORT, --peer HOST:PORT, --latency MS,
+// --rollback-window N or --rollback-bench.
+bool parse_rollback_argument(int argc, char* argv[], int& i, RollbackOptions& options);
+
+// Keys one peer pressed before one step, in the order Simulation::handle_key should see them.
+struct StepInput
+{
+	static constexpr uint32_t max_keys = 4;
+
+	uint32_t count = 0;
+	uint32_t keys[max_keys] = {};
+
+	bool operator==(const StepInput& other) const;
+};
+
+struct RollbackStats
+{
+	uint64_t rollbacks = 0;
+	uint64_t resimulated = 0;
+	uint64_t deepest = 0;
+	uint64_t saves = 0;
+	uint64_t stalls = 0;
+	uint64_t waits = 0;
+	double save_ms = 0.0;
+	double restore_ms = 0.0;
+	double resimulate_ms = 0.0;
+};
+
+// Two peers each running the whole simulation. A step runs as soon as the local input is known, with
+// the other peer's predicted: key presses are events, so the prediction is that there are none. When
+// the real input turns out to hold a key, the simulation is restored to the snapshot taken before that
+// step and run forward again with it. Both peers apply the same keys in the same order, so once every
+// input has arrived they hold the same state.
+class RollbackSession
+{
+public:
+	static constexpr uint32_t max_window = 30;
+	static constexpr uint32_t input_history = 256;
+
+	RollbackSession(Simulation& simulation, uint32_t window);
+
+	bool connect(uint16_t port, const NetAddress& peer, int latency_ms);
+
+	// Applied before the next step this peer runs.
+	void press(uint32_t key);
+
+	// Once per frame. Takes in the peer's inputs and repairs any step predicted wrong, then runs the
+	// next step if advance is set, the window allows it and this peer isn't running ahead of the other.
+	// Returns whether it stepped.
+	bool update(bool advance);
+
+	// Every step run so far has had both peers' real input.
+	bool confirmed() const { return remote_count >= simulation.step_index(); }
+
+	// Tells the peer this side has finished, with the checksum it finished on.
+	void finish(uint64_t checksum);
+	bool peer_finished() const { return peer_done; }
+	uint64_t peer_checksum() const { return peer_sum; }
+
+	const RollbackStats& stats() const { return counters; }
+	uint64_t bytes_sent() const { return socket.bytes_sent(); }
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	struct Delayed
+	{
+		Clock::time_point due;
+		std::vector<uint8_t> packet;
+	};
+
+	void receive();
+	void roll_back();
+	void save(uint64_t step);
+	void run(uint64_t step);
+	void send_inputs();
+	void send(std::vector<uint8_t>& packet);
+	void flush();
+
+	Simulation& simulation;
+	uint32_t window;
+	std::vector<SimulationSnapshot> snapshots;
+	std::vector<uint64_t> snapshot_steps;
+
+	StepInput local[input_history];
+	StepInput remote[input_history];
+	StepInput pending;
+
+	// Steps below remote_count have the peer's input, and steps below peer_acked have reached the peer.
+	uint64_t remote_count = 0;
+	uint64_t peer_acked = 0;
+	uint64_t remote_step = 0;
+	uint64_t rollback_from;
+
+	UdpSocket socket;
+	NetAddress peer;
+	Clock::duration latency{};
+	uint64_t latency_steps = 0;
+	std::deque<Delayed> outgoing;
+	std::vector<uint8_t> incoming;
+
+	bool done = false;
+	uint64_t checksum = 0;
+	bool peer_done = false;
+	uint64_t peer_sum = 0;
+
+	RollbackStats counters;
+};
+
+// Without a peer (--rollback-bench): runs a window's worth of steps guessing no input, saving before
+// each, then rolls back and runs them again with a key that arrived late. Each part is timed, and the
+// corrected state is checked against a second copy of the scene that ran straight with that key.
+// With one: plays config.frames steps against it at 60 Hz, pressing fountain keys at random, then
+// compares final checksums. Returns 0 when the state came out the same.
+int run_rollback_headless(const RollbackOptions& options, const StressConfig& config);
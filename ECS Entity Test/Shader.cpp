@@ -0,0 +1,269 @@
+#include "Shader.h"
+
+#include "Hash.h"
+
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace
+{
+	constexpr uint32_t binary_version = 1;
+
+	struct BinaryHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t key;
+		uint32_t format;
+		uint32_t length;
+	};
+
+	std::string cache_directory;
+	uint64_t driver_key = 0;
+	bool cache_enabled = false;
+	ProgramCacheStats stats = {};
+
+	std::string binary_path(uint64_t key)
+	{
+		static const char digits[] = "0123456789abcdef";
+		std::string name(16, '0');
+		for (int i = 15; i >= 0; --i, key >>= 4)
+		{
+			name[i] = digits[key & 0xf];
+		}
+		return cache_directory + "/" + name + ".bin";
+	}
+
+	GLuint load_binary(uint64_t key)
+	{
+		std::ifstream file(binary_path(key), std::ios::binary);
+		if (!file)
+		{
+			return 0;
+		}
+
+		BinaryHeader header = {};
+		file.read(reinterpret_cast<char*>(&header), sizeof(header));
+		if (!file || std::memcmp(header.magic, "PBIN", 4) != 0 || header.version != binary_version || header.key != key)
+		{
+			return 0;
+		}
+
+		std::vector<char> binary(header.length);
+		file.read(binary.data(), header.length);
+		if (!file)
+		{
+			return 0;
+		}
+
+		GLuint program = glCreateProgram();
+		glProgramBinary(program, header.format, binary.data(), static_cast<GLsizei>(binary.size()));
+
+		// Drivers may reject a binary after an update even when the version string matches.
+		GLint status = 0;
+		glGetProgramiv(program, GL_LINK_STATUS, &status);
+		if (!status)
+		{
+			glDeleteProgram(program);
+			return 0;
+		}
+		return program;
+	}
+
+	void save_binary(uint64_t key, GLuint program)
+	{
+		GLint length = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0)
+		{
+			return;
+		}
+
+		std::vector<char> binary(length);
+		GLenum format = 0;
+		glGetProgramBinary(program, length, nullptr, &format, binary.data());
+
+		std::ofstream file(binary_path(key), std::ios::binary | std::ios::trunc);
+		if (!file)
+		{
+			std::cerr << "Failed to write program binary cache\n";
+			return;
+		}
+
+		BinaryHeader header = {};
+		std::memcpy(header.magic, "PBIN", 4);
+		header.version = binary_version;
+		header.key = key;
+		header.format = format;
+		header.length = static_cast<uint32_t>(length);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(binary.data(), length);
+	}
+
+	GLuint compile_and_link(const GLenum* types, const char* const* sources, size_t count)
+	{
+		GLuint shaders[4] = {};
+		if (count > 4)
+		{
+			std::cerr << "Too many shader stages\n";
+			return 0;
+		}
+
+		bool compiled = true;
+		for (size_t i = 0; i < count; ++i)
+		{
+			shaders[i] = compile_shader(types[i], sources[i]);
+			compiled = compiled && shaders[i];
+		}
+
+		GLuint program = 0;
+		if (compiled)
+		{
+			program = glCreateProgram();
+			if (cache_enabled)
+			{
+				glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+			}
+
+			for (size_t i = 0; i < count; ++i)
+			{
+				glAttachShader(program, shaders[i]);
+			}
+
+			bool linked = link_program(program);
+
+			for (size_t i = 0; i < count; ++i)
+			{
+				glDetachShader(program, shaders[i]);
+			}
+
+			if (!linked)
+			{
+				glDeleteProgram(program);
+				program = 0;
+			}
+		}
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			glDeleteShader(shaders[i]);
+		}
+		return program;
+	}
+}
+
+GLuint compile_shader(GLenum type, const char* source)
+{
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, 1, &source, nullptr);
+	glCompileShader(shader);
+
+	GLint status = 0;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+	if (!status)
+	{
+		GLint length = 0;
+		glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+		std::string log(length > 0 ? length : 1, '\0');
+		glGetShaderInfoLog(shader, static_cast<GLsizei>(log.size()), nullptr, log.data());
+		std::cerr << "Shader compile failed:\n" << log << "\n";
+		glDeleteShader(shader);
+		return 0;
+	}
+
+	return shader;
+}
+
+bool link_program(GLuint program)
+{
+	glLinkProgram(program);
+
+	GLint status = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if (!status)
+	{
+		GLint length = 0;
+		glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+		std::string log(length > 0 ? length : 1, '\0');
+		glGetProgramInfoLog(program, static_cast<GLsizei>(log.size()), nullptr, log.data());
+		std::cerr << "Program link failed:\n" << log << "\n";
+		return false;
+	}
+
+	return true;
+}
+
+GLuint create_program(const char* vertex_source, const char* fragment_source)
+{
+	const GLenum types[] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+	const char* sources[] = { vertex_source, fragment_source };
+	return create_program(types, sources, 2);
+}
+
+GLuint create_program(const GLenum* types, const char* const* sources, size_t count)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	uint64_t key = 0;
+	if (cache_enabled)
+	{
+		key = driver_key;
+		for (size_t i = 0; i < count; ++i)
+		{
+			key = fnv1a_bytes(&types[i], sizeof(GLenum), key);
+			key = fnv1a(sources[i], key);
+		}
+
+		GLuint cached = load_binary(key);
+		if (cached)
+		{
+			++stats.hits;
+			stats.build_milliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			return cached;
+		}
+		++stats.misses;
+	}
+
+	GLuint program = compile_and_link(types, sources, count);
+	if (program && cache_enabled)
+	{
+		save_binary(key, program);
+	}
+
+	stats.build_milliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	return program;
+}
+
+void enable_program_cache(const std::string& directory)
+{
+	GLint formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	if (formats <= 0)
+	{
+		std::cerr << "Driver exposes no program binary formats, shader cache disabled\n";
+		return;
+	}
+
+	// Binaries are only valid for the driver build that produced them.
+	driver_key = fnv1a_bytes(&binary_version, sizeof(binary_version));
+	for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION })
+	{
+		const char* text = reinterpret_cast<const char*>(glGetString(name));
+		driver_key = fnv1a(text ? text : "", driver_key);
+	}
+
+	std::error_code error;
+	std::filesystem::create_directories(directory, error);
+	cache_directory = directory;
+	cache_enabled = true;
+}
+
+ProgramCacheStats program_cache_stats()
+{
+	return stats;
+}
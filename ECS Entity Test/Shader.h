@@ -0,0 +1,27 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <string>
+
+struct ProgramCacheStats
+{
+	unsigned hits;
+	unsigned misses;
+	double build_milliseconds;
+};
+
+// Compiles and links a vertex/fragment pair. Returns 0 and logs to stderr on failure.
+GLuint create_program(const char* vertex_source, const char* fragment_source);
+
+// Same, for any set of stages.
+GLuint create_program(const GLenum* types, const char* const* sources, size_t count);
+
+// Stores linked programs under directory, keyed by source hash and driver, and reloads them with
+// glProgramBinary on later runs instead of compiling. Call once after the GL context exists.
+void enable_program_cache(const std::string& directory);
+ProgramCacheStats program_cache_stats();
+
+GLuint compile_shader(GLenum type, const char* source);
+bool link_program(GLuint program);
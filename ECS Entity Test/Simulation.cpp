@@ -0,0 +1,201 @@
+#include "Simulation.h"
+
+#include "ChunkAllocator.h"
+#include "Components.h"
+#include "ECS.h"
+#include "Hash.h"
+#include "InputRecording.h"
+#include "JobSystem.h"
+#include "Profiler.h"
+#include "Visibility.h"
+
+#include <SDL3/SDL.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <utility>
+
+namespace
+{
+	constexpr float fountain_rate = 500000.0f;
+}
+
+Simulation::Simulation(World& world, JobSystem& jobs, const StressConfig& config)
+	: world(world), jobs(jobs), config(config), stress(world, jobs, config), particle_system(jobs)
+{
+	fountain_desc.rate = 0.0f;
+	fountain_desc.lifetime = 2.0f;
+	fountain_desc.direction = 1.5707963f;
+	fountain_desc.spread = 0.8f;
+	fountain_desc.speed_min = 200.0f;
+	fountain_desc.speed_max = 400.0f;
+	fountain_desc.color = 0xff40c0ff;
+	fountain_emitter = particle_system.create_emitter(fountain_desc, 1 << 20);
+}
+
+void Simulation::populate()
+{
+	if (config.enabled)
+	{
+		stress.populate();
+	}
+}
+
+void Simulation::handle_key(uint32_t key)
+{
+	if (key == SDLK_F3)
+	{
+		float& rate = gpu_fountain ? gpu_rate : particle_system.desc(fountain_emitter).rate;
+		rate = rate > 0.0f ? 0.0f : fountain_rate;
+	}
+
+	if (key == SDLK_F4)
+	{
+		std::swap(particle_system.desc(fountain_emitter).rate, gpu_rate);
+		gpu_fountain = !gpu_fountain;
+	}
+}
+
+void Simulation::step()
+{
+	// Particles don't read the scene, so they run beside it. Their own waits park the fiber rather than
+	// holding the worker, which keeps it free for the scene's par_each chunks.
+	JobCounter particles_done;
+	jobs.run(particles_done, [this]()
+	{
+		CpuZone zone("Particles");
+		particle_system.update(step_seconds);
+	});
+
+	if (config.enabled)
+	{
+		CpuZone zone("Stress");
+		stress.update(step_seconds);
+	}
+
+	{
+		CpuZone zone("Bounds");
+		update_bounds(world, jobs);
+	}
+
+	if (config.enabled)
+	{
+		CpuZone zone("Collide");
+		stress.collide();
+	}
+
+	jobs.wait(particles_done);
+	++steps;
+}
+
+void Simulation::save(SimulationSnapshot& snapshot)
+{
+	world.save(snapshot.world);
+	stress.save(snapshot.stress);
+	particle_system.save(snapshot.particles);
+	snapshot.gpu_rate = gpu_rate;
+	snapshot.gpu_fountain = gpu_fountain;
+	snapshot.steps = steps;
+}
+
+void Simulation::restore(const SimulationSnapshot& snapshot)
+{
+	world.restore(snapshot.world);
+	stress.restore(snapshot.stress);
+	particle_system.restore(snapshot.particles);
+	gpu_rate = snapshot.gpu_rate;
+	gpu_fountain = snapshot.gpu_fountain;
+	steps = snapshot.steps;
+}
+
+uint64_t Simulation::checksum()
+{
+	uint64_t hash = stress.checksum();
+	size_t counts[2] = { particle_system.particle_count(), stress.contact_count() };
+	return fnv1a_bytes(counts, sizeof(counts), hash);
+}
+
+namespace
+{
+	// What a windowed run adds to the world beside the simulation: the level streams in a batch of
+	// sprites a frame, and a client's replicated entities come and go. None of it may reach the checksum.
+	constexpr size_t foreign_batch = 4096;
+	constexpr size_t foreign_batches = 16;
+
+	uint64_t replay(InputRecording& recording, bool foreign, double& total, double& worst)
+	{
+		using Clock = std::chrono::steady_clock;
+
+		JobSystem jobs;
+		ChunkAllocator chunk_allocator(jobs.topology().node_ids);
+		World world(chunk_allocator, jobs);
+		Simulation simulation(world, jobs, recording.config());
+		simulation.populate();
+		recording.rewind();
+
+		uint32_t random = 0x2545f491u;
+		auto next = [&random]()
+		{
+			random ^= random << 13;
+			random ^= random >> 17;
+			random ^= random << 5;
+			return static_cast<float>(random >> 8) * (1.0f / 16777216.0f);
+		};
+
+		float extent = recording.config().extent;
+		while (simulation.step_index() < recording.end_step())
+		{
+			if (foreign && simulation.step_index() < foreign_batches)
+			{
+				for (size_t i = 0; i < foreign_batch; ++i)
+				{
+					world.create(Transform{ next() * extent, next() * extent, 0.0f }, Sprite{ 32.0f, 32.0f, 0, 0xffffffff }, Bounds{});
+				}
+			}
+
+			recording.replay(simulation.step_index(), [&](uint32_t key) { simulation.handle_key(key); });
+
+			auto start = Clock::now();
+			simulation.step();
+			double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+			total += ms;
+			worst = std::max(worst, ms);
+		}
+		return simulation.checksum();
+	}
+}
+
+int run_replay_headless(const std::string& path)
+{
+	InputRecording recording;
+	if (!recording.load(path))
+	{
+		return -1;
+	}
+
+	double total = 0.0;
+	double worst = 0.0;
+	uint64_t checksum = replay(recording, false, total, worst);
+
+	uint64_t steps = std::max<uint64_t>(recording.end_step(), 1);
+	char line[160];
+	std::snprintf(line, sizeof(line), "Replayed %llu steps, %zu inputs: mean step %.3f ms, max %.3f ms",
+		static_cast<unsigned long long>(recording.end_step()), recording.input_count(), total / steps, worst);
+	std::cout << line << "\n";
+	std::snprintf(line, sizeof(line), "checksum %016llx, recorded %016llx: %s",
+		static_cast<unsigned long long>(checksum), static_cast<unsigned long long>(recording.checksum()), checksum == recording.checksum() ? "match" : "MISMATCH");
+	std::cout << line << "\n";
+
+	// Recordings are usually made in a window, with a level and maybe a server's entities beside the
+	// scene. Running again with sprites streamed in the same way checks the checksum doesn't see them.
+	double crowded_total = 0.0;
+	double crowded_worst = 0.0;
+	uint64_t crowded = replay(recording, true, crowded_total, crowded_worst);
+	std::snprintf(line, sizeof(line), "with %zu unrelated sprites added: checksum %016llx: %s",
+		foreign_batch * foreign_batches, static_cast<unsigned long long>(crowded), crowded == checksum ? "match" : "MISMATCH");
+	std::cout << line << "\n";
+
+	return checksum == recording.checksum() && crowded == checksum ? 0 : 1;
+}
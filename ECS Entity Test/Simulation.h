@@ -0,0 +1,69 @@
+#pragma once
+
+#include "ParticleSystem.h"
+#include "StressScene.h"
+
+#include <cstdint>
+#include <string>
+
+class JobSystem;
+
+// Everything step() reads or writes, so the simulation can go back to the step it was saved at.
+struct SimulationSnapshot
+{
+	WorldSnapshot world;
+	StressScene::Snapshot stress;
+	ParticleSnapshot particles;
+	float gpu_rate = 0.0f;
+	bool gpu_fountain = false;
+	uint64_t steps = 0;
+};
+
+// Everything that advances in fixed steps and must come out the same on every run: the stress scene,
+// bounds, collisions and the CPU fountain. Rendering and view toggles stay outside, so it runs headless.
+class Simulation
+{
+public:
+	static constexpr float step_seconds = 1.0f / 60.0f;
+
+	Simulation(World& world, JobSystem& jobs, const StressConfig& config);
+
+	void populate();
+
+	// Applies the simulation side of a key press. Keys it doesn't use are ignored.
+	void handle_key(uint32_t key);
+	void step();
+
+	uint64_t step_index() const { return steps; }
+
+	// Between steps only. Restoring puts step_index() back too; the world must hold nothing but what
+	// the simulation made.
+	void save(SimulationSnapshot& snapshot);
+	void restore(const SimulationSnapshot& snapshot);
+
+	// Combines the stress scene's transforms with the particle count.
+	uint64_t checksum();
+
+	ParticleSystem& particles() { return particle_system; }
+	const EmitterDesc& fountain() const { return fountain_desc; }
+
+	// The GPU fountain lives with the renderer, so the simulation only owns its rate.
+	float gpu_fountain_rate() const { return gpu_rate; }
+
+private:
+	World& world;
+	JobSystem& jobs;
+	StressConfig config;
+	StressScene stress;
+	ParticleSystem particle_system;
+	EmitterDesc fountain_desc;
+	uint32_t fountain_emitter;
+	float gpu_rate = 0.0f;
+	bool gpu_fountain = false;
+	uint64_t steps = 0;
+};
+
+// Replays a recording made with --record through the fixed-step loop without a window, then checks the
+// final state against the checksum stored with it. A second run with unrelated sprites added to the
+// world, as a windowed run's level adds them, must land on the same checksum. Returns 0 when both match.
+int run_replay_headless(const std::string& path);
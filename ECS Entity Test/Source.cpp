@@ -1,10 +1,297 @@
 #include <SDL3/SDL.h>
 #include <glad/glad.h>
 
+#include "AssetLoader.h"
+#include "AudioSystem.h"
+#include "Benchmark.h"
+#include "Camera.h"
+#include "ChunkAllocator.h"
+#include "Coroutine.h"
+#include "DebugDraw.h"
+#include "ECS.h"
+#include "GpuParticleSystem.h"
+#include "InputRecording.h"
+#include "JobSystem.h"
+#include "Memory.h"
+#include "PerfCounters.h"
+#include "PerfOverlay.h"
+#include "Profiler.h"
+#include "Replication.h"
+#include "Rollback.h"
+#include "RenderSystem.h"
+#include "Shader.h"
+#include "Simulation.h"
+#include "SpatialGrid.h"
+#include "SpriteRenderer.h"
+#include "TextRenderer.h"
+#include "TextureAtlas.h"
+#include "TilemapRenderer.h"
+#include "Visibility.h"
+#include "WorldView.h"
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
 #include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace
+{
+	std::vector<std::string> find_files(const std::string& directory, const char* extension)
+	{
+		std::vector<std::string> paths;
+		std::error_code error;
+		for (const auto& entry : std::filesystem::directory_iterator(directory, error))
+		{
+			if (entry.is_regular_file() && entry.path().extension() == extension)
+			{
+				paths.push_back(entry.path().string());
+			}
+		}
+
+		// Directory order is not stable across runs, and the atlas cache key depends on it.
+		std::sort(paths.begin(), paths.end());
+		return paths;
+	}
+
+	// A short decaying tone, so F8 has something to play when there are no sounds on disk.
+	std::vector<float> make_blip()
+	{
+		const size_t frames = AudioSystem::sample_rate / 6;
+		std::vector<float> samples(frames * 2);
+		for (size_t i = 0; i < frames; ++i)
+		{
+			float t = static_cast<float>(i) / AudioSystem::sample_rate;
+			float value = std::sin(t * 880.0f * 6.2831853f) * std::exp(-t * 24.0f) * 0.5f;
+			samples[i * 2] = value;
+			samples[i * 2 + 1] = value;
+		}
+		return samples;
+	}
+
+	// Starts every sprite decoding at once. Once the last one has landed the atlas is read back here and
+	// the cache file written on a job, so the write doesn't stall a frame. The cache key only changes when
+	// a sprite file's path, size or modification time does, so a cache missing a sprite that failed for
+	// any other reason would keep being loaded without it. It is not written if any sprite failed.
+	Task<> stream_sprites(AssetLoader& assets, JobSystem& jobs, TextureAtlas& atlas, std::vector<std::string> paths, std::string cache)
+	{
+		std::vector<AssetHandle> handles;
+		handles.reserve(paths.size());
+		for (const std::string& path : paths)
+		{
+			handles.push_back(assets.load_image(path));
+		}
+
+		bool complete = true;
+		for (AssetHandle handle : handles)
+		{
+			complete &= co_await Coroutines::load(handle) == AssetState::Ready;
+		}
+
+		if (!complete)
+		{
+			std::cout << "Not caching the texture atlas, some sprites failed to load\n";
+			co_return;
+		}
+
+		TextureAtlas::CacheImage image = atlas.capture();
+		JobGroup writing(jobs);
+		writing.run([&] { TextureAtlas::save(paths, cache, image); });
+		co_await writing;
+	}
+
+	// The file is parsed on a loader worker. Its entities are then created a batch per frame, so a large
+	// level doesn't stall the frame it lands in. Sprites still streaming in are drawn white, and tiles
+	// whose sprite is still streaming are filled in on the frame it lands.
+	Task<> load_level(AssetLoader& assets, const TextureAtlas& atlas, TilemapRenderer& tilemaps, World& world, std::string path)
+	{
+		constexpr size_t batch = 4096;
+
+		AssetHandle handle = assets.load_level(path);
+		if (co_await Coroutines::load(handle) != AssetState::Ready)
+		{
+			co_return;
+		}
+
+		const LevelData& level = *assets.level(handle);
+		const std::vector<LevelData::Placement>& placements = level.placements;
+		for (size_t first = 0; first < placements.size(); first += batch)
+		{
+			if (first > 0)
+			{
+				co_await Coroutines::next_frame();
+			}
+
+			size_t end = std::min(first + batch, placements.size());
+			for (size_t i = first; i < end; ++i)
+			{
+				const LevelData::Placement& placement = placements[i];
+				uint32_t region = atlas.find(placement.sprite);
+				region = region == TextureAtlas::invalid_region ? TextureAtlas::white_region : region;
+				world.create(Transform{ placement.x, placement.y, placement.rotation }, Sprite{ placement.width, placement.height, region, placement.color }, Bounds{});
+			}
+		}
+
+		std::vector<uint32_t> maps;
+		std::vector<std::vector<uint32_t>> regions;
+		size_t unresolved = 0;
+		for (const LevelData::TileLayer& layer : level.tile_layers)
+		{
+			maps.push_back(tilemaps.create_map(layer.columns, layer.rows, layer.tile_size));
+			world.create(Transform{ layer.x, layer.y, 0.0f }, Tilemap{ maps.back() });
+			regions.emplace_back(layer.sprites.size(), TextureAtlas::invalid_region);
+			unresolved += layer.sprites.size();
+		}
+
+		// Each pass looks up the names still missing and sets the tiles that use any it found. It stops
+		// once every name is known or nothing is left loading that could supply one.
+		while (unresolved > 0)
+		{
+			for (size_t l = 0; l < level.tile_layers.size(); ++l)
+			{
+				const LevelData::TileLayer& layer = level.tile_layers[l];
+				bool found = false;
+				for (size_t i = 0; i < layer.sprites.size(); ++i)
+				{
+					if (regions[l][i] == TextureAtlas::invalid_region && (regions[l][i] = atlas.find(layer.sprites[i])) != TextureAtlas::invalid_region)
+					{
+						found = true;
+						--unresolved;
+					}
+				}
+
+				if (found)
+				{
+					for (const LevelData::Tile& tile : layer.tiles)
+					{
+						if (regions[l][tile.sprite] != TextureAtlas::invalid_region)
+						{
+							tilemaps.set_tile(maps[l], tile.column, tile.row, regions[l][tile.sprite]);
+						}
+					}
+				}
+			}
+
+			if (unresolved == 0 || assets.pending() == 0)
+			{
+				break;
+			}
+			co_await Coroutines::next_frame();
+		}
+
+		std::cout << "Loaded " << placements.size() << " entities and " << maps.size() << " tile maps from " << path << "\n";
+		if (unresolved > 0)
+		{
+			std::cout << unresolved << " tile sprite(s) in " << path << " are not in the atlas\n";
+		}
+	}
+
+	// Clips decode on the loader's workers and reach the mixer one by one as they become ready. The blip
+	// stands in when none load.
+	Task<> load_sounds(AssetLoader& assets, AudioSystem& audio, std::vector<std::string> paths)
+	{
+		std::vector<AssetHandle> handles;
+		handles.reserve(paths.size());
+		for (const std::string& path : paths)
+		{
+			handles.push_back(assets.load_sound(path));
+		}
+
+		for (AssetHandle handle : handles)
+		{
+			if (co_await Coroutines::load(handle) == AssetState::Ready)
+			{
+				const SoundData* sound = assets.sound(handle);
+				audio.add_clip(sound->samples.data(), sound->samples.size() / 2);
+			}
+		}
+
+		if (audio.clip_count() == 0)
+		{
+			std::vector<float> blip = make_blip();
+			audio.add_clip(blip.data(), blip.size() / 2);
+		}
+	}
+}
 
 int main(int argc, char* argv[])
 {
+	BenchmarkOptions benchmark_options;
+	StressConfig stress_config;
+	ReplayOptions replay_options;
+	NetOptions net_options;
+	RollbackOptions rollback_options;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (!parse_benchmark_argument(argc, argv, i, benchmark_options) && !parse_stress_argument(argc, argv, i, stress_config)
+			&& !parse_replay_argument(argc, argv, i, replay_options) && !parse_net_argument(argc, argv, i, net_options)
+			&& !parse_rollback_argument(argc, argv, i, rollback_options))
+		{
+			std::cerr << "Unknown or incomplete argument " << argv[i] << "\n";
+			return -1;
+		}
+	}
+
+	// Headless runs never touch SDL, so they work on machines without a display or GL driver.
+	if (stress_config.headless && !replay_options.replay_path.empty())
+	{
+		return run_replay_headless(replay_options.replay_path);
+	}
+	if (rollback_options.bench || !rollback_options.peer.empty())
+	{
+		return run_rollback_headless(rollback_options, stress_config);
+	}
+	if (net_options.loopback)
+	{
+		return run_loopback_test(net_options, stress_config);
+	}
+	if (net_options.serve_port != 0)
+	{
+		return run_server_headless(net_options, stress_config);
+	}
+	if (stress_config.headless && !net_options.connect.empty())
+	{
+		return run_client_headless(net_options, stress_config);
+	}
+	if (stress_config.headless && stress_config.enabled)
+	{
+		return run_stress_headless(stress_config);
+	}
+	if (benchmark_options.scaling)
+	{
+		return run_scaling_benchmarks(benchmark_options, stress_config);
+	}
+
+	// A client's scene is whatever the server sends, so it doesn't build one of its own.
+	NetAddress server_address;
+	bool networked = !net_options.connect.empty();
+	if (networked && !parse_address(net_options.connect, server_address))
+	{
+		std::cerr << "Bad server address " << net_options.connect << "\n";
+		return -1;
+	}
+	if (networked)
+	{
+		stress_config.enabled = false;
+	}
+
+	// A replay rebuilds the scene it was recorded with, whatever the other flags say.
+	InputRecording recording;
+	bool replaying = !replay_options.replay_path.empty();
+	if (replaying && !recording.load(replay_options.replay_path))
+	{
+		return -1;
+	}
+	if (replaying)
+	{
+		stress_config = recording.config();
+	}
+	else
+	{
+		recording.start(stress_config);
+	}
 
 	if (!SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO))
 	{
@@ -51,11 +338,193 @@ int main(int argc, char* argv[])
 		return -1;
 	}
 
+	Memory::set_budget(MemoryTag::ECSChunks, 256ull * 1024 * 1024);
+	Memory::set_budget(MemoryTag::RenderBuffers, 256ull * 1024 * 1024);
+	Memory::set_budget(MemoryTag::Physics, 64ull * 1024 * 1024);
+	Memory::set_budget(MemoryTag::Particles, 64ull * 1024 * 1024);
+	Memory::set_budget(MemoryTag::Assets, 512ull * 1024 * 1024);
+	Memory::set_budget(MemoryTag::Transient, 32ull * 1024 * 1024);
+
+	LinearArena frame_arena(16ull * 1024 * 1024);
+
+	JobSystem jobs;
+	ChunkAllocator chunk_allocator(jobs.topology().node_ids);
+	World world(chunk_allocator, jobs);
+
+	std::cout << "Job system: " << jobs.worker_count() << " workers across "
+		<< jobs.topology().node_count << " NUMA node(s)\n";
+
+	enable_program_cache("cache/shaders");
+
+	const std::string atlas_cache = "cache/sprites.atlas";
+	std::vector<std::string> sprite_paths = find_files("assets/sprites", ".bmp");
+
+	TextureAtlas atlas;
+	SpriteRenderer sprite_renderer;
+	TilemapRenderer tilemaps;
+	GpuParticleSystem gpu_particles;
+	AssetLoader assets(jobs, atlas);
+
+	// A warm cache is one upload. Otherwise start with an empty atlas and stream sprites in while the loop runs.
+	bool atlas_cached = atlas.load_cached(sprite_paths, atlas_cache);
+	if (!(atlas_cached || atlas.create(4)) || !sprite_renderer.init(1 << 20) || !tilemaps.init() || !gpu_particles.init(1 << 20) || !DebugDraw::init(1 << 20) || !Profiler::init() || !assets.init(8ull * 1024 * 1024))
+	{
+		std::cerr << "Failed to initialize sprite rendering\n";
+		assets.shutdown();
+		Profiler::shutdown();
+		DebugDraw::shutdown();
+		gpu_particles.shutdown();
+		tilemaps.shutdown();
+		sprite_renderer.shutdown();
+		atlas.destroy();
+		SDL_GL_DestroyContext(gl_context);
+		SDL_DestroyWindow(window);
+		SDL_Quit();
+		return -1;
+	}
+
+	if (!atlas_cached && !sprite_paths.empty())
+	{
+		Coroutines::spawn(stream_sprites(assets, jobs, atlas, sprite_paths, atlas_cache));
+	}
+
+	// Sound is optional; without a device the emitters are still updated, just never heard.
+	AudioSystem audio(jobs);
+	audio.init();
+	Coroutines::spawn(load_sounds(assets, audio, find_files("assets/sounds", ".wav")));
+
+	std::vector<std::string> levels = find_files("assets/levels", ".level");
+	if (!levels.empty() && !benchmark_options.enabled)
+	{
+		Coroutines::spawn(load_level(assets, atlas, tilemaps, world, levels.front()));
+	}
+	uint32_t next_sound = 0;
+
+	// Music is streamed rather than loaded, so a long track costs neither load time nor its full size.
+	std::vector<std::string> music = find_files("assets/music", ".wav");
+	if (!music.empty())
+	{
+		audio.play_stream(music.front(), 0.5f, true);
+	}
+
+	Camera2D camera;
+	SpatialGrid grid;
+	bool use_grid = false;
+	TextRenderer text(atlas);
+	bool debug_view = false;
+	bool show_overlay = false;
+
+	// Set once perf_event_open has been refused, so F7 doesn't try again on every press.
+	bool counters_refused = false;
+
+	Simulation simulation(world, jobs, stress_config);
+	if (stress_config.enabled && !benchmark_options.enabled)
+	{
+		simulation.populate();
+		camera.x = stress_config.extent * 0.5f;
+		camera.y = stress_config.extent * 0.5f;
+		camera.zoom = camera.viewport_height / stress_config.extent;
+	}
+
+	ReplicationClient replication;
+	if (networked && replication.connect(server_address))
+	{
+		camera.x = stress_config.extent * 0.5f;
+		camera.y = stress_config.extent * 0.5f;
+		camera.zoom = camera.viewport_width * 4.0f / stress_config.extent;
+	}
+	ParticleSystem& particles = simulation.particles();
+	gpu_particles.desc() = simulation.fountain();
+	float step_accumulator = 0.0f;
+
+	// The fixed steps run as a job while the sprite pass draws the view captured before them.
+	WorldViewExtractor extractor;
+	JobCounter steps_done;
+
+	struct StepKey
+	{
+		uint64_t step;
+		uint32_t key;
+	};
+	std::vector<StepKey> replay_keys;
+	bool replay_finished = false;
+	uint64_t replay_checksum = 0;
+
+	// Keys that only change what is shown. Applied on the main thread, never while the steps run.
+	auto apply_view_key = [&](uint32_t key)
+	{
+		if (key == SDLK_F1)
+		{
+			Memory::dump(std::cout);
+		}
+
+		if (key == SDLK_F2)
+		{
+			use_grid = !use_grid;
+			grid.clear();
+		}
+
+		if (key == SDLK_F5)
+		{
+			debug_view = !debug_view;
+		}
+
+		if (key == SDLK_F6)
+		{
+			show_overlay = !show_overlay;
+		}
+
+		// Counters are opened lazily since perf_event_open costs a syscall per event per thread.
+		if (key == SDLK_F7)
+		{
+			bool enable = !Profiler::counters_enabled();
+			if (enable && !PerfCounters::available() && !counters_refused)
+			{
+				counters_refused = !PerfCounters::attach(jobs);
+			}
+			Profiler::enable_counters(enable);
+			show_overlay = show_overlay || Profiler::counters_enabled();
+		}
+
+		if (key == SDLK_F8 && audio.clip_count() > 0)
+		{
+			// Alternate sides of the screen so the panning can be heard; they fade out a screen width away.
+			uint32_t clip = next_sound % static_cast<uint32_t>(audio.clip_count());
+			float width = camera.viewport_width / camera.zoom;
+			float x = camera.x + (next_sound++ % 2 == 0 ? -0.25f : 0.25f) * width;
+			world.create(Transform{ x, camera.y, 0.0f }, SoundEmitter{ clip, 0.8f, 128, false, SoundState::Pending, 0, width });
+		}
+	};
+
+	auto apply_key = [&](uint32_t key)
+	{
+		simulation.handle_key(key);
+		apply_view_key(key);
+	};
+
+	Uint64 last_ticks = SDL_GetTicksNS();
+
 	bool quit = false;
+	int exit_code = 0;
 	SDL_Event event;
 
+	// Benchmarks use the renderer and atlas set up above, then exit through the normal cleanup.
+	if (benchmark_options.enabled)
+	{
+		BenchmarkTargets targets{ jobs, chunk_allocator, &atlas, &sprite_renderer };
+		int regressions = run_benchmarks(benchmark_options, stress_config, targets);
+		exit_code = regressions == 0 ? 0 : regressions > 0 ? 1 : -1;
+		quit = true;
+	}
+
 	while (!quit)
 	{
+		frame_arena.reset();
+		Profiler::begin_frame();
+
+		Uint64 ticks = SDL_GetTicksNS();
+		float dt = std::min((ticks - last_ticks) * 1e-9f, 0.1f);
+		last_ticks = ticks;
 
 		while (SDL_PollEvent(&event))
 		{
@@ -71,18 +540,236 @@ int main(int argc, char* argv[])
 				{
 					quit = true;
 				}
+				else if (!replaying)
+				{
+					// Live keys are ignored during a replay so the recorded run isn't disturbed.
+					recording.add(simulation.step_index(), event.key.timestamp, event.key.key);
+					apply_key(event.key.key);
+				}
 			}
 		}
 
+		// Fixed steps, so a replay applies every key before the same step the recording did. The keys are
+		// read out here; the simulation side of each is applied by the job, right before its step.
+		step_accumulator += dt;
+		int step_count = 0;
+		replay_keys.clear();
+		for (; step_accumulator >= Simulation::step_seconds; step_accumulator -= Simulation::step_seconds)
+		{
+			uint64_t step = simulation.step_index() + step_count++;
+			if (replaying)
+			{
+				recording.replay(step, [&](uint32_t key)
+				{
+					replay_keys.push_back({ step, key });
+					apply_view_key(key);
+				});
+			}
+		}
+		gpu_particles.desc().rate = simulation.gpu_fountain_rate();
+
+		std::shared_ptr<const WorldView> world_view;
+		{
+			CpuZone zone("Extract");
+			world_view = extractor.capture(world);
+		}
+
+		if (step_count > 0)
+		{
+			jobs.run(steps_done, [&, step_count]()
+			{
+				size_t next_key = 0;
+				for (int i = 0; i < step_count; ++i)
+				{
+					for (; next_key < replay_keys.size() && replay_keys[next_key].step == simulation.step_index(); ++next_key)
+					{
+						simulation.handle_key(replay_keys[next_key].key);
+					}
+
+					simulation.step();
+					if (replaying && simulation.step_index() == recording.end_step())
+					{
+						replay_finished = true;
+						replay_checksum = simulation.checksum();
+					}
+				}
+			});
+		}
+
+		// The grid and debug view read the live world, so with either on the steps finish first and this
+		// frame shows their result instead of the view.
+		bool overlapped = !use_grid && !debug_view;
+		if (!overlapped)
+		{
+			CpuZone zone("Simulation wait");
+			jobs.wait(steps_done);
+		}
+
+		SDL_GetWindowSizeInPixels(window, &camera.viewport_width, &camera.viewport_height);
+		glViewport(0, 0, camera.viewport_width, camera.viewport_height);
+
 		glClearColor(0.39f, 0.58f, 0.93f, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT);
+		DebugDraw::begin_frame(camera);
+
+		if (use_grid)
+		{
+			CpuZone zone("Grid");
+			grid.build(world);
+		}
+
+		VisibleSet visible;
+		{
+			CpuZone zone("Cull");
+			visible = overlapped ? cull_visible(*world_view, camera.bounds(), frame_arena) : cull_visible(world, camera.bounds(), frame_arena, use_grid ? &grid : nullptr);
+		}
+
+		if (debug_view)
+		{
+			CpuZone zone("Debug view");
+			world.query<const Bounds>().par_each(jobs, [](Entity, const Bounds& b)
+			{
+				DebugDraw::box({ b.min_x, b.min_y, b.max_x, b.max_y }, 0xff00ff00);
+			});
+
+			// Only the cells under the view; the grid can hold up to a million.
+			Rect view = camera.bounds();
+			Rect origin = grid.cell_rect(0, 0);
+			float inverse_cell = 1.0f / grid.cell_size();
+			int first_column = std::max(static_cast<int>(std::floor((view.min_x - origin.min_x) * inverse_cell)), 0);
+			int first_row = std::max(static_cast<int>(std::floor((view.min_y - origin.min_y) * inverse_cell)), 0);
+			int last_column = std::min(static_cast<int>(std::floor((view.max_x - origin.min_x) * inverse_cell)), grid.columns() - 1);
+			int last_row = std::min(static_cast<int>(std::floor((view.max_y - origin.min_y) * inverse_cell)), grid.rows() - 1);
+			for (int row = first_row; row <= last_row; ++row)
+			{
+				for (int column = first_column; column <= last_column; ++column)
+				{
+					Rect cell = grid.cell_rect(column, row);
+					DebugDraw::box(cell, grid.cell_entry_count(column, row) ? 0x8000ffff : 0x40ffffff);
+				}
+			}
+		}
+
+		{
+			CpuZone cpu("GPU particles");
+			GpuZone gpu("GPU particles");
+			gpu_particles.update(dt);
+			gpu_particles.render(camera, atlas);
+		}
+
+		{
+			CpuZone zone("Sprites");
+			sprite_renderer.begin(camera, atlas);
+			submit_sprites(visible, sprite_renderer, atlas);
+		}
+
+		// Everything below reads the world or the particles directly. Sprites are only drawn in end(), so
+		// tilemaps still go underneath them.
+		{
+			CpuZone zone("Simulation wait");
+			jobs.wait(steps_done);
+		}
+
+		if (replay_finished)
+		{
+			bool match = replay_checksum == recording.checksum();
+			std::cout << "Replay finished after " << recording.end_step() << " steps: " << (match ? "state matches the recording" : "state DIFFERS from the recording") << "\n";
+			replay_finished = false;
+			replaying = false;
+		}
+
+		// Coroutines are gameplay code and may change the world, so they wait for the steps too.
+		{
+			CpuZone zone("Assets");
+			assets.pump(4ull * 1024 * 1024);
+			Coroutines::update(assets);
+		}
+
+		{
+			CpuZone zone("Network");
+			replication.update(world, camera.bounds());
+		}
+
+		{
+			CpuZone zone("Audio");
+			audio.set_listener(camera.x, camera.y);
+			audio.update(world, dt);
+
+			// Sounds started from F8 are one-shots; their entities go once they have played.
+			std::vector<Entity> finished_sounds;
+			world.query<const SoundEmitter>().each([&](Entity entity, const SoundEmitter& emitter)
+			{
+				if (emitter.state == SoundState::Finished)
+				{
+					finished_sounds.push_back(entity);
+				}
+			});
+			for (Entity entity : finished_sounds)
+			{
+				world.destroy(entity);
+			}
+		}
+
+		{
+			CpuZone cpu("Tilemaps");
+			GpuZone gpu("Tilemaps");
+			tilemaps.render(world, camera, atlas);
+		}
+
+		{
+			CpuZone cpu("Sprites");
+			GpuZone gpu("Sprites");
+			particles.submit(sprite_renderer, atlas);
+
+			// Text goes through the same batch, pinned to the top-left of the view.
+			Rect view = camera.bounds();
+			float pixel = 1.0f / camera.zoom;
+			text.draw(sprite_renderer, "F1 memory  F2 grid  F3 fountain  F4 CPU/GPU particles  F5 debug view  F6 stats  F7 counters  F8 sound", view.min_x + 8.0f * pixel, view.max_y - 8.0f * pixel, 2.0f * pixel, 0xffffffff);
+
+			sprite_renderer.end();
+			text.end_frame();
+		}
+
+		if (show_overlay)
+		{
+			// GPU particles and debug draw are one call each.
+			size_t draw_calls = sprite_renderer.draw_calls() + tilemaps.draw_calls() + 2;
+			draw_perf_overlay(camera, world, { draw_calls, sprite_renderer.sprite_count(), particles.particle_count() });
+		}
+
+		{
+			CpuZone cpu("Debug draw");
+			GpuZone gpu("Debug draw");
+			DebugDraw::flush();
+		}
 
 		SDL_GL_SwapWindow(window);
+		Profiler::end_frame();
 
 	}
 
+	if (!replay_options.record_path.empty() && !benchmark_options.enabled)
+	{
+		recording.finish(simulation.step_index(), simulation.checksum());
+		if (recording.save(replay_options.record_path))
+		{
+			std::cout << "Recorded " << recording.input_count() << " inputs over " << recording.end_step() << " steps to " << replay_options.record_path << "\n";
+		}
+	}
+
+	Coroutines::shutdown();
+	replication.disconnect(world);
+	audio.shutdown();
+	assets.shutdown();
+	PerfCounters::detach();
+	Profiler::shutdown();
+	DebugDraw::shutdown();
+	gpu_particles.shutdown();
+	tilemaps.shutdown();
+	sprite_renderer.shutdown();
+	atlas.destroy();
 	SDL_GL_DestroyContext(gl_context);
 	SDL_DestroyWindow(window);
 	SDL_Quit();
-
-}
\ No newline at end of file
+	return exit_code;
+}
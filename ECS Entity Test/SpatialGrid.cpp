@@ -0,0 +1,209 @@
+#include "SpatialGrid.h"
+
+#include <cfloat>
+#include <cmath>
+
+namespace
+{
+	constexpr size_t max_cells = 1 << 20;
+
+	// Room left on each side, as a fraction of the world's size, when update() has to lay the grid out
+	// again, so a world that keeps spreading doesn't rebuild every frame.
+	constexpr float rebuild_margin = 0.25f;
+}
+
+SpatialGrid::SpatialGrid(float cell_size, ComponentMask require)
+	: require(require), requested_cell(cell_size), cell(cell_size)
+{
+}
+
+void SpatialGrid::clear()
+{
+	cells.clear();
+	grid_columns = 0;
+	grid_rows = 0;
+	filed_entities = 0;
+	first_pass = pass + 1;
+}
+
+void SpatialGrid::build(World& world)
+{
+	build(world, 0.0f);
+}
+
+void SpatialGrid::build(World& world, float margin)
+{
+	// Empty the cells but keep their storage, since most callers build every frame.
+	for (Cell& cell_entries : cells)
+	{
+		cell_entries.clear();
+	}
+	filed_entities = 0;
+	first_pass = pass + 1;
+
+	Rect extent = { FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX };
+	size_t count = 0;
+	world.query<const Bounds>().each_chunk([&](const Chunk& chunk, const Bounds* bounds)
+	{
+		if (!wanted(chunk))
+		{
+			return;
+		}
+
+		for (uint32_t i = 0; i < chunk.count; ++i)
+		{
+			extent.min_x = std::min(extent.min_x, bounds[i].min_x);
+			extent.min_y = std::min(extent.min_y, bounds[i].min_y);
+			extent.max_x = std::max(extent.max_x, bounds[i].max_x);
+			extent.max_y = std::max(extent.max_y, bounds[i].max_y);
+		}
+		count += chunk.count;
+	});
+
+	if (count == 0)
+	{
+		clear();
+		return;
+	}
+
+	float pad_x = (extent.max_x - extent.min_x) * margin;
+	float pad_y = (extent.max_y - extent.min_y) * margin;
+	extent = { extent.min_x - pad_x, extent.min_y - pad_y, extent.max_x + pad_x, extent.max_y + pad_y };
+
+	// Grow the cells rather than the grid when the world is much larger than expected.
+	cell = requested_cell;
+	float width = extent.max_x - extent.min_x;
+	float height = extent.max_y - extent.min_y;
+	while ((std::floor(width / cell) + 1) * (std::floor(height / cell) + 1) > max_cells)
+	{
+		cell *= 2.0f;
+	}
+
+	inverse_cell = 1.0f / cell;
+	origin_x = extent.min_x;
+	origin_y = extent.min_y;
+	grid_columns = static_cast<int>(width * inverse_cell) + 1;
+	grid_rows = static_cast<int>(height * inverse_cell) + 1;
+
+	cells.resize(static_cast<size_t>(grid_columns) * grid_rows);
+	file(world);
+}
+
+void SpatialGrid::update(World& world)
+{
+	if (cells.empty())
+	{
+		build(world);
+		return;
+	}
+
+	// Entities past the edge would all pile into the border cells, which every query nearby then has to
+	// scan, so the layout is redone instead.
+	if (!file(world))
+	{
+		build(world, rebuild_margin);
+	}
+}
+
+void SpatialGrid::remove(Place& place)
+{
+	// Swap the cell's last entry into the hole and tell its owner where it went.
+	Cell& cell_entries = cells[place.cell];
+	const Entry& last = cell_entries.back();
+	places[last.entity.index].slot = place.slot;
+	cell_entries[place.slot] = last;
+	cell_entries.pop_back();
+	place.pass = 0;
+}
+
+bool SpatialGrid::file(World& world)
+{
+	++pass;
+
+	float end_x = origin_x + grid_columns * cell;
+	float end_y = origin_y + grid_rows * cell;
+	bool inside = true;
+	size_t visited = 0;
+	float widest = 0.0f;
+	float tallest = 0.0f;
+	world.query<const Bounds>().each_chunk([&](const Chunk& chunk, const Bounds* bounds)
+	{
+		if (!wanted(chunk))
+		{
+			return;
+		}
+
+		const Entity* entities = chunk.entities();
+		for (uint32_t i = 0; i < chunk.count; ++i)
+		{
+			const Bounds& b = bounds[i];
+			Entry entry = { entities[i], &chunk, i, b };
+			uint32_t home = static_cast<uint32_t>(row_of(b.min_y) * grid_columns + column_of(b.min_x));
+			widest = std::max(widest, b.max_x - b.min_x);
+			tallest = std::max(tallest, b.max_y - b.min_y);
+			inside &= b.min_x >= origin_x && b.min_x < end_x && b.min_y >= origin_y && b.min_y < end_y;
+
+			if (entry.entity.index >= places.size())
+			{
+				places.resize(entry.entity.index + 1);
+			}
+
+			// A slot belongs to an entity index, whichever generation holds it, so most entities are
+			// rewritten where they stand.
+			Place& place = places[entry.entity.index];
+			if (filed(place) && place.cell == home)
+			{
+				cells[home][place.slot] = entry;
+			}
+			else
+			{
+				if (filed(place))
+				{
+					remove(place);
+				}
+				else
+				{
+					++filed_entities;
+				}
+				place.cell = home;
+				place.slot = static_cast<uint32_t>(cells[home].size());
+				cells[home].push_back(entry);
+			}
+			place.pass = pass;
+			++visited;
+		}
+	});
+	reach_x = widest;
+	reach_y = tallest;
+
+	// Anything filed but not seen this pass was destroyed or lost its Bounds.
+	if (filed_entities > visited)
+	{
+		for (Place& place : places)
+		{
+			if (filed(place) && place.pass != pass)
+			{
+				remove(place);
+			}
+		}
+		filed_entities = visited;
+	}
+	return inside;
+}
+
+Rect SpatialGrid::cell_rect(int column, int row) const
+{
+	float x = origin_x + column * cell;
+	float y = origin_y + row * cell;
+	return { x, y, x + cell, y + cell };
+}
+
+size_t SpatialGrid::cell_entry_count(int column, int row) const
+{
+	if (column < 0 || row < 0 || column >= grid_columns || row >= grid_rows)
+	{
+		return 0;
+	}
+
+	return cells[static_cast<size_t>(row) * grid_columns + column].size();
+}
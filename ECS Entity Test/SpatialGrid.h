@@ -0,0 +1,122 @@
+#pragma once
+
+#include "Camera.h"
+#include "Components.h"
+#include "ECS.h"
+#include "Memory.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Uniform grid over entity Bounds. Each entity is filed once, in the cell holding its min corner, with
+// a copy of its bounds; queries widen their rect by the largest entity to find everything reaching in
+// from neighbouring cells. build() sizes the grid to the world and files everything from scratch, while
+// update() keeps the layout and rewrites each entity in place, only moving the ones that changed cell;
+// it lays the grid out again, with some room to spare, once anything wanders outside it.
+// Entries point into chunks, so the grid is only valid until the world's structure next changes.
+class SpatialGrid
+{
+public:
+	struct Entry
+	{
+		Entity entity;
+		const Chunk* chunk;
+		uint32_t row;
+		Bounds bounds;
+	};
+
+	// Only entities whose archetype holds every component in require are filed, so a system can keep a
+	// grid of just its own entities in a world others share.
+	explicit SpatialGrid(float cell_size = 256.0f, ComponentMask require = 0);
+
+	void build(World& world);
+
+	// Brings the grid up to date with the world, building it first if it is empty or if any entity has
+	// moved outside the extent of the last build.
+	void update(World& world);
+
+	void clear();
+
+	// Calls fn(const Entry&, const Bounds&) once for every entity whose bounds overlap rect.
+	template <typename Fn>
+	void query(const Rect& rect, Fn&& fn) const;
+
+	Rect cell_rect(int column, int row) const;
+	int columns() const { return grid_columns; }
+	int rows() const { return grid_rows; }
+	float cell_size() const { return cell; }
+	size_t entry_count() const { return filed_entities; }
+	size_t cell_entry_count(int column, int row) const;
+
+private:
+	// Where an entity is filed, by entity index. Only valid when pass is at least first_pass.
+	struct Place
+	{
+		uint32_t pass = 0;
+		uint32_t cell = 0;
+		uint32_t slot = 0;
+	};
+
+	using Cell = std::vector<Entry, TaggedAllocator<Entry, MemoryTag::Physics>>;
+
+	int column_of(float x) const { return std::clamp(static_cast<int>((x - origin_x) * inverse_cell), 0, grid_columns - 1); }
+	int row_of(float y) const { return std::clamp(static_cast<int>((y - origin_y) * inverse_cell), 0, grid_rows - 1); }
+	bool filed(const Place& place) const { return place.pass >= first_pass; }
+	bool wanted(const Chunk& chunk) const { return (chunk.archetype->mask & require) == require; }
+
+	// Lays out the grid over the world's extent grown by margin times its size on each side.
+	void build(World& world, float margin);
+	// Returns false if any entity's min corner fell outside the grid and was clamped to an edge cell.
+	bool file(World& world);
+	void remove(Place& place);
+
+	ComponentMask require;
+	float requested_cell;
+	float cell;
+	float inverse_cell = 0.0f;
+	float origin_x = 0.0f;
+	float origin_y = 0.0f;
+	int grid_columns = 0;
+	int grid_rows = 0;
+
+	// Largest width and height filed, which is how far a query has to look back from its rect.
+	float reach_x = 0.0f;
+	float reach_y = 0.0f;
+
+	std::vector<Cell, TaggedAllocator<Cell, MemoryTag::Physics>> cells;
+	std::vector<Place, TaggedAllocator<Place, MemoryTag::Physics>> places;
+	uint32_t pass = 0;
+	uint32_t first_pass = 1;
+	size_t filed_entities = 0;
+};
+
+template <typename Fn>
+void SpatialGrid::query(const Rect& rect, Fn&& fn) const
+{
+	if (filed_entities == 0)
+	{
+		return;
+	}
+
+	int first_column = column_of(rect.min_x - reach_x);
+	int last_column = column_of(rect.max_x);
+	int first_row = row_of(rect.min_y - reach_y);
+	int last_row = row_of(rect.max_y);
+
+	for (int row = first_row; row <= last_row; ++row)
+	{
+		for (int column = first_column; column <= last_column; ++column)
+		{
+			for (const Entry& entry : cells[static_cast<size_t>(row) * grid_columns + column])
+			{
+				const Bounds& b = entry.bounds;
+				if (b.max_x < rect.min_x || b.min_x > rect.max_x || b.max_y < rect.min_y || b.min_y > rect.max_y)
+				{
+					continue;
+				}
+				fn(entry, b);
+			}
+		}
+	}
+}
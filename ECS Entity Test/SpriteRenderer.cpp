@@ -0,0 +1,206 @@
+#include "SpriteRenderer.h"
+
+#include "Memory.h"
+#include "Shader.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+
+namespace
+{
+	const char* vertex_source = R"(#version 450 core
+layout(location = 0) in vec4 in_rect;
+layout(location = 1) in vec4 in_uv;
+layout(location = 2) in vec2 in_layer_rotation;
+layout(location = 3) in vec4 in_color;
+
+uniform vec4 u_projection;
+
+out vec3 v_uv;
+out vec4 v_color;
+
+void main()
+{
+	vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+	vec2 local = (corner - 0.5) * in_rect.zw;
+
+	float s = sin(in_layer_rotation.y);
+	float c = cos(in_layer_rotation.y);
+	vec2 world = in_rect.xy + vec2(local.x * c - local.y * s, local.x * s + local.y * c);
+
+	gl_Position = vec4(world * u_projection.xy + u_projection.zw, 0.0, 1.0);
+	v_uv = vec3(mix(in_uv.x, in_uv.z, corner.x), mix(in_uv.w, in_uv.y, corner.y), in_layer_rotation.x);
+	v_color = in_color;
+}
+)";
+
+	const char* fragment_source = R"(#version 450 core
+in vec3 v_uv;
+in vec4 v_color;
+
+uniform sampler2DArray u_atlas;
+
+out vec4 out_color;
+
+void main()
+{
+	out_color = texture(u_atlas, v_uv) * v_color;
+}
+)";
+}
+
+SpriteRenderer::~SpriteRenderer()
+{
+	shutdown();
+}
+
+bool SpriteRenderer::init(size_t max_sprites_per_frame)
+{
+	program = create_program(vertex_source, fragment_source);
+	if (!program)
+	{
+		return false;
+	}
+
+	projection_location = glGetUniformLocation(program, "u_projection");
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "u_atlas"), 0);
+	glUseProgram(0);
+
+	max_sprites = max_sprites_per_frame;
+	GLsizeiptr bytes = static_cast<GLsizeiptr>(max_sprites * sizeof(SpriteInstance) * frames_in_flight);
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+	glGenVertexArrays(1, &vao);
+	glGenBuffers(1, &buffer);
+	glBindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glBufferStorage(GL_ARRAY_BUFFER, bytes, nullptr, flags);
+	mapped = static_cast<SpriteInstance*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, flags));
+	if (!mapped)
+	{
+		std::cerr << "Failed to map sprite instance buffer\n";
+		shutdown();
+		return false;
+	}
+	Memory::track_alloc(MemoryTag::RenderBuffers, static_cast<size_t>(bytes));
+
+	GLsizei stride = sizeof(SpriteInstance);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, stride, reinterpret_cast<void*>(offsetof(SpriteInstance, x)));
+	glVertexAttribDivisor(0, 1);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, stride, reinterpret_cast<void*>(offsetof(SpriteInstance, u0)));
+	glVertexAttribDivisor(1, 1);
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, reinterpret_cast<void*>(offsetof(SpriteInstance, layer)));
+	glVertexAttribDivisor(2, 1);
+	glEnableVertexAttribArray(3);
+	glVertexAttribPointer(3, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, reinterpret_cast<void*>(offsetof(SpriteInstance, color)));
+	glVertexAttribDivisor(3, 1);
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	return true;
+}
+
+void SpriteRenderer::shutdown()
+{
+	for (GLsync& fence : fences)
+	{
+		if (fence)
+		{
+			glDeleteSync(fence);
+			fence = nullptr;
+		}
+	}
+
+	if (buffer)
+	{
+		if (mapped)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, buffer);
+			glUnmapBuffer(GL_ARRAY_BUFFER);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+			Memory::track_free(MemoryTag::RenderBuffers, max_sprites * sizeof(SpriteInstance) * frames_in_flight);
+			mapped = nullptr;
+		}
+		glDeleteBuffers(1, &buffer);
+		buffer = 0;
+	}
+
+	if (vao)
+	{
+		glDeleteVertexArrays(1, &vao);
+		vao = 0;
+	}
+
+	if (program)
+	{
+		glDeleteProgram(program);
+		program = 0;
+	}
+}
+
+void SpriteRenderer::begin(const Camera2D& camera, const TextureAtlas& atlas)
+{
+	// Don't overwrite a section the GPU may still be reading from.
+	if (fences[frame])
+	{
+		glClientWaitSync(fences[frame], GL_SYNC_FLUSH_COMMANDS_BIT, UINT64_MAX);
+		glDeleteSync(fences[frame]);
+		fences[frame] = nullptr;
+	}
+
+	section = mapped + frame * max_sprites;
+	count = 0;
+	calls = 0;
+	texture = atlas.texture();
+	camera.projection(projection);
+}
+
+SpriteInstance* SpriteRenderer::allocate(size_t amount)
+{
+	if (!section || count + amount > max_sprites)
+	{
+		return nullptr;
+	}
+
+	SpriteInstance* result = section + count;
+	count += amount;
+	return result;
+}
+
+void SpriteRenderer::draw(float x, float y, float width, float height, float rotation, const AtlasRegion& region, uint32_t color)
+{
+	SpriteInstance* instance = allocate(1);
+	if (!instance)
+	{
+		return;
+	}
+
+	*instance = { x, y, width, height, region.u0, region.v0, region.u1, region.v1, static_cast<float>(region.layer), rotation, color, 0 };
+}
+
+void SpriteRenderer::end()
+{
+	if (count > 0)
+	{
+		glUseProgram(program);
+		glUniform4fv(projection_location, 1, projection);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+		glBindVertexArray(vao);
+		glDrawArraysInstancedBaseInstance(GL_TRIANGLE_STRIP, 0, 4, static_cast<GLsizei>(count), static_cast<GLuint>(frame * max_sprites));
+		glBindVertexArray(0);
+		++calls;
+	}
+
+	fences[frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	frame = (frame + 1) % frames_in_flight;
+	section = nullptr;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "Camera.h"
+#include "TextureAtlas.h"
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstdint>
+
+struct SpriteInstance
+{
+	float x;
+	float y;
+	float width;
+	float height;
+	float u0;
+	float v0;
+	float u1;
+	float v1;
+	float layer;
+	float rotation;
+	uint32_t color;
+	uint32_t padding;
+};
+
+// Instanced quad renderer. Instances are written straight into a persistently mapped buffer that is
+// split into one section per frame in flight, and the whole frame is drawn with a single call using
+// the atlas array texture.
+class SpriteRenderer
+{
+public:
+	static constexpr int frames_in_flight = 3;
+
+	~SpriteRenderer();
+
+	bool init(size_t max_sprites_per_frame);
+	void shutdown();
+
+	void begin(const Camera2D& camera, const TextureAtlas& atlas);
+
+	// Reserves space for count sprites in this frame's section. Returns nullptr when the frame is full.
+	SpriteInstance* allocate(size_t count);
+
+	void draw(float x, float y, float width, float height, float rotation, const AtlasRegion& region, uint32_t color);
+
+	void end();
+
+	size_t sprite_count() const { return count; }
+	size_t capacity() const { return max_sprites; }
+	size_t draw_calls() const { return calls; }
+
+private:
+	GLuint program = 0;
+	GLuint vao = 0;
+	GLuint buffer = 0;
+	GLint projection_location = -1;
+	GLsync fences[frames_in_flight] = {};
+
+	SpriteInstance* mapped = nullptr;
+	SpriteInstance* section = nullptr;
+	size_t max_sprites = 0;
+	size_t count = 0;
+	size_t calls = 0;
+	int frame = 0;
+	GLuint texture = 0;
+	float projection[4] = {};
+};
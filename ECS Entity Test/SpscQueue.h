@@ -0,0 +1,102 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+
+// Fixed-capacity queue for one producer thread and one consumer thread. Neither side locks or allocates,
+// so it is safe to use from the audio callback. Capacity must be a power of two.
+template <typename T, size_t Capacity>
+class SpscQueue
+{
+	static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+	// Producer only. Returns false when the queue is full.
+	bool push(const T& value)
+	{
+		size_t tail = write.load(std::memory_order_relaxed);
+		if (tail - read.load(std::memory_order_acquire) == Capacity)
+		{
+			return false;
+		}
+		items[tail & (Capacity - 1)] = value;
+		write.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer only. Returns false when the queue is empty.
+	bool pop(T& value)
+	{
+		size_t head = read.load(std::memory_order_relaxed);
+		if (head == write.load(std::memory_order_acquire))
+		{
+			return false;
+		}
+		value = items[head & (Capacity - 1)];
+		read.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	T items[Capacity];
+
+	// Each index is written by one side only; keeping them apart stops the two threads sharing a line.
+	alignas(64) std::atomic<size_t> write{ 0 };
+	alignas(64) std::atomic<size_t> read{ 0 };
+};
+
+// Ring of values moved in bulk between one producer thread and one consumer thread, such as decoded audio
+// on its way to the mixer. The storage is the caller's; capacity must be a power of two.
+template <typename T>
+class SpscRing
+{
+public:
+	// Only while neither side is using the ring.
+	void reset(T* storage, size_t capacity)
+	{
+		items = storage;
+		mask = capacity - 1;
+		write.store(0, std::memory_order_relaxed);
+		read.store(0, std::memory_order_relaxed);
+	}
+
+	size_t capacity() const { return mask + 1; }
+
+	// Producer only: how many values fit.
+	size_t space() const { return capacity() - (write.load(std::memory_order_relaxed) - read.load(std::memory_order_acquire)); }
+
+	// Consumer only: how many values are waiting.
+	size_t available() const { return write.load(std::memory_order_acquire) - read.load(std::memory_order_relaxed); }
+
+	// Producer only. Writes as many of values as fit and returns how many that was.
+	size_t push(const T* values, size_t count)
+	{
+		size_t tail = write.load(std::memory_order_relaxed);
+		count = std::min(count, capacity() - (tail - read.load(std::memory_order_acquire)));
+		size_t first = std::min(count, capacity() - (tail & mask));
+		std::copy(values, values + first, items + (tail & mask));
+		std::copy(values + first, values + count, items);
+		write.store(tail + count, std::memory_order_release);
+		return count;
+	}
+
+	// Consumer only. Reads up to count values and returns how many there were.
+	size_t pop(T* values, size_t count)
+	{
+		size_t head = read.load(std::memory_order_relaxed);
+		count = std::min(count, write.load(std::memory_order_acquire) - head);
+		size_t first = std::min(count, capacity() - (head & mask));
+		std::copy(items + (head & mask), items + (head & mask) + first, values);
+		std::copy(items, items + (count - first), values + first);
+		read.store(head + count, std::memory_order_release);
+		return count;
+	}
+
+private:
+	T* items = nullptr;
+	size_t mask = 0;
+
+	alignas(64) std::atomic<size_t> write{ 0 };
+	alignas(64) std::atomic<size_t> read{ 0 };
+};
@@ -0,0 +1,328 @@
+#include "StressScene.h"
+
+#include "Camera.h"
+#include "ChunkAllocator.h"
+#include "Components.h"
+#include "Hash.h"
+#include "JobSystem.h"
+#include "Memory.h"
+#include "TextureAtlas.h"
+#include "Visibility.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+namespace
+{
+	constexpr uint32_t no_parent = ~0u;
+	constexpr int tag_count = 8;
+	constexpr float max_speed = 120.0f;
+	constexpr float child_offset = 64.0f;
+
+	// Sprites are at most 48 units across, so a cell this size holds a handful of them instead of hundreds.
+	constexpr float collision_cell = 64.0f;
+
+	template <int... N>
+	void add_tags(World& world, Entity entity, uint32_t mask, std::integer_sequence<int, N...>)
+	{
+		((mask >> N & 1 ? world.add(entity, StressTag<N>{ mask }) : void()), ...);
+	}
+
+	// Circle against AABB, the narrowphase behind the grid query.
+	bool overlaps(float x, float y, float radius, const Bounds& b)
+	{
+		float dx = x - std::clamp(x, b.min_x, b.max_x);
+		float dy = y - std::clamp(y, b.min_y, b.max_y);
+		return dx * dx + dy * dy <= radius * radius;
+	}
+}
+
+StressScene::StressScene(World& world, JobSystem& jobs, const StressConfig& config)
+	: world(world), jobs(jobs), config(config), random(config.seed), grid(collision_cell, component_mask<StressCollider>())
+{
+	this->config.archetypes = std::clamp(config.archetypes, 1u, 1u << tag_count);
+}
+
+void StressScene::populate()
+{
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	uint32_t chain = config.hierarchy_depth + 1;
+
+	slots.resize(config.entities);
+	for (size_t i = 0; i < slots.size(); ++i)
+	{
+		Slot& slot = slots[i];
+		slot.depth = static_cast<uint32_t>(i % chain);
+		slot.parent = slot.depth == 0 ? no_parent : static_cast<uint32_t>(i - 1);
+		slot.tags = random() % config.archetypes;
+		slot.collider = unit(random) < config.collider_density;
+		slot.sprite = slot.collider || unit(random) < config.sprite_density;
+		spawn(slot);
+	}
+}
+
+void StressScene::spawn(Slot& slot)
+{
+	std::uniform_real_distribution<float> position(0.0f, config.extent);
+	std::uniform_real_distribution<float> size(8.0f, 48.0f);
+	std::uniform_real_distribution<float> speed(-max_speed, max_speed);
+	std::uniform_real_distribution<float> offset(-child_offset, child_offset);
+
+	float x = position(random);
+	float y = position(random);
+	Transform transform{ x, y, 0.0f };
+	Sprite sprite{ size(random), size(random), TextureAtlas::white_region, static_cast<uint32_t>(0xff000000 | (random() & 0xffffff)) };
+	Bounds bounds = sprite_bounds(transform, sprite);
+
+	if (slot.parent == no_parent)
+	{
+		StressVelocity velocity{ speed(random), speed(random) };
+		slot.entity = slot.sprite ? world.create(transform, sprite, bounds, velocity) : world.create(transform, velocity);
+	}
+	else
+	{
+		StressParent parent{ slot.parent, slot.depth, offset(random), offset(random) };
+		slot.entity = slot.sprite ? world.create(transform, sprite, bounds, parent) : world.create(transform, parent);
+	}
+
+	if (slot.collider)
+	{
+		world.add(slot.entity, StressCollider{ std::max(sprite.width, sprite.height) * 0.5f });
+	}
+	add_tags(world, slot.entity, slot.tags, std::make_integer_sequence<int, tag_count>());
+}
+
+void StressScene::update(float dt)
+{
+	// Structural changes first; nothing below holds chunk pointers across them.
+	if (!slots.empty())
+	{
+		size_t respawns = static_cast<size_t>(std::lround(slots.size() * config.churn));
+		for (size_t i = 0; i < respawns; ++i)
+		{
+			Slot& slot = slots[random() % slots.size()];
+			world.destroy(slot.entity);
+			spawn(slot);
+		}
+	}
+
+	float extent = config.extent;
+	world.query<Transform, StressVelocity>().par_each(jobs, [dt, extent](Entity, Transform& t, StressVelocity& v)
+	{
+		t.x += v.x * dt;
+		t.y += v.y * dt;
+		if (t.x < 0.0f || t.x > extent)
+		{
+			v.x = -v.x;
+		}
+		if (t.y < 0.0f || t.y > extent)
+		{
+			v.y = -v.y;
+		}
+		t.rotation += dt;
+	});
+
+	// One pass per level, so every parent is final before its children read it.
+	for (uint32_t depth = 1; depth <= config.hierarchy_depth; ++depth)
+	{
+		world.query<Transform, const StressParent>().par_each(jobs, [this, depth](Entity, Transform& t, const StressParent& p)
+		{
+			if (p.depth != depth)
+			{
+				return;
+			}
+
+			const Transform* parent = world.get<const Transform>(slots[p.slot].entity);
+			if (parent)
+			{
+				t = { parent->x + p.offset_x, parent->y + p.offset_y, parent->rotation };
+			}
+		});
+	}
+}
+
+void StressScene::collide()
+{
+	grid.update(world);
+
+	std::atomic<size_t> total{ 0 };
+	world.query<const Bounds, const StressCollider>().par_each(jobs, [this, &total](Entity entity, const Bounds& b, const StressCollider& c)
+	{
+		float x = (b.min_x + b.max_x) * 0.5f;
+		float y = (b.min_y + b.max_y) * 0.5f;
+		size_t count = 0;
+		grid.query({ x - c.radius, y - c.radius, x + c.radius, y + c.radius }, [&](const SpatialGrid::Entry& entry, const Bounds& other)
+		{
+			if (!(entry.entity == entity) && overlaps(x, y, c.radius, other))
+			{
+				++count;
+			}
+		});
+		total.fetch_add(count, std::memory_order_relaxed);
+	});
+	contacts = total.load(std::memory_order_relaxed);
+}
+
+uint64_t StressScene::checksum()
+{
+	uint64_t hash = fnv1a_seed;
+	for (const Slot& slot : slots)
+	{
+		if (const Transform* t = world.get<const Transform>(slot.entity))
+		{
+			hash = fnv1a_bytes(t, sizeof(Transform), hash);
+		}
+	}
+	return hash;
+}
+
+void StressScene::save(Snapshot& snapshot) const
+{
+	snapshot.random = random;
+	snapshot.slots.assign(slots.begin(), slots.end());
+	snapshot.contacts = contacts;
+}
+
+void StressScene::restore(const Snapshot& snapshot)
+{
+	random = snapshot.random;
+	slots.assign(snapshot.slots.begin(), snapshot.slots.end());
+	contacts = snapshot.contacts;
+}
+
+bool parse_stress_argument(int argc, char* argv[], int& i, StressConfig& config)
+{
+	const char* arg = argv[i];
+	if (std::strcmp(arg, "--stress") == 0)
+	{
+		config.enabled = true;
+		return true;
+	}
+	if (std::strcmp(arg, "--headless") == 0)
+	{
+		config.headless = true;
+		return true;
+	}
+	if (i + 1 >= argc)
+	{
+		return false;
+	}
+
+	const char* value = argv[i + 1];
+	if (std::strcmp(arg, "--frames") == 0)
+	{
+		config.frames = std::max(std::atoi(value), 1);
+	}
+	else if (std::strcmp(arg, "--seed") == 0)
+	{
+		config.seed = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+	}
+	else if (std::strcmp(arg, "--entities") == 0)
+	{
+		config.entities = std::strtoull(value, nullptr, 10);
+	}
+	else if (std::strcmp(arg, "--archetypes") == 0)
+	{
+		config.archetypes = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+	}
+	else if (std::strcmp(arg, "--churn") == 0)
+	{
+		config.churn = std::clamp(static_cast<float>(std::atof(value)), 0.0f, 1.0f);
+	}
+	else if (std::strcmp(arg, "--depth") == 0)
+	{
+		config.hierarchy_depth = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+	}
+	else if (std::strcmp(arg, "--colliders") == 0)
+	{
+		config.collider_density = std::clamp(static_cast<float>(std::atof(value)), 0.0f, 1.0f);
+	}
+	else if (std::strcmp(arg, "--sprites") == 0)
+	{
+		config.sprite_density = std::clamp(static_cast<float>(std::atof(value)), 0.0f, 1.0f);
+	}
+	else if (std::strcmp(arg, "--extent") == 0)
+	{
+		config.extent = std::max(static_cast<float>(std::atof(value)), 1.0f);
+	}
+	else
+	{
+		return false;
+	}
+	++i;
+	return true;
+}
+
+int run_stress_headless(const StressConfig& config)
+{
+	using Clock = std::chrono::steady_clock;
+
+	JobSystem jobs;
+	ChunkAllocator chunk_allocator(jobs.topology().node_ids);
+	World world(chunk_allocator, jobs);
+	LinearArena frame_arena(16ull * 1024 * 1024);
+
+	// Fixed step, so the run doesn't depend on how fast this machine is.
+	constexpr float dt = 1.0f / 60.0f;
+
+	Camera2D camera;
+	camera.x = config.extent * 0.5f;
+	camera.y = config.extent * 0.5f;
+	camera.zoom = camera.viewport_width * 4.0f / config.extent;
+
+	auto start = Clock::now();
+	StressScene scene(world, jobs, config);
+	scene.populate();
+	double populate_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+	const char* phase_names[] = { "update", "bounds", "collide", "cull" };
+	constexpr int phase_count = 4;
+	double total[phase_count] = {};
+	double worst[phase_count] = {};
+	size_t visible = 0;
+
+	for (int frame = 0; frame < config.frames; ++frame)
+	{
+		frame_arena.reset();
+		Clock::time_point marks[phase_count + 1];
+		marks[0] = Clock::now();
+		scene.update(dt);
+		marks[1] = Clock::now();
+		update_bounds(world, jobs);
+		marks[2] = Clock::now();
+		scene.collide();
+		marks[3] = Clock::now();
+		visible = cull_visible(world, camera.bounds(), frame_arena).entity_count;
+		marks[4] = Clock::now();
+
+		for (int phase = 0; phase < phase_count; ++phase)
+		{
+			double ms = std::chrono::duration<double, std::milli>(marks[phase + 1] - marks[phase]).count();
+			total[phase] += ms;
+			worst[phase] = std::max(worst[phase], ms);
+		}
+	}
+
+	char line[128];
+	std::snprintf(line, sizeof(line), "Stress scene: seed %u, %zu entities in %zu archetypes, %zu chunks, populated in %.1f ms",
+		config.seed, world.entity_count(), world.archetype_count(), world.chunk_count(), populate_ms);
+	std::cout << line << "\n";
+	std::snprintf(line, sizeof(line), "%-10s %9s %9s", "phase", "mean ms", "max ms");
+	std::cout << line << "\n";
+	for (int phase = 0; phase < phase_count; ++phase)
+	{
+		std::snprintf(line, sizeof(line), "%-10s %9.3f %9.3f", phase_names[phase], total[phase] / config.frames, worst[phase]);
+		std::cout << line << "\n";
+	}
+	std::snprintf(line, sizeof(line), "%d frames, %zu contacts, %zu visible, checksum %016llx",
+		config.frames, scene.contact_count(), visible, static_cast<unsigned long long>(scene.checksum()));
+	std::cout << line << "\n";
+	return 0;
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "ECS.h"
+#include "SpatialGrid.h"
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+struct StressConfig
+{
+	bool enabled = false;
+	bool headless = false;
+	int frames = 600;
+
+	uint32_t seed = 1;
+	size_t entities = 200000;
+
+	// Distinct combinations of the eight StressTag components, so 1 to 256.
+	uint32_t archetypes = 8;
+
+	// Fraction of entities destroyed and respawned every update.
+	float churn = 0.01f;
+
+	// 0 is flat. Otherwise entities are chains of hierarchy_depth + 1, each child following its parent.
+	uint32_t hierarchy_depth = 0;
+
+	// Fractions of entities with a StressCollider and with a Sprite. Colliders are tested with their Bounds,
+	// so every collider also gets a Sprite.
+	float collider_density = 0.1f;
+	float sprite_density = 1.0f;
+
+	float extent = 8192.0f;
+};
+
+// Scene-only components. Tags exist to spread entities across archetypes the way gameplay flags do.
+template <int N>
+struct StressTag
+{
+	uint32_t value;
+};
+
+struct StressVelocity
+{
+	float x;
+	float y;
+};
+
+// Parents are referenced by scene slot, so a respawned parent keeps its children.
+struct StressParent
+{
+	uint32_t slot;
+	uint32_t depth;
+	float offset_x;
+	float offset_y;
+};
+
+struct StressCollider
+{
+	float radius;
+};
+
+// Seeded generator for load tests. The same config always produces the same entities, and update()
+// draws its randomness from the same seed, so frame N of two runs holds identical state.
+class StressScene
+{
+public:
+	// The generator and slots. The entities themselves are saved with the world.
+	struct Snapshot;
+
+	StressScene(World& world, JobSystem& jobs, const StressConfig& config);
+
+	void populate();
+
+	// Churn, root movement and hierarchy propagation. Run update_bounds() before collide().
+	void update(float dt);
+
+	// Broadphase on a SpatialGrid, then counts overlapping pairs of colliders. Only the scene's own
+	// colliders are filed, so sprites others add to the world (a level, replicated entities) never
+	// change the count, which is part of the simulation checksum.
+	void collide();
+
+	size_t contact_count() const { return contacts; }
+	size_t slot_count() const { return slots.size(); }
+
+	// Hash of every slot's Transform, for checking that two runs stayed in step.
+	uint64_t checksum();
+
+	void save(Snapshot& snapshot) const;
+	void restore(const Snapshot& snapshot);
+
+private:
+	struct Slot
+	{
+		Entity entity;
+		uint32_t tags;
+		uint32_t parent;
+		uint32_t depth;
+		bool sprite;
+		bool collider;
+	};
+
+public:
+	struct Snapshot
+	{
+		std::mt19937 random;
+		std::vector<Slot> slots;
+		size_t contacts = 0;
+	};
+
+private:
+	void spawn(Slot& slot);
+
+	World& world;
+	JobSystem& jobs;
+	StressConfig config;
+	std::mt19937 random;
+	std::vector<Slot> slots;
+	SpatialGrid grid;
+	size_t contacts = 0;
+};
+
+// Consumes argv[i] (and its value) when it is a stress flag: --stress, --headless, --frames N, --seed N,
+// --entities N, --archetypes N, --churn F, --depth N, --colliders F, --sprites F, --extent F.
+bool parse_stress_argument(int argc, char* argv[], int& i, StressConfig& config);
+
+// Runs the scene without a window or GL context and prints per-phase timings. Returns the exit code.
+int run_stress_headless(const StressConfig& config);
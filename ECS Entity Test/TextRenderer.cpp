@@ -0,0 +1,135 @@
+#include "TextRenderer.h"
+
+#include "BitmapFont.h"
+#include "Hash.h"
+#include "TextureAtlas.h"
+
+#include <algorithm>
+#include <iterator>
+
+TextRenderer::TextRenderer(TextureAtlas& atlas)
+	: atlas(atlas)
+{
+	std::fill(std::begin(glyphs), std::end(glyphs), TextureAtlas::invalid_region);
+}
+
+uint32_t TextRenderer::glyph(unsigned char c)
+{
+	if (c < ' ' || c > '~')
+	{
+		c = '?';
+	}
+
+	if (glyphs[c] != TextureAtlas::invalid_region)
+	{
+		return glyphs[c];
+	}
+
+	// A cached atlas may already hold the glyph from an earlier run.
+	std::string name = "glyph:" + std::to_string(c);
+	uint32_t region = atlas.find(name);
+	if (region == TextureAtlas::invalid_region)
+	{
+		uint32_t pixels[glyph_width * glyph_height];
+		const uint8_t* columns = bitmap_font_glyph(c);
+		for (int y = 0; y < glyph_height; ++y)
+		{
+			for (int x = 0; x < glyph_width; ++x)
+			{
+				pixels[y * glyph_width + x] = (columns[x] >> y) & 1 ? 0xffffffffu : 0u;
+			}
+		}
+		region = atlas.add(name, pixels, glyph_width, glyph_height);
+	}
+
+	glyphs[c] = region;
+	return region;
+}
+
+const TextRenderer::Run& TextRenderer::run(std::string_view text)
+{
+	auto [entry, inserted] = runs.try_emplace(fnv1a(text));
+	Run& cached = entry->second;
+	cached.last_used = frame;
+	if (!inserted && cached.text == text)
+	{
+		return cached;
+	}
+
+	// Laid out at scale 1 with the origin at the top-left, so one run serves every position and size.
+	cached.text = text;
+	cached.quads.clear();
+	float pen_x = 0.0f;
+	float pen_y = 0.0f;
+	float width = 0.0f;
+	for (char ch : text)
+	{
+		if (ch == '\n')
+		{
+			width = std::max(width, pen_x);
+			pen_x = 0.0f;
+			pen_y -= line_height;
+			continue;
+		}
+
+		if (ch != ' ')
+		{
+			uint32_t region = glyph(static_cast<unsigned char>(ch));
+			if (region != TextureAtlas::invalid_region)
+			{
+				const AtlasRegion& r = atlas.region(region);
+				cached.quads.push_back({ pen_x + glyph_width * 0.5f, pen_y - glyph_height * 0.5f, glyph_width, glyph_height,
+					r.u0, r.v0, r.u1, r.v1, static_cast<float>(r.layer), 0.0f, 0, 0 });
+			}
+		}
+		pen_x += advance;
+	}
+
+	cached.width = std::max(width, pen_x);
+	cached.height = line_height - pen_y;
+	return cached;
+}
+
+void TextRenderer::draw(SpriteRenderer& renderer, std::string_view text, float x, float y, float scale, uint32_t color)
+{
+	const Run& r = run(text);
+	SpriteInstance* out = renderer.allocate(r.quads.size());
+	if (!out)
+	{
+		return;
+	}
+
+	for (const SpriteInstance& quad : r.quads)
+	{
+		*out = quad;
+		out->x = x + quad.x * scale;
+		out->y = y + quad.y * scale;
+		out->width = quad.width * scale;
+		out->height = quad.height * scale;
+		out->color = color;
+		++out;
+	}
+	glyph_total += r.quads.size();
+}
+
+void TextRenderer::measure(std::string_view text, float& width, float& height)
+{
+	const Run& r = run(text);
+	width = r.width;
+	height = r.height;
+}
+
+void TextRenderer::end_frame(uint32_t unused_frames)
+{
+	++frame;
+	glyph_total = 0;
+	if (frame % 64 != 0)
+	{
+		return;
+	}
+
+	std::erase_if(runs, [&](const auto& entry)
+	{
+		return frame - entry.second.last_used > unused_frames;
+	});
+}
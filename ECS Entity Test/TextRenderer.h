@@ -0,0 +1,58 @@
+#pragma once
+
+#include "BitmapFont.h"
+#include "SpriteRenderer.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+class TextureAtlas;
+
+// Bitmap text drawn through the sprite renderer, so any amount of text costs no extra draw calls.
+// Glyphs from a built-in 5x8 font are packed into the atlas the first time they are used, and the
+// laid-out quads for each string are cached so unchanged text is just copied into the frame.
+class TextRenderer
+{
+public:
+	static constexpr int glyph_width = bitmap_font_width;
+	static constexpr int glyph_height = bitmap_font_height;
+	static constexpr int advance = glyph_width + 1;
+	static constexpr int line_height = glyph_height + 2;
+
+	explicit TextRenderer(TextureAtlas& atlas);
+
+	// x, y is the top-left of the first line. Each font pixel covers scale world units.
+	void draw(SpriteRenderer& renderer, std::string_view text, float x, float y, float scale, uint32_t color);
+
+	// Width and height of text at scale 1.
+	void measure(std::string_view text, float& width, float& height);
+
+	// Drops cached runs that were not drawn during the last unused_frames frames.
+	void end_frame(uint32_t unused_frames = 120);
+
+	size_t cached_runs() const { return runs.size(); }
+	size_t glyph_count() const { return glyph_total; }
+
+private:
+	struct Run
+	{
+		std::string text;
+		std::vector<SpriteInstance> quads;
+		float width;
+		float height;
+		uint64_t last_used;
+	};
+
+	const Run& run(std::string_view text);
+	uint32_t glyph(unsigned char c);
+
+	TextureAtlas& atlas;
+	uint32_t glyphs[128];
+	std::unordered_map<uint64_t, Run> runs;
+	uint64_t frame = 0;
+	size_t glyph_total = 0;
+};
@@ -0,0 +1,600 @@
+#include "TextureAtlas.h"
+
+#include "Hash.h"
+#include "Memory.h"
+
+#include <SDL3/SDL.h>
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace
+{
+	constexpr uint32_t cache_version = 1;
+	constexpr size_t max_layers = 256;
+
+	const uint32_t white_pixels[16] = { ~0u, ~0u, ~0u, ~0u, ~0u, ~0u, ~0u, ~0u, ~0u, ~0u, ~0u, ~0u, ~0u, ~0u, ~0u, ~0u };
+
+	struct CacheHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t key;
+		uint32_t layer_size;
+		uint32_t layer_count;
+		uint32_t region_count;
+	};
+
+	uint64_t source_key(const std::vector<std::string>& paths)
+	{
+		uint64_t key = fnv1a_bytes(&cache_version, sizeof(cache_version));
+		int size = TextureAtlas::layer_size;
+		key = fnv1a_bytes(&size, sizeof(size), key);
+
+		for (const std::string& path : paths)
+		{
+			key = fnv1a(path, key);
+
+			std::error_code error;
+			uint64_t bytes = std::filesystem::file_size(path, error);
+			int64_t modified = error ? 0 : std::filesystem::last_write_time(path, error).time_since_epoch().count();
+			key = fnv1a_bytes(&bytes, sizeof(bytes), key);
+			key = fnv1a_bytes(&modified, sizeof(modified), key);
+		}
+		return key;
+	}
+
+	void blit(std::vector<uint32_t>& page, const AtlasRegion& region, const uint32_t* pixels)
+	{
+		size_t needed = static_cast<size_t>(region.y + region.height) * TextureAtlas::layer_size;
+		if (page.size() < needed)
+		{
+			page.resize(needed, 0);
+		}
+
+		for (int row = 0; row < region.height; ++row)
+		{
+			std::memcpy(&page[static_cast<size_t>(region.y + row) * TextureAtlas::layer_size + region.x], pixels + static_cast<size_t>(row) * region.width, region.width * 4);
+		}
+	}
+
+	// Streamed sprites are packed in whatever order their decodes finish, which packs loosely and differs
+	// run to run. Before the atlas is cached it is packed again tallest first, the order a skyline packs
+	// best in, so every later launch loads a tight, repeatable layout. Region indices are kept; only
+	// their places move. Returns false, leaving packed alone, if the sorted layout somehow needs more
+	// layers than the atlas allows.
+	bool pack_sorted(const TextureAtlas::CacheImage& image, TextureAtlas::CacheImage& packed)
+	{
+		constexpr int layer_size = TextureAtlas::layer_size;
+		constexpr int padding = TextureAtlas::padding;
+		constexpr float texel = 1.0f / layer_size;
+
+		std::vector<uint32_t> order(image.regions.size());
+		for (uint32_t i = 0; i < order.size(); ++i)
+		{
+			order[i] = i;
+		}
+		std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+		{
+			const AtlasRegion& ra = image.regions[a];
+			const AtlasRegion& rb = image.regions[b];
+			if (ra.height != rb.height)
+			{
+				return ra.height > rb.height;
+			}
+			if (ra.width != rb.width)
+			{
+				return ra.width > rb.width;
+			}
+			return image.names[a] < image.names[b];
+		});
+
+		std::vector<AtlasRegion> regions = image.regions;
+		std::vector<SkylinePacker> packers;
+		for (uint32_t index : order)
+		{
+			AtlasRegion& region = regions[index];
+			int x = 0;
+			int y = 0;
+			size_t layer = 0;
+			while (layer < packers.size() && !packers[layer].insert(region.width + padding, region.height + padding, x, y))
+			{
+				++layer;
+			}
+			if (layer == packers.size())
+			{
+				if (packers.size() >= max_layers)
+				{
+					return false;
+				}
+				packers.emplace_back(layer_size, layer_size);
+				packers.back().insert(region.width + padding, region.height + padding, x, y);
+			}
+
+			region.layer = static_cast<uint16_t>(layer);
+			region.x = static_cast<uint16_t>(x);
+			region.y = static_cast<uint16_t>(y);
+			region.u0 = x * texel;
+			region.v0 = y * texel;
+			region.u1 = (x + region.width) * texel;
+			region.v1 = (y + region.height) * texel;
+		}
+
+		std::vector<std::vector<uint32_t>> pages(packers.size());
+		for (size_t layer = 0; layer < packers.size(); ++layer)
+		{
+			pages[layer].resize(static_cast<size_t>(packers[layer].used_height()) * layer_size, 0);
+		}
+
+		for (size_t i = 0; i < regions.size(); ++i)
+		{
+			const AtlasRegion& from = image.regions[i];
+			const AtlasRegion& to = regions[i];
+			const std::vector<uint32_t>& source = image.pages[from.layer];
+			for (int row = 0; row < from.height; ++row)
+			{
+				std::memcpy(&pages[to.layer][static_cast<size_t>(to.y + row) * layer_size + to.x],
+					&source[static_cast<size_t>(from.y + row) * layer_size + from.x], from.width * 4);
+			}
+		}
+
+		packed.names = image.names;
+		packed.regions = std::move(regions);
+		packed.pages = std::move(pages);
+		return true;
+	}
+}
+
+bool load_image_rgba(const std::string& path, std::vector<uint32_t>& pixels, int& width, int& height)
+{
+	SDL_Surface* loaded = SDL_LoadBMP(path.c_str());
+	if (!loaded)
+	{
+		std::cerr << "Failed to load image " << path << ": " << SDL_GetError() << "\n";
+		return false;
+	}
+
+	SDL_Surface* rgba = SDL_ConvertSurface(loaded, SDL_PIXELFORMAT_RGBA32);
+	SDL_DestroySurface(loaded);
+	if (!rgba)
+	{
+		std::cerr << "Failed to convert image " << path << ": " << SDL_GetError() << "\n";
+		return false;
+	}
+
+	width = rgba->w;
+	height = rgba->h;
+	pixels.resize(static_cast<size_t>(width) * height);
+	for (int row = 0; row < height; ++row)
+	{
+		std::memcpy(&pixels[static_cast<size_t>(row) * width], static_cast<unsigned char*>(rgba->pixels) + row * rgba->pitch, width * 4);
+	}
+
+	SDL_DestroySurface(rgba);
+	return true;
+}
+
+SkylinePacker::SkylinePacker(int width, int height)
+	: bin_width(width), bin_height(height)
+{
+	reset();
+}
+
+void SkylinePacker::reset(int floor)
+{
+	skyline.clear();
+	skyline.push_back({ 0, floor, bin_width });
+	top = floor;
+}
+
+bool SkylinePacker::fits(size_t index, int width, int height, int& out_y) const
+{
+	int x = skyline[index].x;
+	if (x + width > bin_width)
+	{
+		return false;
+	}
+
+	int y = skyline[index].y;
+	int remaining = width;
+	for (size_t i = index; remaining > 0; ++i)
+	{
+		y = std::max(y, skyline[i].y);
+		if (y + height > bin_height)
+		{
+			return false;
+		}
+		remaining -= skyline[i].width;
+	}
+
+	out_y = y;
+	return true;
+}
+
+bool SkylinePacker::insert(int width, int height, int& out_x, int& out_y)
+{
+	size_t best_index = skyline.size();
+	int best_y = INT_MAX;
+	int best_width = INT_MAX;
+
+	for (size_t i = 0; i < skyline.size(); ++i)
+	{
+		int y = 0;
+		if (fits(i, width, height, y))
+		{
+			if (y + height < best_y || (y + height == best_y && skyline[i].width < best_width))
+			{
+				best_index = i;
+				best_y = y + height;
+				best_width = skyline[i].width;
+			}
+		}
+	}
+
+	if (best_index == skyline.size())
+	{
+		return false;
+	}
+
+	out_x = skyline[best_index].x;
+	out_y = best_y - height;
+
+	skyline.insert(skyline.begin() + best_index, { out_x, best_y, width });
+
+	// Trim or drop the segments now covered by the new one.
+	for (size_t i = best_index + 1; i < skyline.size();)
+	{
+		const Segment& previous = skyline[i - 1];
+		int overlap = previous.x + previous.width - skyline[i].x;
+		if (overlap <= 0)
+		{
+			break;
+		}
+
+		skyline[i].x += overlap;
+		skyline[i].width -= overlap;
+		if (skyline[i].width > 0)
+		{
+			break;
+		}
+		skyline.erase(skyline.begin() + i);
+	}
+
+	for (size_t i = 0; i + 1 < skyline.size();)
+	{
+		if (skyline[i].y == skyline[i + 1].y)
+		{
+			skyline[i].width += skyline[i + 1].width;
+			skyline.erase(skyline.begin() + i + 1);
+		}
+		else
+		{
+			++i;
+		}
+	}
+
+	top = std::max(top, best_y);
+	return true;
+}
+
+TextureAtlas::~TextureAtlas()
+{
+	destroy();
+}
+
+bool TextureAtlas::load_cached(const std::vector<std::string>& paths, const std::string& cache_path, int spare_layers)
+{
+	destroy();
+
+	std::vector<std::vector<uint32_t>> pages;
+	if (!read_cache(cache_path, source_key(paths), pages))
+	{
+		return false;
+	}
+
+	create_texture(pages, spare_layers);
+	return handle != 0;
+}
+
+bool TextureAtlas::create(int layer_count)
+{
+	destroy();
+
+	std::vector<std::vector<uint32_t>> pages;
+	place("white", 4, 4, max_layers);
+	pages.resize(packers.size());
+	blit(pages[0], regions[white_region], white_pixels);
+
+	create_texture(pages, layer_count - 1);
+	return handle != 0;
+}
+
+TextureAtlas::CacheImage TextureAtlas::capture() const
+{
+	CacheImage image;
+	image.names = names;
+	image.regions = regions;
+
+	size_t used_layers = 0;
+	for (size_t layer = 0; layer < packers.size(); ++layer)
+	{
+		if (packers[layer].used_height() > 0)
+		{
+			used_layers = layer + 1;
+		}
+	}
+
+	image.pages.resize(used_layers);
+	for (size_t layer = 0; layer < used_layers; ++layer)
+	{
+		std::vector<uint32_t>& page = image.pages[layer];
+		int rows = packers[layer].used_height();
+		page.resize(static_cast<size_t>(rows) * layer_size);
+		if (rows > 0)
+		{
+			glGetTextureSubImage(handle, 0, 0, 0, static_cast<GLint>(layer), layer_size, rows, 1, GL_RGBA, GL_UNSIGNED_BYTE,
+				static_cast<GLsizei>(page.size() * 4), page.data());
+		}
+	}
+	return image;
+}
+
+void TextureAtlas::save(const std::vector<std::string>& paths, const std::string& cache_path, const CacheImage& image)
+{
+	CacheImage packed;
+	write_cache(cache_path, source_key(paths), pack_sorted(image, packed) ? packed : image);
+}
+
+void TextureAtlas::destroy()
+{
+	if (handle)
+	{
+		glDeleteTextures(1, &handle);
+		Memory::track_free(MemoryTag::Assets, texture_bytes);
+		handle = 0;
+	}
+
+	regions.clear();
+	names.clear();
+	lookup.clear();
+	packers.clear();
+	layers = 0;
+	texture_bytes = 0;
+}
+
+uint32_t TextureAtlas::add(const std::string& name, const uint32_t* pixels, int width, int height)
+{
+	uint32_t index = reserve(name, width, height);
+	if (index == invalid_region)
+	{
+		return index;
+	}
+
+	const AtlasRegion& r = regions[index];
+	glBindTexture(GL_TEXTURE_2D_ARRAY, handle);
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, r.x, r.y, r.layer, r.width, r.height, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	return index;
+}
+
+uint32_t TextureAtlas::reserve(const std::string& name, int width, int height)
+{
+	uint32_t existing = find(name);
+	if (existing != invalid_region)
+	{
+		return existing;
+	}
+
+	return place(name, width, height, static_cast<size_t>(layers));
+}
+
+uint32_t TextureAtlas::find(const std::string& name) const
+{
+	auto found = lookup.find(name);
+	return found == lookup.end() ? invalid_region : found->second;
+}
+
+uint32_t TextureAtlas::place(const std::string& name, int width, int height, size_t layer_limit)
+{
+	if (width <= 0 || height <= 0 || width + padding > layer_size || height + padding > layer_size)
+	{
+		return invalid_region;
+	}
+
+	int x = 0;
+	int y = 0;
+	size_t layer = 0;
+	for (; layer < packers.size(); ++layer)
+	{
+		if (packers[layer].insert(width + padding, height + padding, x, y))
+		{
+			break;
+		}
+	}
+
+	if (layer == packers.size())
+	{
+		if (packers.size() >= layer_limit)
+		{
+			return invalid_region;
+		}
+
+		packers.emplace_back(layer_size, layer_size);
+		packers.back().insert(width + padding, height + padding, x, y);
+	}
+
+	constexpr float texel = 1.0f / layer_size;
+
+	AtlasRegion region;
+	region.layer = static_cast<uint16_t>(layer);
+	region.x = static_cast<uint16_t>(x);
+	region.y = static_cast<uint16_t>(y);
+	region.width = static_cast<uint16_t>(width);
+	region.height = static_cast<uint16_t>(height);
+	region.u0 = x * texel;
+	region.v0 = y * texel;
+	region.u1 = (x + width) * texel;
+	region.v1 = (y + height) * texel;
+
+	uint32_t index = static_cast<uint32_t>(regions.size());
+	regions.push_back(region);
+	names.push_back(name);
+	lookup[name] = index;
+	return index;
+}
+
+bool TextureAtlas::read_cache(const std::string& path, uint64_t key, std::vector<std::vector<uint32_t>>& pages)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+	{
+		return false;
+	}
+
+	file.seekg(0, std::ios::end);
+	uint64_t file_bytes = static_cast<uint64_t>(file.tellg());
+	file.seekg(0, std::ios::beg);
+
+	// Everything below sizes allocations or indexes layers from the file, so a truncated or corrupt
+	// cache has to be turned away here rather than trusted.
+	CacheHeader header = {};
+	file.read(reinterpret_cast<char*>(&header), sizeof(header));
+	if (!file || std::memcmp(header.magic, "ATLS", 4) != 0 || header.version != cache_version
+		|| header.key != key || header.layer_size != layer_size || header.layer_count > max_layers
+		|| header.region_count > (file_bytes - sizeof(header)) / (sizeof(uint16_t) + sizeof(AtlasRegion)))
+	{
+		return false;
+	}
+
+	std::vector<AtlasRegion> cached_regions(header.region_count);
+	std::vector<std::string> cached_names(header.region_count);
+	for (uint32_t i = 0; i < header.region_count; ++i)
+	{
+		uint16_t length = 0;
+		file.read(reinterpret_cast<char*>(&length), sizeof(length));
+		cached_names[i].resize(length);
+		file.read(cached_names[i].data(), length);
+		file.read(reinterpret_cast<char*>(&cached_regions[i]), sizeof(AtlasRegion));
+
+		const AtlasRegion& region = cached_regions[i];
+		if (!file || region.layer >= header.layer_count || region.x + region.width > layer_size || region.y + region.height > layer_size)
+		{
+			return false;
+		}
+	}
+
+	std::vector<std::vector<uint32_t>> cached_pages(header.layer_count);
+	std::vector<SkylinePacker> cached_packers;
+	for (uint32_t layer = 0; layer < header.layer_count; ++layer)
+	{
+		uint32_t rows = 0;
+		file.read(reinterpret_cast<char*>(&rows), sizeof(rows));
+		if (rows > static_cast<uint32_t>(layer_size))
+		{
+			return false;
+		}
+
+		cached_pages[layer].resize(static_cast<size_t>(rows) * layer_size);
+		file.read(reinterpret_cast<char*>(cached_pages[layer].data()), cached_pages[layer].size() * 4);
+
+		// The exact skyline is not stored; packing above the used rows is always safe.
+		cached_packers.emplace_back(layer_size, layer_size);
+		cached_packers.back().reset(static_cast<int>(rows));
+	}
+
+	if (!file)
+	{
+		return false;
+	}
+
+	regions = std::move(cached_regions);
+	names = std::move(cached_names);
+	packers = std::move(cached_packers);
+	pages = std::move(cached_pages);
+	for (uint32_t i = 0; i < regions.size(); ++i)
+	{
+		lookup[names[i]] = i;
+	}
+	return true;
+}
+
+void TextureAtlas::write_cache(const std::string& path, uint64_t key, const CacheImage& image)
+{
+	std::error_code error;
+	std::filesystem::path parent = std::filesystem::path(path).parent_path();
+	if (!parent.empty())
+	{
+		std::filesystem::create_directories(parent, error);
+	}
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		std::cerr << "Failed to write atlas cache " << path << "\n";
+		return;
+	}
+
+	CacheHeader header = {};
+	std::memcpy(header.magic, "ATLS", 4);
+	header.version = cache_version;
+	header.key = key;
+	header.layer_size = layer_size;
+	header.layer_count = static_cast<uint32_t>(image.pages.size());
+	header.region_count = static_cast<uint32_t>(image.regions.size());
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	for (size_t i = 0; i < image.regions.size(); ++i)
+	{
+		uint16_t length = static_cast<uint16_t>(image.names[i].size());
+		file.write(reinterpret_cast<const char*>(&length), sizeof(length));
+		file.write(image.names[i].data(), length);
+		file.write(reinterpret_cast<const char*>(&image.regions[i]), sizeof(AtlasRegion));
+	}
+
+	for (const std::vector<uint32_t>& page : image.pages)
+	{
+		uint32_t rows = static_cast<uint32_t>(page.size() / layer_size);
+		file.write(reinterpret_cast<const char*>(&rows), sizeof(rows));
+		file.write(reinterpret_cast<const char*>(page.data()), page.size() * 4);
+	}
+}
+
+void TextureAtlas::create_texture(const std::vector<std::vector<uint32_t>>& pages, int spare_layers)
+{
+	layers = static_cast<int>(pages.size()) + std::max(spare_layers, 0);
+	if (layers == 0)
+	{
+		layers = 1;
+	}
+
+	glGenTextures(1, &handle);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, handle);
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGBA8, layer_size, layer_size, layers);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	for (size_t layer = 0; layer < pages.size(); ++layer)
+	{
+		GLsizei rows = static_cast<GLsizei>(pages[layer].size() / layer_size);
+		if (rows > 0)
+		{
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, static_cast<GLint>(layer), layer_size, rows, 1, GL_RGBA, GL_UNSIGNED_BYTE, pages[layer].data());
+		}
+	}
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	while (packers.size() < static_cast<size_t>(layers))
+	{
+		packers.emplace_back(layer_size, layer_size);
+	}
+
+	texture_bytes = static_cast<size_t>(layer_size) * layer_size * 4 * layers;
+	Memory::track_alloc(MemoryTag::Assets, texture_bytes);
+}
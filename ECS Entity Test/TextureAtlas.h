@@ -0,0 +1,118 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct AtlasRegion
+{
+	float u0;
+	float v0;
+	float u1;
+	float v1;
+	uint16_t layer;
+	uint16_t x;
+	uint16_t y;
+	uint16_t width;
+	uint16_t height;
+};
+
+// Decodes a BMP into tightly packed RGBA8 rows, top row first. Safe to call from worker threads.
+bool load_image_rgba(const std::string& path, std::vector<uint32_t>& pixels, int& width, int& height);
+
+// Skyline bottom-left packer. Keeps the top edge of everything placed so far as a list of segments
+// and puts each rectangle where it would sit lowest.
+class SkylinePacker
+{
+public:
+	SkylinePacker(int width = 0, int height = 0);
+
+	bool insert(int width, int height, int& out_x, int& out_y);
+
+	// Replaces the skyline with a flat line, used when the exact packing state was not kept.
+	void reset(int floor = 0);
+
+	int used_height() const { return top; }
+
+private:
+	struct Segment
+	{
+		int x;
+		int y;
+		int width;
+	};
+
+	bool fits(size_t index, int width, int height, int& out_y) const;
+
+	std::vector<Segment> skyline;
+	int bin_width;
+	int bin_height;
+	int top = 0;
+};
+
+// Packs every sprite into one GL_TEXTURE_2D_ARRAY so a sprite batch binds a single texture.
+// The packed result is cached on disk and reused while the source files are unchanged.
+class TextureAtlas
+{
+public:
+	static constexpr int layer_size = 2048;
+	static constexpr int padding = 1;
+	static constexpr uint32_t white_region = 0;
+	static constexpr uint32_t invalid_region = ~0u;
+
+	~TextureAtlas();
+
+	// Only succeeds from an up to date cache, and never decodes sources. spare_layers are left empty for
+	// sprites added at runtime.
+	bool load_cached(const std::vector<std::string>& paths, const std::string& cache_path, int spare_layers = 1);
+
+	// Empty atlas holding just the white region, for sprites streamed in later with reserve().
+	bool create(int layer_count);
+
+	// What the cache file holds: the regions and every layer with something packed in it.
+	struct CacheImage
+	{
+		std::vector<std::string> names;
+		std::vector<AtlasRegion> regions;
+		std::vector<std::vector<uint32_t>> pages;
+	};
+
+	// Reads the packed layers back from the GPU, so main thread only.
+	CacheImage capture() const;
+
+	// Writes image to the cache under the key for paths. Touches neither GL nor the atlas, so it can run on a job.
+	static void save(const std::vector<std::string>& paths, const std::string& cache_path, const CacheImage& image);
+
+	void destroy();
+
+	// Packs a sprite into the live atlas and uploads just its rectangle.
+	uint32_t add(const std::string& name, const uint32_t* pixels, int width, int height);
+
+	// Packs without uploading; the caller fills the rectangle itself.
+	uint32_t reserve(const std::string& name, int width, int height);
+
+	uint32_t find(const std::string& name) const;
+	const AtlasRegion& region(uint32_t index) const { return regions[index]; }
+	const AtlasRegion* region_data() const { return regions.data(); }
+	size_t region_count() const { return regions.size(); }
+
+	GLuint texture() const { return handle; }
+	int layer_count() const { return layers; }
+
+private:
+	uint32_t place(const std::string& name, int width, int height, size_t layer_limit);
+	bool read_cache(const std::string& path, uint64_t key, std::vector<std::vector<uint32_t>>& pages);
+	static void write_cache(const std::string& path, uint64_t key, const CacheImage& image);
+	void create_texture(const std::vector<std::vector<uint32_t>>& pages, int spare_layers);
+
+	std::vector<AtlasRegion> regions;
+	std::vector<std::string> names;
+	std::unordered_map<std::string, uint32_t> lookup;
+	std::vector<SkylinePacker> packers;
+	GLuint handle = 0;
+	int layers = 0;
+	size_t texture_bytes = 0;
+};
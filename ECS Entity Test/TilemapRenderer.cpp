@@ -0,0 +1,316 @@
+#include "TilemapRenderer.h"
+
+#include "Components.h"
+#include "ECS.h"
+#include "Memory.h"
+#include "Shader.h"
+#include "TextureAtlas.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+
+namespace
+{
+	constexpr size_t chunk_area = TilemapRenderer::chunk_tiles * TilemapRenderer::chunk_tiles;
+
+	const char* vertex_source = R"(#version 450 core
+layout(location = 0) in vec2 in_tile;
+layout(location = 1) in vec4 in_uv;
+layout(location = 2) in float in_layer;
+
+uniform vec4 u_projection;
+uniform vec3 u_origin;
+
+out vec3 v_uv;
+
+void main()
+{
+	vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+	vec2 world = u_origin.xy + (in_tile + corner) * u_origin.z;
+
+	gl_Position = vec4(world * u_projection.xy + u_projection.zw, 0.0, 1.0);
+	v_uv = vec3(mix(in_uv.x, in_uv.z, corner.x), mix(in_uv.w, in_uv.y, corner.y), in_layer);
+}
+)";
+
+	const char* fragment_source = R"(#version 450 core
+in vec3 v_uv;
+
+uniform sampler2DArray u_atlas;
+
+out vec4 out_color;
+
+void main()
+{
+	out_color = texture(u_atlas, v_uv);
+}
+)";
+}
+
+TilemapRenderer::~TilemapRenderer()
+{
+	shutdown();
+}
+
+bool TilemapRenderer::init()
+{
+	program = create_program(vertex_source, fragment_source);
+	if (!program)
+	{
+		return false;
+	}
+
+	projection_location = glGetUniformLocation(program, "u_projection");
+	origin_location = glGetUniformLocation(program, "u_origin");
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "u_atlas"), 0);
+	glUseProgram(0);
+
+	// Every chunk shares one layout; only the buffer bound to binding 0 changes between draws.
+	glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+	glEnableVertexAttribArray(0);
+	glVertexAttribFormat(0, 2, GL_FLOAT, GL_FALSE, offsetof(TileInstance, x));
+	glVertexAttribBinding(0, 0);
+	glEnableVertexAttribArray(1);
+	glVertexAttribFormat(1, 4, GL_FLOAT, GL_FALSE, offsetof(TileInstance, u0));
+	glVertexAttribBinding(1, 0);
+	glEnableVertexAttribArray(2);
+	glVertexAttribFormat(2, 1, GL_FLOAT, GL_FALSE, offsetof(TileInstance, layer));
+	glVertexAttribBinding(2, 0);
+	glVertexBindingDivisor(0, 1);
+	glBindVertexArray(0);
+
+	scratch.reserve(chunk_area);
+	return true;
+}
+
+void TilemapRenderer::shutdown()
+{
+	for (Map& map : maps)
+	{
+		for (MapChunk& chunk : map.chunks)
+		{
+			if (chunk.buffer)
+			{
+				glDeleteBuffers(1, &chunk.buffer);
+				chunk.buffer = 0;
+			}
+		}
+	}
+	maps.clear();
+
+	if (buffer_bytes)
+	{
+		Memory::track_free(MemoryTag::RenderBuffers, buffer_bytes);
+		buffer_bytes = 0;
+	}
+
+	if (vao)
+	{
+		glDeleteVertexArrays(1, &vao);
+		vao = 0;
+	}
+
+	if (program)
+	{
+		glDeleteProgram(program);
+		program = 0;
+	}
+}
+
+uint32_t TilemapRenderer::create_map(int width, int height, float tile_size)
+{
+	Map map;
+	map.width = std::max(width, 0);
+	map.height = std::max(height, 0);
+	map.chunk_columns = (map.width + chunk_tiles - 1) / chunk_tiles;
+	map.chunk_rows = (map.height + chunk_tiles - 1) / chunk_tiles;
+	map.tile_size = tile_size;
+	map.tiles.assign(static_cast<size_t>(map.width) * map.height, empty_tile);
+	map.chunks.resize(static_cast<size_t>(map.chunk_columns) * map.chunk_rows);
+
+	maps.push_back(std::move(map));
+	return static_cast<uint32_t>(maps.size() - 1);
+}
+
+void TilemapRenderer::set_tile(uint32_t map_id, int x, int y, uint32_t region)
+{
+	if (map_id >= maps.size())
+	{
+		return;
+	}
+
+	Map& map = maps[map_id];
+	if (x < 0 || y < 0 || x >= map.width || y >= map.height)
+	{
+		return;
+	}
+
+	uint32_t& tile = map.tiles[static_cast<size_t>(y) * map.width + x];
+	if (tile != region)
+	{
+		tile = region;
+		map.chunks[static_cast<size_t>(y / chunk_tiles) * map.chunk_columns + x / chunk_tiles].dirty = true;
+	}
+}
+
+uint32_t TilemapRenderer::tile(uint32_t map_id, int x, int y) const
+{
+	if (map_id >= maps.size())
+	{
+		return empty_tile;
+	}
+
+	const Map& map = maps[map_id];
+	if (x < 0 || y < 0 || x >= map.width || y >= map.height)
+	{
+		return empty_tile;
+	}
+	return map.tiles[static_cast<size_t>(y) * map.width + x];
+}
+
+void TilemapRenderer::rebuild(Map& map, int chunk_x, int chunk_y, const TextureAtlas& atlas)
+{
+	MapChunk& chunk = map.chunks[static_cast<size_t>(chunk_y) * map.chunk_columns + chunk_x];
+	chunk.dirty = false;
+	chunk.missing = false;
+	++rebuilt;
+
+	scratch.clear();
+	int first_x = chunk_x * chunk_tiles;
+	int first_y = chunk_y * chunk_tiles;
+	int last_x = std::min(first_x + chunk_tiles, map.width);
+	int last_y = std::min(first_y + chunk_tiles, map.height);
+	for (int y = first_y; y < last_y; ++y)
+	{
+		const uint32_t* row = map.tiles.data() + static_cast<size_t>(y) * map.width;
+		for (int x = first_x; x < last_x; ++x)
+		{
+			if (row[x] == empty_tile)
+			{
+				continue;
+			}
+			if (row[x] >= atlas.region_count())
+			{
+				chunk.missing = true;
+				continue;
+			}
+
+			const AtlasRegion& r = atlas.region(row[x]);
+			scratch.push_back({ static_cast<float>(x), static_cast<float>(y), r.u0, r.v0, r.u1, r.v1, static_cast<float>(r.layer), 0.0f });
+		}
+	}
+
+	chunk.instances = static_cast<uint32_t>(scratch.size());
+	if (scratch.empty())
+	{
+		return;
+	}
+
+	// Sized for a full chunk up front so later edits never reallocate.
+	if (!chunk.buffer)
+	{
+		GLsizeiptr bytes = static_cast<GLsizeiptr>(chunk_area * sizeof(TileInstance));
+		glCreateBuffers(1, &chunk.buffer);
+		glNamedBufferStorage(chunk.buffer, bytes, nullptr, GL_DYNAMIC_STORAGE_BIT);
+		Memory::track_alloc(MemoryTag::RenderBuffers, static_cast<size_t>(bytes));
+		buffer_bytes += static_cast<size_t>(bytes);
+	}
+	glNamedBufferSubData(chunk.buffer, 0, static_cast<GLsizeiptr>(scratch.size() * sizeof(TileInstance)), scratch.data());
+}
+
+void TilemapRenderer::render(World& world, const Camera2D& camera, const TextureAtlas& atlas)
+{
+	calls = 0;
+	rebuilt = 0;
+
+	// Regions only ever get added, so a chunk that skipped a tile might be able to draw it now.
+	if (atlas.region_count() != atlas_regions)
+	{
+		atlas_regions = atlas.region_count();
+		for (Map& map : maps)
+		{
+			for (MapChunk& chunk : map.chunks)
+			{
+				chunk.dirty |= chunk.missing;
+			}
+		}
+	}
+
+	float projection[4];
+	camera.projection(projection);
+	Rect view = camera.bounds();
+	bool bound = false;
+
+	world.query<const Transform, const Tilemap>().each([&](Entity, const Transform& transform, const Tilemap& tilemap)
+	{
+		if (tilemap.map >= maps.size())
+		{
+			return;
+		}
+
+		Map& map = maps[tilemap.map];
+		float chunk_extent = map.tile_size * chunk_tiles;
+		if (map.chunks.empty() || chunk_extent <= 0.0f)
+		{
+			return;
+		}
+
+		// Only the chunks under the view are touched, so cost follows the screen rather than the map.
+		float first_x = std::floor((view.min_x - transform.x) / chunk_extent);
+		float first_y = std::floor((view.min_y - transform.y) / chunk_extent);
+		float last_x = std::floor((view.max_x - transform.x) / chunk_extent);
+		float last_y = std::floor((view.max_y - transform.y) / chunk_extent);
+		if (last_x < 0.0f || last_y < 0.0f || first_x >= map.chunk_columns || first_y >= map.chunk_rows)
+		{
+			return;
+		}
+
+		int column_begin = static_cast<int>(std::max(first_x, 0.0f));
+		int row_begin = static_cast<int>(std::max(first_y, 0.0f));
+		int column_end = static_cast<int>(std::min(last_x, static_cast<float>(map.chunk_columns - 1)));
+		int row_end = static_cast<int>(std::min(last_y, static_cast<float>(map.chunk_rows - 1)));
+
+		if (!bound)
+		{
+			glUseProgram(program);
+			glUniform4fv(projection_location, 1, projection);
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, atlas.texture());
+			glEnable(GL_BLEND);
+			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+			glBindVertexArray(vao);
+			bound = true;
+		}
+		glUniform3f(origin_location, transform.x, transform.y, map.tile_size);
+
+		for (int row = row_begin; row <= row_end; ++row)
+		{
+			for (int column = column_begin; column <= column_end; ++column)
+			{
+				MapChunk& chunk = map.chunks[static_cast<size_t>(row) * map.chunk_columns + column];
+				if (chunk.dirty)
+				{
+					rebuild(map, column, row, atlas);
+				}
+
+				if (chunk.instances == 0)
+				{
+					continue;
+				}
+
+				glBindVertexBuffer(0, chunk.buffer, 0, sizeof(TileInstance));
+				glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, static_cast<GLsizei>(chunk.instances));
+				++calls;
+			}
+		}
+	});
+
+	if (bound)
+	{
+		glBindVertexArray(0);
+	}
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "Camera.h"
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class TextureAtlas;
+class World;
+
+// Tile layers split into 32x32 chunks. Each chunk keeps its tile instances in its own GPU buffer that is
+// only rewritten when one of its tiles changes, and is drawn with one call when it is on screen.
+class TilemapRenderer
+{
+public:
+	static constexpr int chunk_tiles = 32;
+	static constexpr uint32_t empty_tile = ~0u;
+
+	~TilemapRenderer();
+
+	bool init();
+	void shutdown();
+
+	// Returns the id to put in a Tilemap component. Tiles hold atlas region indices; ones the atlas doesn't
+	// have yet are left out until it grows.
+	uint32_t create_map(int width, int height, float tile_size);
+	void set_tile(uint32_t map, int x, int y, uint32_t region);
+	uint32_t tile(uint32_t map, int x, int y) const;
+
+	void render(World& world, const Camera2D& camera, const TextureAtlas& atlas);
+
+	size_t draw_calls() const { return calls; }
+	size_t chunks_rebuilt() const { return rebuilt; }
+
+private:
+	struct TileInstance
+	{
+		float x;
+		float y;
+		float u0;
+		float v0;
+		float u1;
+		float v1;
+		float layer;
+		float padding;
+	};
+
+	struct MapChunk
+	{
+		GLuint buffer = 0;
+		uint32_t instances = 0;
+		bool dirty = false;
+		// Some tile's region wasn't in the atlas at the last rebuild; it is rebuilt once more arrive.
+		bool missing = false;
+	};
+
+	struct Map
+	{
+		int width;
+		int height;
+		int chunk_columns;
+		int chunk_rows;
+		float tile_size;
+		std::vector<uint32_t> tiles;
+		std::vector<MapChunk> chunks;
+	};
+
+	void rebuild(Map& map, int chunk_x, int chunk_y, const TextureAtlas& atlas);
+
+	std::vector<Map> maps;
+	std::vector<TileInstance> scratch;
+	GLuint program = 0;
+	GLuint vao = 0;
+	GLint projection_location = -1;
+	GLint origin_location = -1;
+	size_t buffer_bytes = 0;
+	size_t atlas_regions = 0;
+	size_t calls = 0;
+	size_t rebuilt = 0;
+};
@@ -0,0 +1,233 @@
+#include "Visibility.h"
+
+#include "Components.h"
+#include "ECS.h"
+#include "JobSystem.h"
+#include "Memory.h"
+#include "SpatialGrid.h"
+#include "WorldView.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define VISIBILITY_SSE 1
+#include <xmmintrin.h>
+#endif
+
+namespace
+{
+	bool overlaps(const Bounds& b, const Rect& view)
+	{
+		return b.max_x >= view.min_x && b.min_x <= view.max_x && b.max_y >= view.min_y && b.min_y <= view.max_y;
+	}
+
+#if VISIBILITY_SSE
+	struct ViewLanes
+	{
+		__m128 min_x;
+		__m128 min_y;
+		__m128 max_x;
+		__m128 max_y;
+	};
+
+	// Four Bounds are four rows of (min_x, min_y, max_x, max_y); transposing gives one register per field.
+	uint32_t test4(const Bounds* b, const ViewLanes& view)
+	{
+		__m128 min_x = _mm_load_ps(&b[0].min_x);
+		__m128 min_y = _mm_load_ps(&b[1].min_x);
+		__m128 max_x = _mm_load_ps(&b[2].min_x);
+		__m128 max_y = _mm_load_ps(&b[3].min_x);
+		_MM_TRANSPOSE4_PS(min_x, min_y, max_x, max_y);
+
+		__m128 inside = _mm_and_ps(_mm_cmpge_ps(max_x, view.min_x), _mm_cmple_ps(min_x, view.max_x));
+		inside = _mm_and_ps(inside, _mm_cmpge_ps(max_y, view.min_y));
+		inside = _mm_and_ps(inside, _mm_cmple_ps(min_y, view.max_y));
+		return static_cast<uint32_t>(_mm_movemask_ps(inside));
+	}
+#endif
+
+	uint32_t cull_rows(const Bounds* bounds, uint32_t count, const Rect& view, uint16_t* out)
+	{
+		uint32_t visible = 0;
+		uint32_t i = 0;
+
+#if VISIBILITY_SSE
+		ViewLanes lanes = { _mm_set1_ps(view.min_x), _mm_set1_ps(view.min_y), _mm_set1_ps(view.max_x), _mm_set1_ps(view.max_y) };
+		for (; i + 8 <= count; i += 8)
+		{
+			uint32_t mask = test4(bounds + i, lanes) | (test4(bounds + i + 4, lanes) << 4);
+			while (mask)
+			{
+				out[visible++] = static_cast<uint16_t>(i + std::countr_zero(mask));
+				mask &= mask - 1;
+			}
+		}
+#endif
+
+		for (; i < count; ++i)
+		{
+			if (overlaps(bounds[i], view))
+			{
+				out[visible++] = static_cast<uint16_t>(i);
+			}
+		}
+		return visible;
+	}
+
+	struct Candidate
+	{
+		const Chunk* chunk;
+		uint32_t row;
+	};
+
+	VisibleSet cull_with_grid(const SpatialGrid& grid, const Rect& view, LinearArena& arena)
+	{
+		VisibleSet set;
+
+		// Sized by what the view holds rather than by the whole grid, and kept between frames. Only the
+		// rows that come out of it go into the arena.
+		thread_local std::vector<Candidate, TaggedAllocator<Candidate, MemoryTag::Transient>> candidates;
+		candidates.clear();
+
+		// The grid already did the exact overlap test, so everything it reports is visible.
+		grid.query(view, [&](const SpatialGrid::Entry& entry, const Bounds&)
+		{
+			candidates.push_back({ entry.chunk, entry.row });
+		});
+
+		std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b)
+		{
+			return a.chunk != b.chunk ? a.chunk < b.chunk : a.row < b.row;
+		});
+		size_t found = candidates.size();
+
+		size_t chunk_total = 0;
+		for (size_t i = 0; i < found; ++i)
+		{
+			chunk_total += (i == 0 || candidates[i].chunk != candidates[i - 1].chunk);
+		}
+
+		VisibleChunk* chunks = arena.allocate_array<VisibleChunk>(chunk_total);
+		uint16_t* rows = arena.allocate_array<uint16_t>(found);
+		if ((chunk_total && !chunks) || (found && !rows))
+		{
+			return set;
+		}
+
+		for (size_t i = 0; i < found; ++i)
+		{
+			if (i == 0 || candidates[i].chunk != candidates[i - 1].chunk)
+			{
+				const Chunk* chunk = candidates[i].chunk;
+				chunks[set.chunk_count++] = { chunk->column<const Transform>(), chunk->column<const Sprite>(), rows + i, 0 };
+			}
+			rows[i] = static_cast<uint16_t>(candidates[i].row);
+			++chunks[set.chunk_count - 1].count;
+		}
+
+		set.chunks = chunks;
+		set.entity_count = static_cast<uint32_t>(found);
+		set.tested_count = static_cast<uint32_t>(found);
+		return set;
+	}
+}
+
+Bounds sprite_bounds(const Transform& t, const Sprite& s)
+{
+	float half_width = s.width * 0.5f;
+	float half_height = s.height * 0.5f;
+
+	if (t.rotation != 0.0f)
+	{
+		float c = std::fabs(std::cos(t.rotation));
+		float si = std::fabs(std::sin(t.rotation));
+		float rotated_width = c * half_width + si * half_height;
+		half_height = si * half_width + c * half_height;
+		half_width = rotated_width;
+	}
+
+	return { t.x - half_width, t.y - half_height, t.x + half_width, t.y + half_height };
+}
+
+void update_bounds(World& world, JobSystem& jobs)
+{
+	world.query<const Transform, const Sprite, Bounds>().par_each(jobs, [](Entity, const Transform& t, const Sprite& s, Bounds& b)
+	{
+		b = sprite_bounds(t, s);
+	});
+}
+
+VisibleSet cull_visible(World& world, const Rect& view, LinearArena& arena, const SpatialGrid* grid)
+{
+	if (grid && grid->entry_count() > 0)
+	{
+		return cull_with_grid(*grid, view, arena);
+	}
+
+	VisibleSet set;
+	auto query = world.query<const Bounds>();
+
+	size_t chunk_total = 0;
+	query.each_chunk([&](const Chunk&, const Bounds*) { ++chunk_total; });
+
+	VisibleChunk* chunks = arena.allocate_array<VisibleChunk>(chunk_total);
+	if (!chunks)
+	{
+		return set;
+	}
+
+	query.each_chunk([&](const Chunk& chunk, const Bounds* bounds)
+	{
+		uint16_t* rows = arena.allocate_array<uint16_t>(chunk.count);
+		if (!rows)
+		{
+			return;
+		}
+
+		uint32_t visible = cull_rows(bounds, chunk.count, view, rows);
+		set.tested_count += chunk.count;
+		if (visible > 0)
+		{
+			chunks[set.chunk_count++] = { chunk.column<const Transform>(), chunk.column<const Sprite>(), rows, visible };
+			set.entity_count += visible;
+		}
+	});
+
+	set.chunks = chunks;
+	return set;
+}
+
+VisibleSet cull_visible(const WorldView& world, const Rect& view, LinearArena& arena)
+{
+	VisibleSet set;
+	const std::vector<ViewChunk>& source = world.chunks();
+
+	VisibleChunk* chunks = arena.allocate_array<VisibleChunk>(source.size());
+	if (!chunks)
+	{
+		return set;
+	}
+
+	for (const ViewChunk& chunk : source)
+	{
+		uint16_t* rows = arena.allocate_array<uint16_t>(chunk.count);
+		if (!rows)
+		{
+			break;
+		}
+
+		uint32_t visible = cull_rows(chunk.bounds, chunk.count, view, rows);
+		set.tested_count += chunk.count;
+		if (visible > 0)
+		{
+			chunks[set.chunk_count++] = { chunk.transforms, chunk.sprites, rows, visible };
+			set.entity_count += visible;
+		}
+	}
+
+	set.chunks = chunks;
+	return set;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "Camera.h"
+
+#include <cstdint>
+
+struct Chunk;
+class JobSystem;
+class LinearArena;
+class SpatialGrid;
+class World;
+class WorldView;
+struct Bounds;
+struct Sprite;
+struct Transform;
+
+// Rows of one chunk, in the world or in a WorldView. The columns are null when the chunk has none.
+struct VisibleChunk
+{
+	const Transform* transforms;
+	const Sprite* sprites;
+	const uint16_t* rows;
+	uint32_t count;
+};
+
+// Lives in the frame arena; valid until the arena is reset or the world's structure changes, or for a
+// set culled from a WorldView, as long as the view.
+struct VisibleSet
+{
+	const VisibleChunk* chunks = nullptr;
+	uint32_t chunk_count = 0;
+	uint32_t entity_count = 0;
+	uint32_t tested_count = 0;
+};
+
+// The sprite's rotated rect, centred on its transform.
+Bounds sprite_bounds(const Transform& transform, const Sprite& sprite);
+
+// Recomputes Bounds for every Transform + Sprite entity.
+void update_bounds(World& world, JobSystem& jobs);
+
+// Tests every Bounds against view, eight per step with SSE, and keeps the rows that overlap.
+// With a grid, only entities in the cells under view are tested.
+VisibleSet cull_visible(World& world, const Rect& view, LinearArena& arena, const SpatialGrid* grid = nullptr);
+
+// Same test against a snapshot, so it can run while the world is being changed.
+VisibleSet cull_visible(const WorldView& world, const Rect& view, LinearArena& arena);
@@ -0,0 +1,86 @@
+#include "WorldView.h"
+
+#include "ECS.h"
+#include "Memory.h"
+
+#include <cstring>
+
+// Columns are aligned for the culling loads, which read Bounds four at a time.
+struct WorldView::Column
+{
+	explicit Column(size_t bytes)
+		: data(Memory::allocate(MemoryTag::RenderBuffers, bytes, 64)), bytes(bytes)
+	{
+	}
+
+	~Column()
+	{
+		Memory::deallocate(MemoryTag::RenderBuffers, data, bytes, 64);
+	}
+
+	Column(const Column&) = delete;
+	Column& operator=(const Column&) = delete;
+
+	void* data;
+	size_t bytes;
+};
+
+std::shared_ptr<const WorldView> WorldViewExtractor::capture(World& world)
+{
+	uint32_t tick = world.tick();
+	world.advance_tick();
+
+	auto view = std::make_shared<WorldView>();
+	std::unordered_map<const void*, Captured> next;
+	next.reserve(captured.size());
+	copied = 0;
+	shared = 0;
+
+	const ComponentId ids[3] = { component_id<Transform>(), component_id<Sprite>(), component_id<Bounds>() };
+	const size_t sizes[3] = { sizeof(Transform), sizeof(Sprite), sizeof(Bounds) };
+	ComponentMask mask = component_mask<Transform, Sprite, Bounds>();
+
+	for (const std::unique_ptr<Archetype>& archetype : world.archetypes())
+	{
+		if ((archetype->mask & mask) != mask)
+		{
+			continue;
+		}
+
+		for (const Chunk& chunk : archetype->chunks)
+		{
+			auto previous = captured.find(chunk.memory);
+			bool known = previous != captured.end() && previous->second.archetype == archetype.get() && previous->second.count == chunk.count;
+
+			Captured& entry = next[chunk.memory];
+			entry = { archetype.get(), chunk.count, tick, {} };
+			const void* data[3];
+			for (int c = 0; c < 3; ++c)
+			{
+				int8_t slot = archetype->slot_of[ids[c]];
+				size_t bytes = chunk.count * sizes[c];
+				if (known && chunk.changed[slot] <= previous->second.tick)
+				{
+					entry.columns[c] = previous->second.columns[c];
+					shared += bytes;
+				}
+				else
+				{
+					auto column = std::make_shared<WorldView::Column>(bytes);
+					std::memcpy(column->data, archetype->column(chunk, ids[c]), bytes);
+					entry.columns[c] = std::move(column);
+					copied += bytes;
+				}
+				data[c] = entry.columns[c]->data;
+				view->columns.push_back(entry.columns[c]);
+			}
+
+			view->view_chunks.push_back({ chunk.count, static_cast<const Transform*>(data[0]), static_cast<const Sprite*>(data[1]), static_cast<const Bounds*>(data[2]) });
+			view->entities += chunk.count;
+		}
+	}
+
+	// Chunks that are gone drop out here; views still holding their columns keep them alive.
+	captured.swap(next);
+	return view;
+}
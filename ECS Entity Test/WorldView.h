@@ -0,0 +1,67 @@
+#pragma once
+
+#include "Components.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+struct Archetype;
+class World;
+
+// One chunk's Transform, Sprite and Bounds rows as they were when the view was captured.
+struct ViewChunk
+{
+	uint32_t count;
+	const Transform* transforms;
+	const Sprite* sprites;
+	const Bounds* bounds;
+};
+
+// Immutable copy of what the sprite pass reads from the world. Any thread can read it while the world
+// moves on; the columns stay alive until the last reference to every view holding them is dropped.
+class WorldView
+{
+public:
+	const std::vector<ViewChunk>& chunks() const { return view_chunks; }
+	size_t entity_count() const { return entities; }
+
+private:
+	friend class WorldViewExtractor;
+
+	struct Column;
+
+	std::vector<ViewChunk> view_chunks;
+	std::vector<std::shared_ptr<const Column>> columns;
+	size_t entities = 0;
+};
+
+// Captures WorldViews. A column is only copied when the world has written it since the previous
+// capture; otherwise the new view shares the previous view's copy, so a static scene costs nothing.
+class WorldViewExtractor
+{
+public:
+	// The world must not be changing during the call. Advances the world's tick.
+	std::shared_ptr<const WorldView> capture(World& world);
+
+	// Bytes the last capture copied, and bytes it shared with the capture before.
+	size_t copied_bytes() const { return copied; }
+	size_t shared_bytes() const { return shared; }
+
+private:
+	struct Captured
+	{
+		const Archetype* archetype;
+		uint32_t count;
+		uint32_t tick;
+		std::shared_ptr<const WorldView::Column> columns[3];
+	};
+
+	// Keyed by chunk memory. A chunk that was freed and reallocated is stamped as changed throughout,
+	// so it never matches a stale entry.
+	std::unordered_map<const void*, Captured> captured;
+	size_t copied = 0;
+	size_t shared = 0;
+};